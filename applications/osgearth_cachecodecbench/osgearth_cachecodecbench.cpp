@@ -0,0 +1,254 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Checks and times the built-in cache codec (osgEarth::CacheCodec).
+ *
+ * The checks round-trip synthetic tiles through the QOI and raw encodings and
+ * require them to come back bit for bit, including a block-compressed image
+ * whose size is not a multiple of the block size, and make sure a truncated
+ * file is rejected. The benchmark then encodes and decodes the tiles with the
+ * codec and with the osgDB PNG plugin (the default disk cache format), and
+ * reports the time per tile and the encoded size of each.
+ *
+ * usage: osgearth_cachecodecbench [--tiles N] [--size N]
+ */
+
+#include <osgEarth/CacheCodec>
+#include <osg/ArgumentParser>
+#include <osg/Image>
+#include <osg/Texture>
+#include <osg/Timer>
+#include <osgDB/Registry>
+#include <osgDB/ReaderWriter>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    /** Imagery-like tile: smooth gradients with a little noise. */
+    osg::Image* makeImagery( unsigned size, GLenum pixelFormat )
+    {
+        unsigned channels = pixelFormat == GL_RGBA ? 4 : 3;
+        osg::Image* image = new osg::Image();
+        image->allocateImage( size, size, 1, pixelFormat, GL_UNSIGNED_BYTE );
+        for( unsigned t = 0; t < size; ++t )
+        {
+            unsigned char* p = image->data(0, t);
+            for( unsigned s = 0; s < size; ++s, p += channels )
+            {
+                double v = 0.5 + 0.25*sin(0.05*s) + 0.25*cos(0.03*t);
+                int noise = rand() % 9 - 4;
+                p[0] = (unsigned char)osg::clampBetween( (int)(200.0*v) + noise, 0, 255 );
+                p[1] = (unsigned char)osg::clampBetween( (int)(160.0*v) + noise, 0, 255 );
+                p[2] = (unsigned char)osg::clampBetween( (int)(120.0*v) + noise, 0, 255 );
+                if ( channels == 4 )
+                    p[3] = s < 8 || t < 8 ? 0 : 255;
+            }
+        }
+        return image;
+    }
+
+    /** Map-like tile: flat color areas with sharp edges. */
+    osg::Image* makeMap( unsigned size )
+    {
+        osg::Image* image = new osg::Image();
+        image->allocateImage( size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+        for( unsigned t = 0; t < size; ++t )
+        {
+            unsigned char* p = image->data(0, t);
+            for( unsigned s = 0; s < size; ++s, p += 4 )
+            {
+                bool road  = (s % 64) < 3 || (t % 80) < 3;
+                bool water = (s + t) < size/2;
+                p[0] = road ? 255 : water ? 160 : 238;
+                p[1] = road ? 255 : water ? 200 : 232;
+                p[2] = road ? 255 : water ? 250 : 220;
+                p[3] = 255;
+            }
+        }
+        return image;
+    }
+
+    bool samePixels( const osg::Image* a, const osg::Image* b )
+    {
+        if ( !a || !b || a->s() != b->s() || a->t() != b->t() || a->r() != b->r() ||
+             a->getPixelFormat() != b->getPixelFormat() || a->getDataType() != b->getDataType() )
+            return false;
+
+        for( int r = 0; r < a->r(); ++r )
+            for( int t = 0; t < a->t(); ++t )
+                if ( memcmp(a->data(0, t, r), b->data(0, t, r), a->getRowSizeInBytes()) != 0 )
+                    return false;
+        return true;
+    }
+
+    bool check( bool result, const std::string& what )
+    {
+        std::cout << (result ? "PASS: " : "FAIL: ") << what << std::endl;
+        return result;
+    }
+
+    struct Timing
+    {
+        Timing() : _encode(0.0), _decode(0.0), _bytes(0), _raw(0) { }
+        double   _encode, _decode;  // milliseconds
+        unsigned _bytes, _raw;      // encoded and raw bytes
+    };
+
+    void report( const std::string& name, const Timing& timing, unsigned tiles )
+    {
+        std::cout
+            << "  " << name << ": encode " << timing._encode/(double)tiles << " ms, "
+            << "decode " << timing._decode/(double)tiles << " ms, "
+            << "size " << (100.0*(double)timing._bytes/(double)timing._raw) << "% of raw"
+            << std::endl;
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+
+    unsigned numTiles = 200;
+    unsigned size = 256;
+    arguments.read( "--tiles", numTiles );
+    arguments.read( "--size", size );
+    if ( numTiles < 1 )
+        numTiles = 1;
+
+    srand( 1 );
+
+    std::vector< osg::ref_ptr<osg::Image> > tiles;
+    tiles.push_back( makeImagery(size, GL_RGB) );
+    tiles.push_back( makeImagery(size, GL_RGBA) );
+    tiles.push_back( makeMap(size) );
+    const char* names[] = { "imagery RGB", "imagery RGBA", "map RGBA" };
+
+    // checks:
+    bool ok = true;
+
+    for( unsigned i = 0; i < tiles.size(); ++i )
+    {
+        for( int compress = 0; compress < 2; ++compress )
+        {
+            std::string buffer;
+            bool encoded = CacheCodec::encode( tiles[i].get(), buffer, compress != 0 );
+            osg::ref_ptr<osg::Image> decoded = encoded ? CacheCodec::decode( buffer.data(), buffer.size() ) : 0L;
+            ok = check( samePixels(tiles[i].get(), decoded.get()),
+                std::string(names[i]) + (compress ? " survives QOI" : " survives raw") ) && ok;
+        }
+    }
+
+    {
+        // 6x6 DXT1 is 2x2 blocks of 8 bytes; bits per pixel alone would say 18 bytes.
+        const unsigned bytes = 2*2*8;
+        unsigned char* data = new unsigned char[bytes];
+        for( unsigned i = 0; i < bytes; ++i )
+            data[i] = (unsigned char)(i*37);
+        osg::ref_ptr<osg::Image> dxt = new osg::Image();
+        dxt->setImage( 6, 6, 1, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+            GL_UNSIGNED_BYTE, data, osg::Image::USE_NEW_DELETE );
+
+        std::string buffer;
+        bool same = true;
+        if ( CacheCodec::encode(dxt.get(), buffer, true) )
+        {
+            osg::ref_ptr<osg::Image> decoded = CacheCodec::decode( buffer.data(), buffer.size() );
+            same = decoded.valid() && memcmp( decoded->data(), data, bytes ) == 0;
+        }
+        else
+        {
+            std::cout << "  (this OSG sizes the 6x6 DXT1 image short, so it is not stored)" << std::endl;
+        }
+        ok = check( same, "a 6x6 DXT1 image keeps all of its blocks" ) && ok;
+    }
+
+    {
+        std::string buffer;
+        CacheCodec::encode( tiles[0].get(), buffer, true );
+        osg::ref_ptr<osg::Image> truncated = CacheCodec::decode( buffer.data(), buffer.size()/2 );
+        ok = check( !truncated.valid(), "a truncated file is rejected" ) && ok;
+    }
+
+    // benchmark:
+    osgDB::ReaderWriter* png = osgDB::Registry::instance()->getReaderWriterForExtension( "png" );
+    osg::Timer* timer = osg::Timer::instance();
+
+    std::cout << numTiles << " encodes and decodes of each " << size << "x" << size << " tile:" << std::endl;
+
+    for( unsigned i = 0; i < tiles.size(); ++i )
+    {
+        const osg::Image* tile = tiles[i].get();
+        Timing qoi, raw, pngTiming;
+
+        for( unsigned n = 0; n < numTiles; ++n )
+        {
+            for( int compress = 0; compress < 2; ++compress )
+            {
+                Timing& timing = compress ? qoi : raw;
+                std::string buffer;
+
+                osg::Timer_t t0 = timer->tick();
+                CacheCodec::encode( tile, buffer, compress != 0 );
+                osg::Timer_t t1 = timer->tick();
+                osg::ref_ptr<osg::Image> decoded = CacheCodec::decode( buffer.data(), buffer.size() );
+                osg::Timer_t t2 = timer->tick();
+
+                timing._encode += timer->delta_m( t0, t1 );
+                timing._decode += timer->delta_m( t1, t2 );
+                timing._bytes  += buffer.size();
+                timing._raw    += tile->getTotalSizeInBytes();
+            }
+
+            if ( png )
+            {
+                std::stringstream buf;
+                osg::Timer_t t0 = timer->tick();
+                png->writeImage( *tile, buf );
+                osg::Timer_t t1 = timer->tick();
+                osgDB::ReaderWriter::ReadResult rr = png->readImage( buf );
+                osg::Timer_t t2 = timer->tick();
+
+                pngTiming._encode += timer->delta_m( t0, t1 );
+                pngTiming._decode += timer->delta_m( t1, t2 );
+                pngTiming._bytes  += buf.str().size();
+                pngTiming._raw    += tile->getTotalSizeInBytes();
+            }
+        }
+
+        std::cout << names[i] << ":" << std::endl;
+        report( "QOI", qoi, numTiles );
+        report( "raw", raw, numTiles );
+        if ( png )
+            report( "PNG", pngTiming, numTiles );
+        else
+            std::cout << "  PNG: skipped, no osgDB png plugin" << std::endl;
+    }
+
+    return ok ? 0 : 1;
+}
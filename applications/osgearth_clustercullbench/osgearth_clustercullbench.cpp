@@ -0,0 +1,231 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Checks and times HeightFieldUtils::createClusterCullingCallback().
+ *
+ * The reference is the original per-sample version, which converted every post
+ * with EllipsoidModel::convertLatLongHeightToXYZ and evaluated the whole cone for
+ * each. The checks run both on tiles of several sizes, latitudes and post counts,
+ * with random heights, and require the same answer: both turn cluster culling off
+ * for the same (wrap-around) tiles, and otherwise produce the same control point,
+ * normal, deviation and radius. The benchmark times both on a 33x33 tile.
+ *
+ * usage: osgearth_clustercullbench [--tiles N]
+ */
+
+#include <osgEarth/HeightFieldUtils>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+
+using namespace osgEarth;
+
+namespace
+{
+    /** The per-sample version this check compares against. */
+    osg::ClusterCullingCallback* createPerSample( osg::HeightField* grid, osg::EllipsoidModel* et, float verticalScale )
+    {
+        double globe_radius = et->getRadiusPolar();
+        unsigned int numColumns = grid->getNumColumns();
+        unsigned int numRows = grid->getNumRows();
+
+        double midLong = grid->getOrigin().x()+grid->getXInterval()*((double)(numColumns-1))*0.5;
+        double midLat = grid->getOrigin().y()+grid->getYInterval()*((double)(numRows-1))*0.5;
+        double midZ = grid->getOrigin().z();
+
+        double midX,midY;
+        et->convertLatLongHeightToXYZ(osg::DegreesToRadians(midLat),osg::DegreesToRadians(midLong),midZ, midX,midY,midZ);
+
+        osg::Vec3 center_position(midX,midY,midZ);
+        osg::Vec3 center_normal(midX,midY,midZ);
+        center_normal.normalize();
+
+        double orig_X = grid->getOrigin().x();
+        double delta_X = grid->getXInterval();
+        double orig_Y = grid->getOrigin().y();
+        double delta_Y = grid->getYInterval();
+        double orig_Z = grid->getOrigin().z();
+
+        float min_dot_product = 1.0f;
+        float max_cluster_culling_height = 0.0f;
+        float max_cluster_culling_radius = 0.0f;
+
+        for( unsigned int r = 0; r < numRows; ++r )
+        {
+            for( unsigned int c = 0; c < numColumns; ++c )
+            {
+                double X = orig_X + delta_X*(double)c;
+                double Y = orig_Y + delta_Y*(double)r;
+                double Z = orig_Z + grid->getHeight(c,r) * verticalScale;
+                double height = Z;
+
+                et->convertLatLongHeightToXYZ(
+                    osg::DegreesToRadians(Y), osg::DegreesToRadians(X), Z,
+                    X, Y, Z);
+
+                osg::Vec3d v(X,Y,Z);
+                osg::Vec3 dv = v - center_position;
+                double d = sqrt(dv.x()*dv.x() + dv.y()*dv.y() + dv.z()*dv.z());
+                double theta = acos( globe_radius/ (globe_radius + fabs(height)) );
+                double phi = 2.0 * asin (d*0.5/globe_radius);
+                double beta = theta+phi;
+                double cutoff = osg::PI_2 - 0.1;
+
+                if (phi<cutoff && beta<cutoff)
+                {
+                    float local_dot_product = -sin(theta + phi);
+                    float local_m = globe_radius*( 1.0/ cos(theta+phi) - 1.0);
+                    float local_radius = static_cast<float>(globe_radius * tan(beta));
+                    min_dot_product = osg::minimum(min_dot_product, local_dot_product);
+                    max_cluster_culling_height = osg::maximum(max_cluster_culling_height,local_m);
+                    max_cluster_culling_radius = osg::maximum(max_cluster_culling_radius,local_radius);
+                }
+                else
+                {
+                    return 0L;
+                }
+            }
+        }
+
+        osg::ClusterCullingCallback* ccc = new osg::ClusterCullingCallback;
+        ccc->set(center_position + center_normal*max_cluster_culling_height,
+            center_normal,
+            min_dot_product,
+            max_cluster_culling_radius);
+        return ccc;
+    }
+
+    osg::HeightField* createTile( double lat, double lon, double size, unsigned numPosts )
+    {
+        osg::HeightField* hf = new osg::HeightField();
+        hf->allocate( numPosts, numPosts );
+        hf->setOrigin( osg::Vec3(lon, lat, 0.0f) );
+        hf->setXInterval( size / (double)(numPosts-1) );
+        hf->setYInterval( size / (double)(numPosts-1) );
+        for( unsigned r = 0; r < numPosts; ++r )
+            for( unsigned c = 0; c < numPosts; ++c )
+                hf->setHeight( c, r, -400.0f + 8400.0f * (float)rand() / (float)RAND_MAX );
+        return hf;
+    }
+
+    bool close( double a, double b, double tolerance )
+    {
+        return fabs(a - b) <= tolerance * osg::maximum( 1.0, fabs(b) );
+    }
+
+    bool same( const osg::ClusterCullingCallback* a, const osg::ClusterCullingCallback* b )
+    {
+        if ( !a || !b )
+            return !a && !b;
+
+        const double tolerance = 1e-6;
+        for( unsigned i = 0; i < 3; ++i )
+        {
+            if ( !close(a->getControlPoint()[i], b->getControlPoint()[i], tolerance) ||
+                 !close(a->getNormal()[i], b->getNormal()[i], tolerance) )
+                return false;
+        }
+        return close( a->getDeviation(), b->getDeviation(), tolerance ) && close( a->getRadius(), b->getRadius(), tolerance );
+    }
+
+    bool check( bool result, const std::string& what )
+    {
+        std::cout << (result ? "PASS: " : "FAIL: ") << what << std::endl;
+        return result;
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+
+    unsigned numTiles = 2000;
+    arguments.read( "--tiles", numTiles );
+
+    osg::ref_ptr<osg::EllipsoidModel> em = new osg::EllipsoidModel();
+
+    // checks:
+    bool ok = true;
+
+    const double lats[]  = { 0.0, 45.0, -60.0, 84.0 };
+    const double sizes[] = { 0.01, 0.5, 5.0, 45.0, 90.0, 170.0 };
+    const unsigned posts[] = { 2, 17, 33, 65 };
+    const float scales[] = { 1.0f, 3.0f };
+
+    unsigned numCompared = 0, numCulled = 0, numSame = 0;
+    for( unsigned a = 0; a < sizeof(lats)/sizeof(lats[0]); ++a )
+    {
+        for( unsigned s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s )
+        {
+            for( unsigned p = 0; p < sizeof(posts)/sizeof(posts[0]); ++p )
+            {
+                for( unsigned v = 0; v < sizeof(scales)/sizeof(scales[0]); ++v )
+                {
+                    osg::ref_ptr<osg::HeightField> hf = createTile( osg::minimum(lats[a], 90.0 - sizes[s]), -170.0 + 40.0*a, sizes[s], posts[p] );
+                    osg::ref_ptr<osg::ClusterCullingCallback> expected = createPerSample( hf.get(), em.get(), scales[v] );
+                    osg::ref_ptr<osg::ClusterCullingCallback> actual = HeightFieldUtils::createClusterCullingCallback( hf.get(), em.get(), scales[v] );
+
+                    ++numCompared;
+                    if ( expected.valid() )
+                        ++numCulled;
+                    if ( same(actual.get(), expected.get()) )
+                    {
+                        ++numSame;
+                    }
+                    else
+                    {
+                        std::cout << "  mismatch: lat " << lats[a] << ", size " << sizes[s]
+                            << ", " << posts[p] << " posts, scale " << scales[v] << std::endl;
+                    }
+                }
+            }
+        }
+    }
+
+    std::stringstream buf;
+    buf << "the culler matches the per-sample version on " << numSame << " of " << numCompared
+        << " tiles (" << numCulled << " with a culler)";
+    ok = check( numSame == numCompared, buf.str() ) && ok;
+    ok = check( numCulled > 0 && numCulled < numCompared, "both tiles with and without a culler were compared" ) && ok;
+
+    // benchmark:
+    osg::ref_ptr<osg::HeightField> hf = createTile( 45.0, 10.0, 0.5, 33 );
+    osg::ref_ptr<osg::ClusterCullingCallback> sink;
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    for( unsigned i = 0; i < numTiles; ++i )
+        sink = createPerSample( hf.get(), em.get(), 1.0f );
+    double perSample = osg::Timer::instance()->delta_u( start, osg::Timer::instance()->tick() );
+
+    start = osg::Timer::instance()->tick();
+    for( unsigned i = 0; i < numTiles; ++i )
+        sink = HeightFieldUtils::createClusterCullingCallback( hf.get(), em.get(), 1.0f );
+    double batched = osg::Timer::instance()->delta_u( start, osg::Timer::instance()->tick() );
+
+    std::cout
+        << numTiles << " tiles of 33x33 posts: "
+        << (perSample / (double)numTiles) << " us/tile per-sample, "
+        << (batched / (double)numTiles) << " us/tile batched" << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,230 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Checks and times Config's shared contents and child index.
+ *
+ * The checks verify copy-on-write: writing to a copy (its value, attributes or
+ * children) never shows through in the original or in other copies, and a copy
+ * taken before a write keeps the old contents. They also verify the child index:
+ * for Configs with fewer and more children than the index threshold, and with
+ * repeated keys, child() and hasChild() agree with a scan of children(), also
+ * after remove() and after a copy is extended.
+ *
+ * The benchmark times copying a Config with 256 children against building the
+ * same Config again (what a copy cost when each Config owned its contents), and
+ * looking up each of 64 children by key against scanning children().
+ *
+ * usage: osgearth_configbench [--repeats N]
+ */
+
+#include <osgEarth/Config>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    std::string keyFor( unsigned i )
+    {
+        std::stringstream buf;
+        buf << "key_" << i;
+        return buf.str();
+    }
+
+    /** A Config with numChildren children, with only numKeys distinct keys among them. */
+    Config createConfig( unsigned numChildren, unsigned numKeys )
+    {
+        Config conf( "root" );
+        conf.attr( "name" ) = "bench";
+        for( unsigned i = 0; i < numChildren; ++i )
+        {
+            Config child( keyFor(i % numKeys), keyFor(i) );
+            child.attr( "index" ) = keyFor(i);
+            conf.add( child );
+        }
+        return conf;
+    }
+
+    /** The first child with the key, found by scanning every child. */
+    const Config* scanChild( const Config& conf, const std::string& key )
+    {
+        for( ConfigSet::const_iterator i = conf.children().begin(); i != conf.children().end(); ++i )
+            if ( i->key() == key )
+                return &(*i);
+        return 0L;
+    }
+
+    /** Whether child() and hasChild() agree with a scan of children() for every key. */
+    bool lookupsMatchScan( const Config& conf, unsigned numKeys )
+    {
+        for( unsigned k = 0; k <= numKeys; ++k )
+        {
+            std::string key = keyFor(k);
+            const Config* expected = scanChild( conf, key );
+            if ( conf.hasChild(key) != (expected != 0L) )
+                return false;
+            if ( expected && &conf.child(key) != expected )
+                return false;
+            if ( !expected && !conf.child(key).empty() )
+                return false;
+        }
+        return true;
+    }
+
+    bool check( bool result, const std::string& what )
+    {
+        std::cout << (result ? "PASS: " : "FAIL: ") << what << std::endl;
+        return result;
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+
+    unsigned numRepeats = 20000;
+    arguments.read( "--repeats", numRepeats );
+
+    // checks:
+    bool ok = true;
+
+    {
+        const Config original = createConfig( 20, 10 );
+        const std::string before = original.toString();
+
+        Config a = original;
+        a.value() = "changed";
+        Config b = original;
+        b.attr( "name" ) = "changed";
+        Config c = original;
+        c.add( "extra", "value" );
+        Config d = original;
+        d.remove( keyFor(3) );
+        Config e = original;
+        Config f = e;
+        e.key() = "renamed";
+
+        ok = check(
+            original.toString() == before &&
+            f.toString() == before &&
+            a.value() == "changed" &&
+            b.attr("name") == "changed" &&
+            c.hasChild("extra") && !original.hasChild("extra") &&
+            !d.hasChild(keyFor(3)) && original.hasChild(keyFor(3)) &&
+            e.key() == "renamed" && f.key() == "root",
+            "writing to a copy leaves the original and the other copies unchanged" ) && ok;
+    }
+
+    {
+        Config a( "a", "one" );
+        Config b = a;
+        a.value() = "two";
+        Config c = a;
+        c.value() = "three";
+        ok = check( a.value() == "two" && b.value() == "one" && c.value() == "three",
+            "a copy keeps the contents it was taken from" ) && ok;
+    }
+
+    {
+        bool allMatch = true;
+        const unsigned counts[] = { 0, 1, 7, 8, 9, 40 };
+        for( unsigned n = 0; n < sizeof(counts)/sizeof(counts[0]); ++n )
+        {
+            unsigned numKeys = osg::maximum( 1u, counts[n] / 3 );
+            Config conf = createConfig( counts[n], numKeys );
+            allMatch = allMatch && lookupsMatchScan( conf, numKeys );
+
+            Config extended = conf;
+            for( unsigned i = 0; i < 10; ++i )
+                extended.add( keyFor(numKeys + i), "added" );
+            allMatch = allMatch && lookupsMatchScan( extended, numKeys + 10 ) && lookupsMatchScan( conf, numKeys + 10 );
+
+            for( unsigned k = 0; k < numKeys; k += 2 )
+                extended.remove( keyFor(k) );
+            allMatch = allMatch && lookupsMatchScan( extended, numKeys + 10 ) && lookupsMatchScan( conf, numKeys + 10 );
+        }
+        ok = check( allMatch, "child lookups agree with a scan of the children, below and above the index threshold" ) && ok;
+    }
+
+    // copying, against building the same Config again:
+    const Config big = createConfig( 256, 256 );
+    unsigned sink = 0;
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    for( unsigned r = 0; r < numRepeats; ++r )
+    {
+        Config copy = big;
+        sink += copy.children().size();
+    }
+    double copyTime = osg::Timer::instance()->delta_u( start, osg::Timer::instance()->tick() );
+
+    unsigned numRebuilds = osg::maximum( 1u, numRepeats / 100 );
+    start = osg::Timer::instance()->tick();
+    for( unsigned r = 0; r < numRebuilds; ++r )
+    {
+        Config copy( big.key(), big.value() );
+        copy.attrs() = big.attrs();
+        for( ConfigSet::const_iterator i = big.children().begin(); i != big.children().end(); ++i )
+            copy.add( Config(i->key(), i->value()) );
+        sink += copy.children().size();
+    }
+    double rebuildTime = osg::Timer::instance()->delta_u( start, osg::Timer::instance()->tick() );
+
+    double copyPerOp = copyTime / (double)numRepeats;
+    double rebuildPerOp = rebuildTime / (double)numRebuilds;
+    std::cout
+        << "copy a Config with 256 children: "
+        << copyPerOp << " us shared, " << rebuildPerOp << " us rebuilt" << std::endl;
+
+    // lookups, against scanning the children:
+    const Config wide = createConfig( 64, 64 );
+    std::vector<std::string> keys;
+    for( unsigned k = 0; k < 64; ++k )
+        keys.push_back( keyFor(k) );
+
+    start = osg::Timer::instance()->tick();
+    for( unsigned r = 0; r < numRepeats; ++r )
+        for( unsigned k = 0; k < keys.size(); ++k )
+            sink += wide.child( keys[k] ).value().size();
+    double indexTime = osg::Timer::instance()->delta_u( start, osg::Timer::instance()->tick() );
+
+    start = osg::Timer::instance()->tick();
+    for( unsigned r = 0; r < numRepeats; ++r )
+        for( unsigned k = 0; k < keys.size(); ++k )
+            sink += scanChild( wide, keys[k] )->value().size();
+    double scanTime = osg::Timer::instance()->delta_u( start, osg::Timer::instance()->tick() );
+
+    double numLookups = (double)numRepeats * (double)keys.size();
+    std::cout
+        << "look up a child of 64 by key: "
+        << 1000.0 * indexTime / numLookups << " ns indexed, "
+        << 1000.0 * scanTime / numLookups << " ns scanned"
+        << " (" << sink << ")" << std::endl;
+
+    ok = check( copyPerOp * 10.0 <= rebuildPerOp, "sharing a copy costs at most a tenth of rebuilding it" ) && ok;
+    ok = check( indexTime <= scanTime, "an indexed lookup costs no more than a scan" ) && ok;
+
+    return ok ? 0 : 1;
+}
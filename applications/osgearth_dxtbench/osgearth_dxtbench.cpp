@@ -0,0 +1,240 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Measures the quality and throughput of ImageUtils::compressImageDXT on the
+ * CPU; no GL context is needed.
+ *
+ * The compressed tiles are decoded in software and compared with the originals:
+ * the checks require an RGB PSNR of at least 30 dB on imagery-like tiles, fully
+ * transparent and fully opaque pixels to keep their alpha exactly, DXT1 for
+ * opaque tiles and DXT5 otherwise. The benchmark reports the compression rate
+ * in megapixels per second, next to the RGB to RGBA conversion every
+ * uncompressed tile already goes through, for scale.
+ *
+ * usage: osgearth_dxtbench [--tiles N] [--size N]
+ */
+
+#include <osgEarth/ImageUtils>
+#include <osg/ArgumentParser>
+#include <osg/Image>
+#include <osg/Texture>
+#include <osg/Timer>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace osgEarth;
+
+namespace
+{
+    osg::Image* makeImagery( unsigned size, GLenum pixelFormat, bool transparentEdge )
+    {
+        unsigned channels = pixelFormat == GL_RGBA ? 4 : 3;
+        osg::Image* image = new osg::Image();
+        image->allocateImage( size, size, 1, pixelFormat, GL_UNSIGNED_BYTE );
+        for( unsigned t = 0; t < size; ++t )
+        {
+            unsigned char* p = image->data(0, t);
+            for( unsigned s = 0; s < size; ++s, p += channels )
+            {
+                int noise = rand() % 21 - 10;
+                p[0] = (unsigned char)osg::clampBetween( (int)(128.0 + 100.0*sin(0.05*s)) + noise, 0, 255 );
+                p[1] = (unsigned char)osg::clampBetween( (int)(128.0 + 90.0*cos(0.07*t)) + noise, 0, 255 );
+                p[2] = (unsigned char)((s + t) / 2);
+                if ( channels == 4 )
+                    p[3] = !transparentEdge ? 255 : s < 8 ? 0 : s < 16 ? (unsigned char)(s*16) : 255;
+            }
+        }
+        return image;
+    }
+
+    void fromRGB565( unsigned short c, int* rgb )
+    {
+        int r = (c >> 11) & 0x1F, g = (c >> 5) & 0x3F, b = c & 0x1F;
+        rgb[0] = (r << 3) | (r >> 2);
+        rgb[1] = (g << 2) | (g >> 4);
+        rgb[2] = (b << 3) | (b >> 2);
+    }
+
+    /** Decodes pixel i (0-15) of an 8-byte BC1 color block. */
+    void decodeColor( const unsigned char* block, int i, bool dxt1, int* out )
+    {
+        unsigned short c0 = block[0] | (block[1] << 8);
+        unsigned short c1 = block[2] | (block[3] << 8);
+        int e0[3], e1[3];
+        fromRGB565( c0, e0 );
+        fromRGB565( c1, e1 );
+
+        unsigned indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((unsigned)block[7] << 24);
+        unsigned index = (indices >> (2*i)) & 3;
+
+        for( int c = 0; c < 3; ++c )
+        {
+            if ( index == 0 )      out[c] = e0[c];
+            else if ( index == 1 ) out[c] = e1[c];
+            else if ( c0 > c1 || !dxt1 )
+                out[c] = index == 2 ? (2*e0[c] + e1[c]) / 3 : (e0[c] + 2*e1[c]) / 3;
+            else
+                out[c] = index == 2 ? (e0[c] + e1[c]) / 2 : 0;
+        }
+    }
+
+    /** Decodes pixel i (0-15) of an 8-byte BC3 alpha block. */
+    int decodeAlpha( const unsigned char* block, int i )
+    {
+        int a0 = block[0], a1 = block[1];
+        int bit = 16 + 3*i;
+        int index = 0;
+        for( int k = 0; k < 3; ++k, ++bit )
+            index |= ((block[bit/8] >> (bit%8)) & 1) << k;
+
+        if ( index == 0 ) return a0;
+        if ( index == 1 ) return a1;
+        if ( a0 > a1 )    return ((8-index)*a0 + (index-1)*a1) / 7;
+        if ( index == 6 ) return 0;
+        if ( index == 7 ) return 255;
+        return ((6-index)*a0 + (index-1)*a1) / 5;
+    }
+
+    struct Quality
+    {
+        double _psnr;          // RGB, dB
+        bool   _alphaExtremes; // 0 and 255 alpha kept exactly
+    };
+
+    Quality measure( const osg::Image* original, const osg::Image* compressed )
+    {
+        bool dxt1 = compressed->getPixelFormat() == GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        unsigned blockBytes = dxt1 ? 8 : 16;
+        int channels = original->getPixelFormat() == GL_RGBA ? 4 : 3;
+
+        Quality q;
+        q._alphaExtremes = true;
+        double sumSq = 0.0;
+
+        const unsigned char* block = compressed->data();
+        for( int bt = 0; bt < original->t(); bt += 4 )
+        {
+            for( int bs = 0; bs < original->s(); bs += 4, block += blockBytes )
+            {
+                for( int i = 0; i < 16; ++i )
+                {
+                    const unsigned char* p = original->data( bs + i%4, bt + i/4 );
+                    int rgb[3];
+                    decodeColor( dxt1 ? block : block+8, i, dxt1, rgb );
+                    for( int c = 0; c < 3; ++c )
+                        sumSq += (double)(rgb[c] - p[c]) * (double)(rgb[c] - p[c]);
+
+                    if ( !dxt1 && channels == 4 )
+                    {
+                        int a = decodeAlpha( block, i );
+                        if ( (p[3] == 0 && a != 0) || (p[3] == 255 && a != 255) )
+                            q._alphaExtremes = false;
+                    }
+                }
+            }
+        }
+
+        double mse = sumSq / (3.0 * original->s() * original->t());
+        q._psnr = mse > 0.0 ? 10.0 * log10(255.0*255.0 / mse) : 99.0;
+        return q;
+    }
+
+    bool check( bool result, const std::string& what )
+    {
+        std::cout << (result ? "PASS: " : "FAIL: ") << what << std::endl;
+        return result;
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+
+    unsigned numTiles = 100;
+    unsigned size = 256;
+    arguments.read( "--tiles", numTiles );
+    arguments.read( "--size", size );
+    if ( numTiles < 1 )
+        numTiles = 1;
+    size = osg::maximum( 4u, size & ~3u );
+
+    srand( 1 );
+
+    osg::ref_ptr<osg::Image> opaque = makeImagery( size, GL_RGB, false );
+    osg::ref_ptr<osg::Image> alpha  = makeImagery( size, GL_RGBA, true );
+
+    // checks:
+    bool ok = true;
+
+    osg::ref_ptr<osg::Image> dxt1 = ImageUtils::compressImageDXT( opaque.get() );
+    osg::ref_ptr<osg::Image> dxt5 = ImageUtils::compressImageDXT( alpha.get() );
+
+    ok = check( dxt1.valid() && dxt1->getPixelFormat() == GL_COMPRESSED_RGB_S3TC_DXT1_EXT, "an opaque tile becomes DXT1" ) && ok;
+    ok = check( dxt5.valid() && dxt5->getPixelFormat() == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, "a translucent tile becomes DXT5" ) && ok;
+
+    if ( dxt1.valid() && dxt5.valid() )
+    {
+        Quality q1 = measure( opaque.get(), dxt1.get() );
+        Quality q5 = measure( alpha.get(), dxt5.get() );
+        std::cout << "DXT1 RGB PSNR " << q1._psnr << " dB, DXT5 RGB PSNR " << q5._psnr << " dB" << std::endl;
+
+        ok = check( q1._psnr >= 30.0, "DXT1 keeps an RGB PSNR of at least 30 dB" ) && ok;
+        ok = check( q5._psnr >= 30.0, "DXT5 keeps an RGB PSNR of at least 30 dB" ) && ok;
+        ok = check( q5._alphaExtremes, "DXT5 keeps fully transparent and opaque pixels exact" ) && ok;
+    }
+
+    {
+        osg::ref_ptr<osg::Image> odd = makeImagery( 6, GL_RGB, false );
+        osg::ref_ptr<osg::Image> result = ImageUtils::compressImageDXT( odd.get() );
+        ok = check( !result.valid(), "a tile that is not a whole number of blocks is left alone" ) && ok;
+    }
+
+    // benchmark:
+    osg::Timer* timer = osg::Timer::instance();
+    double compress1 = 0.0, compress5 = 0.0, convert = 0.0;
+
+    for( unsigned n = 0; n < numTiles; ++n )
+    {
+        osg::Timer_t t0 = timer->tick();
+        osg::ref_ptr<osg::Image> c1 = ImageUtils::compressImageDXT( opaque.get() );
+        osg::Timer_t t1 = timer->tick();
+        osg::ref_ptr<osg::Image> c5 = ImageUtils::compressImageDXT( alpha.get() );
+        osg::Timer_t t2 = timer->tick();
+        osg::ref_ptr<osg::Image> rgba = ImageUtils::convertToRGBA8( opaque.get() );
+        osg::Timer_t t3 = timer->tick();
+
+        compress1 += timer->delta_m( t0, t1 );
+        compress5 += timer->delta_m( t1, t2 );
+        convert   += timer->delta_m( t2, t3 );
+    }
+
+    double mpix = (double)size * (double)size * (double)numTiles / 1000.0; // megapixels, per ms -> per s
+    std::cout
+        << numTiles << " " << size << "x" << size << " tiles: "
+        << "DXT1 " << compress1/(double)numTiles << " ms/tile (" << mpix/compress1 << " Mpix/s), "
+        << "DXT5 " << compress5/(double)numTiles << " ms/tile (" << mpix/compress5 << " Mpix/s), "
+        << "RGB to RGBA " << convert/(double)numTiles << " ms/tile"
+        << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,199 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Checks and times the batched ECEF conversions in osgEarth::ECEF.
+ *
+ * The checks convert random points on the WGS84 ellipsoid at a range of heights
+ * to ECEF and back, and compare the results against osg::EllipsoidModel (for
+ * geodeticToECEF) and against an iterated reference solution in long double (for
+ * ecefToGeodetic). They fail if the errors go over the bounds documented in the
+ * ECEF header. The benchmark then times both conversions against the per-point
+ * osg::EllipsoidModel calls.
+ *
+ * usage: osgearth_ecefbench [--points N] [--seed N]
+ */
+
+#include <osgEarth/ECEF>
+#include <osg/ArgumentParser>
+#include <osg/CoordinateSystemNode>
+#include <osg/Timer>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    /** ECEF to geodetic by fixed-point iteration in long double; lat in radians. */
+    void referenceGeodetic( const osg::EllipsoidModel* em, long double x, long double y, long double z,
+                            long double& out_lat, long double& out_height )
+    {
+        const long double a  = em->getRadiusEquator();
+        const long double b  = em->getRadiusPolar();
+        const long double e2 = (a*a - b*b) / (a*a);
+
+        long double p   = sqrtl( x*x + y*y );
+        long double phi = atan2l( z, p*(1.0L - e2) );
+        for( int i = 0; i < 50; ++i )
+        {
+            long double s = sinl(phi);
+            long double N = a / sqrtl( 1.0L - e2*s*s );
+            long double h = p*cosl(phi) + z*s - a*sqrtl( 1.0L - e2*s*s );
+            phi = atan2l( z, p*(1.0L - e2*N/(N + h)) );
+        }
+        long double s = sinl(phi);
+        out_lat    = phi;
+        out_height = p*cosl(phi) + z*s - a*sqrtl( 1.0L - e2*s*s );
+    }
+
+    double randomBetween( double lo, double hi )
+    {
+        return lo + (hi - lo) * (double)rand() / (double)RAND_MAX;
+    }
+
+    /** Random lat/long points at the given height, including both poles. */
+    void makePoints( unsigned count, double height, std::vector<osg::Vec3d>& out_points )
+    {
+        out_points.resize( count );
+        for( unsigned i = 0; i < count; ++i )
+            out_points[i].set( randomBetween(-180.0, 180.0), randomBetween(-90.0, 90.0), height );
+        if ( count > 1 )
+        {
+            out_points[0].y() =  90.0;
+            out_points[1].y() = -90.0;
+        }
+    }
+
+    struct Bound
+    {
+        double _height;     // meters above the ellipsoid
+        double _maxLat;     // degrees
+        double _maxHeight;  // meters
+    };
+
+    // the bounds documented on ECEF::ecefToGeodetic:
+    const Bound s_bounds[] = {
+        { -10000.0,  1e-9, 1e-6 },
+        {      0.0,  1e-9, 1e-6 },
+        {   1000.0,  1e-9, 1e-6 },
+        {  10000.0,  1e-9, 1e-6 },
+        { 100000.0,  1e-9, 1e-6 },
+        {1000000.0,  1e-7, 1e-6 }
+    };
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+
+    unsigned numPoints = 100000;
+    unsigned seed = 1;
+    arguments.read( "--points", numPoints );
+    arguments.read( "--seed", seed );
+    if ( numPoints < 2 )
+        numPoints = 2;
+    srand( seed );
+
+    osg::ref_ptr<osg::EllipsoidModel> em = new osg::EllipsoidModel();
+
+    // checks:
+    bool ok = true;
+    std::vector<osg::Vec3d> geodetic, ecef, roundTrip;
+
+    for( unsigned b = 0; b < sizeof(s_bounds)/sizeof(s_bounds[0]); ++b )
+    {
+        const Bound& bound = s_bounds[b];
+        makePoints( numPoints, bound._height, geodetic );
+
+        ecef.resize( numPoints );
+        ECEF::geodeticToECEF( em.get(), &geodetic[0], &ecef[0], numPoints );
+
+        roundTrip.resize( numPoints );
+        ECEF::ecefToGeodetic( em.get(), &ecef[0], &roundTrip[0], numPoints );
+
+        double maxForward = 0.0, maxLat = 0.0, maxHeight = 0.0;
+        for( unsigned i = 0; i < numPoints; ++i )
+        {
+            osg::Vec3d expected;
+            em->convertLatLongHeightToXYZ(
+                osg::DegreesToRadians(geodetic[i].y()), osg::DegreesToRadians(geodetic[i].x()), geodetic[i].z(),
+                expected.x(), expected.y(), expected.z() );
+            maxForward = osg::maximum( maxForward, (ecef[i] - expected).length() );
+
+            long double lat, height;
+            referenceGeodetic( em.get(), ecef[i].x(), ecef[i].y(), ecef[i].z(), lat, height );
+            maxLat    = osg::maximum( maxLat, fabs(roundTrip[i].y() - osg::RadiansToDegrees((double)lat)) );
+            maxHeight = osg::maximum( maxHeight, fabs(roundTrip[i].z() - (double)height) );
+        }
+
+        bool pass = maxForward < 1e-6 && maxLat < bound._maxLat && maxHeight < bound._maxHeight;
+        std::cout
+            << (pass ? "PASS: " : "FAIL: ")
+            << "height " << bound._height << " m: "
+            << "geodeticToECEF error " << maxForward << " m, "
+            << "ecefToGeodetic latitude error " << maxLat << " deg (bound " << bound._maxLat << "), "
+            << "height error " << maxHeight << " m (bound " << bound._maxHeight << ")"
+            << std::endl;
+        ok = pass && ok;
+    }
+
+    // benchmark:
+    makePoints( numPoints, 0.0, geodetic );
+    for( unsigned i = 0; i < numPoints; ++i )
+        geodetic[i].z() = randomBetween( 0.0, 1000.0 );
+    ecef.resize( numPoints );
+    roundTrip.resize( numPoints );
+    std::vector<osg::Vec3d> scratch( numPoints );
+
+    osg::Timer* timer = osg::Timer::instance();
+
+    osg::Timer_t t0 = timer->tick();
+    ECEF::geodeticToECEF( em.get(), &geodetic[0], &ecef[0], numPoints );
+    osg::Timer_t t1 = timer->tick();
+    for( unsigned i = 0; i < numPoints; ++i )
+    {
+        em->convertLatLongHeightToXYZ(
+            osg::DegreesToRadians(geodetic[i].y()), osg::DegreesToRadians(geodetic[i].x()), geodetic[i].z(),
+            scratch[i].x(), scratch[i].y(), scratch[i].z() );
+    }
+    osg::Timer_t t2 = timer->tick();
+    ECEF::ecefToGeodetic( em.get(), &ecef[0], &roundTrip[0], numPoints );
+    osg::Timer_t t3 = timer->tick();
+    for( unsigned i = 0; i < numPoints; ++i )
+    {
+        double lat, lon, height;
+        em->convertXYZToLatLongHeight( ecef[i].x(), ecef[i].y(), ecef[i].z(), lat, lon, height );
+        scratch[i].set( osg::RadiansToDegrees(lon), osg::RadiansToDegrees(lat), height );
+    }
+    osg::Timer_t t4 = timer->tick();
+
+    std::cout
+        << numPoints << " points: "
+        << "geodeticToECEF " << timer->delta_m(t0, t1) << " ms "
+        << "(EllipsoidModel " << timer->delta_m(t1, t2) << " ms), "
+        << "ecefToGeodetic " << timer->delta_m(t2, t3) << " ms "
+        << "(EllipsoidModel " << timer->delta_m(t3, t4) << " ms)"
+        << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Checks and times the sharded LRUCache.
+ *
+ * The checks verify that the entry and weight limits hold for the cache as a
+ * whole: keys that all hash to one shard can still fill the whole capacity and
+ * keep the most recent entries, the weight never goes over the limit, and an
+ * entry heavier than the whole limit is kept on its own. Copies and assignments
+ * carry the entries in their recency order and are independent of the original.
+ * Several threads then hammer a cache with inserts, lookups and erases, after
+ * which the tracked weight must equal the weight of the entries left in it.
+ *
+ * The benchmark times the same mixed workload on 1 and 8 shards.
+ *
+ * usage: osgearth_lrucachebench [--ops N] [--threads N]
+ */
+
+#include <osgEarth/Utils>
+#include <OpenThreads/Thread>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <iostream>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    /** Puts every key but one in ten in shard 0. */
+    struct SkewedHash {
+        unsigned operator()( unsigned key ) const { return key % 10 == 0 ? key : 0u; }
+    };
+
+    struct SpreadHash {
+        unsigned operator()( unsigned key ) const { return key * 2654435761u; }
+    };
+
+    typedef LRUCache<unsigned, unsigned, SpreadHash> Cache;
+
+    /** Mixed inserts, lookups and erases over a key range larger than the cache. */
+    struct Worker : public OpenThreads::Thread
+    {
+        Worker( Cache& cache, unsigned seed, unsigned numOps ) : _cache(cache), _seed(seed), _numOps(numOps) { }
+
+        void run()
+        {
+            for( unsigned i = 0; i < _numOps; ++i )
+            {
+                unsigned key = (i*7 + _seed*13) % 3000;
+                if ( i % 1000 == 0 )
+                    _cache.erase( key );
+                else if ( i % 3 == 0 )
+                    _cache.insert( key, i, 1 + key % 5 );
+                else
+                    _cache.get( key );
+            }
+        }
+
+        Cache&   _cache;
+        unsigned _seed;
+        unsigned _numOps;
+    };
+
+    /** Runs the workload on the cache, and returns the time it took in seconds. */
+    double runWorkers( Cache& cache, unsigned numThreads, unsigned numOps )
+    {
+        std::vector<Worker*> workers;
+        for( unsigned t = 0; t < numThreads; ++t )
+            workers.push_back( new Worker(cache, t, numOps) );
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        for( unsigned t = 0; t < numThreads; ++t )
+            workers[t]->start();
+        for( unsigned t = 0; t < numThreads; ++t )
+            workers[t]->join();
+        double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+        for( unsigned t = 0; t < numThreads; ++t )
+            delete workers[t];
+        return seconds;
+    }
+
+    bool check( bool result, const std::string& what )
+    {
+        std::cout << (result ? "PASS: " : "FAIL: ") << what << std::endl;
+        return result;
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+
+    unsigned numOps = 200000;
+    arguments.read( "--ops", numOps );
+
+    unsigned numThreads = 8;
+    arguments.read( "--threads", numThreads );
+
+    // checks:
+    bool ok = true;
+
+    {
+        LRUCache<unsigned, unsigned, SkewedHash> cache( ~0u, 8 );
+        cache.setMaxEntries( 64 );
+        for( unsigned i = 0; i < 1000; ++i )
+            cache.insert( i, i );
+
+        unsigned numRecent = 0;
+        for( unsigned i = 950; i < 1000; ++i )
+            numRecent += cache.contains( i ) ? 1 : 0;
+
+        ok = check( cache.getStats()._entries == 64 && numRecent == 50,
+            "keys that crowd into one shard fill the whole capacity and keep the most recent" ) && ok;
+    }
+
+    {
+        Cache cache( 1000, 8 );
+        bool withinLimit = true;
+        for( unsigned i = 0; i < 5000; ++i )
+        {
+            cache.insert( i, i, 1 + i % 7 );
+            withinLimit = withinLimit && cache.getWeight() <= 1000;
+        }
+        ok = check( withinLimit && cache.getWeight() > 990, "the weight stays within the limit of the whole cache" ) && ok;
+
+        cache.insert( 10000, 0, 5000 );
+        ok = check( cache.getStats()._entries == 1 && cache.contains(10000),
+            "an entry heavier than the limit is kept on its own" ) && ok;
+    }
+
+    {
+        Cache cache( ~0u, 4 );
+        cache.setMaxEntries( 10 );
+        for( unsigned i = 0; i < 10; ++i )
+            cache.insert( i, i*10 );
+
+        Cache copy( cache );
+        Cache assigned;
+        assigned = cache;
+
+        bool same = true;
+        for( unsigned i = 0; i < 10; ++i )
+        {
+            Cache::Record a = copy.get( i ), b = assigned.get( i );
+            same = same && a.valid() && a.value() == i*10 && b.valid() && b.value() == i*10;
+        }
+
+        // the copy's oldest entry is 0, since the lookups above went in key order
+        copy.insert( 100, 0 );
+        ok = check(
+            same && assigned.getMaxEntries() == 10 &&
+            !copy.contains(0) && cache.contains(0) && !cache.contains(100),
+            "copies carry the entries in recency order and are independent" ) && ok;
+    }
+
+    {
+        Cache cache( ~0u, 8 );
+        cache.setMaxEntries( 500 );
+        runWorkers( cache, numThreads, numOps / 4 );
+
+        unsigned numEntries = cache.getStats()._entries;
+        unsigned long weight = cache.getWeight(), evicted = 0;
+        unsigned w;
+        while( cache.evictOldest(w) )
+            evicted += w;
+
+        ok = check( numEntries <= 500 && weight == evicted && cache.getWeight() == 0,
+            "concurrent use keeps the entry limit and the weight total" ) && ok;
+    }
+
+    // shards, under contention:
+    double seconds[2];
+    const unsigned numShards[2] = { 1, 8 };
+    for( unsigned i = 0; i < 2; ++i )
+    {
+        Cache cache( ~0u, numShards[i] );
+        cache.setMaxEntries( 1000 );
+        seconds[i] = runWorkers( cache, numThreads, numOps );
+    }
+
+    double total = (double)numThreads * (double)numOps;
+    std::cout
+        << numThreads << " threads: "
+        << (unsigned)(total / seconds[0]) << " ops/s with 1 shard, "
+        << (unsigned)(total / seconds[1]) << " ops/s with 8 shards" << std::endl;
+
+    return ok ? 0 : 1;
+}
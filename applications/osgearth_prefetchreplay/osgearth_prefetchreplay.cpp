@@ -0,0 +1,181 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Replays a camera path through a TilePrefetcher whose map has one image layer
+ * backed by a synthetic tile source, which sleeps for a fixed latency before
+ * returning each tile. The prefetch tasks are the real ones, so the report
+ * reflects the task service, the pending limit and the cancellations.
+ *
+ * The path is read from a file ("time x y z" per line, see CameraPathIO), or
+ * else is a steady flyover at 100km. The checks verify that every tile the
+ * camera needed is counted exactly once, that the flyover gets prefetch hits,
+ * that each completed prefetch read its tile from the source, and that a
+ * camera at rest prefetches nothing.
+ *
+ * usage: osgearth_prefetchreplay [path-file] [--speed N] [--latency ms] [--max-pending N]
+ */
+
+#include <osgEarth/TilePrefetcher>
+#include <osgEarth/ImageLayer>
+#include <osgEarth/Registry>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Thread>
+#include <osg/ArgumentParser>
+#include <osg/Image>
+#include <osg/Timer>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace osgEarth;
+
+namespace
+{
+    /** Returns a small blank image for any tile, after a fixed delay. */
+    class SyntheticTileSource : public TileSource
+    {
+    public:
+        SyntheticTileSource( double latency ) : TileSource(), _latency(latency) { }
+
+        void initialize( const std::string& referenceURI, const Profile* overrideProfile )
+        {
+            setProfile( overrideProfile ? overrideProfile : Registry::instance()->getGlobalGeodeticProfile() );
+        }
+
+        unsigned getNumCreated() const { return _numCreated; }
+
+    protected:
+        osg::Image* createImage( const TileKey& key, ProgressCallback* progress )
+        {
+            ++_numCreated;
+            if ( _latency > 0.0 )
+                OpenThreads::Thread::microSleep( (unsigned int)(_latency * 1.0e6) );
+
+            osg::Image* image = new osg::Image();
+            image->allocateImage( 8, 8, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+            memset( image->data(), 0, image->getTotalSizeInBytes() );
+            return image;
+        }
+
+        double                _latency;
+        OpenThreads::Atomic   _numCreated;
+    };
+
+    /** Eastbound at a steady speed and height, sampled at 10Hz. */
+    void makeFlyover( double seconds, double degreesPerSecond, double height, CameraPath& out_path )
+    {
+        for( double t = 0.0; t <= seconds; t += 0.1 )
+            out_path.push_back( CameraSample(t, osg::Vec3d(-10.0 + degreesPerSecond*t, 45.0, height)) );
+    }
+
+    void print( const std::string& name, const TilePrefetchReport& r )
+    {
+        std::cout << name << ": " << r._samples << " samples, " << r._demanded << " tiles needed: "
+            << r._hits << " hits, " << r._late << " late, " << r._misses << " misses ("
+            << (int)(100.0f * r.getHitRate()) << "% hit rate); "
+            << r._issued << " prefetches issued, " << r._cancelled << " cancelled, "
+            << r._wasted << " wasted" << std::endl;
+    }
+
+    bool check( bool result, const std::string& what )
+    {
+        std::cout << (result ? "PASS: " : "FAIL: ") << what << std::endl;
+        return result;
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+
+    // replay this many times faster than recorded; the source latency scales with it.
+    double speed = 1.0;
+    arguments.read( "--speed", speed );
+    if ( speed <= 0.0 )
+        speed = 1.0;
+
+    double latencyMs = 50.0;
+    arguments.read( "--latency", latencyMs );
+
+    unsigned maxPending = 64;
+    arguments.read( "--max-pending", maxPending );
+
+    CameraPath path;
+    bool fromFile = false;
+    for( int i = 1; i < arguments.argc(); ++i )
+    {
+        if ( arguments.isOption(i) )
+            continue;
+
+        std::ifstream in( arguments[i] );
+        if ( !in.is_open() || !CameraPathIO::read(in, path) || path.empty() )
+        {
+            std::cout << "Cannot read a camera path from " << arguments[i] << std::endl;
+            return 1;
+        }
+        fromFile = true;
+        break;
+    }
+    if ( !fromFile )
+        makeFlyover( 30.0, 0.05, 100000.0, path );
+
+    SyntheticTileSource* source = new SyntheticTileSource( 0.001*latencyMs/speed );
+    osg::ref_ptr<Map> map = new Map();
+    map->addImageLayer( new ImageLayer(ImageLayerOptions("synthetic"), source) );
+
+    osg::ref_ptr<TilePrefetcher> prefetcher = new TilePrefetcher( map.get() );
+    prefetcher->setMaxPending( maxPending );
+
+    bool ok = true;
+
+    unsigned completed = prefetcher->getNumCompleted();
+    unsigned created   = source->getNumCreated();
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    TilePrefetchReport report = prefetcher->replay( path, speed );
+    double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+    print( fromFile ? "path" : "flyover", report );
+    std::cout << "replayed in " << seconds << "s at " << speed << "x" << std::endl;
+
+    completed = prefetcher->getNumCompleted() - completed;
+    created   = source->getNumCreated() - created;
+
+    ok = check( report._hits + report._late + report._misses == report._demanded,
+        "each tile the camera needed is counted once" ) && ok;
+    ok = check( created >= completed, "each completed prefetch read its tile from the source" ) && ok;
+    ok = check( report._cancelled <= report._issued, "only issued prefetches are cancelled" ) && ok;
+
+    if ( !fromFile )
+    {
+        ok = check( report._hits > 0, "the flyover gets prefetch hits" ) && ok;
+
+        CameraPath still;
+        for( double t = 0.0; t <= 2.0; t += 0.1 )
+            still.push_back( CameraSample(t, osg::Vec3d(20.0, -30.0, 100000.0)) );
+
+        TilePrefetchReport atRest = prefetcher->replay( still, speed );
+        print( "at rest", atRest );
+        ok = check( atRest._issued == 0 && atRest._wasted == 0, "a camera at rest prefetches nothing" ) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,213 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Checks and times the heightfield resampling kernel behind
+ * HeightFieldUtils::createSubSample and HeightFieldUtils::resizeHeightField.
+ *
+ * The kernel must produce exactly what sampling every post through
+ * getHeightAtLocation (subsampling) or getHeightAtNormalizedLocation (resizing)
+ * produces. The checks compare the two, post by post, for all four interpolations
+ * on random heightfields from 2x2 posts up, with scattered NO_DATA posts, NO_DATA
+ * corners, and output extents that hang off the edge of the input (so the sample
+ * positions are clamped). The benchmark times subsampling the four children of a
+ * 65x65 tile both ways.
+ *
+ * usage: osgearth_resamplebench [--tiles N]
+ */
+
+#include <osgEarth/HeightFieldUtils>
+#include <osgEarth/GeoData>
+#include <osgEarth/SpatialReference>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+
+using namespace osgEarth;
+
+namespace
+{
+    const char* s_interpNames[] = { "average", "nearest", "bilinear", "triangulate" };
+
+    osg::HeightField* createInput( unsigned numCols, unsigned numRows, bool noDataCorners )
+    {
+        osg::HeightField* hf = new osg::HeightField();
+        hf->allocate( numCols, numRows );
+        for( unsigned r = 0; r < numRows; ++r )
+            for( unsigned c = 0; c < numCols; ++c )
+                hf->setHeight( c, r, rand() % 10 == 0 ? NO_DATA_VALUE : (float)(rand() % 10000) / 7.0f );
+
+        if ( noDataCorners )
+        {
+            hf->setHeight( 0, 0, NO_DATA_VALUE );
+            hf->setHeight( numCols-1, 0, NO_DATA_VALUE );
+            hf->setHeight( 0, numRows-1, NO_DATA_VALUE );
+            hf->setHeight( numCols-1, numRows-1, NO_DATA_VALUE );
+        }
+        return hf;
+    }
+
+    /** Subsamples one post at a time, the way createSubSample used to. */
+    osg::HeightField* subSamplePerPost( const osg::HeightField* input, const GeoExtent& inputEx, const GeoExtent& outputEx, ElevationInterpolation interp )
+    {
+        double div = outputEx.width()/inputEx.width();
+        int numCols = input->getNumColumns();
+        int numRows = input->getNumRows();
+        double xInterval = inputEx.width()  / (double)(numCols-1);
+        double yInterval = inputEx.height() / (double)(numRows-1);
+        double dx = div * xInterval;
+        double dy = div * yInterval;
+
+        osg::HeightField* dest = new osg::HeightField();
+        dest->allocate( numCols, numRows );
+
+        double x, y;
+        int col, row;
+        for( x = outputEx.xMin(), col=0; col < numCols; x += dx, col++ )
+            for( y = outputEx.yMin(), row=0; row < numRows; y += dy, row++ )
+                dest->setHeight( col, row, HeightFieldUtils::getHeightAtLocation( input, x, y, inputEx.xMin(), inputEx.yMin(), xInterval, yInterval, interp ) );
+
+        return dest;
+    }
+
+    /** Counts the posts that differ (NO_DATA only matches NO_DATA). */
+    unsigned countDifferences( const osg::HeightField* a, const osg::HeightField* b )
+    {
+        if ( !a || !b || a->getNumColumns() != b->getNumColumns() || a->getNumRows() != b->getNumRows() )
+            return 1;
+
+        unsigned diffs = 0;
+        for( unsigned r = 0; r < a->getNumRows(); ++r )
+            for( unsigned c = 0; c < a->getNumColumns(); ++c )
+                if ( !(a->getHeight(c, r) == b->getHeight(c, r)) )
+                    ++diffs;
+        return diffs;
+    }
+
+    bool check( bool result, const std::string& what )
+    {
+        std::cout << (result ? "PASS: " : "FAIL: ") << what << std::endl;
+        return result;
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+
+    unsigned numTiles = 500;
+    arguments.read( "--tiles", numTiles );
+
+    osg::ref_ptr<const SpatialReference> srs = SpatialReference::create( "wgs84" );
+
+    // checks:
+    bool ok = true;
+    srand( 3 );
+
+    for( int interp = 0; interp < 4; ++interp )
+    {
+        ElevationInterpolation interpolation = (ElevationInterpolation)interp;
+        unsigned subPosts = 0, subDiffs = 0, resizePosts = 0, resizeDiffs = 0;
+
+        for( unsigned t = 0; t < 100; ++t )
+        {
+            unsigned numCols = t < 4 ? 2 : 2 + rand() % 40;
+            unsigned numRows = t < 4 ? 2 : 2 + rand() % 40;
+            osg::ref_ptr<osg::HeightField> input = createInput( numCols, numRows, t % 3 == 0 );
+
+            double xmin = -10.0 + rand() % 20, ymin = -10.0 + rand() % 20;
+            double width = 1.0 + rand() % 5, height = 1.0 + rand() % 5;
+            GeoExtent inputEx( srs.get(), xmin, ymin, xmin + width, ymin + height );
+
+            // one quadrant of the input, or a quarter-size extent hanging off its edges.
+            double x = xmin + 0.5 * width * (rand() % 2), y = ymin + 0.5 * height * (rand() % 2);
+            if ( t % 5 == 0 )
+            {
+                x = xmin + 0.8 * width;
+                y = ymin - 0.2 * height;
+            }
+            GeoExtent outputEx( srs.get(), x, y, x + 0.5 * width, y + 0.5 * height );
+
+            osg::ref_ptr<osg::HeightField> expected = subSamplePerPost( input.get(), inputEx, outputEx, interpolation );
+            osg::ref_ptr<osg::HeightField> actual = HeightFieldUtils::createSubSample( input.get(), inputEx, outputEx, interpolation );
+            subPosts += numCols * numRows;
+            subDiffs += countDifferences( actual.get(), expected.get() );
+
+            // (the same size is a plain copy, so skip it)
+            int newCols = 2 + rand() % 50, newRows = 2 + rand() % 50;
+            if ( newCols == (int)numCols && newRows == (int)numRows )
+                ++newCols;
+            osg::ref_ptr<osg::HeightField> resized = HeightFieldUtils::resizeHeightField( input.get(), newCols, newRows, interpolation );
+            osg::ref_ptr<osg::HeightField> resizedExpected = new osg::HeightField();
+            resizedExpected->allocate( newCols, newRows );
+            for( int r = 0; r < newRows; ++r )
+                for( int c = 0; c < newCols; ++c )
+                    resizedExpected->setHeight( c, r, HeightFieldUtils::getHeightAtNormalizedLocation(
+                        input.get(), (double)c / (double)(newCols-1), (double)r / (double)(newRows-1), interpolation) );
+            resizePosts += newCols * newRows;
+            resizeDiffs += countDifferences( resized.get(), resizedExpected.get() );
+        }
+
+        std::stringstream sub, resize;
+        sub << s_interpNames[interp] << ": createSubSample matches getHeightAtLocation ("
+            << subDiffs << " of " << subPosts << " posts differ)";
+        resize << s_interpNames[interp] << ": resizeHeightField matches getHeightAtNormalizedLocation ("
+            << resizeDiffs << " of " << resizePosts << " posts differ)";
+        ok = check( subDiffs == 0, sub.str() ) && ok;
+        ok = check( resizeDiffs == 0, resize.str() ) && ok;
+    }
+
+    // benchmark: the four children of a 65x65 tile.
+    osg::ref_ptr<osg::HeightField> input = createInput( 65, 65, false );
+    GeoExtent inputEx( srs.get(), 0.0, 0.0, 1.0, 1.0 );
+    std::vector<GeoExtent> children;
+    for( unsigned i = 0; i < 4; ++i )
+    {
+        double x = 0.5 * (i % 2), y = 0.5 * (i / 2);
+        children.push_back( GeoExtent(srs.get(), x, y, x + 0.5, y + 0.5) );
+    }
+
+    for( int interp = 0; interp < 4; ++interp )
+    {
+        ElevationInterpolation interpolation = (ElevationInterpolation)interp;
+        osg::ref_ptr<osg::HeightField> sink;
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        for( unsigned t = 0; t < numTiles; ++t )
+            for( unsigned i = 0; i < children.size(); ++i )
+                sink = subSamplePerPost( input.get(), inputEx, children[i], interpolation );
+        double perPost = osg::Timer::instance()->delta_u( start, osg::Timer::instance()->tick() );
+
+        start = osg::Timer::instance()->tick();
+        for( unsigned t = 0; t < numTiles; ++t )
+            for( unsigned i = 0; i < children.size(); ++i )
+                sink = HeightFieldUtils::createSubSample( input.get(), inputEx, children[i], interpolation );
+        double kernel = osg::Timer::instance()->delta_u( start, osg::Timer::instance()->tick() );
+
+        std::cout
+            << s_interpNames[interp] << ", " << numTiles << " tiles of 65x65 posts: "
+            << (perPost / (double)numTiles) << " us/tile per post, "
+            << (kernel / (double)numTiles) << " us/tile with the kernel" << std::endl;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,240 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Checks and times how the ResidencyManager enforces its budget on inserts.
+ *
+ * Two test consumers hold fixed-size entries and report each insert through
+ * ResidencyManager::added(). The checks verify that the consumers never end up
+ * over the budget, that the manager walks the consumers only once the running
+ * total crosses the budget (rather than on every insert), that the cheaper
+ * consumer gives up more entries, and that a consumer dropping entries on its
+ * own is picked up by the next walk.
+ *
+ * The benchmark times inserts on 1 to 8 threads, reporting through added() and,
+ * for reference, calling enforce() after each one.
+ *
+ * usage: osgearth_residencybench [--ops N]
+ */
+
+#include <osgEarth/ResidencyManager>
+#include <osgEarth/Registry>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Thread>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    const size_t ENTRY_BYTES = 10000;
+
+    /** Holds entries of a fixed size, oldest first, and counts the manager's walks. */
+    class TestConsumer : public ResidencyConsumer
+    {
+    public:
+        TestConsumer( const std::string& name, float cost ) : _bytes(0) {
+            attach( name, cost );
+        }
+
+        ~TestConsumer() {
+            detach();
+        }
+
+        /** Adds an entry and reports it, the way MemCache::setObject does. */
+        void insert() {
+            {
+                Threading::ScopedMutexLock lock( _mutex );
+                _ages.push_back( osg::Timer::instance()->time_s() );
+                _bytes += ENTRY_BYTES;
+            }
+            Registry::instance()->getResidencyManager()->added( ENTRY_BYTES );
+        }
+
+        /** Drops the oldest entry without telling the manager, like a cache hitting its own limit. */
+        void drop() {
+            Threading::ScopedMutexLock lock( _mutex );
+            if ( !_ages.empty() ) {
+                _ages.pop_front();
+                _bytes -= ENTRY_BYTES;
+            }
+        }
+
+        size_t getResidentBytes() const {
+            ++_walks;
+            Threading::ScopedMutexLock lock( _mutex );
+            return _bytes;
+        }
+
+        unsigned getResidentEntries() const {
+            Threading::ScopedMutexLock lock( _mutex );
+            return _ages.size();
+        }
+
+        bool getOldestResident( double& out_lastUsed, size_t& out_bytes ) const {
+            Threading::ScopedMutexLock lock( _mutex );
+            if ( _ages.empty() )
+                return false;
+            out_lastUsed = _ages.front();
+            out_bytes = ENTRY_BYTES;
+            return true;
+        }
+
+        bool evictOldestResident( size_t& out_bytes ) {
+            Threading::ScopedMutexLock lock( _mutex );
+            if ( _ages.empty() )
+                return false;
+            _ages.pop_front();
+            _bytes -= ENTRY_BYTES;
+            out_bytes = ENTRY_BYTES;
+            return true;
+        }
+
+        unsigned getNumWalks() const { return _walks; }
+
+    private:
+        std::deque<double>          _ages;
+        size_t                      _bytes;
+        mutable OpenThreads::Atomic _walks;
+        mutable Threading::Mutex    _mutex;
+    };
+
+    struct Inserter : public OpenThreads::Thread
+    {
+        Inserter( TestConsumer& consumer, unsigned numOps, bool enforceEach ) :
+            _consumer(consumer), _numOps(numOps), _enforceEach(enforceEach) { }
+
+        void run()
+        {
+            ResidencyManager* manager = Registry::instance()->getResidencyManager();
+            for( unsigned i = 0; i < _numOps; ++i )
+            {
+                _consumer.insert();
+                if ( _enforceEach )
+                    manager->enforce();
+            }
+        }
+
+        TestConsumer& _consumer;
+        unsigned      _numOps;
+        bool          _enforceEach;
+    };
+
+    double runInserts( TestConsumer& consumer, unsigned numThreads, unsigned numOps, bool enforceEach )
+    {
+        std::vector<Inserter*> threads;
+        for( unsigned i = 0; i < numThreads; ++i )
+            threads.push_back( new Inserter(consumer, numOps/numThreads, enforceEach) );
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        for( unsigned i = 0; i < threads.size(); ++i )
+            threads[i]->start();
+        for( unsigned i = 0; i < threads.size(); ++i )
+            threads[i]->join();
+        double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+        for( unsigned i = 0; i < threads.size(); ++i )
+            delete threads[i];
+        return seconds;
+    }
+
+    bool check( bool result, const std::string& what )
+    {
+        std::cout << (result ? "PASS: " : "FAIL: ") << what << std::endl;
+        return result;
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+
+    unsigned numOps = 50000;
+    arguments.read( "--ops", numOps );
+
+    ResidencyManager* manager = Registry::instance()->getResidencyManager();
+    const size_t budget = 100 * ENTRY_BYTES;
+
+    // checks:
+    bool ok = true;
+
+    {
+        TestConsumer cheap( "cheap", 1.0f ), dear( "dear", 10.0f );
+        manager->setBudget( budget );
+
+        unsigned walks = cheap.getNumWalks();
+        bool withinBudget = true;
+        for( unsigned i = 0; i < 1000; ++i )
+        {
+            (i % 2 == 0 ? cheap : dear).insert();
+            // counted by entry, since asking for the bytes would count as a walk:
+            withinBudget = withinBudget && (cheap.getResidentEntries() + dear.getResidentEntries()) * ENTRY_BYTES <= budget;
+        }
+        walks = cheap.getNumWalks() - walks;
+
+        std::cout << "1000 inserts, " << walks << " walks" << std::endl;
+        ok = check( withinBudget, "the consumers stay within the budget" ) && ok;
+        ok = check( walks > 0 && walks <= 100, "the consumers are walked only when the budget is crossed" ) && ok;
+
+        ResidencyUsage cheapUsage, dearUsage;
+        manager->getUsage( &cheap, cheapUsage );
+        manager->getUsage( &dear, dearUsage );
+        ok = check( cheapUsage._evictions > dearUsage._evictions, "the cheaper consumer gives up more entries" ) && ok;
+
+        // entries dropped behind the manager's back leave room it does not know about;
+        // the next walk finds it, and nothing more is evicted than needed.
+        while( cheap.getResidentEntries() > 0 )
+            cheap.drop();
+        unsigned evictions = dearUsage._evictions;
+        for( unsigned i = 0; i < 20; ++i )
+            cheap.insert();
+        manager->getUsage( &dear, dearUsage );
+        ok = check( manager->getResidentBytes() <= budget && dearUsage._evictions - evictions <= 20,
+            "a walk picks up the entries consumers dropped on their own" ) && ok;
+
+        manager->setBudget( 0 );
+    }
+
+    // benchmark:
+    for( unsigned numThreads = 1; numThreads <= 8; numThreads *= 2 )
+    {
+        double reported, enforced;
+        {
+            TestConsumer consumer( "bench", 1.0f );
+            manager->setBudget( 1000 * ENTRY_BYTES );
+            reported = runInserts( consumer, numThreads, numOps, false );
+            manager->setBudget( 0 );
+        }
+        {
+            TestConsumer consumer( "bench", 1.0f );
+            manager->setBudget( 1000 * ENTRY_BYTES );
+            enforced = runInserts( consumer, numThreads, numOps, true );
+            manager->setBudget( 0 );
+        }
+        std::cout << numThreads << " threads: added() " << 1.0e6*reported/numOps
+            << " us/insert, enforce() each " << 1.0e6*enforced/numOps << " us/insert" << std::endl;
+    }
+
+    return ok ? 0 : 1;
+}
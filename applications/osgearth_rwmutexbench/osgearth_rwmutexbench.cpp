@@ -0,0 +1,242 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Checks and times Threading::ReadWriteMutex under contention.
+ *
+ * The reference is the event-based lock ReadWriteMutex replaced (two Events and
+ * a reader count behind a mutex). Threads take read locks on a small shared table,
+ * with one operation in a hundred (see --write-every) taking a write lock and
+ * updating it. The checks run the workload on 1 to 64 threads and require that no
+ * reader ever overlaps a writer, that writers never overlap each other, and that
+ * no update is lost. The benchmark reports the throughput of both locks at each
+ * thread count.
+ *
+ * usage: osgearth_rwmutexbench [--ops N] [--write-every N]
+ */
+
+#include <osgEarth/ThreadingUtils>
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Thread>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    /** The event-based read/write lock this check compares against. */
+    class EventReadWriteMutex
+    {
+    public:
+        EventReadWriteMutex() : _readerCount(0)
+        {
+            _noWriterEvent.set();
+            _noReadersEvent.set();
+        }
+
+        void readLock()
+        {
+            for( ; ; )
+            {
+                _noWriterEvent.wait();
+                incrementReaderCount();
+                if ( !_noWriterEvent.isSet() )
+                    decrementReaderCount();
+                else
+                    break;
+            }
+        }
+
+        void readUnlock()
+        {
+            decrementReaderCount();
+        }
+
+        void writeLock()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _lockWriterMutex );
+            _noWriterEvent.wait();
+            _noWriterEvent.reset();
+            _noReadersEvent.wait();
+        }
+
+        void writeUnlock()
+        {
+            _noWriterEvent.set();
+        }
+
+    private:
+        void incrementReaderCount()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _readerCountMutex );
+            _readerCount++;
+            _noReadersEvent.reset();
+        }
+
+        void decrementReaderCount()
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _readerCountMutex );
+            _readerCount--;
+            if ( _readerCount <= 0 )
+                _noReadersEvent.set();
+        }
+
+        int                _readerCount;
+        OpenThreads::Mutex _lockWriterMutex;
+        OpenThreads::Mutex _readerCountMutex;
+        Threading::Event   _noWriterEvent;
+        Threading::Event   _noReadersEvent;
+    };
+
+    /** What the threads share: the lock, the table it guards, and overlap counters. */
+    template<typename LOCK>
+    struct Shared
+    {
+        Shared() : _updates(0) { for( unsigned i = 0; i < 16; ++i ) _table[i] = 0; }
+
+        LOCK                _lock;
+        unsigned            _table[16];
+        unsigned            _updates;
+        OpenThreads::Atomic _readers;
+        OpenThreads::Atomic _writers;
+        OpenThreads::Atomic _overlaps;
+    };
+
+    template<typename LOCK>
+    struct Worker : public OpenThreads::Thread
+    {
+        Worker( Shared<LOCK>& shared, unsigned numOps, unsigned writeEvery, unsigned seed )
+            : _shared(shared), _numOps(numOps), _writeEvery(writeEvery), _seed(seed), _sum(0) { }
+
+        void run()
+        {
+            for( unsigned i = 0; i < _numOps; ++i )
+            {
+                if ( (i + _seed) % _writeEvery == 0 )
+                {
+                    _shared._lock.writeLock();
+                    if ( ++_shared._writers != 1 || (unsigned)_shared._readers != 0 )
+                        ++_shared._overlaps;
+                    _shared._table[i % 16]++;
+                    _shared._updates++;
+                    --_shared._writers;
+                    _shared._lock.writeUnlock();
+                }
+                else
+                {
+                    _shared._lock.readLock();
+                    ++_shared._readers;
+                    if ( (unsigned)_shared._writers != 0 )
+                        ++_shared._overlaps;
+                    for( unsigned k = 0; k < 16; ++k )
+                        _sum += _shared._table[k];
+                    --_shared._readers;
+                    _shared._lock.readUnlock();
+                }
+            }
+        }
+
+        Shared<LOCK>& _shared;
+        unsigned      _numOps;
+        unsigned      _writeEvery;
+        unsigned      _seed;
+        unsigned      _sum;
+    };
+
+    /**
+     * Runs the workload, and returns its throughput in operations per second.
+     * Sets out_ok to whether the lock kept readers and writers apart and lost
+     * no updates.
+     */
+    template<typename LOCK>
+    double run( unsigned numThreads, unsigned numOps, unsigned writeEvery, bool& out_ok )
+    {
+        Shared<LOCK> shared;
+        std::vector< Worker<LOCK>* > workers;
+        unsigned expectedUpdates = 0;
+        for( unsigned t = 0; t < numThreads; ++t )
+        {
+            workers.push_back( new Worker<LOCK>(shared, numOps, writeEvery, t) );
+            for( unsigned i = 0; i < numOps; ++i )
+                expectedUpdates += (i + t) % writeEvery == 0 ? 1 : 0;
+        }
+
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        for( unsigned t = 0; t < numThreads; ++t )
+            workers[t]->start();
+        for( unsigned t = 0; t < numThreads; ++t )
+            workers[t]->join();
+        double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+        for( unsigned t = 0; t < numThreads; ++t )
+            delete workers[t];
+
+        unsigned tableTotal = 0;
+        for( unsigned k = 0; k < 16; ++k )
+            tableTotal += shared._table[k];
+
+        out_ok = (unsigned)shared._overlaps == 0 && shared._updates == expectedUpdates && tableTotal == expectedUpdates;
+        return seconds > 0.0 ? (double)numThreads * (double)numOps / seconds : 0.0;
+    }
+
+    bool check( bool result, const std::string& what )
+    {
+        std::cout << (result ? "PASS: " : "FAIL: ") << what << std::endl;
+        return result;
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+
+    unsigned numOps = 100000;
+    arguments.read( "--ops", numOps );
+
+    unsigned writeEvery = 100;
+    arguments.read( "--write-every", writeEvery );
+    writeEvery = osg::maximum( writeEvery, 1u );
+
+    bool ok = true;
+    for( unsigned numThreads = 1; numThreads <= 64; numThreads *= 2 )
+    {
+        bool lockOk, referenceOk;
+        double ops = run<Threading::ReadWriteMutex>( numThreads, numOps, writeEvery, lockOk );
+        double referenceOps = run<EventReadWriteMutex>( numThreads, numOps, writeEvery, referenceOk );
+
+        std::cout
+            << numThreads << " threads: "
+            << (unsigned)ops << " ops/s, "
+            << (unsigned)referenceOps << " ops/s with the event-based lock" << std::endl;
+
+        std::stringstream buf;
+        buf << "readers and writers never overlap and no update is lost on " << numThreads << " threads";
+        ok = check( lockOk, buf.str() ) && ok;
+
+        if ( !referenceOk )
+            std::cout << "  (the event-based lock failed the same check)" << std::endl;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Checks and times VirtualProgram::apply().
+ *
+ * The scene is a base VirtualProgram with a number of child VirtualPrograms
+ * under it, one box each. The checks verify that the program each box is drawn
+ * with follows shader changes: a change to the base reaches every box, and a
+ * change to one child reaches only that box. The benchmark then times frames of
+ * the unchanged scene, optionally creating and deleting unrelated
+ * VirtualPrograms every frame (--churn), which must not slow anything down.
+ *
+ * usage: osgearth_shaderbench [--children N] [--frames N] [--churn]
+ */
+
+#include <osgEarth/ShaderComposition>
+#include <osg/ArgumentParser>
+#include <osg/Geode>
+#include <osg/ShapeDrawable>
+#include <osg/Timer>
+#include <osgViewer/Viewer>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    /** Records the program object each drawable was last drawn with. */
+    struct RecordProgram : public osg::Drawable::DrawCallback
+    {
+        RecordProgram() : _program(0L) { }
+
+        void drawImplementation( osg::RenderInfo& renderInfo, const osg::Drawable* drawable ) const
+        {
+            drawable->drawImplementation( renderInfo );
+            _program = renderInfo.getState()->getLastAppliedProgramObject();
+        }
+
+        mutable const osg::Program::PerContextProgram* _program;
+    };
+
+    std::string colorFunction( const std::string& name, float r, float g, float b )
+    {
+        std::stringstream buf;
+        buf << "void " << name << "( inout vec4 color ) { color.rgb *= vec3("
+            << r << ", " << g << ", " << b << "); } \n";
+        return buf.str();
+    }
+
+    typedef std::vector< osg::ref_ptr<RecordProgram> > Recorders;
+
+    /** Draws a frame and collects the program object of every box. */
+    void drawFrame( osgViewer::Viewer& viewer, const Recorders& recorders, std::vector<const void*>& out_programs )
+    {
+        viewer.frame();
+        out_programs.resize( recorders.size() );
+        for( unsigned i = 0; i < recorders.size(); ++i )
+            out_programs[i] = recorders[i]->_program;
+    }
+
+    bool check( bool result, const std::string& what )
+    {
+        std::cout << (result ? "PASS: " : "FAIL: ") << what << std::endl;
+        return result;
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+
+    unsigned numChildren = 64;
+    unsigned numFrames = 1000;
+    arguments.read( "--children", numChildren );
+    arguments.read( "--frames", numFrames );
+    bool churn = arguments.read( "--churn" );
+
+    if ( numChildren < 2 )
+        numChildren = 2;
+
+    osg::Group* root = new osg::Group();
+    VirtualProgram* base = new VirtualProgram();
+    base->setFunction( "bench_base", colorFunction("bench_base", 1, 1, 1), ShaderComp::LOCATION_FRAGMENT_POST_LIGHTING );
+    root->getOrCreateStateSet()->setAttributeAndModes( base, osg::StateAttribute::ON );
+
+    std::vector< osg::ref_ptr<VirtualProgram> > children;
+    Recorders recorders;
+    for( unsigned i = 0; i < numChildren; ++i )
+    {
+        osg::ShapeDrawable* box = new osg::ShapeDrawable( new osg::Box(osg::Vec3((float)(i % 8), (float)(i / 8), 0.0f), 0.8f) );
+        box->setUseDisplayList( false );
+        RecordProgram* recorder = new RecordProgram();
+        box->setDrawCallback( recorder );
+        recorders.push_back( recorder );
+
+        osg::Geode* geode = new osg::Geode();
+        geode->addDrawable( box );
+
+        VirtualProgram* vp = new VirtualProgram();
+        vp->setFunction( "bench_child", colorFunction("bench_child", 1, 1, 1), ShaderComp::LOCATION_FRAGMENT_PRE_LIGHTING );
+        geode->getOrCreateStateSet()->setAttributeAndModes( vp, osg::StateAttribute::ON );
+        children.push_back( vp );
+
+        root->addChild( geode );
+    }
+
+    osgViewer::Viewer viewer( arguments );
+    viewer.setThreadingModel( osgViewer::Viewer::SingleThreaded );
+    viewer.setUpViewInWindow( 10, 10, 256, 256 );
+    viewer.setSceneData( root );
+    viewer.realize();
+
+    // checks:
+    bool ok = true;
+    std::vector<const void*> before, after;
+
+    drawFrame( viewer, recorders, before );
+    drawFrame( viewer, recorders, after );
+    ok = check( before == after, "an unchanged scene draws with the same programs" ) && ok;
+
+    {
+        osg::ref_ptr<VirtualProgram> unrelated = new VirtualProgram();
+        unrelated->setFunction( "bench_unrelated", colorFunction("bench_unrelated", 0, 0, 0), ShaderComp::LOCATION_FRAGMENT_PRE_LIGHTING );
+    }
+    drawFrame( viewer, recorders, before );
+    ok = check( before == after, "an unrelated VirtualProgram changes nothing" ) && ok;
+
+    base->setShader( "bench_base", new osg::Shader(osg::Shader::FRAGMENT, colorFunction("bench_base", 1, 0, 0)) );
+    drawFrame( viewer, recorders, after );
+    bool allChanged = true;
+    for( unsigned i = 0; i < after.size(); ++i )
+        allChanged = allChanged && after[i] != before[i];
+    ok = check( allChanged, "a change to the base reaches every child" ) && ok;
+
+    children[0]->setShader( "bench_child", new osg::Shader(osg::Shader::FRAGMENT, colorFunction("bench_child", 0, 1, 0)) );
+    drawFrame( viewer, recorders, before );
+    bool onlyFirst = before[0] != after[0];
+    for( unsigned i = 1; i < before.size(); ++i )
+        onlyFirst = onlyFirst && before[i] == after[i];
+    ok = check( onlyFirst, "a change to one child reaches only that child" ) && ok;
+
+    // benchmark:
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    for( unsigned f = 0; f < numFrames && !viewer.done(); ++f )
+    {
+        if ( churn )
+        {
+            osg::ref_ptr<VirtualProgram> unrelated = new VirtualProgram();
+        }
+        viewer.frame();
+    }
+    double seconds = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+    std::cout
+        << numFrames << " frames, " << numChildren << " VirtualPrograms"
+        << (churn ? ", with churn" : "") << ": "
+        << (1000.0 * seconds / (double)numFrames) << " ms/frame" << std::endl;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,213 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Checks and times VoidFillOperator.
+ *
+ * The checks fill random heightfields with scattered voids and holes, and verify
+ * that the valid posts are untouched, that no void is left, that the filled values
+ * stay within the range of the valid data, and that a heightfield with no valid
+ * data takes the default value. The void mask must come out the same whether the
+ * voids are found by the built-in NO_DATA test, an osgTerrain::NoDataValue, or an
+ * operator the fill knows nothing about. The cost check requires filling a 65x65
+ * tile (10% scattered voids plus a 16x16 hole, four smoothing passes) to cost no
+ * more than a few times what subsampling the same tile does, since the fill runs
+ * on the same path right after it.
+ *
+ * usage: osgearth_voidfillbench [--tiles N]
+ */
+
+#include <osgEarth/HeightFieldUtils>
+#include <osgEarth/GeoData>
+#include <osgEarth/SpatialReference>
+#include <osgTerrain/ValidDataOperator>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <float.h>
+
+using namespace osgEarth;
+
+namespace
+{
+    /** NO_DATA as an operator the fill can't recognize. */
+    struct OpaqueNoData : public osgTerrain::ValidDataOperator
+    {
+        virtual bool operator()( float value ) const { return value != NO_DATA_VALUE; }
+    };
+
+    osg::HeightField* createInput( unsigned numCols, unsigned numRows, unsigned voidPercent, unsigned holeSize )
+    {
+        osg::HeightField* hf = new osg::HeightField();
+        hf->allocate( numCols, numRows );
+        for( unsigned r = 0; r < numRows; ++r )
+            for( unsigned c = 0; c < numCols; ++c )
+                hf->setHeight( c, r, (unsigned)(rand() % 100) < voidPercent ? NO_DATA_VALUE : (float)(rand() % 10000) / 7.0f );
+
+        unsigned c0 = (numCols - osg::minimum(holeSize, numCols)) / 2;
+        unsigned r0 = (numRows - osg::minimum(holeSize, numRows)) / 2;
+        for( unsigned r = r0; r < osg::minimum(r0 + holeSize, numRows); ++r )
+            for( unsigned c = c0; c < osg::minimum(c0 + holeSize, numCols); ++c )
+                hf->setHeight( c, r, NO_DATA_VALUE );
+        return hf;
+    }
+
+    /** Whether the fill kept the valid posts, left no voids, and stayed in the valid range. */
+    bool isGoodFill( const osg::HeightField* before, const osg::HeightField* after )
+    {
+        float minValid = FLT_MAX, maxValid = -FLT_MAX;
+        const osg::HeightField::HeightList& in = before->getHeightList();
+        const osg::HeightField::HeightList& out = after->getHeightList();
+        for( unsigned i = 0; i < in.size(); ++i )
+        {
+            if ( in[i] != NO_DATA_VALUE )
+            {
+                minValid = osg::minimum( minValid, in[i] );
+                maxValid = osg::maximum( maxValid, in[i] );
+            }
+        }
+
+        for( unsigned i = 0; i < in.size(); ++i )
+        {
+            if ( in[i] != NO_DATA_VALUE ? out[i] != in[i] : (out[i] < minValid || out[i] > maxValid) )
+                return false;
+        }
+        return true;
+    }
+
+    bool check( bool result, const std::string& what )
+    {
+        std::cout << (result ? "PASS: " : "FAIL: ") << what << std::endl;
+        return result;
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+
+    unsigned numTiles = 2000;
+    arguments.read( "--tiles", numTiles );
+
+    // checks:
+    bool ok = true;
+    srand( 5 );
+
+    osg::ref_ptr<VoidFillOperator> fill = new VoidFillOperator();
+    osg::ref_ptr<VoidFillOperator> fillNoData = new VoidFillOperator();
+    fillNoData->setValidDataOperator( new osgTerrain::NoDataValue(NO_DATA_VALUE) );
+    osg::ref_ptr<VoidFillOperator> fillOpaque = new VoidFillOperator();
+    fillOpaque->setValidDataOperator( new OpaqueNoData() );
+
+    bool allGood = true, allSame = true;
+    for( unsigned t = 0; t < 100; ++t )
+    {
+        osg::ref_ptr<osg::HeightField> input = createInput( 2 + rand() % 60, 2 + rand() % 60, rand() % 50, rand() % 20 );
+        osg::ref_ptr<osg::HeightField> a = new osg::HeightField( *input.get(), osg::CopyOp::DEEP_COPY_ALL );
+        osg::ref_ptr<osg::HeightField> b = new osg::HeightField( *input.get(), osg::CopyOp::DEEP_COPY_ALL );
+        osg::ref_ptr<osg::HeightField> c = new osg::HeightField( *input.get(), osg::CopyOp::DEEP_COPY_ALL );
+        (*fill)( a.get() );
+        (*fillNoData)( b.get() );
+        (*fillOpaque)( c.get() );
+
+        bool anyValid = false;
+        for( unsigned i = 0; i < input->getHeightList().size(); ++i )
+            anyValid = anyValid || input->getHeightList()[i] != NO_DATA_VALUE;
+
+        allGood = allGood && ( !anyValid || isGoodFill(input.get(), a.get()) );
+        allSame = allSame && a->getHeightList() == b->getHeightList() && a->getHeightList() == c->getHeightList();
+    }
+    ok = check( allGood, "valid posts are kept, voids are filled within the valid range" ) && ok;
+    ok = check( allSame, "the built-in NO_DATA test, NoDataValue and an opaque operator find the same voids" ) && ok;
+
+    {
+        osg::ref_ptr<osg::HeightField> empty = createInput( 17, 17, 100, 0 );
+        fill->setDefaultValue( 42.0f );
+        (*fill)( empty.get() );
+        fill->setDefaultValue( 0.0f );
+        bool allDefault = true;
+        for( unsigned i = 0; i < empty->getHeightList().size(); ++i )
+            allDefault = allDefault && empty->getHeightList()[i] == 42.0f;
+        ok = check( allDefault, "a heightfield with no valid data takes the default value" ) && ok;
+    }
+
+    {
+        osg::ref_ptr<osg::HeightField> input = createInput( 33, 33, 0, 0 );
+        input->setHeight( 3, 3, -50000.0f );
+        input->setHeight( 20, 7, 90000.0f );
+        osg::ref_ptr<VoidFillOperator> fillRange = new VoidFillOperator();
+        fillRange->setValidDataOperator( new osgTerrain::ValidRange(-15000.0f, 15000.0f) );
+        (*fillRange)( input.get() );
+        ok = check(
+            input->getHeight(3, 3) >= 0.0f && input->getHeight(3, 3) <= 15000.0f &&
+            input->getHeight(20, 7) >= 0.0f && input->getHeight(20, 7) <= 15000.0f,
+            "a ValidRange operator fills the posts outside the range" ) && ok;
+    }
+
+    // cost, against subsampling the same tile:
+    osg::ref_ptr<const SpatialReference> srs = SpatialReference::create( "wgs84" );
+    GeoExtent inputEx( srs.get(), 0.0, 0.0, 1.0, 1.0 );
+    GeoExtent outputEx( srs.get(), 0.0, 0.0, 0.5, 0.5 );
+    osg::ref_ptr<osg::HeightField> input = createInput( 65, 65, 10, 16 );
+    osg::ref_ptr<osg::HeightField> work = new osg::HeightField( *input.get(), osg::CopyOp::DEEP_COPY_ALL );
+
+    // best of a few runs, to keep the comparison steady on a busy machine.
+    double bestFill = 0.0, bestResample = 0.0;
+    for( unsigned run = 0; run < 5; ++run )
+    {
+        double copy = 0.0, fillTime = 0.0, resample = 0.0;
+        osg::Timer_t start = osg::Timer::instance()->tick();
+        for( unsigned t = 0; t < numTiles; ++t )
+            work->getHeightList() = input->getHeightList();
+        copy = osg::Timer::instance()->delta_u( start, osg::Timer::instance()->tick() );
+
+        start = osg::Timer::instance()->tick();
+        for( unsigned t = 0; t < numTiles; ++t )
+        {
+            work->getHeightList() = input->getHeightList();
+            (*fill)( work.get() );
+        }
+        fillTime = osg::Timer::instance()->delta_u( start, osg::Timer::instance()->tick() ) - copy;
+
+        osg::ref_ptr<osg::HeightField> sink;
+        start = osg::Timer::instance()->tick();
+        for( unsigned t = 0; t < numTiles; ++t )
+            sink = HeightFieldUtils::createSubSample( work.get(), inputEx, outputEx, INTERP_BILINEAR );
+        resample = osg::Timer::instance()->delta_u( start, osg::Timer::instance()->tick() );
+
+        if ( run == 0 || fillTime < bestFill )     bestFill = fillTime;
+        if ( run == 0 || resample < bestResample ) bestResample = resample;
+    }
+
+    double fillPerTile = bestFill / (double)numTiles;
+    double resamplePerTile = bestResample / (double)numTiles;
+    std::cout
+        << numTiles << " tiles of 65x65 posts: "
+        << fillPerTile << " us/tile to fill, "
+        << resamplePerTile << " us/tile to subsample (bilinear)" << std::endl;
+
+    std::stringstream buf;
+    buf << "the fill costs " << (fillPerTile / resamplePerTile) << "x a subsample (at most 4x)";
+    ok = check( fillPerTile <= 4.0 * resamplePerTile, buf.str() ) && ok;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,246 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Checks and times VirtualProgram::apply() without a graphics context.
+ *
+ * The attribute stacks are built by pushing state sets onto a bare osg::State, and
+ * apply() is called on the top VirtualProgram directly. Without a context the
+ * resolved osg::Program finds no GLSL support and does nothing, so the checks look
+ * at which program apply() resolved instead: that it holds the shaders of every
+ * VirtualProgram in the stack, that it follows shader changes and ignores unrelated
+ * programs, that plain osg::Programs in the stack are skipped, and that the stack
+ * cache drops one stack at a time when full instead of starting over. The benchmark
+ * times apply() for an unchanged stack and for two stacks taking turns.
+ *
+ * usage: osgearth_vpapplybench [--applies N]
+ */
+
+#include <osgEarth/ShaderComposition>
+#include <osg/ArgumentParser>
+#include <osg/State>
+#include <osg/StateSet>
+#include <osg/Timer>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace osgEarth;
+
+namespace
+{
+    /** A VirtualProgram that reports what its apply() resolved. */
+    class ProbeProgram : public VirtualProgram
+    {
+    public:
+        const osg::Program* getLastProgram( unsigned contextID ) const
+        {
+            const osg::ref_ptr<StackEntry>& last = _lastApplied[contextID];
+            return last.valid() ? last->_program.get() : 0L;
+        }
+
+        unsigned getNumStacks() const
+        {
+            Threading::ScopedMutexLock lock( _stackProgramMapMutex );
+            return _stackProgramMap.size();
+        }
+
+    protected:
+        virtual ~ProbeProgram() { }
+    };
+
+    std::string colorFunction( const std::string& name, float r, float g, float b )
+    {
+        std::stringstream buf;
+        buf << "void " << name << "( inout vec4 color ) { color.rgb *= vec3("
+            << r << ", " << g << ", " << b << "); } \n";
+        return buf.str();
+    }
+
+    osg::StateSet* stateSetWith( osg::StateAttribute* program )
+    {
+        osg::StateSet* ss = new osg::StateSet();
+        ss->setAttributeAndModes( program, osg::StateAttribute::ON );
+        return ss;
+    }
+
+    bool hasShader( const osg::Program* program, const osg::Shader* shader )
+    {
+        for( unsigned i = 0; program && i < program->getNumShaders(); ++i )
+            if ( program->getShader(i) == shader )
+                return true;
+        return false;
+    }
+
+    /** Pushes the state sets, applies the probe on top of them, and pops them again. */
+    const osg::Program* applyStack( osg::State& state, const std::vector<osg::StateSet*>& stack, ProbeProgram* probe )
+    {
+        for( unsigned i = 0; i < stack.size(); ++i )
+            state.pushStateSet( stack[i] );
+        probe->apply( state );
+        for( unsigned i = 0; i < stack.size(); ++i )
+            state.popStateSet();
+        return probe->getLastProgram( state.getContextID() );
+    }
+
+    bool check( bool result, const std::string& what )
+    {
+        std::cout << (result ? "PASS: " : "FAIL: ") << what << std::endl;
+        return result;
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+
+    unsigned numApplies = 1000000;
+    arguments.read( "--applies", numApplies );
+
+    osg::ref_ptr<osg::State> state = new osg::State();
+    state->setContextID( 0 );
+
+    osg::ref_ptr<VirtualProgram> base = new VirtualProgram();
+    base->setFunction( "bench_base", colorFunction("bench_base", 1, 1, 1), ShaderComp::LOCATION_FRAGMENT_POST_LIGHTING );
+
+    osg::ref_ptr<ProbeProgram> probe = new ProbeProgram();
+    probe->setFunction( "bench_child", colorFunction("bench_child", 1, 1, 1), ShaderComp::LOCATION_FRAGMENT_PRE_LIGHTING );
+
+    osg::ref_ptr<osg::StateSet> baseSS = stateSetWith( base.get() );
+    osg::ref_ptr<osg::StateSet> probeSS = stateSetWith( probe.get() );
+
+    std::vector<osg::StateSet*> stack;
+    stack.push_back( baseSS.get() );
+    stack.push_back( probeSS.get() );
+
+    // checks:
+    bool ok = true;
+
+    const osg::Program* first = applyStack( *state, stack, probe.get() );
+    ok = check(
+        hasShader(first, base->getShader("bench_base", osg::Shader::FRAGMENT)) &&
+        hasShader(first, probe->getShader("bench_child", osg::Shader::FRAGMENT)),
+        "the program holds the shaders of every VirtualProgram in the stack" ) && ok;
+
+    ok = check( applyStack(*state, stack, probe.get()) == first, "an unchanged stack resolves to the same program" ) && ok;
+
+    for( unsigned i = 0; i < 1000; ++i )
+    {
+        osg::ref_ptr<VirtualProgram> unrelated = new VirtualProgram();
+        unrelated->setFunction( "bench_unrelated", colorFunction("bench_unrelated", 0, 0, 0), ShaderComp::LOCATION_FRAGMENT_PRE_LIGHTING );
+    }
+    ok = check( applyStack(*state, stack, probe.get()) == first, "unrelated VirtualPrograms change nothing" ) && ok;
+
+    {
+        osg::ref_ptr<osg::Program> plain = new osg::Program();
+        osg::ref_ptr<osg::Shader> plainShader = new osg::Shader( osg::Shader::FRAGMENT, "void main() { }\n" );
+        plain->addShader( plainShader.get() );
+        osg::ref_ptr<osg::StateSet> plainSS = stateSetWith( plain.get() );
+
+        std::vector<osg::StateSet*> withPlain;
+        withPlain.push_back( plainSS.get() );
+        withPlain.push_back( baseSS.get() );
+        withPlain.push_back( probeSS.get() );
+        const osg::Program* program = applyStack( *state, withPlain, probe.get() );
+        ok = check(
+            hasShader(program, base->getShader("bench_base", osg::Shader::FRAGMENT)) && !hasShader(program, plainShader.get()),
+            "a plain osg::Program in the stack is skipped" ) && ok;
+    }
+
+    osg::ref_ptr<osg::Shader> red = new osg::Shader( osg::Shader::FRAGMENT, colorFunction("bench_base", 1, 0, 0) );
+    base->setShader( "bench_base", red.get() );
+    const osg::Program* changed = applyStack( *state, stack, probe.get() );
+    ok = check( changed != first && hasShader(changed, red.get()), "a change to the base reaches the program" ) && ok;
+
+    {
+        // a second context applying another stack does not disturb the first.
+        osg::ref_ptr<osg::State> state2 = new osg::State();
+        state2->setContextID( 1 );
+        std::vector<osg::StateSet*> alone;
+        alone.push_back( probeSS.get() );
+        const osg::Program* other = applyStack( *state2, alone, probe.get() );
+        ok = check(
+            other != changed && !hasShader(other, red.get()) &&
+            applyStack(*state, stack, probe.get()) == changed,
+            "each context keeps its own last stack" ) && ok;
+    }
+
+    {
+        // more distinct stacks than the cache holds; each must still resolve correctly.
+        const unsigned numStacks = 100;
+        std::vector< osg::ref_ptr<VirtualProgram> > middles;
+        std::vector< osg::ref_ptr<osg::StateSet> > middleSSs;
+        for( unsigned i = 0; i < numStacks; ++i )
+        {
+            VirtualProgram* middle = new VirtualProgram();
+            std::stringstream name;
+            name << "bench_middle" << i;
+            middle->setFunction( name.str(), colorFunction(name.str(), 1, 1, 1), ShaderComp::LOCATION_FRAGMENT_PRE_TEXTURING );
+            middles.push_back( middle );
+            middleSSs.push_back( stateSetWith(middle) );
+        }
+
+        bool allRight = true;
+        for( unsigned pass = 0; pass < 2; ++pass )
+        {
+            for( unsigned i = 0; i < numStacks; ++i )
+            {
+                std::vector<osg::StateSet*> withMiddle;
+                withMiddle.push_back( baseSS.get() );
+                withMiddle.push_back( middleSSs[i].get() );
+                withMiddle.push_back( probeSS.get() );
+
+                std::stringstream name;
+                name << "bench_middle" << i;
+                const osg::Program* program = applyStack( *state, withMiddle, probe.get() );
+                allRight = allRight &&
+                    hasShader( program, middles[i]->getShader(name.str(), osg::Shader::FRAGMENT) ) &&
+                    hasShader( program, red.get() );
+            }
+        }
+        ok = check( allRight, "stacks beyond the cache size resolve correctly" ) && ok;
+        ok = check( probe->getNumStacks() == 64, "a full stack cache drops one stack at a time" ) && ok;
+    }
+
+    // benchmark:
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    state->pushStateSet( baseSS.get() );
+    state->pushStateSet( probeSS.get() );
+    for( unsigned i = 0; i < numApplies; ++i )
+        probe->apply( *state );
+    state->popStateSet();
+    state->popStateSet();
+    double sameStack = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+    std::vector<osg::StateSet*> alone;
+    alone.push_back( probeSS.get() );
+    start = osg::Timer::instance()->tick();
+    for( unsigned i = 0; i < numApplies; ++i )
+        applyStack( *state, (i & 1) ? stack : alone, probe.get() );
+    double alternating = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
+    std::cout
+        << numApplies << " applies: "
+        << (1e9 * sameStack / (double)numApplies) << " ns/apply for an unchanged stack, "
+        << (1e9 * alternating / (double)numApplies) << " ns/apply (including the pushes) for two stacks in turn"
+        << std::endl;
+
+    return ok ? 0 : 1;
+}
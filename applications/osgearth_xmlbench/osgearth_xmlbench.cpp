@@ -0,0 +1,237 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Checks and times XmlDocument::load against the tinyxml reader it replaced.
+ *
+ * The reference parses with the bundled tinyxml and converts the result to an
+ * XmlElement tree, the way XmlDocument::load used to. The checks load random
+ * documents (nested and empty elements, attributes in either quote style,
+ * entities, character references, comments, CDATA and runs of whitespace) both
+ * ways and require identical trees. They also require that text before the root
+ * element and mismatched end tags are errors, and that end tags match their start
+ * tags regardless of case. The benchmark times both on a 400 KB document.
+ *
+ * usage: osgearth_xmlbench [--repeats N]
+ */
+
+#include <osgEarth/XmlUtils>
+#include <osgEarth/tinyxml.h>
+#include <osg/ArgumentParser>
+#include <osg/Timer>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+
+using namespace osgEarth;
+
+namespace
+{
+    std::string toLower( const std::string& in )
+    {
+        std::string out = in;
+        std::transform( out.begin(), out.end(), out.begin(), tolower );
+        return out;
+    }
+
+    /** Converts a tinyxml node the way XmlDocument::load used to. */
+    void processNode( XmlElement* parent, TiXmlNode* node )
+    {
+        XmlElement* new_element = 0;
+        switch (node->Type())
+        {
+        case TiXmlNode::TINYXML_ELEMENT:
+            {
+                TiXmlElement* element = node->ToElement();
+                XmlAttributes attrs;
+                for( TiXmlAttribute* attr = element->FirstAttribute(); attr; attr = attr->Next() )
+                    attrs[ toLower(attr->Name()) ] = attr->Value();
+                new_element = new XmlElement( toLower(element->Value()), attrs );
+                parent->getChildren().push_back( new_element );
+            }
+            break;
+        case TiXmlNode::TINYXML_TEXT:
+            parent->getChildren().push_back( new XmlText( node->ToText()->Value() ) );
+            break;
+        default:
+            break;
+        }
+
+        XmlElement* new_parent = new_element ? new_element : parent;
+        for( TiXmlNode* child = node->FirstChild(); child != 0; child = child->NextSibling() )
+            processNode( new_parent, child );
+    }
+
+    XmlDocument* loadWithTinyXml( const std::string& buffer )
+    {
+        TiXmlDocument xmlDoc;
+        xmlDoc.Parse( buffer.c_str() );
+        if ( xmlDoc.Error() || !xmlDoc.RootElement() )
+            return 0L;
+
+        XmlDocument* doc = new XmlDocument();
+        processNode( doc, xmlDoc.RootElement() );
+        return doc;
+    }
+
+    XmlDocument* load( const std::string& buffer )
+    {
+        std::stringstream in( buffer );
+        return XmlDocument::load( in );
+    }
+
+    bool same( const XmlElement* a, const XmlElement* b )
+    {
+        if ( a->getName() != b->getName() || a->getAttrs() != b->getAttrs() || a->getChildren().size() != b->getChildren().size() )
+            return false;
+
+        for( unsigned i = 0; i < a->getChildren().size(); ++i )
+        {
+            const XmlNode* ca = a->getChildren()[i].get();
+            const XmlNode* cb = b->getChildren()[i].get();
+            if ( ca->isElement() != cb->isElement() )
+                return false;
+            if ( ca->isElement() && !same( static_cast<const XmlElement*>(ca), static_cast<const XmlElement*>(cb) ) )
+                return false;
+            if ( ca->isText() && static_cast<const XmlText*>(ca)->getValue() != static_cast<const XmlText*>(cb)->getValue() )
+                return false;
+        }
+        return true;
+    }
+
+    const char* s_names[] = { "map", "Image", "elevation", "url", "options", "Profile" };
+
+    const char* s_text[] = {
+        "alpha", "Beta", "x &amp; y", "a&lt;b", "&#65;&#x42;",
+        "  spaced   out  ", "q&quot;q", "tab\there", "new\nline" };
+
+    /** Appends a random element (and its subtree) to the document. */
+    void appendElement( std::string& doc, unsigned depth )
+    {
+        const char* name = s_names[rand() % 6];
+        doc += "<";
+        doc += name;
+
+        unsigned numAttrs = rand() % 3;
+        for( unsigned i = 0; i < numAttrs; ++i )
+        {
+            std::stringstream buf;
+            char quote = rand() % 2 ? '"' : '\'';
+            buf << " a" << i << "=" << quote << s_text[rand() % 5] << quote;
+            doc += buf.str();
+        }
+
+        if ( depth > 4 || rand() % 5 == 0 )
+        {
+            doc += "/>";
+            return;
+        }
+
+        doc += ">";
+        unsigned numChildren = rand() % 5;
+        for( unsigned i = 0; i < numChildren; ++i )
+        {
+            switch( rand() % 6 )
+            {
+            case 0:
+            case 1: appendElement( doc, depth+1 ); break;
+            case 2:
+            case 3: doc += s_text[rand() % 9]; break;
+            case 4: doc += "<!-- comment -->"; break;
+            case 5: doc += "<![CDATA[ raw <b> & stuff ]]>"; break;
+            }
+            if ( rand() % 2 )
+                doc += "\n   ";
+        }
+        doc += "</";
+        doc += name;
+        doc += ">";
+    }
+
+    bool check( bool result, const std::string& what )
+    {
+        std::cout << (result ? "PASS: " : "FAIL: ") << what << std::endl;
+        return result;
+    }
+}
+
+int
+main( int argc, char** argv )
+{
+    osg::ArgumentParser arguments( &argc, argv );
+
+    unsigned numRepeats = 20;
+    arguments.read( "--repeats", numRepeats );
+
+    // checks:
+    bool ok = true;
+    srand( 3 );
+
+    unsigned numSame = 0, numDocs = 1000;
+    for( unsigned i = 0; i < numDocs; ++i )
+    {
+        std::string doc = "<?xml version=\"1.0\"?>\n<!-- leading comment -->\n";
+        appendElement( doc, 0 );
+
+        osg::ref_ptr<XmlDocument> expected = loadWithTinyXml( doc );
+        osg::ref_ptr<XmlDocument> actual = load( doc );
+        if ( expected.valid() && actual.valid() && same(actual.get(), expected.get()) )
+            ++numSame;
+    }
+    std::stringstream buf;
+    buf << numSame << " of " << numDocs << " random documents load the same as with tinyxml";
+    ok = check( numSame == numDocs, buf.str() ) && ok;
+
+    osg::ref_ptr<XmlDocument> doc = load( "junk<map/>" );
+    ok = check( !doc.valid(), "text before the root element is an error" ) && ok;
+    doc = load( "<map><a></b></map>" );
+    ok = check( !doc.valid(), "a mismatched end tag is an error" ) && ok;
+    doc = load( "<map></mapx>" );
+    ok = check( !doc.valid(), "an end tag that extends the start tag's name is an error" ) && ok;
+    doc = load( "<MAP><Image></IMAGE></map>" );
+    ok = check(
+        doc.valid() && doc->getSubElement("map") && doc->getSubElement("map")->getSubElement("image"),
+        "end tags match their start tags regardless of case" ) && ok;
+
+    // timing, on one large document:
+    srand( 9 );
+    std::string big = "<?xml version=\"1.0\"?>\n<root>";
+    while( big.size() < 400000 )
+        appendElement( big, 1 );
+    big += "</root>";
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    for( unsigned r = 0; r < numRepeats; ++r )
+        doc = load( big );
+    double loadTime = osg::Timer::instance()->delta_u( start, osg::Timer::instance()->tick() ) / (double)numRepeats;
+
+    start = osg::Timer::instance()->tick();
+    for( unsigned r = 0; r < numRepeats; ++r )
+        doc = loadWithTinyXml( big );
+    double tinyTime = osg::Timer::instance()->delta_u( start, osg::Timer::instance()->tick() ) / (double)numRepeats;
+
+    std::cout
+        << "load a " << big.size() / 1024 << " KB document: "
+        << loadTime << " us, " << tinyTime << " us with tinyxml" << std::endl;
+
+    ok = check( loadTime <= tinyTime, "loading costs no more than with tinyxml" ) && ok;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,350 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/BufferPool>
+#include <osg/Array>
+#include <OpenThreads/Thread>
+
+using namespace osgEarth;
+
+#define LC "[BufferPool] "
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // An image whose pixel buffer came from the pool, and goes back to it when the
+    // image is deleted.
+    class PooledImage : public osg::Image
+    {
+    public:
+        PooledImage( BufferPool* pool, const BufferPool::Key& key, const BufferPool::Buffer& buffer ) :
+          _pool( pool ),
+          _key( key ),
+          _buffer( buffer )
+        {
+            setImage( key._s, key._t, key._r, key._pixelFormat, key._pixelFormat, key._dataType,
+                _buffer._data, osg::Image::NO_DELETE, key._packing );
+        }
+
+    protected:
+        virtual ~PooledImage()
+        {
+            // detach the buffer (this also frees any buffer that replaced it, in case
+            // someone reallocated the image) before recycling it.
+            setImage( 0, 0, 0, getInternalTextureFormat(), getPixelFormat(), getDataType(),
+                0L, osg::Image::NO_DELETE, getPacking() );
+            _pool->release( _key, _buffer );
+        }
+
+        osg::ref_ptr<BufferPool> _pool;
+        BufferPool::Key          _key;
+        BufferPool::Buffer       _buffer;
+
+    private:
+        PooledImage( const PooledImage& );
+    };
+
+    // A heightfield whose height list came from the pool, and goes back to it when
+    // the heightfield is deleted.
+    class PooledHeightField : public osg::HeightField
+    {
+    public:
+        PooledHeightField( BufferPool* pool, const BufferPool::Key& key, const BufferPool::Buffer& buffer ) :
+          _pool( pool ),
+          _key( key )
+        {
+            if ( buffer._heights )
+            {
+                getHeightList().swap( *buffer._heights );
+                delete buffer._heights;
+            }
+            allocate( key._s, key._t );
+        }
+
+    protected:
+        virtual ~PooledHeightField()
+        {
+            // only recycle the heights if nobody else holds on to them and they
+            // still have the shape we handed out.
+            osg::FloatArray* heights = getFloatArray();
+            if ( heights && heights->referenceCount() == 1 &&
+                 getHeightList().size() == (size_t)_key._s * (size_t)_key._t )
+            {
+                BufferPool::Buffer buffer;
+                buffer._heights = new std::vector<float>();
+                buffer._heights->swap( getHeightList() );
+                buffer._size = buffer._heights->capacity() * sizeof(float);
+                _pool->release( _key, buffer );
+            }
+        }
+
+        osg::ref_ptr<BufferPool> _pool;
+        BufferPool::Key          _key;
+
+    private:
+        PooledHeightField( const PooledHeightField& );
+    };
+
+    // heightfield buffers are keyed apart from any image format
+    BufferPool::Key heightFieldKey( unsigned numColumns, unsigned numRows )
+    {
+        return BufferPool::Key( numColumns, numRows, 1, 0, GL_FLOAT, 0 );
+    }
+}
+
+//------------------------------------------------------------------------
+
+bool
+BufferPool::Key::operator < ( const Key& rhs ) const
+{
+    if ( _s != rhs._s ) return _s < rhs._s;
+    if ( _t != rhs._t ) return _t < rhs._t;
+    if ( _r != rhs._r ) return _r < rhs._r;
+    if ( _pixelFormat != rhs._pixelFormat ) return _pixelFormat < rhs._pixelFormat;
+    if ( _dataType != rhs._dataType ) return _dataType < rhs._dataType;
+    return _packing < rhs._packing;
+}
+
+//------------------------------------------------------------------------
+
+BufferPool::BufferPool( unsigned numShards ) :
+osg::Referenced( true ),
+_maxRetainedBytes( 64 * 1024 * 1024 )
+{
+    _shards.resize( numShards > 0 ? numShards : 1 );
+    for( unsigned i=0; i<_shards.size(); ++i )
+        _shards[i] = new Shard();
+}
+
+BufferPool::~BufferPool()
+{
+    clear();
+    for( unsigned i=0; i<_shards.size(); ++i )
+        delete _shards[i];
+}
+
+void
+BufferPool::setMaxRetainedBytes( size_t bytes )
+{
+    _maxRetainedBytes = bytes;
+
+    // trim each shard to its new share
+    size_t shardMax = _maxRetainedBytes / _shards.size();
+    for( unsigned i=0; i<_shards.size(); ++i )
+    {
+        Shard& s = *_shards[i];
+        Threading::ScopedMutexLock lock( s._mutex );
+        for( BufferMap::iterator b = s._buffers.begin(); b != s._buffers.end() && s._retainedBytes > shardMax; ++b )
+        {
+            while( !b->second.empty() && s._retainedBytes > shardMax )
+            {
+                s._retainedBytes -= b->second.back()._size;
+                destroy( b->second.back() );
+                b->second.pop_back();
+                s._discarded++;
+            }
+        }
+    }
+}
+
+osg::Image*
+BufferPool::createImage( int s, int t, int r, GLenum pixelFormat, GLenum dataType, int packing )
+{
+    size_t size = s > 0 && t > 0 && r > 0 ?
+        (size_t)osg::Image::computeRowWidthInBytes( s, pixelFormat, dataType, packing ) * t * r : 0;
+
+    if ( size == 0 )
+    {
+        osg::Image* image = new osg::Image();
+        image->allocateImage( s, t, r, pixelFormat, dataType, packing );
+        return image;
+    }
+
+    Key key( s, t, r, pixelFormat, dataType, packing );
+    Buffer buffer;
+    if ( !acquire(key, buffer) )
+    {
+        buffer._data = new unsigned char[size];
+        buffer._size = size;
+    }
+    return new PooledImage( this, key, buffer );
+}
+
+osg::HeightField*
+BufferPool::createHeightField( unsigned numColumns, unsigned numRows )
+{
+    if ( numColumns == 0 || numRows == 0 )
+    {
+        osg::HeightField* hf = new osg::HeightField();
+        hf->allocate( numColumns, numRows );
+        return hf;
+    }
+
+    Key key = heightFieldKey( numColumns, numRows );
+    Buffer buffer;
+    acquire( key, buffer );
+    return new PooledHeightField( this, key, buffer );
+}
+
+void
+BufferPool::clear()
+{
+    for( unsigned i=0; i<_shards.size(); ++i )
+    {
+        Shard& s = *_shards[i];
+        Threading::ScopedMutexLock lock( s._mutex );
+        for( BufferMap::iterator b = s._buffers.begin(); b != s._buffers.end(); ++b )
+        {
+            for( std::vector<Buffer>::iterator j = b->second.begin(); j != b->second.end(); ++j )
+                destroy( *j );
+        }
+        s._buffers.clear();
+        s._retainedBytes = 0;
+    }
+}
+
+BufferPoolStats
+BufferPool::getStats() const
+{
+    BufferPoolStats stats;
+    for( unsigned i=0; i<_shards.size(); ++i )
+    {
+        Shard& s = *_shards[i];
+        Threading::ScopedMutexLock lock( s._mutex );
+        stats._acquired      += s._acquired;
+        stats._reused        += s._reused;
+        stats._released      += s._released;
+        stats._discarded     += s._discarded;
+        stats._retainedBytes += s._retainedBytes;
+        for( BufferMap::const_iterator b = s._buffers.begin(); b != s._buffers.end(); ++b )
+            stats._retainedBuffers += b->second.size();
+    }
+    return stats;
+}
+
+bool
+BufferPool::acquire( const Key& key, Buffer& out_buffer )
+{
+    Shard& local = localShard();
+    {
+        Threading::ScopedMutexLock lock( local._mutex );
+        local._acquired++;
+        if ( take(local, key, out_buffer) )
+        {
+            local._reused++;
+            return true;
+        }
+    }
+
+    // nothing in our own shard; see if another thread left one behind.
+    for( unsigned i=0; i<_shards.size(); ++i )
+    {
+        Shard& s = *_shards[i];
+        if ( &s == &local )
+            continue;
+
+        bool found;
+        {
+            Threading::ScopedMutexLock lock( s._mutex );
+            found = take( s, key, out_buffer );
+        }
+        if ( found )
+        {
+            Threading::ScopedMutexLock lock( local._mutex );
+            local._reused++;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void
+BufferPool::release( const Key& key, Buffer& buffer )
+{
+    Shard& s = localShard();
+    Threading::ScopedMutexLock lock( s._mutex );
+    s._released++;
+
+    size_t shardMax = _maxRetainedBytes / _shards.size();
+    if ( buffer._size > shardMax )
+    {
+        destroy( buffer );
+        s._discarded++;
+        return;
+    }
+
+    // make room by dropping buffers of the most plentiful shape, which is the one
+    // least likely to run short.
+    while( s._retainedBytes + buffer._size > shardMax )
+    {
+        BufferMap::iterator most = s._buffers.end();
+        for( BufferMap::iterator b = s._buffers.begin(); b != s._buffers.end(); ++b )
+        {
+            if ( !b->second.empty() && (most == s._buffers.end() || b->second.size() > most->second.size()) )
+                most = b;
+        }
+        if ( most == s._buffers.end() )
+            break;
+
+        s._retainedBytes -= most->second.back()._size;
+        destroy( most->second.back() );
+        most->second.pop_back();
+        s._discarded++;
+    }
+
+    s._buffers[key].push_back( buffer );
+    s._retainedBytes += buffer._size;
+}
+
+BufferPool::Shard&
+BufferPool::localShard() const
+{
+    if ( _shards.size() == 1 )
+        return *_shards[0];
+
+    // threads not started by OpenThreads (including the main thread) share shard 0.
+    size_t id = (size_t)OpenThreads::Thread::CurrentThread();
+    unsigned h = (unsigned)(id >> 4) * 2654435761u;
+    return *_shards[ (h >> 16) % _shards.size() ];
+}
+
+bool
+BufferPool::take( Shard& s, const Key& key, Buffer& out_buffer )
+{
+    BufferMap::iterator b = s._buffers.find( key );
+    if ( b == s._buffers.end() || b->second.empty() )
+        return false;
+
+    // the most recently released buffer is the likeliest to still be in cache
+    out_buffer = b->second.back();
+    b->second.pop_back();
+    s._retainedBytes -= out_buffer._size;
+    return true;
+}
+
+void
+BufferPool::destroy( Buffer& buffer )
+{
+    delete [] buffer._data;
+    delete buffer._heights;
+    buffer._data    = 0L;
+    buffer._heights = 0L;
+    buffer._size    = 0;
+}
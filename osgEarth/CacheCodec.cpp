@@ -0,0 +1,497 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/CacheCodec>
+#include <osgEarth/Registry>
+#include <osg/Texture>
+#include <fstream>
+#include <algorithm>
+#include <string.h>
+
+using namespace osgEarth;
+
+#define LC "[CacheCodec] "
+
+const char* CacheCodec::EXTENSION = "oec";
+
+namespace
+{
+    // Header layout: magic "OEC", version, codec, endianness, 2 reserved bytes,
+    // then s, t, r, internal format, pixel format, data type, packing and
+    // payload size as little-endian 32-bit words.
+    const unsigned HEADER_SIZE = 40;
+    const unsigned char VERSION = 1;
+
+    // Upper bounds on what a header may ask decode() to allocate; anything
+    // larger is treated as a corrupt file rather than a tile.
+    const unsigned MAX_DIMENSION = 16384;
+    const unsigned long long MAX_IMAGE_BYTES = 256u * 1024u * 1024u;
+
+    enum Codec
+    {
+        CODEC_RAW = 0,
+        CODEC_QOI = 1
+    };
+
+    bool isBigEndian()
+    {
+        const unsigned short test = 1;
+        return *(const unsigned char*)&test == 0;
+    }
+
+    void putU32( std::string& buf, unsigned v )
+    {
+        buf.push_back( (char)( v        & 0xff) );
+        buf.push_back( (char)((v >> 8)  & 0xff) );
+        buf.push_back( (char)((v >> 16) & 0xff) );
+        buf.push_back( (char)((v >> 24) & 0xff) );
+    }
+
+    unsigned getU32( const unsigned char* p )
+    {
+        return (unsigned)p[0] | ((unsigned)p[1] << 8) | ((unsigned)p[2] << 16) | ((unsigned)p[3] << 24);
+    }
+
+    unsigned componentSize( GLenum dataType )
+    {
+        switch( dataType )
+        {
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT: return 2;
+        case GL_INT:
+        case GL_UNSIGNED_INT:
+        case GL_FLOAT:          return 4;
+        case GL_DOUBLE:         return 8;
+        default:                return 1;
+        }
+    }
+
+    void swapBytes( unsigned char* data, unsigned size, unsigned wordSize )
+    {
+        for( unsigned i = 0; i + wordSize <= size; i += wordSize )
+            std::reverse( data + i, data + i + wordSize );
+    }
+
+    //--------------------------------------------------------------------
+    // QOI-style encoding: each pixel is a run of the previous pixel, a reference into
+    // a 64-entry table of recently seen pixels, a small delta from the previous pixel,
+    // or a literal. See http://qoiformat.org for the description of the opcodes.
+
+    const unsigned char QOI_OP_INDEX = 0x00;
+    const unsigned char QOI_OP_DIFF  = 0x40;
+    const unsigned char QOI_OP_LUMA  = 0x80;
+    const unsigned char QOI_OP_RUN   = 0xc0;
+    const unsigned char QOI_OP_RGB   = 0xfe;
+    const unsigned char QOI_OP_RGBA  = 0xff;
+    const unsigned char QOI_MASK     = 0xc0;
+
+    struct Pixel
+    {
+        unsigned char r, g, b, a;
+        bool operator == (const Pixel& rhs) const { return r==rhs.r && g==rhs.g && b==rhs.b && a==rhs.a; }
+        unsigned hash() const { return (r*3 + g*5 + b*7 + a*11) % 64; }
+    };
+
+    void encodeQOI(const unsigned char* data, unsigned width, unsigned height,
+                   unsigned rowStride, unsigned channels, std::string& out)
+    {
+        Pixel index[64];
+        memset( index, 0, sizeof(index) );
+
+        Pixel prev = { 0, 0, 0, 255 };
+        Pixel px   = prev;
+        unsigned run = 0;
+
+        out.reserve( out.size() + width*height*channels/2 );
+
+        for( unsigned y = 0; y < height; ++y )
+        {
+            const unsigned char* ptr = data + y*rowStride;
+            for( unsigned x = 0; x < width; ++x, ptr += channels )
+            {
+                px.r = ptr[0];
+                px.g = ptr[1];
+                px.b = ptr[2];
+                px.a = channels == 4 ? ptr[3] : 255;
+
+                if ( px == prev )
+                {
+                    if ( ++run == 62 )
+                    {
+                        out.push_back( (char)(QOI_OP_RUN | (run-1)) );
+                        run = 0;
+                    }
+                    continue;
+                }
+
+                if ( run > 0 )
+                {
+                    out.push_back( (char)(QOI_OP_RUN | (run-1)) );
+                    run = 0;
+                }
+
+                unsigned h = px.hash();
+                if ( index[h] == px )
+                {
+                    out.push_back( (char)(QOI_OP_INDEX | h) );
+                }
+                else
+                {
+                    index[h] = px;
+
+                    if ( px.a == prev.a )
+                    {
+                        signed char vr = (signed char)(px.r - prev.r);
+                        signed char vg = (signed char)(px.g - prev.g);
+                        signed char vb = (signed char)(px.b - prev.b);
+                        signed char vg_r = (signed char)(vr - vg);
+                        signed char vg_b = (signed char)(vb - vg);
+
+                        if ( vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2 )
+                        {
+                            out.push_back( (char)(QOI_OP_DIFF | ((vr+2) << 4) | ((vg+2) << 2) | (vb+2)) );
+                        }
+                        else if ( vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8 )
+                        {
+                            out.push_back( (char)(QOI_OP_LUMA | (vg+32)) );
+                            out.push_back( (char)(((vg_r+8) << 4) | (vg_b+8)) );
+                        }
+                        else
+                        {
+                            out.push_back( (char)QOI_OP_RGB );
+                            out.push_back( (char)px.r );
+                            out.push_back( (char)px.g );
+                            out.push_back( (char)px.b );
+                        }
+                    }
+                    else
+                    {
+                        out.push_back( (char)QOI_OP_RGBA );
+                        out.push_back( (char)px.r );
+                        out.push_back( (char)px.g );
+                        out.push_back( (char)px.b );
+                        out.push_back( (char)px.a );
+                    }
+                }
+
+                prev = px;
+            }
+        }
+
+        if ( run > 0 )
+        {
+            out.push_back( (char)(QOI_OP_RUN | (run-1)) );
+        }
+    }
+
+    bool decodeQOI(const unsigned char* in, unsigned size, unsigned char* data,
+                   unsigned width, unsigned height, unsigned rowStride, unsigned channels)
+    {
+        Pixel index[64];
+        memset( index, 0, sizeof(index) );
+
+        Pixel px = { 0, 0, 0, 255 };
+        unsigned run = 0;
+        unsigned p = 0;
+
+        for( unsigned y = 0; y < height; ++y )
+        {
+            unsigned char* ptr = data + y*rowStride;
+            for( unsigned x = 0; x < width; ++x, ptr += channels )
+            {
+                if ( run > 0 )
+                {
+                    --run;
+                }
+                else
+                {
+                    if ( p >= size )
+                        return false;
+
+                    unsigned char b1 = in[p++];
+
+                    if ( b1 == QOI_OP_RGB )
+                    {
+                        if ( p + 3 > size ) return false;
+                        px.r = in[p++];
+                        px.g = in[p++];
+                        px.b = in[p++];
+                    }
+                    else if ( b1 == QOI_OP_RGBA )
+                    {
+                        if ( p + 4 > size ) return false;
+                        px.r = in[p++];
+                        px.g = in[p++];
+                        px.b = in[p++];
+                        px.a = in[p++];
+                    }
+                    else if ( (b1 & QOI_MASK) == QOI_OP_INDEX )
+                    {
+                        px = index[b1];
+                    }
+                    else if ( (b1 & QOI_MASK) == QOI_OP_DIFF )
+                    {
+                        px.r += ((b1 >> 4) & 0x03) - 2;
+                        px.g += ((b1 >> 2) & 0x03) - 2;
+                        px.b += ( b1       & 0x03) - 2;
+                    }
+                    else if ( (b1 & QOI_MASK) == QOI_OP_LUMA )
+                    {
+                        if ( p >= size ) return false;
+                        unsigned char b2 = in[p++];
+                        int vg = (b1 & 0x3f) - 32;
+                        px.r += vg - 8 + ((b2 >> 4) & 0x0f);
+                        px.g += vg;
+                        px.b += vg - 8 +  (b2       & 0x0f);
+                    }
+                    else // QOI_OP_RUN
+                    {
+                        run = (b1 & 0x3f);
+                    }
+
+                    index[px.hash()] = px;
+                }
+
+                ptr[0] = px.r;
+                ptr[1] = px.g;
+                ptr[2] = px.b;
+                if ( channels == 4 )
+                    ptr[3] = px.a;
+            }
+        }
+
+        return true;
+    }
+
+    bool canUseQOI( GLenum pixelFormat, GLenum dataType, unsigned r )
+    {
+        return
+            dataType == GL_UNSIGNED_BYTE &&
+            r == 1 &&
+            (pixelFormat == GL_RGB || pixelFormat == GL_RGBA);
+    }
+
+    bool canUseQOI( const osg::Image* image )
+    {
+        return canUseQOI( image->getPixelFormat(), image->getDataType(), image->r() );
+    }
+
+    // Bytes per 4x4 block of the block-compressed formats; 0 for any other format.
+    unsigned compressedBlockBytes( GLenum pixelFormat )
+    {
+        switch( pixelFormat )
+        {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+            return 8;
+        case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            return 16;
+        default:
+            return 0;
+        }
+    }
+
+    // Size of the pixel data of an image. Block-compressed images hold whole 4x4
+    // blocks, so a dimension that is not a multiple of 4 rounds up.
+    unsigned long long computeImageBytes( unsigned s, unsigned t, unsigned r, GLenum pixelFormat, GLenum dataType, unsigned packing )
+    {
+#if OSG_MIN_VERSION_REQUIRED(3,0,0)
+        return osg::Image::computeImageSizeInBytes( s, t, r, pixelFormat, dataType, packing );
+#else
+        // older OSG sizes compressed images by bits per pixel, which comes up short.
+        unsigned blockBytes = compressedBlockBytes( pixelFormat );
+        if ( blockBytes > 0 )
+            return (unsigned long long)((s+3)/4) * (unsigned long long)((t+3)/4) * r * blockBytes;
+        return (unsigned long long)osg::Image::computeRowWidthInBytes( s, pixelFormat, dataType, packing ) * t * r;
+#endif
+    }
+}
+
+//------------------------------------------------------------------------
+
+bool
+CacheCodec::encode( const osg::Image* image, std::string& out, bool compress )
+{
+    if ( !image || !image->valid() || image->isMipmap() )
+        return false;
+
+    Codec codec = compress && canUseQOI(image) ? CODEC_QOI : CODEC_RAW;
+
+    out.clear();
+    out.push_back( 'O' );
+    out.push_back( 'E' );
+    out.push_back( 'C' );
+    out.push_back( (char)VERSION );
+    out.push_back( (char)codec );
+    out.push_back( (char)(isBigEndian() ? 1 : 0) );
+    out.push_back( 0 );
+    out.push_back( 0 );
+    putU32( out, image->s() );
+    putU32( out, image->t() );
+    putU32( out, image->r() );
+    putU32( out, image->getInternalTextureFormat() );
+    putU32( out, image->getPixelFormat() );
+    putU32( out, image->getDataType() );
+    putU32( out, image->getPacking() );
+    putU32( out, 0 ); // payload size, filled in below
+
+    if ( codec == CODEC_QOI )
+    {
+        encodeQOI(
+            image->data(), image->s(), image->t(), image->getRowSizeInBytes(),
+            image->getPixelFormat() == GL_RGBA ? 4 : 3,
+            out );
+    }
+    else
+    {
+        // an image whose buffer is smaller than its pixel data calls for (e.g. a
+        // block-compressed one sized by an older allocateImage) cannot be stored.
+        unsigned long long bytes = computeImageBytes(
+            image->s(), image->t(), image->r(), image->getPixelFormat(), image->getDataType(), image->getPacking() );
+        if ( bytes == 0 || bytes > image->getTotalSizeInBytes() )
+            return false;
+        out.append( (const char*)image->data(), (size_t)bytes );
+    }
+
+    unsigned payload = out.size() - HEADER_SIZE;
+    std::string size;
+    putU32( size, payload );
+    out.replace( HEADER_SIZE-4, 4, size );
+
+    return true;
+}
+
+osg::Image*
+CacheCodec::decode( const char* data, unsigned size )
+{
+    const unsigned char* in = (const unsigned char*)data;
+
+    if ( size < HEADER_SIZE || in[0] != 'O' || in[1] != 'E' || in[2] != 'C' || in[3] != VERSION )
+        return 0L;
+
+    Codec    codec          = (Codec)in[4];
+    bool     bigEndian      = in[5] != 0;
+    unsigned s              = getU32( in+8 );
+    unsigned t              = getU32( in+12 );
+    unsigned r              = getU32( in+16 );
+    GLint    internalFormat = (GLint)getU32( in+20 );
+    GLenum   pixelFormat    = (GLenum)getU32( in+24 );
+    GLenum   dataType       = (GLenum)getU32( in+28 );
+    unsigned packing        = getU32( in+32 );
+    unsigned payload        = getU32( in+36 );
+
+    if ( payload > size - HEADER_SIZE )
+        return 0L;
+
+    if ( codec != CODEC_RAW && codec != CODEC_QOI )
+        return 0L;
+
+    // don't trust the header with an allocation until it describes a sane image.
+    if ( s == 0 || t == 0 || r == 0 || s > MAX_DIMENSION || t > MAX_DIMENSION || r > MAX_DIMENSION )
+        return 0L;
+
+    if ( packing != 1 && packing != 2 && packing != 4 && packing != 8 )
+        return 0L;
+
+    unsigned long long imageBytes = computeImageBytes( s, t, r, pixelFormat, dataType, packing );
+    if ( imageBytes == 0 || imageBytes > MAX_IMAGE_BYTES )
+        return 0L;
+
+    if ( codec == CODEC_QOI && !canUseQOI(pixelFormat, dataType, r) )
+        return 0L;
+
+    if ( codec == CODEC_RAW && payload != imageBytes )
+        return 0L;
+
+    const unsigned char* payloadData = in + HEADER_SIZE;
+
+    osg::ref_ptr<osg::Image> image;
+    if ( compressedBlockBytes(pixelFormat) > 0 )
+    {
+        // allocate whole blocks ourselves; allocateImage may size them short.
+        unsigned char* buffer = new unsigned char[(size_t)imageBytes];
+        image = new osg::Image();
+        image->setImage( s, t, r, internalFormat, pixelFormat, dataType, buffer, osg::Image::USE_NEW_DELETE, packing );
+    }
+    else
+    {
+        image = Registry::instance()->getBufferPool()->createImage( s, t, r, pixelFormat, dataType, packing );
+        image->setInternalTextureFormat( internalFormat );
+    }
+    if ( !image->valid() )
+        return 0L;
+
+    if ( codec == CODEC_QOI )
+    {
+        if ( !decodeQOI(payloadData, payload, image->data(), s, t, image->getRowSizeInBytes(), pixelFormat == GL_RGBA ? 4 : 3) )
+            return 0L;
+    }
+    else
+    {
+        memcpy( image->data(), payloadData, payload );
+
+        unsigned wordSize = componentSize( dataType );
+        if ( wordSize > 1 && bigEndian != isBigEndian() )
+            swapBytes( image->data(), payload, wordSize );
+    }
+
+    return image.release();
+}
+
+bool
+CacheCodec::writeImageFile( const osg::Image* image, const std::string& filename, bool compress )
+{
+    std::string buffer;
+    if ( !encode(image, buffer, compress) )
+        return false;
+
+    std::ofstream out( filename.c_str(), std::ios::out | std::ios::binary );
+    if ( !out.is_open() )
+        return false;
+
+    out.write( buffer.data(), buffer.size() );
+    return !out.fail();
+}
+
+osg::Image*
+CacheCodec::readImageFile( const std::string& filename )
+{
+    std::ifstream in( filename.c_str(), std::ios::in | std::ios::binary );
+    if ( !in.is_open() )
+        return 0L;
+
+    in.seekg( 0, std::ios::end );
+    std::streamoff size = in.tellg();
+    in.seekg( 0, std::ios::beg );
+    if ( size <= 0 )
+        return 0L;
+
+    std::string buffer( (size_t)size, '\0' );
+    in.read( &buffer[0], size );
+    if ( in.fail() )
+        return 0L;
+
+    osg::Image* image = decode( buffer.data(), buffer.size() );
+    if ( image )
+        image->setFileName( filename );
+    else
+        OE_WARN << LC << "Failed to decode " << filename << std::endl;
+
+    return image;
+}
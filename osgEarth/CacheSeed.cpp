@@ -188,6 +188,10 @@ CacheSeed::processKey(const MapFrame& mapf, const TileKey& key ) const
 void
 CacheSeed::cacheTile(const MapFrame& mapf, const TileKey& key ) const
 {
+    // tiles already cached for every layer (e.g. when resuming a seed) cost no more than a lookup.
+    if ( mapf.isCached( key ) )
+        return;
+
     for( ImageLayerVector::const_iterator i = mapf.imageLayers().begin(); i != mapf.imageLayers().end(); i++ )
     {
         ImageLayer* layer = i->get();
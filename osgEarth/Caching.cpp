@@ -18,11 +18,16 @@
  */
 #include <limits.h>
 #include <iomanip>
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <osgEarth/Caching>
+#include <osgEarth/CacheCodec>
 #include <osgEarth/ImageToHeightFieldConverter>
 #include <osgEarth/FileUtils>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/Registry>
 #include <osgEarth/ThreadingUtils>
 
 #include <osgDB/FileUtils>
@@ -30,7 +35,10 @@
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
 
+#include <algorithm>
+
 #include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
 
 using namespace osgEarth;
 
@@ -76,15 +84,159 @@ Cache::setHeightField( const TileKey& key, const CacheSpec& spec, const osg::Hei
 	setImage( key, spec, image.get() );
 }
 
+void
+Cache::isCached( const std::vector<TileKey>& keys, const CacheSpec& spec, std::vector<bool>& out_cached ) const
+{
+    out_cached.resize( keys.size() );
+    for( unsigned i = 0; i < keys.size(); ++i )
+        out_cached[i] = isCached( keys[i], spec );
+}
+
 //------------------------------------------------------------------------
 
 #undef  LC
 #define LC "[DiskCache] "
 
-static Threading::ReadWriteMutex s_mutex;
+static Threading::ReadWriteMutex s_mutex( "DiskCache" );
+
+namespace
+{
+    /**
+     * Determine the correct extension for a world file. Typically, world file extensions
+     * consist of the first letter of the extension, followed by the third, then the letter "w".
+     * For instance a jpg file's world file would be a jgw file.
+     */
+    std::string getWorldFileName( const std::string& filename )
+    {
+        std::string ext = osgDB::getFileExtension(filename);
+        std::string worldFileExt = "wld";
+        if (ext.size() >= 3)
+        {
+            worldFileExt[0] = ext[0];
+            worldFileExt[1] = ext[2];
+            worldFileExt[2] = 'w';
+        }
+        return osgDB::getNameLessExtension(filename) + std::string(".") + worldFileExt;
+    }
+
+    bool isWorldFile( const std::string& filename )
+    {
+        std::string ext = osgDB::getFileExtension(filename);
+        return ext == "wld" || (ext.size() == 3 && ext[2] == 'w');
+    }
+
+    /** Gets the size of a file and the later of its access and modification times. */
+    bool statFile( const std::string& filename, unsigned& out_size, time_t& out_time )
+    {
+        struct stat buf;
+        if ( ::stat( filename.c_str(), &buf ) != 0 )
+            return false;
+        out_size = (unsigned)buf.st_size;
+        out_time = std::max( buf.st_atime, buf.st_mtime );
+        return true;
+    }
+
+    /** 64-bit FNV-1a hash of a tile's filename, the key of the in-memory manifest. */
+    unsigned long long hashFilename( const std::string& filename )
+    {
+        unsigned long long hash = 14695981039346656037ULL;
+        for( std::string::const_iterator i = filename.begin(); i != filename.end(); ++i )
+        {
+            hash ^= (unsigned char)*i;
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    /** Collects the size and access time of each tile file into a cache index. */
+    template<typename INDEX, typename ENTRY>
+    struct IndexCollector
+    {
+        IndexCollector( INDEX& index ) : _index(index) { }
+        void add( const std::string& filename, const struct stat& buf )
+        {
+            ENTRY entry;
+            entry._size = (unsigned)buf.st_size;
+            entry._accessTime = std::max( buf.st_atime, buf.st_mtime );
+            _index._entries[filename] = entry;
+            _index._totalBytes += entry._size;
+        }
+        INDEX& _index;
+    };
+
+    /** Collects the filename hashes of the tile files into a manifest. */
+    template<typename TILES>
+    struct ManifestCollector
+    {
+        void add( const std::string& filename, const struct stat& )
+        {
+            _tiles.insert( hashFilename(filename) );
+        }
+        TILES _tiles;
+    };
+
+    /** Recursively passes the tile files under a folder to a collector. */
+    template<typename COLLECTOR>
+    void scanFolder( const std::string& path, COLLECTOR& collector, ProgressCallback* progress )
+    {
+        osgDB::DirectoryContents contents = osgDB::getDirectoryContents( path );
+        for( osgDB::DirectoryContents::const_iterator i = contents.begin(); i != contents.end(); ++i )
+        {
+            if ( progress && progress->isCanceled() )
+                return;
+
+            if ( *i == "." || *i == ".." )
+                continue;
+
+            // one stat per entry tells us both the type and the size.
+            std::string filename = path + std::string("/") + *i;
+            struct stat buf;
+            if ( ::stat( filename.c_str(), &buf ) != 0 )
+                continue;
+
+            if ( (buf.st_mode & S_IFMT) == S_IFDIR )
+            {
+                scanFolder( filename, collector, progress );
+            }
+            else if ( (buf.st_mode & S_IFMT) == S_IFREG && *i != "tms.xml" && !isWorldFile(*i) )
+            {
+                collector.add( filename, buf );
+            }
+        }
+    }
+
+    struct CompactTask : public TaskRequest
+    {
+        CompactTask( DiskCache* cache, bool rescan ) : _cache(cache), _rescan(rescan) { }
+        void operator()( ProgressCallback* progress ) { _cache->runCompact( _rescan, progress ); }
+        DiskCache* _cache;
+        bool       _rescan;
+    };
+
+    struct PurgeTask : public TaskRequest
+    {
+        PurgeTask( DiskCache* cache, const std::string& cacheId, time_t olderThan )
+            : _cache(cache), _cacheId(cacheId), _olderThan(olderThan) { }
+        void operator()( ProgressCallback* progress ) { _cache->runPurge( _cacheId, _olderThan, progress ); }
+        DiskCache*  _cache;
+        std::string _cacheId;
+        time_t      _olderThan;
+    };
+
+    struct ManifestTask : public TaskRequest
+    {
+        ManifestTask( DiskCache* cache, const std::string& cacheId ) : _cache(cache), _cacheId(cacheId) { }
+        void operator()( ProgressCallback* progress ) { _cache->runBuildManifest( _cacheId, progress ); }
+        DiskCache*  _cache;
+        std::string _cacheId;
+    };
+}
 
 DiskCache::DiskCache( const DiskCacheOptions& options ) :
 Cache( options ),
+_indexedBytes( 0 ),
+_compactPending( false ),
+_discovered( false ),
 _options( options )
 {
     setName( "tilecache" );
@@ -93,6 +245,9 @@ _options( options )
 
 DiskCache::DiskCache( const DiskCache& rhs, const osg::CopyOp& op ) :
 Cache( rhs, op ),
+_indexedBytes( 0 ),
+_compactPending( false ),
+_discovered( false ),
 _layerPropertiesCache( rhs._layerPropertiesCache ),
 _writeWorldFilesOverride( rhs._writeWorldFilesOverride ),
 _options( rhs._options )
@@ -100,12 +255,112 @@ _options( rhs._options )
     //NOP
 }
 
+DiskCache::~DiskCache()
+{
+    // the maintenance tasks point back at this cache. Cancel them (a running scan or
+    // removal stops at its next file) and wait for the service to retire each one,
+    // whoever else may hold on to the service.
+    MaintenanceTasks tasks;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+        tasks.swap( _maintenanceTasks );
+    }
+
+    for( MaintenanceTasks::iterator i = tasks.begin(); i != tasks.end(); ++i )
+        i->get()->cancel();
+
+    for( MaintenanceTasks::iterator i = tasks.begin(); i != tasks.end(); ++i )
+    {
+        while( !i->get()->isCompleted() )
+            OpenThreads::Thread::YieldCurrentThread();
+    }
+
+    _maintenanceService = 0L;
+}
+
 bool
 DiskCache::isCached(const osgEarth::TileKey& key, const CacheSpec& spec ) const
 {
+    std::vector<std::string> filenames( 1, getFilename(key, spec) );
+
+    std::vector<bool> cached;
+    if ( lookupManifest(spec.cacheId(), filenames, cached) )
+        return cached[0];
+
 	//Check to see if the file for this key exists
-	std::string filename = getFilename( key, spec );
-    return osgDB::fileExists(filename);
+    return osgDB::fileExists(filenames[0]);
+}
+
+void
+DiskCache::isCached( const std::vector<TileKey>& keys, const CacheSpec& spec, std::vector<bool>& out_cached ) const
+{
+    out_cached.assign( keys.size(), false );
+
+    std::vector<std::string> filenames( keys.size() );
+    for( unsigned i = 0; i < keys.size(); ++i )
+        filenames[i] = getFilename( keys[i], spec );
+
+    if ( !lookupManifest(spec.cacheId(), filenames, out_cached) )
+    {
+        for( unsigned i = 0; i < filenames.size(); ++i )
+            out_cached[i] = osgDB::fileExists( filenames[i] );
+    }
+}
+
+bool
+DiskCache::lookupManifest( const std::string& cacheId, const std::vector<std::string>& filenames, std::vector<bool>& out_cached ) const
+{
+    // the manifest relies on a directory listing, which we can't get inside an archive.
+    if ( _options.inMemoryManifest() == false || osgEarth::isZipPath(getPath()) )
+        return false;
+
+    bool build = false;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _manifestMutex );
+        ManifestState& state = _manifestStates[cacheId];
+        if ( state == MANIFEST_READY )
+        {
+            out_cached.resize( filenames.size() );
+            for( unsigned i = 0; i < filenames.size(); ++i )
+                out_cached[i] = _manifest.find( hashFilename(filenames[i]) ) != _manifest.end();
+            return true;
+        }
+
+        if ( state == MANIFEST_NONE )
+        {
+            state = MANIFEST_BUILDING;
+            build = true;
+        }
+    }
+
+    // first query for this cacheId: list its folder in the background, and answer
+    // with a stat until that's done.
+    if ( build )
+    {
+        DiskCache* self = const_cast<DiskCache*>(this);
+        self->scheduleMaintenance( new ManifestTask(self, cacheId) );
+    }
+    return false;
+}
+
+void
+DiskCache::runBuildManifest( const std::string& cacheId, ProgressCallback* progress )
+{
+    ManifestCollector<Manifest> collector;
+    scanFolder( getPath() + std::string("/") + cacheId, collector, progress );
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _manifestMutex );
+    if ( progress && progress->isCanceled() )
+    {
+        _manifestStates[cacheId] = MANIFEST_NONE;
+        return;
+    }
+
+    // setImage() has been adding to the manifest during the scan; keep those.
+    _manifest.insert( collector._tiles.begin(), collector._tiles.end() );
+    _manifestStates[cacheId] = MANIFEST_READY;
+
+    OE_DEBUG << LC << "Listed " << collector._tiles.size() << " tiles in " << cacheId << std::endl;
 }
 
 std::string
@@ -162,10 +417,16 @@ DiskCache::getImage( const TileKey& key, const CacheSpec& spec, osg::ref_ptr<con
     }
 
     {
-        Threading::ScopedReadLock lock(s_mutex);
-        out_image = osgDB::readImageFile( filename );
+        Threading::ScopedReadLock lock(s_mutex, OE_LOCK_SITE);
+        if ( spec.format() == CacheCodec::EXTENSION )
+            out_image = CacheCodec::readImageFile( filename );
+        else
+            out_image = osgDB::readImageFile( filename );
     }
 
+    if ( out_image.valid() )
+        touchIndex( spec.cacheId(), filename, false );
+
     return out_image.valid();
 }
 
@@ -195,7 +456,7 @@ DiskCache::setImage( const TileKey& key, const CacheSpec& spec, const osg::Image
 	}
 
     // serialize cache writes.
-    Threading::ScopedWriteLock lock(s_mutex);
+    Threading::ScopedWriteLock lock(s_mutex, OE_LOCK_SITE);
 
     //If the path doesn't currently exist or we can't create the path, don't cache the file
     if (!osgDB::fileExists(path) && !osgEarth::isZipPath(path) && !osgDB::makeDirectory(path))
@@ -211,21 +472,7 @@ DiskCache::setImage( const TileKey& key, const CacheSpec& spec, const osg::Image
         double minx, miny, maxx, maxy;
         key.getExtent().getBounds(minx, miny, maxx, maxy);
 
-        std::string baseFilename = osgDB::getNameLessExtension(filename);
-
-        /*
-        Determine the correct extension for the file type.  Typically, world file extensions
-        consist of the first letter of the extension, followed by the third, then the letter "w".
-        For instance a jpg file's world file would be a jgw file.
-        */
-        std::string worldFileExt = "wld";
-        if (ext.size() >= 3)
-        {
-            worldFileExt[0] = ext[0];
-            worldFileExt[1] = ext[2];
-            worldFileExt[2] = 'w';
-        }
-        std::string worldFileName = baseFilename + std::string(".") + worldFileExt;
+        std::string worldFileName = getWorldFileName(filename);
         std::ofstream worldFile;
         worldFile.open(worldFileName.c_str());
 
@@ -247,11 +494,23 @@ DiskCache::setImage( const TileKey& key, const CacheSpec& spec, const osg::Image
         worldFile.close();
     }
 
+    // the built-in codec bypasses the osgDB plugins altogether.
+    if ( ext == CacheCodec::EXTENSION )
+    {
+        if ( CacheCodec::writeImageFile(image, filename, _options.nativeCodecCompression() == true) )
+            touchIndex( spec.cacheId(), filename, true );
+        else
+            OE_WARN << LC << "Failed to write " << filename << std::endl;
+        return;
+    }
+
     bool writingJpeg = (ext == "jpg" || ext == "jpeg");
 
 	osg::ref_ptr<osgDB::ReaderWriter::Options> op = new osgDB::ReaderWriter::Options();
 	op->setOptionString(_options.imageWriterPluginOptions().value());
 
+    bool written = false;
+
 	//If we are trying to write a non RGB image to JPEG, convert it to RGB before we write it
     if ((image->getPixelFormat() != GL_RGB) && writingJpeg)
     {
@@ -259,13 +518,19 @@ DiskCache::setImage( const TileKey& key, const CacheSpec& spec, const osg::Image
 		osg::ref_ptr<osg::Image> rgb = ImageUtils::convertToRGB8( image );
 		if (rgb.valid())
 		{
-			osgDB::writeImageFile(*rgb.get(), filename, op.get());
+			written = osgDB::writeImageFile(*rgb.get(), filename, op.get());
 		}
     }
     else
     {
-        osgDB::writeImageFile(*image, filename, op.get());
+        written = osgDB::writeImageFile(*image, filename, op.get());
     }
+
+    // only account for files that actually made it to disk.
+    if ( written )
+        touchIndex( spec.cacheId(), filename, true );
+    else
+        OE_WARN << LC << "Failed to write " << filename << std::endl;
 }
 
 std::string
@@ -331,32 +596,413 @@ DiskCache::loadProperties(const std::string&           cacheId,
 	return false;
 }
 
+unsigned long long
+DiskCache::getMaxSizeBytes() const
+{
+    return (unsigned long long)_options.maxSizeMB().value() * 1048576ULL;
+}
+
+unsigned long long
+DiskCache::getIndexedSize() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+    return _indexedBytes;
+}
+
+// reads are recorded in batches of this many, so that cache hits don't line up on the index lock.
+#define TOUCH_BATCH_SIZE 128
+
+void
+DiskCache::touchIndex( const std::string& cacheId, const std::string& filename, bool written )
+{
+    if ( !written )
+    {
+        // a read only refreshes the access time, which nothing needs right away.
+        PendingTouches batch;
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _touchMutex );
+            PendingTouch touch;
+            touch._cacheId  = cacheId;
+            touch._filename = filename;
+            touch._time     = ::time(0L);
+            _touches.push_back( touch );
+            if ( _touches.size() < TOUCH_BATCH_SIZE )
+                return;
+            batch.swap( _touches );
+        }
+        flushTouches( batch );
+        return;
+    }
+
+    unsigned size = 0;
+    time_t modified;
+    if ( !statFile(filename, size, modified) )
+        return;
+
+    if ( _options.inMemoryManifest() == true )
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _manifestMutex );
+        _manifest.insert( hashFilename(filename) );
+    }
+
+    unsigned long long maxBytes = getMaxSizeBytes();
+    bool needsCompact = false;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+
+        CacheIndex& index = _index[cacheId];
+        IndexEntry& entry = index._entries[filename];
+        index._totalBytes = index._totalBytes - entry._size + size;
+        _indexedBytes     = _indexedBytes - entry._size + size;
+        entry._size = size;
+        entry._accessTime = ::time(0L);
+
+        // a new cacheId needs a folder scan before the quota is meaningful.
+        if ( maxBytes > 0 && !_compactPending && (!_discovered || !index._scanned || _indexedBytes > maxBytes) )
+        {
+            _compactPending = true;
+            needsCompact = true;
+        }
+    }
+
+    if ( needsCompact )
+    {
+        scheduleMaintenance( new CompactTask(this, false) );
+    }
+}
+
+void
+DiskCache::flushTouches( PendingTouches& touches )
+{
+    unsigned long long maxBytes = getMaxSizeBytes();
+    bool needsCompact = false;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+
+        for( PendingTouches::const_iterator i = touches.begin(); i != touches.end(); ++i )
+        {
+            CacheIndex& index = _index[i->_cacheId];
+            IndexEntry& entry = index._entries[i->_filename];
+            entry._accessTime = std::max( entry._accessTime, i->_time );
+
+            if ( maxBytes > 0 && !_compactPending && (!_discovered || !index._scanned) )
+            {
+                _compactPending = true;
+                needsCompact = true;
+            }
+        }
+    }
+    touches.clear();
+
+    if ( needsCompact )
+    {
+        scheduleMaintenance( new CompactTask(this, false) );
+    }
+}
+
+void
+DiskCache::flushTouches()
+{
+    PendingTouches batch;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _touchMutex );
+        batch.swap( _touches );
+    }
+    if ( !batch.empty() )
+        flushTouches( batch );
+}
+
+void
+DiskCache::scanIndex( const std::string& cacheId, ProgressCallback* progress ) const
+{
+    time_t scanStart = ::time(0L);
+
+    CacheIndex scanned;
+    IndexCollector<CacheIndex,IndexEntry> collector( scanned );
+    scanFolder( getPath() + std::string("/") + cacheId, collector, progress );
+    if ( progress && progress->isCanceled() )
+        return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+    CacheIndex& index = _index[cacheId];
+
+    // preserve access times recorded in this session, and any tiles written during the scan.
+    for( CacheIndex::Entries::const_iterator i = index._entries.begin(); i != index._entries.end(); ++i )
+    {
+        CacheIndex::Entries::iterator s = scanned._entries.find( i->first );
+        if ( s != scanned._entries.end() )
+        {
+            s->second._accessTime = std::max( s->second._accessTime, i->second._accessTime );
+        }
+        else if ( i->second._accessTime >= scanStart && i->second._size > 0 )
+        {
+            scanned._entries[i->first] = i->second;
+            scanned._totalBytes += i->second._size;
+        }
+    }
+
+    index._entries.swap( scanned._entries );
+    _indexedBytes = _indexedBytes - index._totalBytes + scanned._totalBytes;
+    index._totalBytes = scanned._totalBytes;
+    index._scanned = true;
+
+    OE_DEBUG << LC << "Indexed " << index._entries.size() << " tiles (" 
+        << index._totalBytes << " bytes) in " << cacheId << std::endl;
+}
+
+void
+DiskCache::trimIndex( ProgressCallback* progress )
+{
+    unsigned long long maxBytes = getMaxSizeBytes();
+    if ( maxBytes == 0 )
+        return;
+
+    // evict by the latest access times.
+    flushTouches();
+
+    std::vector<std::string> victims;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+
+        unsigned long long total = _indexedBytes;
+
+        if ( total <= maxBytes )
+            return;
+
+        // evict down to 90% of the quota so that we don't compact again on the next write.
+        unsigned long long target = maxBytes - maxBytes/10;
+
+        typedef std::pair<CacheIndex*, CacheIndex::Entries::iterator> IndexRef;
+        typedef std::multimap<time_t, IndexRef> LRU;
+        LRU lru;
+        for( CacheIndexMap::iterator i = _index.begin(); i != _index.end(); ++i )
+            for( CacheIndex::Entries::iterator e = i->second._entries.begin(); e != i->second._entries.end(); ++e )
+                lru.insert( std::make_pair(e->second._accessTime, IndexRef(&i->second, e)) );
+
+        for( LRU::iterator i = lru.begin(); i != lru.end() && total > target; ++i )
+        {
+            CacheIndex* index = i->second.first;
+            CacheIndex::Entries::iterator e = i->second.second;
+            victims.push_back( e->first );
+            total -= e->second._size;
+            index->_totalBytes -= e->second._size;
+            _indexedBytes -= e->second._size;
+            index->_entries.erase( e );
+        }
+    }
+
+    OE_INFO << LC << "Evicting " << victims.size() << " tiles to stay within " 
+        << _options.maxSizeMB().value() << " MB" << std::endl;
+
+    removeFiles( victims, progress );
+}
+
+void
+DiskCache::removeFiles( const std::vector<std::string>& filenames, ProgressCallback* progress )
+{
+    // forget them first; a tile that survives a canceled removal is merely re-fetched.
+    if ( _options.inMemoryManifest() == true )
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _manifestMutex );
+        for( std::vector<std::string>::const_iterator i = filenames.begin(); i != filenames.end(); ++i )
+            _manifest.erase( hashFilename(*i) );
+    }
+
+    for( std::vector<std::string>::const_iterator i = filenames.begin(); i != filenames.end(); ++i )
+    {
+        if ( progress && progress->isCanceled() )
+            return;
+
+        Threading::ScopedWriteLock lock(s_mutex, OE_LOCK_SITE);
+        ::remove( i->c_str() );
+
+        std::string worldFileName = getWorldFileName( *i );
+        if ( osgDB::fileExists(worldFileName) )
+            ::remove( worldFileName.c_str() );
+    }
+}
+
+void
+DiskCache::scheduleMaintenance( TaskRequest* task )
+{
+    osg::ref_ptr<TaskRequest> request = task;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+        if ( !_maintenanceService.valid() )
+            _maintenanceService = new TaskService( "DiskCache maintenance", 1 );
+
+        // remember the task so the destructor can cancel it, forgetting the finished ones.
+        for( MaintenanceTasks::iterator i = _maintenanceTasks.begin(); i != _maintenanceTasks.end(); )
+        {
+            if ( i->get()->isCompleted() )
+                i = _maintenanceTasks.erase( i );
+            else
+                ++i;
+        }
+        _maintenanceTasks.push_back( request );
+    }
+    _maintenanceService->add( request.get() );
+}
+
+void
+DiskCache::runCompact( bool rescan, ProgressCallback* progress )
+{
+    std::vector<std::string> cacheIds;
+    bool discover;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+        discover = rescan || !_discovered;
+        for( CacheIndexMap::const_iterator i = _index.begin(); i != _index.end(); ++i )
+            if ( rescan || !i->second._scanned )
+                cacheIds.push_back( i->first );
+    }
+
+    if ( discover )
+    {
+        // find the cacheIds already on disk, i.e. any folder containing a TMS file.
+        std::string path = getPath();
+        osgDB::DirectoryContents contents = osgDB::getDirectoryContents( path );
+        for( osgDB::DirectoryContents::const_iterator i = contents.begin(); i != contents.end(); ++i )
+        {
+            if ( *i != "." && *i != ".." && 
+                 osgDB::fileExists( getTMSPath(*i) ) &&
+                 std::find( cacheIds.begin(), cacheIds.end(), *i ) == cacheIds.end() )
+            {
+                cacheIds.push_back( *i );
+            }
+        }
+    }
+
+    for( std::vector<std::string>::const_iterator i = cacheIds.begin(); i != cacheIds.end(); ++i )
+    {
+        if ( progress && progress->isCanceled() )
+            break;
+        scanIndex( *i, progress );
+    }
+
+    if ( !progress || !progress->isCanceled() )
+    {
+        trimIndex( progress );
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+    if ( discover )
+        _discovered = true;
+    _compactPending = false;
+}
+
+void
+DiskCache::runPurge( const std::string& cacheId, time_t olderThan, ProgressCallback* progress )
+{
+    bool scanned;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+        scanned = _index[cacheId]._scanned;
+    }
+
+    if ( !scanned )
+        scanIndex( cacheId, progress );
+
+    if ( progress && progress->isCanceled() )
+        return;
+
+    // purge by the latest access times.
+    flushTouches();
+
+    std::vector<std::string> victims;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+        CacheIndex& index = _index[cacheId];
+        for( CacheIndex::Entries::iterator i = index._entries.begin(); i != index._entries.end(); )
+        {
+            if ( olderThan <= 0 || i->second._accessTime < olderThan )
+            {
+                victims.push_back( i->first );
+                index._totalBytes -= i->second._size;
+                _indexedBytes -= i->second._size;
+                index._entries.erase( i++ );
+            }
+            else ++i;
+        }
+    }
+
+    OE_INFO << LC << "Purging " << victims.size() << " tiles from " << cacheId << std::endl;
+
+    removeFiles( victims, progress );
+}
+
+bool
+DiskCache::compact( bool async )
+{
+    if ( async )
+    {
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _indexMutex );
+            if ( _compactPending )
+                return true;
+            _compactPending = true;
+        }
+        scheduleMaintenance( new CompactTask(this, true) );
+    }
+    else
+    {
+        runCompact( true, 0L );
+    }
+    return true;
+}
+
+bool
+DiskCache::purge( const std::string& cacheId, int olderThan, bool async )
+{
+    if ( async )
+        scheduleMaintenance( new PurgeTask(this, cacheId, (time_t)olderThan) );
+    else
+        runPurge( cacheId, (time_t)olderThan, 0L );
+    return true;
+}
+
 //------------------------------------------------------------------------
 
 #undef  LC
 #define LC "[MemCache] "
 
-MemCache::MemCache( int maxSize ):
-_maxNumTilesInCache( maxSize )
+namespace
+{
+    // Only stripe the lock for caches with enough entries to spread the keys
+    // out; the capacity itself applies to the cache as a whole.
+    unsigned numShardsFor( int maxSize )
+    {
+        return osg::clampBetween( maxSize/64, 1, 8 );
+    }
+}
+
+// Entries are weighed in bytes, and the tile limit is an entry limit, so the
+// weight itself is left unbounded; the ResidencyManager enforces the budget.
+MemCache::MemCache( int maxSize, const std::string& residencyName, float residencyCost ):
+_objects( ~0u, numShardsFor(maxSize) ),
+_residency( _objects, residencyName, residencyCost )
 {
     setName( "mem" );
+    _objects.setMaxEntries( osg::maximum(maxSize, 1) );
 }
 
 MemCache::MemCache( const MemCache& rhs, const osg::CopyOp& op ) :
-_maxNumTilesInCache( rhs._maxNumTilesInCache )
+_objects( ~0u, numShardsFor(rhs._objects.getMaxEntries()) ),
+_residency( _objects, rhs._residency.getResidencyName(), rhs._residency.getResidencyCost() )
 {
+    _objects.setMaxEntries( rhs._objects.getMaxEntries() );
 }
 
 unsigned int
 MemCache::getMaxNumTilesInCache() const
 {
-	return _maxNumTilesInCache;
+	return _objects.getMaxEntries();
 }
 
 void
 MemCache::setMaxNumTilesInCache(unsigned int max)
 {
-	_maxNumTilesInCache = max;
+	_objects.setMaxEntries( osg::maximum(max, 1u) );
 }
 
 bool
@@ -374,7 +1020,7 @@ MemCache::getImage(const osgEarth::TileKey& key, const CacheSpec& spec, osg::ref
 void
 MemCache::setImage(const osgEarth::TileKey& key, const CacheSpec& spec, const osg::Image* image)
 {
-    setObject( key, spec, ImageUtils::cloneImage(image) );
+    setObject( key, spec, image );
 }
 
 bool
@@ -392,19 +1038,14 @@ MemCache::getHeightField( const TileKey& key,const CacheSpec& spec, osg::ref_ptr
 void
 MemCache::setHeightField( const TileKey& key, const CacheSpec& spec, const osg::HeightField* hf)
 {
-    setObject( key, spec, new osg::HeightField(*hf) );
+    setObject( key, spec, hf );
 }
 
 bool
 MemCache::purge( const std::string& cacheId, int olderThan, bool async )
 {
-    //TODO: can this be a ReadWriteLock instead?
-
     // MemCache does not support timestamps or async, so just clear it out altogether.
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-
     // MemCache does not support cacheId...
-    _keyToIterMap.clear();
     _objects.clear();
 
     return true;
@@ -413,57 +1054,37 @@ MemCache::purge( const std::string& cacheId, int olderThan, bool async )
 bool
 MemCache::getObject( const TileKey& key, const CacheSpec& spec, osg::ref_ptr<const osg::Object>& output )
 {
-  OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-
-  std::string id = key.str() + spec.cacheId();
-  KeyToIteratorMap::iterator itr = _keyToIterMap.find(id);
-  if (itr != _keyToIterMap.end())
-  {
-    CachedObject entry = *itr->second;
-    _objects.erase(itr->second);
-    _objects.push_front(entry);
-    itr->second = _objects.begin();
-    output = itr->second->_object.get();
-    return output.valid();
-  }
-  return false;
+    ObjectCache::Record rec = _objects.get( key.str() + spec.cacheId() );
+    if ( rec.valid() )
+    {
+        output = rec.value().get();
+        return output.valid();
+    }
+    return false;
 }
 
 void
 MemCache::setObject( const TileKey& key, const CacheSpec& spec, const osg::Object* referenced )
 {
-  OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
-
-  std::string id = key.str() + spec.cacheId();
-
-  _objects.push_front(CachedObject());
-  CachedObject& entry = _objects.front();
-
-  //CachedObject entry;
-  entry._object = referenced;
-  entry._key = id;
-  //_objects.push_front(entry);
+    size_t bytes = ResidencyManager::getSizeInBytes( referenced );
+    _objects.insert( key.str() + spec.cacheId(), referenced, bytes );
 
-  _keyToIterMap[id] = _objects.begin();
-
-  if (_objects.size() > _maxNumTilesInCache)
-  {
-      _keyToIterMap.erase( _objects.back()._key );
-      _objects.pop_back();
-    //CachedObject toRemove = _objects.back();
-    //_objects.pop_back();
-    //_keyToIterMap.erase(toRemove._key);
-  }
+    // done outside the cache's locks, since the manager may evict from any cache
+    Registry::instance()->getResidencyManager()->added( bytes );
 }
 
 bool
 MemCache::isCached(const osgEarth::TileKey& key, const CacheSpec& spec) const
 {
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( const_cast<MemCache*>(this)->_mutex);
-    std::string id = key.str() + spec.cacheId();
-    return _keyToIterMap.find(id) != _keyToIterMap.end();
-	//osg::ref_ptr<osg::Image> image = getImage(key,spec);
-	//return image.valid();
+    return _objects.contains( key.str() + spec.cacheId() );
+}
+
+void
+MemCache::isCached( const std::vector<TileKey>& keys, const CacheSpec& spec, std::vector<bool>& out_cached ) const
+{
+    out_cached.resize( keys.size() );
+    for( unsigned i = 0; i < keys.size(); ++i )
+        out_cached[i] = _objects.contains( keys[i].str() + spec.cacheId() );
 }
 
 //------------------------------------------------------------------------
@@ -509,6 +1130,389 @@ TMSCache::getFilename( const TileKey& key,const CacheSpec& spec ) const
 
 //------------------------------------------------------------------------
 
+#undef  LC
+#define LC "[WriteBehindCache] "
+
+namespace
+{
+    // maximum number of tiles a writer thread commits per wakeup.
+    const unsigned MAX_WRITE_BATCH = 16;
+
+    struct WriteBehindThread : public OpenThreads::Thread
+    {
+        WriteBehindThread( WriteBehindCache* cache ) : _cache(cache) { }
+        void run() { while( _cache->writeNextBatch() ); }
+        WriteBehindCache* _cache;
+    };
+
+    std::string pendingWriteId( const TileKey& key, const CacheSpec& spec )
+    {
+        return key.str() + spec.cacheId();
+    }
+}
+
+WriteBehindCache::WriteBehindCache( Cache* target, unsigned numThreads, unsigned maxQueueSizeMB ) :
+Cache( target ? target->getCacheOptions() : CacheOptions() ),
+_target( target ),
+_numThreads( osg::maximum(1u, numThreads) ),
+_maxQueuedBytes( (unsigned long long)maxQueueSizeMB * 1048576ULL ),
+_queuedBytes( 0 ),
+_done( false )
+{
+    setName( "write_behind" );
+    startThreads();
+}
+
+WriteBehindCache::WriteBehindCache( const WriteBehindCache& rhs, const osg::CopyOp& op ) :
+Cache( rhs, op ),
+_target( rhs._target.get() ),
+_numThreads( rhs._numThreads ),
+_maxQueuedBytes( rhs._maxQueuedBytes ),
+_queuedBytes( 0 ),
+_done( false )
+{
+    startThreads();
+}
+
+WriteBehindCache::~WriteBehindCache()
+{
+    stopThreads();
+}
+
+void
+WriteBehindCache::startThreads()
+{
+    if ( !_target.valid() )
+        return;
+
+    for( unsigned i=0; i<_numThreads; ++i )
+    {
+        WriteBehindThread* thread = new WriteBehindThread( this );
+        _threads.push_back( thread );
+        thread->start();
+    }
+}
+
+void
+WriteBehindCache::stopThreads()
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+        _done = true;
+        // alternative to buggy win32 broadcast (OSG pre-r10457 on windows)
+        for( unsigned i=0; i<_threads.size(); ++i )
+            _writeCond.signal();
+        _drainCond.broadcast();
+    }
+
+    // the writers drain the queue before exiting.
+    for( std::vector<OpenThreads::Thread*>::iterator i = _threads.begin(); i != _threads.end(); ++i )
+    {
+        (*i)->join();
+        delete *i;
+    }
+    _threads.clear();
+
+    if ( _queuedBytes > 0 )
+    {
+        OE_WARN << LC << "Shut down with " << _pending.size() << " unwritten tiles" << std::endl;
+    }
+}
+
+void
+WriteBehindCache::flush()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+    while( !_threads.empty() && (!_pending.empty() || !_inFlight.empty()) )
+        _drainCond.wait( &_queueMutex );
+}
+
+unsigned
+WriteBehindCache::getNumPendingWrites() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+    return _pending.size() + _inFlight.size();
+}
+
+void
+WriteBehindCache::enqueue(const TileKey&          key,
+                          const CacheSpec&        spec,
+                          const osg::Image*       image,
+                          const osg::HeightField* hf,
+                          unsigned                bytes )
+{
+    osg::ref_ptr<const osg::Image>       imageRef = image;
+    osg::ref_ptr<const osg::HeightField> hfRef    = hf;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+
+    // apply backpressure: wait for the writers to make room.
+    while( !_done && _queuedBytes > 0 && _queuedBytes + bytes > _maxQueuedBytes )
+        _drainCond.wait( &_queueMutex );
+
+    std::string id = pendingWriteId( key, spec );
+    PendingWrites::iterator i = _pending.find( id );
+    if ( i != _pending.end() )
+    {
+        // coalesce with the write already in the queue.
+        _queuedBytes -= i->second._bytes;
+    }
+    else
+    {
+        i = _pending.insert( std::make_pair(id, PendingWrite()) ).first;
+        i->second._key  = key;
+        i->second._spec = spec;
+        _order.push_back( id );
+    }
+
+    i->second._image = imageRef.get();
+    i->second._hf    = hfRef.get();
+    i->second._bytes = bytes;
+    _queuedBytes += bytes;
+
+    _writeCond.signal();
+}
+
+const WriteBehindCache::PendingWrite*
+WriteBehindCache::findPending( const TileKey& key, const CacheSpec& spec ) const
+{
+    // caller must hold the queue mutex.
+    std::string id = pendingWriteId( key, spec );
+    PendingWrites::const_iterator i = _pending.find( id );
+    if ( i != _pending.end() )
+        return &i->second;
+    i = _inFlight.find( id );
+    if ( i != _inFlight.end() )
+        return &i->second;
+    return 0L;
+}
+
+bool
+WriteBehindCache::writeNextBatch()
+{
+    std::vector<std::string> batch;
+    std::vector<PendingWrite> writes;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+
+        while( batch.empty() )
+        {
+            while( !_done && _order.empty() )
+                _writeCond.wait( &_queueMutex );
+
+            if ( _order.empty() )
+                return false; // shut down and drained.
+
+            // take the oldest writes, skipping any tile that another thread is 
+            // still writing so that writes to one tile stay in order.
+            std::list<std::string>::iterator i = _order.begin();
+            while( i != _order.end() && batch.size() < MAX_WRITE_BATCH )
+            {
+                if ( _inFlight.find(*i) != _inFlight.end() )
+                {
+                    ++i;
+                    continue;
+                }
+                PendingWrites::iterator p = _pending.find( *i );
+                _inFlight[*i] = p->second;
+                writes.push_back( p->second );
+                _pending.erase( p );
+                batch.push_back( *i );
+                i = _order.erase( i );
+            }
+
+            if ( batch.empty() )
+                _writeCond.wait( &_queueMutex );
+        }
+    }
+
+    for( std::vector<PendingWrite>::const_iterator w = writes.begin(); w != writes.end(); ++w )
+    {
+        if ( w->_image.valid() )
+            _target->setImage( w->_key, w->_spec, w->_image.get() );
+        else if ( w->_hf.valid() )
+            _target->setHeightField( w->_key, w->_spec, w->_hf.get() );
+    }
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+        for( std::vector<std::string>::const_iterator i = batch.begin(); i != batch.end(); ++i )
+        {
+            PendingWrites::iterator p = _inFlight.find( *i );
+            _queuedBytes -= p->second._bytes;
+            _inFlight.erase( p );
+        }
+
+        // wake a writer that may be waiting on a tile this batch was holding.
+        if ( !_order.empty() )
+            _writeCond.signal();
+
+        _drainCond.broadcast();
+    }
+
+    return true;
+}
+
+bool
+WriteBehindCache::getImage( const TileKey& key, const CacheSpec& spec, osg::ref_ptr<const osg::Image>& out_image )
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+        const PendingWrite* w = findPending( key, spec );
+        if ( w && w->_image.valid() )
+        {
+            out_image = w->_image.get();
+            return true;
+        }
+    }
+    return _target.valid() && _target->getImage( key, spec, out_image );
+}
+
+void
+WriteBehindCache::setImage( const TileKey& key, const CacheSpec& spec, const osg::Image* image )
+{
+    if ( !image || !_target.valid() )
+        return;
+
+    // cached images are immutable, so the queue can simply hold on to this one.
+    enqueue( key, spec, image, 0L, image->getTotalSizeInBytes() );
+}
+
+bool
+WriteBehindCache::getHeightField( const TileKey& key, const CacheSpec& spec, osg::ref_ptr<const osg::HeightField>& out_hf )
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+        const PendingWrite* w = findPending( key, spec );
+        if ( w && w->_hf.valid() )
+        {
+            out_hf = w->_hf.get();
+            return true;
+        }
+    }
+    return _target.valid() && _target->getHeightField( key, spec, out_hf );
+}
+
+void
+WriteBehindCache::setHeightField( const TileKey& key, const CacheSpec& spec, const osg::HeightField* hf )
+{
+    if ( !hf || !_target.valid() )
+        return;
+
+    // the conversion to an image happens in the target cache, on the writer thread.
+    enqueue( key, spec, 0L, hf, hf->getNumColumns() * hf->getNumRows() * sizeof(float) );
+}
+
+bool
+WriteBehindCache::isCached( const TileKey& key, const CacheSpec& spec ) const
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+        if ( findPending(key, spec) )
+            return true;
+    }
+    return _target.valid() && _target->isCached( key, spec );
+}
+
+void
+WriteBehindCache::isCached( const std::vector<TileKey>& keys, const CacheSpec& spec, std::vector<bool>& out_cached ) const
+{
+    out_cached.assign( keys.size(), false );
+
+    // answer from the queue first, and pass the rest to the target in one batch.
+    std::vector<TileKey>  remaining;
+    std::vector<unsigned> remainingIndex;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+        for( unsigned i = 0; i < keys.size(); ++i )
+        {
+            if ( findPending(keys[i], spec) )
+            {
+                out_cached[i] = true;
+            }
+            else
+            {
+                remaining.push_back( keys[i] );
+                remainingIndex.push_back( i );
+            }
+        }
+    }
+
+    if ( remaining.empty() || !_target.valid() )
+        return;
+
+    std::vector<bool> targetCached;
+    _target->isCached( remaining, spec, targetCached );
+    for( unsigned i = 0; i < remaining.size(); ++i )
+        out_cached[remainingIndex[i]] = targetCached[i];
+}
+
+const std::string&
+WriteBehindCache::getReferenceURI()
+{
+    return _target.valid() ? _target->getReferenceURI() : _refURI;
+}
+
+void
+WriteBehindCache::setReferenceURI( const std::string& value )
+{
+    _refURI = value;
+    if ( _target.valid() )
+        _target->setReferenceURI( value );
+}
+
+void
+WriteBehindCache::storeProperties( const CacheSpec& spec, const Profile* profile, unsigned int tileSize )
+{
+    if ( _target.valid() )
+        _target->storeProperties( spec, profile, tileSize );
+}
+
+bool
+WriteBehindCache::loadProperties(const std::string&           cacheId,
+                                 CacheSpec&                   out_spec,
+                                 osg::ref_ptr<const Profile>& out_profile,
+                                 unsigned int&                out_tileSize)
+{
+    return _target.valid() && _target->loadProperties( cacheId, out_spec, out_profile, out_tileSize );
+}
+
+bool
+WriteBehindCache::compact( bool async )
+{
+    if ( !async )
+        flush();
+    return _target.valid() && _target->compact( async );
+}
+
+bool
+WriteBehindCache::purge( const std::string& cacheId, int olderThan, bool async )
+{
+    // queued tiles are newer than any timestamp, so only a full purge drops them.
+    if ( olderThan <= 0 )
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _queueMutex );
+        for( std::list<std::string>::iterator i = _order.begin(); i != _order.end(); )
+        {
+            PendingWrites::iterator p = _pending.find( *i );
+            if ( p->second._spec.cacheId() == cacheId )
+            {
+                _queuedBytes -= p->second._bytes;
+                _pending.erase( p );
+                i = _order.erase( i );
+            }
+            else ++i;
+        }
+        _drainCond.broadcast();
+    }
+
+    // let in-flight writes land before purging the target.
+    flush();
+    return _target.valid() && _target->purge( cacheId, olderThan, async );
+}
+
+//------------------------------------------------------------------------
+
 #undef  LC
 #define LC "[CacheFactory] "
 #define CACHE_OPTIONS_TAG "__osgEarth::CacheOptions"
@@ -544,6 +1548,14 @@ CacheFactory::create( const CacheOptions& options)
             OE_WARN << LC << "Failed to load cache plugin for type \"" << options.getDriver() << "\"" << std::endl;
         }
     }
+
+    if ( result.valid() && options.asyncWrites() == true )
+    {
+        OE_INFO << LC << "Enabling write-behind queue with " << options.numWriteThreads().value()
+            << " threads" << std::endl;
+        result = new WriteBehindCache( result.get(), options.numWriteThreads().value(), options.writeQueueSizeMB().value() );
+    }
+
     return result.release();
 }
 
@@ -18,6 +18,7 @@
  */
 #include <osgEarth/CompositeTileSource>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/Registry>
 #include <osgDB/FileNameUtils>
 
 #define LC "[CompositeTileSource] "
@@ -27,7 +28,8 @@ using namespace osgEarth;
 //------------------------------------------------------------------------
 
 CompositeTileSourceOptions::CompositeTileSourceOptions( const TileSourceOptions& options ) :
-TileSourceOptions( options )
+TileSourceOptions( options ),
+_maxConcurrentRequests( 4 )
 {
     setDriver( "composite" );
     fromConfig( _conf );
@@ -70,6 +72,7 @@ Config
 CompositeTileSourceOptions::getConfig() const
 {
     Config conf = TileSourceOptions::getConfig();
+    conf.updateIfSet( "max_concurrent_requests", _maxConcurrentRequests );
 
     for( ComponentVector::const_iterator i = _components.begin(); i != _components.end(); ++i )
     {
@@ -92,6 +95,8 @@ CompositeTileSourceOptions::mergeConfig( const Config& conf )
 void 
 CompositeTileSourceOptions::fromConfig( const Config& conf )
 {
+    conf.getIfSet( "max_concurrent_requests", _maxConcurrentRequests );
+
     const ConfigSet& children = conf.children("image");
     for( ConfigSet::const_iterator i = children.begin(); i != children.end(); ++i )
     {
@@ -109,10 +114,6 @@ CompositeTileSourceOptions::fromConfig( const Config& conf )
 
 namespace
 {
-    // some helper types.
-    typedef std::pair< osg::ref_ptr<osg::Image>, float> ImageOpacityPair;
-    typedef std::vector<ImageOpacityPair> ImageMixVector;
-
     // same op that occurs in ImageLayer.cpp ... maybe consilidate
     struct ImageLayerPreCacheOperation : public TileSource::ImageOperation
     {
@@ -123,6 +124,77 @@ namespace
 
         ImageLayerTileProcessor _processor;
     };
+
+    // fetches one component's image, blacklisting the tile on a (non-canceled) failure.
+    // The image is shared with the component's L2 cache, so it is read-only.
+    void fetchComponent(TileSource*                     source,
+                        TileSource::ImageOperation*     op,
+                        const TileKey&                  key,
+                        ProgressCallback*               progress,
+                        osg::ref_ptr<const osg::Image>& out_image )
+    {
+        if ( !source->getImage( key, out_image, op, progress ) && (!progress || !progress->isCanceled()) )
+        {
+            OE_DEBUG << LC << "Adding tile " << key.str() << " to the blacklist" << std::endl;
+            source->getBlacklist()->add( key.getTileId() );
+        }
+    }
+
+    // collects the component images for one tile as the fetch tasks complete.
+    struct FetchGroup : public osg::Referenced
+    {
+        FetchGroup( unsigned num ) : osg::Referenced( true ), _images( num ), _done( num, false ) { }
+
+        void set( unsigned index, const osg::Image* image )
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            _images[index] = image;
+            _done[index] = true;
+            _cond.signal(); // only the tile's calling thread waits
+        }
+
+        // waits for a component's image. Returns false if the progress callback cancels the
+        // tile first. A task that completes without running yields no image.
+        bool wait( unsigned index, const TaskRequest* task, ProgressCallback* progress, osg::ref_ptr<const osg::Image>& out_image )
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            while( !_done[index] )
+            {
+                if ( progress && progress->isCanceled() )
+                    return false;
+                if ( task && task->isCompleted() )
+                    break;
+                _cond.wait( &_mutex, 50 );
+            }
+            out_image = _images[index].get();
+            _images[index] = 0L;
+            return true;
+        }
+
+        std::vector< osg::ref_ptr<const osg::Image> > _images;
+        std::vector<bool>                             _done;
+        OpenThreads::Mutex                            _mutex;
+        OpenThreads::Condition                        _cond;
+    };
+
+    struct FetchTask : public TaskRequest
+    {
+        FetchTask( FetchGroup* group, unsigned index, TileSource* source, TileSource::ImageOperation* op, const TileKey& key ) :
+            _group( group ), _index( index ), _source( source ), _op( op ), _key( key ) { }
+
+        void operator()( ProgressCallback* progress )
+        {
+            osg::ref_ptr<const osg::Image> image;
+            fetchComponent( _source.get(), _op.get(), _key, progress, image );
+            _group->set( _index, image.get() );
+        }
+
+        osg::ref_ptr<FetchGroup>                 _group;
+        unsigned                                 _index;
+        osg::ref_ptr<TileSource>                 _source;
+        osg::ref_ptr<TileSource::ImageOperation> _op;
+        TileKey                                  _key;
+    };
 }
 
 //-----------------------------------------------------------------------
@@ -163,129 +235,127 @@ _dynamic( false )
     }
 }
 
+CompositeTileSource::~CompositeTileSource()
+{
+    if ( _fetchService.valid() )
+        Registry::instance()->getTaskServiceManager()->remove( _fetchService.get() );
+}
+
 osg::Image*
 CompositeTileSource::createImage( const TileKey& key, ProgressCallback* progress )
 {
-    ImageMixVector images;
-    images.reserve( _options._components.size() );
+    if ( progress && progress->isCanceled() )
+        return 0L;
 
-    for(CompositeTileSourceOptions::ComponentVector::const_iterator i = _options._components.begin();
-        i != _options._components.end();
-        ++i )
+    // collect the components that can contribute to this key, in layer order.
+    std::vector<const ComponentState*> components;
+    components.reserve( _componentStates.size() );
+
+    for( ComponentStateVector::const_iterator i = _componentStates.begin(); i != _componentStates.end(); ++i )
     {
-        if ( progress && progress->isCanceled() )
-            return 0L;
+        // check that this source is within the level bounds:
+        if ( i->_minLevel > (int)key.getLevelOfDetail() || i->_maxLevel < (int)key.getLevelOfDetail() )
+            continue;
 
-        TileSource* source = i->_tileSourceInstance->get();
-        if ( source )
+        if ( i->_source->getBlacklist()->contains( key.getTileId() ) )
         {
+            OE_DEBUG << LC << "Tile " << key.str() << " is blacklisted, not checking" << std::endl;
+            continue;
+        }
 
-            //TODO:  This duplicates code in ImageLayer::isKeyValid.  Maybe should move that to TileSource::isKeyValid instead
-            int minLevel = 0;
-            int maxLevel = INT_MAX;
-            if (i->_imageLayerOptions->minLevel().isSet())
-            {
-                minLevel = i->_imageLayerOptions->minLevel().value();
-            }
-            else if (i->_imageLayerOptions->minLevelResolution().isSet())
-            {
-                minLevel = source->getProfile()->getLevelOfDetailForHorizResolution( i->_imageLayerOptions->minLevelResolution().value(), source->getPixelsPerTile());            
-            }
-
-            if (i->_imageLayerOptions->maxLevel().isSet())
-            {
-                maxLevel = i->_imageLayerOptions->maxLevel().value();
-            }
-            else if (i->_imageLayerOptions->maxLevelResolution().isSet())
-            {
-                maxLevel = source->getProfile()->getLevelOfDetailForHorizResolution( i->_imageLayerOptions->maxLevelResolution().value(), source->getPixelsPerTile());            
-            }
-
-
+        //Only try to get data if the source actually has data
+        if ( !i->_source->hasData( key ) )
+        {
+            OE_DEBUG << LC << "Source has no data at " << key.str() << std::endl;
+            continue;
+        }
 
+        components.push_back( &(*i) );
+    }
 
-            // check that this source is within the level bounds:
-            if (minLevel > key.getLevelOfDetail() ||
-                maxLevel < key.getLevelOfDetail() )
-            {
-                continue;
-            }
+    if ( components.size() == 0 )
+        return 0L;
 
+    // fetch the first component in this thread and hand the following ones to the fetch
+    // service, keeping at most maxConcurrent of this tile's fetches in flight. Without a
+    // fetch service, all of them are fetched here in order.
+    osg::ref_ptr<FetchGroup> group = new FetchGroup( components.size() );
+    std::vector< osg::ref_ptr<FetchTask> > tasks( components.size() );
+    unsigned window = osg::maximum( 1u, _options.maxConcurrentRequests().value() );
+    unsigned queued = _fetchService.valid() ? 1 : components.size();
 
+    // mix each image in layer order as soon as it and all the ones before it are available.
+    osg::ref_ptr<const osg::Image> result;
+    osg::ref_ptr<osg::Image>       mixed;
 
+    for( unsigned i=0; i<components.size(); ++i )
+    {
+        const ComponentState* c = components[i];
+        osg::ref_ptr<const osg::Image> image;
 
+        // slide the window: queue the components up to (window-1) past this one.
+        for( ; queued < components.size() && queued < i + window; ++queued )
+        {
+            const ComponentState* q = components[queued];
+            tasks[queued] = new FetchTask( group.get(), queued, q->_source.get(), q->_preCacheOp.get(), key );
+            _fetchService->add( tasks[queued].get() );
+        }
 
-            if ( !source->getBlacklist()->contains( key.getTileId() ) )
+        if ( tasks[i].valid() )
+        {
+            if ( !group->wait( i, tasks[i].get(), progress, image ) )
             {
-                //Only try to get data if the source actually has data
-                if ( source->hasData( key ) )
-                {
-                    osg::ref_ptr< ImageLayerPreCacheOperation > preCacheOp;
-                    if ( i->_imageLayerOptions.isSet() )
-                    {
-                        preCacheOp = new ImageLayerPreCacheOperation();
-                        preCacheOp->_processor.init( i->_imageLayerOptions.value(), true );                        
-                    }
-
-
-
-                    ImageOpacityPair imagePair(
-                        source->createImage( key, preCacheOp.get(), progress ),
-                        1.0f );
-
-                    //If the image is not valid and the progress was not cancelled, blacklist
-                    if (!imagePair.first.valid() && (!progress || !progress->isCanceled()))
-                    {
-                        //Add the tile to the blacklist
-                        OE_DEBUG << LC << "Adding tile " << key.str() << " to the blacklist" << std::endl;
-                        source->getBlacklist()->add( key.getTileId() );
-                    }
-
-                    if ( imagePair.first.valid() )
-                    {
-                        // check for opacity:
-                        imagePair.second = i->_imageLayerOptions.isSet() ? i->_imageLayerOptions->opacity().value() : 1.0f;
-
-                        images.push_back( imagePair );
-                    }
-                }
-                else
+                // the tile is no longer needed; abandon the outstanding fetches.
+                for( unsigned j=i; j<tasks.size(); ++j )
                 {
-                    OE_DEBUG << LC << "Source has no data at " << key.str() << std::endl;
+                    if ( tasks[j].valid() )
+                        tasks[j]->cancel();
                 }
+                return 0L;
             }
-            else
+        }
+        else
+        {
+            fetchComponent( c->_source.get(), c->_preCacheOp.get(), key, progress, image );
+        }
+
+        if ( progress && progress->isCanceled() )
+        {
+            for( unsigned j=i+1; j<tasks.size(); ++j )
             {
-                OE_DEBUG << LC << "Tile " << key.str() << " is blacklisted, not checking" << std::endl;
+                if ( tasks[j].valid() )
+                    tasks[j]->cancel();
             }
+            return 0L;
         }
-    }
 
-    if ( progress && progress->isCanceled() )
-    {
-        return 0L;
-    }
-    else if ( images.size() == 0 )
-    {
-        return 0L;
-    }
-    else if ( images.size() == 1 )
-    {
-        return images[0].first.release();
-    }
-    else
-    {
-        osg::Image* result = new osg::Image( *images[0].first.get() );
-        for( unsigned int i=1; i<images.size(); ++i )
+        if ( image.valid() )
         {
-            ImageOpacityPair& pair = images[i];
-            if ( pair.first.valid() )
+            if ( !result.valid() )
             {
-                ImageUtils::mix( result, pair.first.get(), pair.second );
+                result = image.get();
+            }
+            else
+            {
+                // the component images are shared; mix into a copy of the first one.
+                if ( !mixed.valid() )
+                {
+                    mixed = ImageUtils::cloneImage( result.get() );
+                    result = mixed.get();
+                }
+                ImageUtils::mix( mixed.get(), image.get(), c->_opacity );
             }
         }
-        return result;
     }
+
+    // our caller may modify the result, so copy it if it is still a component's image.
+    if ( !mixed.valid() && result.valid() )
+    {
+        mixed = ImageUtils::makeWritable( result.get() );
+    }
+    result = 0L;
+
+    return mixed.release();
 }
 
 void
@@ -293,6 +363,8 @@ CompositeTileSource::initialize( const std::string& referenceURI, const Profile*
 {
     osg::ref_ptr<const Profile> profile = overrideProfile;
 
+    _componentStates.clear();
+
     for(CompositeTileSourceOptions::ComponentVector::iterator i = _options._components.begin();
         i != _options._components.end();
         ++i)
@@ -325,13 +397,67 @@ CompositeTileSource::initialize( const std::string& referenceURI, const Profile*
 
             // gather extents
             const DataExtentList& extents = source->getDataExtents();
-            for( DataExtentList::const_iterator j = extents.begin(); j != extents.end(); ++j )
+            DataExtentList& myExtents = getDataExtents();
+            myExtents.insert( myExtents.end(), extents.begin(), extents.end() );
+
+            // compute the per-component settings once, instead of for every tile.
+            ComponentState state;
+            state._source   = source;
+            state._minLevel = 0;
+            state._maxLevel = INT_MAX;
+            state._opacity  = 1.0f;
+
+            if ( i->_imageLayerOptions.isSet() )
             {
-                getDataExtents().push_back( *j );
+                const ImageLayerOptions& layerOpt = i->_imageLayerOptions.value();
+
+                //TODO:  This duplicates code in ImageLayer::isKeyValid.  Maybe should move that to TileSource::isKeyValid instead
+                if ( source->getProfile() )
+                {
+                    if ( layerOpt.minLevel().isSet() )
+                        state._minLevel = layerOpt.minLevel().value();
+                    else if ( layerOpt.minLevelResolution().isSet() )
+                        state._minLevel = source->getProfile()->getLevelOfDetailForHorizResolution( layerOpt.minLevelResolution().value(), source->getPixelsPerTile() );
+
+                    if ( layerOpt.maxLevel().isSet() )
+                        state._maxLevel = layerOpt.maxLevel().value();
+                    else if ( layerOpt.maxLevelResolution().isSet() )
+                        state._maxLevel = source->getProfile()->getLevelOfDetailForHorizResolution( layerOpt.maxLevelResolution().value(), source->getPixelsPerTile() );
+                }
+
+                state._opacity = layerOpt.opacity().value();
+
+                ImageLayerPreCacheOperation* op = new ImageLayerPreCacheOperation();
+                op->_processor.init( layerOpt, true );
+                state._preCacheOp = op;
             }
+
+            _componentStates.push_back( state );
         }
     }
 
+    // the calling thread fetches one component of a tile itself; the service, shared by
+    // all tiles, runs the others. It is managed by the registry so its threads count
+    // against the application's total.
+    TaskServiceManager* manager = Registry::instance()->getTaskServiceManager();
+    if ( _fetchService.valid() )
+    {
+        manager->remove( _fetchService.get() );
+        _fetchService = 0L;
+    }
+
+    unsigned maxConcurrent = osg::maximum( 1u, _options.maxConcurrentRequests().value() );
+    if ( maxConcurrent > 1 && _componentStates.size() > 1 )
+    {
+        unsigned numThreads = osg::minimum( maxConcurrent, (unsigned)_componentStates.size() ) - 1;
+        _fetchService = manager->add( Registry::instance()->createUID() );
+        _fetchService->setName( "CompositeTileSource" );
+        manager->setThreadLimits( _fetchService.get(), 1, (int)numThreads );
+    }
+
+    // the extents are final now; index them on the next query.
+    dirtyDataExtents();
+
     setProfile( profile.get() );
 
     _initialized = true;
@@ -29,13 +29,93 @@ Config& emptyConfig()
     return _emptyConfig;
 }
 
+const Config::Data&
+Config::emptyData()
+{
+    static osg::ref_ptr<Data> _emptyData = new Data();
+    return *_emptyData.get();
+}
+
+Config::Data::Data( const Data& rhs ) :
+osg::Referenced( true ),
+_key         ( rhs._key ),
+_defaultValue( rhs._defaultValue ),
+_attrs       ( rhs._attrs ),
+_children    ( rhs._children ),
+_uriContext  ( rhs._uriContext ),
+_refMap      ( rhs._refMap )
+{
+    // the index points into the child list, so it cannot be copied
+    if ( !rhs._index.empty() )
+        buildIndex();
+}
+
+Config&
+Config::Data::add( const Config& conf )
+{
+    _children.push_back( conf );
+    Config& added = _children.back();
+
+    if ( !_index.empty() )
+        _index.insert( ChildIndex::value_type(conf.key(), &added) );
+    else if ( _children.size() >= INDEX_THRESHOLD )
+        buildIndex();
+
+    return added;
+}
+
+void
+Config::Data::remove( const std::string& key )
+{
+    _attrs.erase(key);
+    for(ConfigSet::iterator i = _children.begin(); i != _children.end(); ) {
+        const Config& c = *i; // const access, so the child is not un-shared
+        if ( c.key() == key )
+            i = _children.erase( i );
+        else
+            ++i;
+    }
+    _index.erase(key);
+}
+
+void
+Config::Data::buildIndex()
+{
+    _index.clear();
+    for( ConfigSet::const_iterator i = _children.begin(); i != _children.end(); ++i )
+    {
+        // insert() keeps the first child with a given key, matching Config::child()
+        _index.insert( ChildIndex::value_type(i->key(), &(*i)) );
+    }
+}
+
+bool
+Config::uriContextChanges( const URIContext& context ) const
+{
+    const Data& d = data();
+    if ( context.referrer() != d._uriContext.referrer() )
+        return true;
+
+    for( ConfigSet::const_iterator i = d._children.begin(); i != d._children.end(); i++ )
+    {
+        if ( i->uriContextChanges( context.add(i->uriContext()) ) )
+            return true;
+    }
+    return false;
+}
+
 void
 Config::setURIContext( const URIContext& context )
 {
-    _uriContext = context;
-    for( ConfigSet::iterator i = _children.begin(); i != _children.end(); i++ )
+    // avoid un-sharing the subtree when the context would not change anything
+    if ( !uriContextChanges( context ) )
+        return;
+
+    Data& d = mutableData();
+    d._uriContext = context;
+    for( ConfigSet::iterator i = d._children.begin(); i != d._children.end(); i++ )
     { 
-        i->setURIContext( context.add(i->_uriContext) );
+        i->setURIContext( context.add(i->uriContext()) );
         //URI newURI( i->uriContext(), context );
         //i->setURIContext( *newURI );
     }
@@ -44,50 +124,74 @@ Config::setURIContext( const URIContext& context )
 bool
 Config::loadXML( std::istream& in )
 {
-    osg::ref_ptr<XmlDocument> xml = XmlDocument::load( in );
-    if ( xml.valid() )
-        *this = xml->getConfig();
-    return xml.valid();
+    Config conf;
+    if ( !XmlReader::readConfig( in, conf ) )
+        return false;
+    *this = conf;
+    return true;
 }
 
-const Config&
-Config::child( const std::string& childName ) const
+const Config*
+Config::findChild( const std::string& childName ) const
 {
-    for( ConfigSet::const_iterator i = _children.begin(); i != _children.end(); i++ ) {
+    const Data& d = data();
+    if ( !d._index.empty() )
+    {
+        Data::ChildIndex::const_iterator i = d._index.find( childName );
+        return i != d._index.end() ? i->second : 0L;
+    }
+
+    for( ConfigSet::const_iterator i = d._children.begin(); i != d._children.end(); i++ ) {
         if ( i->key() == childName )
-            return *i;
+            return &(*i);
     }
-    return emptyConfig();
+    return 0L;
+}
+
+const Config&
+Config::child( const std::string& childName ) const
+{
+    const Config* c = findChild( childName );
+    return c ? *c : emptyConfig();
 }
 
 void
 Config::merge( const Config& rhs ) 
 {
-    for( Properties::const_iterator a = rhs._attrs.begin(); a != rhs._attrs.end(); ++a )
-        _attrs[ a->first ] = a->second;
+    const Data& r = rhs.data();
+    if ( r._attrs.empty() && r._children.empty() )
+        return;
+
+    // hold a reference in case rhs shares our data (e.g. merging with ourself)
+    osg::ref_ptr<Data> rhsData = rhs._data;
 
-    for( ConfigSet::const_iterator c = rhs._children.begin(); c != rhs._children.end(); ++c )
+    Properties& attrs = mutableData()._attrs;
+    for( Properties::const_iterator a = r._attrs.begin(); a != r._attrs.end(); ++a )
+        attrs[ a->first ] = a->second;
+
+    for( ConfigSet::const_iterator c = r._children.begin(); c != r._children.end(); ++c )
         addChild( *c );
 }
 
 std::string
 Config::toString( int indent ) const
 {
+    const Data& d = data();
     std::stringstream buf;
     buf << std::fixed;
     for( int i=0; i<indent; i++ ) buf << "  ";
-    buf << "{ " << (_key.empty()? "anonymous" : _key) << ": ";
-    if ( !_defaultValue.empty() ) buf << _defaultValue;
-    if ( !_attrs.empty() ) {
+    buf << "{ " << (d._key.empty()? "anonymous" : d._key) << ": ";
+    if ( !d._defaultValue.empty() ) buf << d._defaultValue;
+    if ( !d._attrs.empty() ) {
         buf << std::endl;
         for( int i=0; i<indent+1; i++ ) buf << "  ";
         buf << "attrs: [ ";
-        for( Properties::const_iterator a = _attrs.begin(); a != _attrs.end(); a++ )
+        for( Properties::const_iterator a = d._attrs.begin(); a != d._attrs.end(); a++ )
             buf << a->first << "=" << a->second << ", ";
         buf << " ]";
     }
-    if ( !_children.empty() ) {
-        for( ConfigSet::const_iterator c = _children.begin(); c != _children.end(); c++ )
+    if ( !d._children.empty() ) {
+        for( ConfigSet::const_iterator c = d._children.begin(); c != d._children.end(); c++ )
             buf << std::endl << (*c).toString( indent+1 );
     }
 
@@ -101,24 +205,32 @@ Config::toString( int indent ) const
 std::string
 Config::toHashString() const
 {
-    std::stringstream buf;
-    buf << std::fixed;
-    buf << "{" << (_key.empty()? "anonymous" : _key) << ":";
-    if ( !_defaultValue.empty() ) buf << _defaultValue;
-    if ( !_attrs.empty() ) {
-        buf << "[";
-        for( Properties::const_iterator a = _attrs.begin(); a != _attrs.end(); a++ )
-            buf << a->first << "=" << a->second << ",";
-        buf << "]";
-    }
-    if ( !_children.empty() ) {
-        for( ConfigSet::const_iterator c = _children.begin(); c != _children.end(); c++ )
-            buf << (*c).toHashString();
-    }
+    std::string buf;
+    appendHashString( buf );
+    return buf;
+}
 
-    buf << "}";
+void
+Config::appendHashString( std::string& buf ) const
+{
+    // appends to one buffer instead of building a stream per node
+    const Data& d = data();
+    buf += '{';
+    buf += d._key.empty()? "anonymous" : d._key;
+    buf += ':';
+    buf += d._defaultValue;
+    if ( !d._attrs.empty() ) {
+        buf += '[';
+        for( Properties::const_iterator a = d._attrs.begin(); a != d._attrs.end(); a++ ) {
+            buf += a->first;
+            buf += '=';
+            buf += a->second;
+            buf += ',';
+        }
+        buf += ']';
+    }
+    for( ConfigSet::const_iterator c = d._children.begin(); c != d._children.end(); c++ )
+        c->appendHashString( buf );
 
-	std::string bufStr;
-	bufStr = buf.str();
-    return bufStr;
+    buf += '}';
 }
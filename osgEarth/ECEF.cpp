@@ -25,6 +25,71 @@ using namespace osgEarth;
 
 // --------------------------------------------------------------------------
 
+namespace
+{
+    // The ellipsoid terms the conversions need, computed once per batch.
+    struct Geodesy
+    {
+        Geodesy( const osg::EllipsoidModel* em )
+        {
+            _a   = em->getRadiusEquator();
+            _b   = em->getRadiusPolar();
+            _e2  = (_a*_a - _b*_b) / (_a*_a);
+            _ep2 = (_a*_a - _b*_b) / (_b*_b);
+        }
+
+        inline void toECEF( double lon, double lat, double height, double& x, double& y, double& z ) const
+        {
+            double phi    = osg::DegreesToRadians( lat );
+            double lambda = osg::DegreesToRadians( lon );
+            double sinPhi = sin(phi), cosPhi = cos(phi);
+            double N      = _a / sqrt( 1.0 - _e2*sinPhi*sinPhi );
+            double r      = (N + height) * cosPhi;
+
+            x = r * cos(lambda);
+            y = r * sin(lambda);
+            z = (N*(1.0 - _e2) + height) * sinPhi;
+        }
+
+        inline void toGeodetic( double x, double y, double z, double& lon, double& lat, double& height ) const
+        {
+            double p = sqrt( x*x + y*y );
+
+            // Bowring: one step from the parametric latitude. The sines and cosines come
+            // straight from the coordinates, which saves four trig calls per point and
+            // also covers the polar axis (p == 0).
+            double u = z*_a, v = p*_b;
+            double r = sqrt( u*u + v*v );
+            double st = r > 0.0 ? u/r : 1.0;
+            double ct = r > 0.0 ? v/r : 0.0;
+
+            double num = z + _ep2*_b*st*st*st;
+            double den = p - _e2*_a*ct*ct*ct;
+            double q = sqrt( num*num + den*den );
+            double sinPhi = num/q, cosPhi = den/q;
+
+            // unlike p/cos(phi) - N, this form holds up near the poles.
+            height = p*cosPhi + z*sinPhi - _a*sqrt( 1.0 - _e2*sinPhi*sinPhi );
+            lon    = osg::RadiansToDegrees( atan2(y, x) );
+            lat    = osg::RadiansToDegrees( atan2(num, den) );
+        }
+
+        double _a, _b, _e2, _ep2;
+    };
+
+    // same as osg::Vec3d * osg::Matrixd
+    inline void localize( const osg::Matrixd& m, double& x, double& y, double& z )
+    {
+        double d  = 1.0/(m(0,3)*x + m(1,3)*y + m(2,3)*z + m(3,3));
+        double lx = (m(0,0)*x + m(1,0)*y + m(2,0)*z + m(3,0))*d;
+        double ly = (m(0,1)*x + m(1,1)*y + m(2,1)*z + m(3,1))*d;
+        double lz = (m(0,2)*x + m(1,2)*y + m(2,2)*z + m(3,2))*d;
+        x = lx; y = ly; z = lz;
+    }
+}
+
+// --------------------------------------------------------------------------
+
 
 osg::Matrixd
 ECEF::createInverseRefFrame( const osg::Vec3d& input )
@@ -79,18 +144,126 @@ ECEF::transformAndLocalize(const osg::Vec3d&       input,
 }
 
 
-void
+bool
 ECEF::transformAndLocalize(const std::vector<osg::Vec3d>& input,
                            osg::Vec3Array*                output,
                            const SpatialReference*        srs,
                            const osg::Matrixd&            world2local )
 {
-    output->reserve( output->size() + input.size() );
-    for( std::vector<osg::Vec3d>::const_iterator i = input.begin(); i != input.end(); ++i )
+    if ( input.size() == 0 )
+        return true;
+
+    const SpatialReference* geoSRS = srs->getGeographicSRS();
+
+    // bring the points to lat/long in one batch if necessary. The batch fails as a
+    // whole if any one point fails, so then try them one at a time to find out.
+    std::vector<osg::Vec3d> geodetic;
+    const osg::Vec3d* points = &input[0];
+    if ( !srs->isGeographic() )
+    {
+        geodetic = input;
+        if ( !srs->transformPoints( geoSRS, geodetic, 0L, false ) )
+        {
+            for( unsigned i=0; i<input.size(); ++i )
+            {
+                if ( !srs->transform( input[i], geoSRS, geodetic[i] ) )
+                {
+                    OE_WARN << LC << "Failed to transform point " << i << " of " << input.size()
+                        << " from " << srs->getName() << " to lat/long" << std::endl;
+                    return false;
+                }
+            }
+        }
+        points = &geodetic[0];
+    }
+
+    Geodesy geodesy( geoSRS->getEllipsoid() );
+    bool    needsLocalize = !world2local.isIdentity();
+
+    unsigned base = output->size();
+    output->resize( base + input.size() );
+
+    for( unsigned i=0; i<input.size(); ++i )
+    {
+        double x, y, z;
+        geodesy.toECEF( points[i].x(), points[i].y(), points[i].z(), x, y, z );
+        if ( needsLocalize )
+            localize( world2local, x, y, z );
+        (*output)[base+i].set( x, y, z );
+    }
+
+    return true;
+}
+
+void
+ECEF::geodeticToECEF(const osg::EllipsoidModel* ellipsoid,
+                     const osg::Vec3d*          input,
+                     osg::Vec3d*                output,
+                     unsigned                   count,
+                     const osg::Matrixd*        world2local )
+{
+    Geodesy geodesy( ellipsoid );
+    bool    needsLocalize = world2local && !world2local->isIdentity();
+
+    for( unsigned i=0; i<count; ++i )
+    {
+        double x, y, z;
+        geodesy.toECEF( input[i].x(), input[i].y(), input[i].z(), x, y, z );
+        if ( needsLocalize )
+            localize( *world2local, x, y, z );
+        output[i].set( x, y, z );
+    }
+}
+
+void
+ECEF::geodeticToECEF(const osg::EllipsoidModel* ellipsoid,
+                     const double* lon, const double* lat, const double* height,
+                     double* x, double* y, double* z,
+                     unsigned                   count,
+                     const osg::Matrixd*        world2local )
+{
+    Geodesy geodesy( ellipsoid );
+    bool    needsLocalize = world2local && !world2local->isIdentity();
+
+    for( unsigned i=0; i<count; ++i )
+    {
+        double ex, ey, ez;
+        geodesy.toECEF( lon[i], lat[i], height[i], ex, ey, ez );
+        if ( needsLocalize )
+            localize( *world2local, ex, ey, ez );
+        x[i] = ex; y[i] = ey; z[i] = ez;
+    }
+}
+
+void
+ECEF::ecefToGeodetic(const osg::EllipsoidModel* ellipsoid,
+                     const osg::Vec3d*          input,
+                     osg::Vec3d*                output,
+                     unsigned                   count )
+{
+    Geodesy geodesy( ellipsoid );
+
+    for( unsigned i=0; i<count; ++i )
+    {
+        double lon, lat, height;
+        geodesy.toGeodetic( input[i].x(), input[i].y(), input[i].z(), lon, lat, height );
+        output[i].set( lon, lat, height );
+    }
+}
+
+void
+ECEF::ecefToGeodetic(const osg::EllipsoidModel* ellipsoid,
+                     const double* x, const double* y, const double* z,
+                     double* lon, double* lat, double* height,
+                     unsigned                   count )
+{
+    Geodesy geodesy( ellipsoid );
+
+    for( unsigned i=0; i<count; ++i )
     {
-        osg::Vec3d ecef;
-        srs->transformToECEF( *i, ecef );
-        output->push_back( ecef * world2local );
+        double glon, glat, gheight;
+        geodesy.toGeodetic( x[i], y[i], z[i], glon, glat, gheight );
+        lon[i] = glon; lat[i] = glat; height[i] = gheight;
     }
 }
 
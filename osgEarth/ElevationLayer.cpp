@@ -182,8 +182,7 @@ ElevationLayer::initTileSource()
 GeoHeightField
 ElevationLayer::createGeoHeightField(const TileKey& key, ProgressCallback* progress)
 {
-    osg::HeightField* hf = 0L;
-    //osg::ref_ptr<osg::HeightField> hf;
+    osg::ref_ptr<const osg::HeightField> hf;
 
     TileSource* source = getTileSource();
 
@@ -193,10 +192,11 @@ ElevationLayer::createGeoHeightField(const TileKey& key, ProgressCallback* progr
         //Only try to get data if the source actually has data
         if (source->hasData( key ) )
         {
-            hf = source->createHeightField( key, _preCacheOp.get(), progress );
+            // shared with the source's L2 cache; only read from here on.
+            source->getHeightField( key, hf, _preCacheOp.get(), progress );
 
             //Blacklist the tile if we can't get it and it wasn't cancelled
-            if ( !hf && (!progress || !progress->isCanceled()))
+            if ( !hf.valid() && (!progress || !progress->isCanceled()))
             {
                 source->getBlacklist()->add(key.getTileId());
             }
@@ -211,16 +211,28 @@ ElevationLayer::createGeoHeightField(const TileKey& key, ProgressCallback* progr
         OE_DEBUG << LC << "Tile " << key.str() << " is blacklisted " << std::endl;
     }
 
-    return hf ?
-        GeoHeightField( hf, key.getExtent(), getProfile()->getVerticalSRS() ) :
+    return hf.valid() ?
+        GeoHeightField( hf.get(), key.getExtent(), getProfile()->getVerticalSRS() ) :
         GeoHeightField::INVALID;
 }
 
 osg::HeightField*
 ElevationLayer::createHeightField(const osgEarth::TileKey& key, ProgressCallback* progress )
 {
-    osg::HeightField* result = 0L;
-    //osg::ref_ptr<osg::HeightField> result;
+    osg::ref_ptr<const osg::HeightField> hf;
+    if ( !getHeightField(key, hf, progress) )
+        return 0L;
+
+    // the caller may modify the result, so copy it if a cache holds it too.
+    osg::ref_ptr<osg::HeightField> result = HeightFieldUtils::makeWritable( hf.get() );
+    hf = 0L;
+    return result.release();
+}
+
+bool
+ElevationLayer::getHeightField(const osgEarth::TileKey& key, osg::ref_ptr<const osg::HeightField>& out_hf, ProgressCallback* progress )
+{
+    osg::ref_ptr<const osg::HeightField> result;
 
     const Profile* layerProfile = getProfile();
     const Profile* mapProfile = key.getProfile();
@@ -228,13 +240,13 @@ ElevationLayer::createHeightField(const osgEarth::TileKey& key, ProgressCallback
 	if ( !layerProfile )
 	{
 		OE_WARN << LC << "Could not get a valid profile for Layer \"" << getName() << "\"" << std::endl;
-        return 0L;
+        return false;
 	}
 
 	if ( !isCacheOnly() && !getTileSource() )
 	{
 		OE_WARN << LC << "Error: ElevationLayer does not have a valid TileSource, cannot create heightfield " << std::endl;
-		return 0L;
+		return false;
 	}
 
     //Write the layer properties if they haven't been written yet.  Heightfields are always stored in the map profile.
@@ -255,18 +267,19 @@ ElevationLayer::createHeightField(const osgEarth::TileKey& key, ProgressCallback
 		{
 			OE_DEBUG << LC << "ElevationLayer::createHeightField got tile " << key.str() << " from layer \"" << getName() << "\" from cache " << std::endl;
 
-            // make a copy:
-            result = new osg::HeightField( *cachedHF.get() );
+            result = cachedHF.get();
 		}
 	}
 
     //in cache-only mode, if the cache fetch failed, bail out.
-    if ( result == 0L && isCacheOnly() )
+    if ( !result.valid() && isCacheOnly() )
     {
-        return 0L;
+        return false;
     }
 
-	if ( result == 0L && getTileSource() && getTileSource()->isOK() )
+    bool fromCache = result.valid();
+
+	if ( !result.valid() && getTileSource() && getTileSource()->isOK() )
     {
 		//If the profiles are equivalent, get the HF from the TileSource.
 		if (key.getProfile()->isEquivalentTo( getProfile() ))
@@ -276,7 +289,7 @@ ElevationLayer::createHeightField(const osgEarth::TileKey& key, ProgressCallback
 				GeoHeightField hf = createGeoHeightField( key, progress );
 				if (hf.valid())
 				{
-					result = hf.takeHeightField();
+					result = hf.getHeightField();
 				}
 			}
 		}
@@ -319,8 +332,7 @@ ElevationLayer::createHeightField(const osgEarth::TileKey& key, ProgressCallback
                         height = itr->getHeightField()->getNumRows();
 				}
 
-                result = new osg::HeightField();
-				result->allocate(width, height);
+                osg::ref_ptr<osg::HeightField> mosaic = Registry::instance()->getBufferPool()->createHeightField( width, height );
 
 				//Go ahead and set up the heightfield so we don't have to worry about it later
 				double minx, miny, maxx, maxy;
@@ -347,32 +359,30 @@ ElevationLayer::createHeightField(const osgEarth::TileKey& key, ProgressCallback
 								break;
 							}
 						}
-						result->setHeight( c, r, elevation );                
+						mosaic->setHeight( c, r, elevation );                
 					}
 				}
+
+                result = mosaic.get();
 			}
 		}
-    
-        //Write the result to the cache.
-        if (result && _cache.valid() && _runtimeOptions.cacheEnabled() == true )
-        {
-            _cache->setHeightField( key, _cacheSpec, result );
-        }
     }
 
-	//Initialize the HF values for osgTerrain
-	if ( result )
+	//Initialize the HF values for osgTerrain. GeoHeightField sets them up, copying the
+	//heightfield first if it is shared and does not have them already.
+	if ( result.valid() )
 	{	
-		//Go ahead and set up the heightfield so we don't have to worry about it later
-		double minx, miny, maxx, maxy;
-		key.getExtent().getBounds(minx, miny, maxx, maxy);
-		result->setOrigin( osg::Vec3d( minx, miny, 0.0 ) );
-		double dx = (maxx - minx)/(double)(result->getNumColumns()-1);
-		double dy = (maxy - miny)/(double)(result->getNumRows()-1);
-		result->setXInterval( dx );
-		result->setYInterval( dy );
-		result->setBorderWidth( 0 );
+		result = GeoHeightField( result.get(), key.getExtent(), getProfile()->getVerticalSRS() ).getHeightField();
 	}
-	
-    return result;
+
+    //Write the result to the cache. It is immutable from here on.
+    if ( result.valid() && !fromCache && _cache.valid() && _runtimeOptions.cacheEnabled() == true )
+    {
+        _cache->setHeightField( key, _cacheSpec, result.get() );
+    }
+
+    recordAvailability( key, result.valid(), progress );
+
+    out_hf = result.get();
+    return out_hf.valid();
 }
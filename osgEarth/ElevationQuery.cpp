@@ -1,5 +1,6 @@
 #include <osgEarth/ElevationQuery>
 #include <osgEarth/Locators>
+#include <osgEarth/Registry>
 #include <osgTerrain/TerrainTile>
 #include <osgTerrain/GeometryTechnique>
 #include <osgUtil/IntersectionVisitor>
@@ -11,17 +12,46 @@ using namespace osgEarth;
 using namespace OpenThreads;
 
 ElevationQuery::ElevationQuery( const Map* map ) :
-_mapf( map, Map::ELEVATION_LAYERS )
+_mapf( map, Map::ELEVATION_LAYERS ),
+_residency( _tileCache, "ElevationQuery" )
 {
     postCTOR();
 }
 
 ElevationQuery::ElevationQuery( const MapFrame& mapFrame ) :
-_mapf( mapFrame )
+_mapf( mapFrame ),
+_residency( _tileCache, "ElevationQuery" )
 {
     postCTOR();
 }
 
+ElevationQuery::ElevationQuery( const ElevationQuery& rhs ) :
+_mapf            ( rhs._mapf ),
+_tileSize        ( rhs._tileSize ),
+_maxDataLevel    ( rhs._maxDataLevel ),
+_maxLevelOverride( rhs._maxLevelOverride ),
+_technique       ( rhs._technique ),
+_interpolation   ( rhs._interpolation ),
+_tileCache       ( rhs._tileCache ),
+_residency       ( _tileCache, "ElevationQuery" )
+{
+    //nop
+}
+
+ElevationQuery&
+ElevationQuery::operator=( const ElevationQuery& rhs )
+{
+    // the residency adapter stays bound to this query's own cache
+    _mapf             = rhs._mapf;
+    _tileSize         = rhs._tileSize;
+    _maxDataLevel     = rhs._maxDataLevel;
+    _maxLevelOverride = rhs._maxLevelOverride;
+    _technique        = rhs._technique;
+    _interpolation    = rhs._interpolation;
+    _tileCache        = rhs._tileCache;
+    return *this;
+}
+
 void
 ElevationQuery::postCTOR()
 {
@@ -32,8 +62,10 @@ ElevationQuery::postCTOR()
     _maxLevelOverride = -1;
 
     // Limit the size of the cache we'll use to cache heightfields. This is an
-    // LRU cache.
-    _tileCache.setMaxSize( 50 );
+    // LRU cache. Entries are weighed in bytes for the ResidencyManager, so the
+    // limit is on the number of entries instead.
+    _tileCache.setMaxSize( ~0u );
+    _tileCache.setMaxEntries( 50 );
 }
 
 void
@@ -74,13 +106,13 @@ ElevationQuery::setTechnique( ElevationQuery::Technique technique )
 void
 ElevationQuery::setMaxTilesToCache( int value )
 {
-    _tileCache.setMaxSize( value );
+    _tileCache.setMaxEntries( osg::maximum(value, 1) );
 }
 
 int
 ElevationQuery::getMaxTilesToCache() const
 {
-    return _tileCache.getMaxSize();
+    return _tileCache.getMaxEntries();
 }
 
 void
@@ -241,7 +273,9 @@ ElevationQuery::getElevationImpl(const osg::Vec3d&       point,
         tile->setTerrainTechnique( new osgTerrain::GeometryTechnique );
 
         // store it in the local tile cache.
-        _tileCache.insert( key, tile.get() );
+        size_t bytes = ResidencyManager::getSizeInBytes( tile.get() );
+        _tileCache.insert( key, tile.get(), bytes );
+        Registry::instance()->getResidencyManager()->added( bytes );
     }
 
     OE_DEBUG << LC << "LRU Cache, hit ratio = " << _tileCache.getStats()._hitRatio << std::endl;
@@ -584,8 +584,8 @@ GeoImage::addTransparentBorder(bool leftBorder, bool rightBorder, bool bottomBor
     if (topBorder)    newT += buffer;
     if (bottomBorder) newT += buffer;
 
-    osg::Image* newImage = new osg::Image;
-    newImage->allocateImage(newS, newT, _image->r(), _image->getPixelFormat(), _image->getDataType(), _image->getPacking());
+    osg::Image* newImage = Registry::instance()->getBufferPool()->createImage(
+        newS, newT, _image->r(), _image->getPixelFormat(), _image->getDataType(), _image->getPacking());
     newImage->setInternalTextureFormat(_image->getInternalTextureFormat());
     memset(newImage->data(), 0, newImage->getImageSizeInBytes());
     unsigned startC = leftBorder ? buffer : 0;
@@ -763,8 +763,7 @@ manualReproject(const osg::Image* image, const GeoExtent& src_extent, const GeoE
     // need to know this in order to choose the right interpolation algorithm
     const bool isSrcContiguous = src_extent.getSRS()->isContiguous();
 
-    osg::Image *result = new osg::Image();
-    result->allocateImage(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    osg::Image *result = Registry::instance()->getBufferPool()->createImage(width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE);
     //Initialize the image to be completely transparent
     memset(result->data(), 0, result->getImageSizeInBytes());
 
@@ -982,21 +981,27 @@ _vsrs( 0L )
     //nop
 }
 
-GeoHeightField::GeoHeightField(osg::HeightField* heightField,
+GeoHeightField::GeoHeightField(const osg::HeightField* heightField,
                                const GeoExtent& extent,
                                const VerticalSpatialReference* vsrs) :
-_heightField( heightField ),
 _extent( extent ),
 _vsrs( vsrs )
 {
-    if ( _heightField )
+    if ( heightField )
     {
         double minx, miny, maxx, maxy;
         _extent.getBounds(minx, miny, maxx, maxy);
 
-        _heightField->setOrigin( osg::Vec3d( minx, miny, 0.0 ) );
-        _heightField->setXInterval( (maxx - minx)/(double)(_heightField->getNumColumns()-1) );
-        _heightField->setYInterval( (maxy - miny)/(double)(_heightField->getNumRows()-1) );
+        osg::Vec3 origin( minx, miny, 0.0 );
+        float dx = (maxx - minx)/(double)(heightField->getNumColumns()-1);
+        float dy = (maxy - miny)/(double)(heightField->getNumRows()-1);
+
+        // callers may modify the heightfield through getHeightField(), so never keep
+        // one that somebody else (e.g. a cache) can see.
+        _heightField = HeightFieldUtils::makeWritable( heightField );
+        _heightField->setOrigin( origin );
+        _heightField->setXInterval( dx );
+        _heightField->setYInterval( dy );
         _heightField->setBorderWidth( 0 );
     }
 }
@@ -1061,42 +1066,10 @@ GeoHeightField::getElevation(const osgEarth::SpatialReference* inputSRS,
 GeoHeightField
 GeoHeightField::createSubSample( const GeoExtent& destEx, ElevationInterpolation interpolation) const
 {
-    double div = destEx.width()/_extent.width();
-    if ( div >= 1.0f )
+    osg::HeightField* dest = HeightFieldUtils::createSubSample( _heightField.get(), _extent, destEx, interpolation );
+    if ( !dest )
         return GeoHeightField::INVALID;
 
-    int w = _heightField->getNumColumns();
-    int h = _heightField->getNumRows();
-    //double dx = _heightField->getXInterval() * div;
-    //double dy = _heightField->getYInterval() * div;
-    double xInterval = _extent.width() / (double)(_heightField->getNumColumns()-1);
-    double yInterval = _extent.height() / (double)(_heightField->getNumRows()-1);
-    double dx = xInterval * div;
-    double dy = yInterval * div;
-
-    osg::HeightField* dest = new osg::HeightField();
-    dest->allocate( w, h );
-    dest->setXInterval( dx );
-    dest->setYInterval( dy );
-
-    // copy over the skirt height, adjusting it for tile size.
-    dest->setSkirtHeight( _heightField->getSkirtHeight() * div );
-
-    double x, y;
-    int col, row;
-
-    for( x = destEx.xMin(), col=0; col < w; x += dx, col++ )
-    {
-        for( y = destEx.yMin(), row=0; row < h; y += dy, row++ )
-        {
-            float height = HeightFieldUtils::getHeightAtLocation( _heightField.get(), x, y, _extent.xMin(), _extent.yMin(), xInterval, yInterval, interpolation);
-            dest->setHeight( col, row, height );
-        }
-    }
-
-    osg::Vec3d orig( destEx.xMin(), destEx.yMin(), _heightField->getOrigin().z() );
-    dest->setOrigin( orig );
-
     return GeoHeightField( dest, destEx, _vsrs.get() );
 }
 
@@ -19,10 +19,214 @@
 
 #include <osgEarth/HeightFieldUtils>
 #include <osgEarth/GeoData>
+#include <osgEarth/Registry>
 #include <osg/Notify>
+#include <algorithm>
+#include <typeinfo>
+#include <climits>
 
 using namespace osgEarth;
 
+namespace
+{
+    /**
+     * The source posts and weights for each output post along one axis of a
+     * resampling. Computing these once per axis (rather than once per sample)
+     * is what makes the resampling kernel below cheap; the per-axis math is the
+     * same as in HeightFieldUtils::getHeightAtPixel, so the results are identical.
+     */
+    struct AxisSamples
+    {
+        std::vector<double> _p;       // clamped pixel coordinate
+        std::vector<int>    _min;     // lower neighbor (bilinear/average)
+        std::vector<int>    _max;     // upper neighbor (bilinear/average)
+        std::vector<int>    _triMin;  // lower neighbor (triangulate)
+        std::vector<int>    _triMax;  // upper neighbor (triangulate)
+        std::vector<int>    _nearest; // nearest neighbor
+
+        AxisSamples( const std::vector<double>& p, int numPosts ) :
+            _p(p), _min(p.size()), _max(p.size()), _triMin(p.size()), _triMax(p.size()), _nearest(p.size())
+        {
+            for( unsigned i = 0; i < p.size(); ++i )
+            {
+                double v = p[i];
+                int lo = osg::maximum((int)floor(v), 0);
+                int hi = osg::maximum(osg::minimum((int)ceil(v), numPosts-1), 0);
+
+                int triLo = lo, triHi = hi;
+                if ( triLo == triHi )
+                {
+                    if ( triLo < numPosts-2 || triHi == 0 )
+                        triHi = triLo + 1;
+                    else
+                        triLo = triHi - 1;
+                }
+                if ( triLo > triHi ) triLo = triHi;
+                if ( lo > hi ) lo = hi;
+
+                _min[i]     = lo;
+                _max[i]     = hi;
+                _triMin[i]  = triLo;
+                _triMax[i]  = triHi;
+                _nearest[i] = (int)(unsigned int)osg::round(v);
+            }
+        }
+    };
+
+    /** Pointers to the first post of each row of a heightfield. */
+    typedef std::vector<const float*> RowPointers;
+
+    void getRowPointers( const osg::HeightField* hf, RowPointers& out_rows )
+    {
+        unsigned numCols = hf->getNumColumns();
+        const float* in  = &hf->getFloatArray()->front();
+        out_rows.resize( hf->getNumRows() );
+        for( unsigned i = 0; i < out_rows.size(); ++i )
+            out_rows[i] = in + i * numCols;
+    }
+
+    /**
+     * Resamples the input into the output (already allocated to cols x rows) one
+     * output row at a time, reading the input through row pointers.
+     */
+    void resample(const RowPointers&      in,
+                  const AxisSamples&      cols,
+                  const AxisSamples&      rows,
+                  ElevationInterpolation  interpolation,
+                  osg::HeightField*       output )
+    {
+        unsigned outCols = cols._p.size();
+        unsigned outRows = rows._p.size();
+        float*       out = &output->getFloatArray()->front();
+
+        if ( interpolation == INTERP_NEAREST )
+        {
+            for( unsigned y = 0; y < outRows; ++y, out += outCols )
+            {
+                const float* src = in[ rows._nearest[y] ];
+                for( unsigned x = 0; x < outCols; ++x )
+                    out[x] = src[ cols._nearest[x] ];
+            }
+        }
+
+        else if ( interpolation == INTERP_TRIANGULATE )
+        {
+            for( unsigned y = 0; y < outRows; ++y, out += outCols )
+            {
+                double r      = rows._p[y];
+                int    rowMin = rows._triMin[y];
+                int    rowMax = rows._triMax[y];
+                double dy     = r - (double)rowMin;
+                const float* lower = in[ rowMin ];
+                const float* upper = in[ rowMax ];
+
+                for( unsigned x = 0; x < outCols; ++x )
+                {
+                    double c      = cols._p[x];
+                    int    colMin = cols._triMin[x];
+                    int    colMax = cols._triMax[x];
+
+                    float urHeight = upper[colMax];
+                    float llHeight = lower[colMin];
+                    float ulHeight = upper[colMin];
+                    float lrHeight = lower[colMax];
+
+                    if (urHeight == NO_DATA_VALUE || llHeight == NO_DATA_VALUE || ulHeight == NO_DATA_VALUE || lrHeight == NO_DATA_VALUE)
+                    {
+                        out[x] = NO_DATA_VALUE;
+                        continue;
+                    }
+
+                    double dx = c - (double)colMin;
+
+                    osg::Vec3d v0, v1, v2;
+                    if (dx > dy)
+                    {
+                        v0.set(colMin, rowMin, llHeight);
+                        v1.set(colMax, rowMin, lrHeight);
+                        v2.set(colMax, rowMax, urHeight);
+                    }
+                    else
+                    {
+                        v0.set(colMin, rowMin, llHeight);
+                        v1.set(colMax, rowMax, urHeight);
+                        v2.set(colMin, rowMax, ulHeight);
+                    }
+
+                    osg::Vec3d n = (v1 - v0) ^ (v2 - v0);
+                    out[x] = ( n.x() * ( c - v0.x() ) + n.y() * ( r - v0.y() ) ) / -n.z() + v0.z();
+                }
+            }
+        }
+
+        else // INTERP_BILINEAR or INTERP_AVERAGE
+        {
+            bool average = interpolation == INTERP_AVERAGE;
+
+            for( unsigned y = 0; y < outRows; ++y, out += outCols )
+            {
+                double r      = rows._p[y];
+                int    rowMin = rows._min[y];
+                int    rowMax = rows._max[y];
+                double wy0    = (double)rowMax - r;
+                double wy1    = r - (double)rowMin;
+                double y_rem  = r - (int)r;
+                const float* lower = in[ rowMin ];
+                const float* upper = in[ rowMax ];
+
+                for( unsigned x = 0; x < outCols; ++x )
+                {
+                    double c      = cols._p[x];
+                    int    colMin = cols._min[x];
+                    int    colMax = cols._max[x];
+
+                    float urHeight = upper[colMax];
+                    float llHeight = lower[colMin];
+                    float ulHeight = upper[colMin];
+                    float lrHeight = lower[colMax];
+
+                    if (urHeight == NO_DATA_VALUE || llHeight == NO_DATA_VALUE || ulHeight == NO_DATA_VALUE || lrHeight == NO_DATA_VALUE)
+                    {
+                        out[x] = NO_DATA_VALUE;
+                    }
+                    else if ( average )
+                    {
+                        double x_rem = c - (int)c;
+                        double w00 = (1.0 - y_rem) * (1.0 - x_rem) * (double)llHeight;
+                        double w01 = (1.0 - y_rem) * x_rem * (double)lrHeight;
+                        double w10 = y_rem * (1.0 - x_rem) * (double)ulHeight;
+                        double w11 = y_rem * x_rem * (double)urHeight;
+                        out[x] = (float)(w00 + w01 + w10 + w11);
+                    }
+                    else if ( colMax == colMin && rowMax == rowMin )
+                    {
+                        out[x] = llHeight;
+                    }
+                    else if ( colMax == colMin )
+                    {
+                        out[x] = wy0 * llHeight + wy1 * ulHeight;
+                    }
+                    else
+                    {
+                        double wx0 = (double)colMax - c;
+                        double wx1 = c - (double)colMin;
+                        if ( rowMax == rowMin )
+                        {
+                            out[x] = wx0 * llHeight + wx1 * lrHeight;
+                        }
+                        else
+                        {
+                            float r1 = wx0 * llHeight + wx1 * lrHeight;
+                            float r2 = wx0 * ulHeight + wx1 * urHeight;
+                            out[x] = wy0 * r1 + wy1 * r2;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
 float
 HeightFieldUtils::getHeightAtPixel(const osg::HeightField* hf, double c, double r, ElevationInterpolation interpolation)
 {
@@ -42,7 +246,8 @@ HeightFieldUtils::getHeightAtPixel(const osg::HeightField* hf, double c, double
 
         if (rowMin == rowMax)
         {
-            if (rowMin < (int)hf->getNumRows()-2)
+            // (with only two rows, the first row has to take the upper one)
+            if (rowMin < (int)hf->getNumRows()-2 || rowMax == 0)
             {
                 rowMax = rowMin + 1;
             }
@@ -54,7 +259,7 @@ HeightFieldUtils::getHeightAtPixel(const osg::HeightField* hf, double c, double
 
          if (colMin == colMax)
          {
-            if (colMin < (int)hf->getNumColumns()-2)
+            if (colMin < (int)hf->getNumColumns()-2 || colMax == 0)
             {
                 colMax = colMin + 1;
             }
@@ -222,7 +427,7 @@ HeightFieldUtils::scaleHeightFieldToDegrees( osg::HeightField* hf )
 
 
 osg::HeightField*
-HeightFieldUtils::createSubSample(osg::HeightField* input, const GeoExtent& inputEx, 
+HeightFieldUtils::createSubSample(const osg::HeightField* input, const GeoExtent& inputEx, 
                                   const GeoExtent& outputEx, osgEarth::ElevationInterpolation interpolation)
 {
     double div = outputEx.width()/inputEx.width();
@@ -232,34 +437,31 @@ HeightFieldUtils::createSubSample(osg::HeightField* input, const GeoExtent& inpu
     int numCols = input->getNumColumns();
     int numRows = input->getNumRows();
 
-    //float dx = input->getXInterval() * div;
-    //float dy = input->getYInterval() * div;
-
     double xInterval = inputEx.width()  / (double)(input->getNumColumns()-1);
     double yInterval = inputEx.height()  / (double)(input->getNumRows()-1);
     double dx = div * xInterval;
     double dy = div * yInterval;
 
-
-    osg::HeightField* dest = new osg::HeightField();
-    dest->allocate( numCols, numRows );
+    osg::HeightField* dest = Registry::instance()->getBufferPool()->createHeightField( numCols, numRows );
     dest->setXInterval( dx );
     dest->setYInterval( dy );
 
     // copy over the skirt height, adjusting it for relative tile size.
     dest->setSkirtHeight( input->getSkirtHeight() * div );
 
-    double x, y;
-    int col, row;
+    // pixel coordinates of the output posts in the input, accumulated the same way the
+    // posts are laid out so that they match getHeightAtLocation exactly.
+    std::vector<double> px( numCols ), py( numRows );
+    double x = outputEx.xMin();
+    for( int col = 0; col < numCols; x += dx, ++col )
+        px[col] = osg::clampBetween( (x - inputEx.xMin()) / xInterval, 0.0, (double)(numCols-1) );
+    double y = outputEx.yMin();
+    for( int row = 0; row < numRows; y += dy, ++row )
+        py[row] = osg::clampBetween( (y - inputEx.yMin()) / yInterval, 0.0, (double)(numRows-1) );
 
-    for( x = outputEx.xMin(), col=0; col < numCols; x += dx, col++ )
-    {
-        for( y = outputEx.yMin(), row=0; row < numRows; y += dy, row++ )
-        {
-            float height = HeightFieldUtils::getHeightAtLocation( input, x, y, inputEx.xMin(), inputEx.yMin(), xInterval, yInterval, interpolation);
-            dest->setHeight( col, row, height );
-        }
-    }
+    RowPointers rows;
+    getRowPointers( input, rows );
+    resample( rows, AxisSamples(px, numCols), AxisSamples(py, numRows), interpolation, dest );
 
     osg::Vec3d orig( outputEx.xMin(), outputEx.yMin(), input->getOrigin().z() );
     dest->setOrigin( orig );
@@ -267,6 +469,18 @@ HeightFieldUtils::createSubSample(osg::HeightField* input, const GeoExtent& inpu
     return dest;
 }
 
+osg::HeightField*
+HeightFieldUtils::makeWritable( const osg::HeightField* hf )
+{
+    if ( !hf ) return 0L;
+
+    // nobody else can get at a heightfield that only the caller references.
+    if ( hf->referenceCount() <= 1 )
+        return const_cast<osg::HeightField*>( hf );
+
+    return new osg::HeightField( *hf );
+}
+
 osg::HeightField*
 HeightFieldUtils::resizeHeightField(osg::HeightField* input, int newColumns, int newRows,
                                     ElevationInterpolation interp)
@@ -284,22 +498,21 @@ HeightFieldUtils::resizeHeightField(osg::HeightField* input, int newColumns, int
     double stepX = spanX/(double)(newColumns-1);
     double stepY = spanY/(double)(newRows-1);
 
-    osg::HeightField* output = new osg::HeightField();
-    output->allocate( newColumns, newRows );
+    osg::HeightField* output = Registry::instance()->getBufferPool()->createHeightField( newColumns, newRows );
     output->setXInterval( stepX );
     output->setYInterval( stepY );
     output->setOrigin( origin );
     
+    // note: resizing has always used the default (bilinear) interpolation.
+    std::vector<double> px( newColumns ), py( newRows );
+    for( int x = 0; x < newColumns; ++x )
+        px[x] = ((double)x / (double)(newColumns-1)) * (double)(input->getNumColumns() - 1);
     for( int y = 0; y < newRows; ++y )
-    {
-        for( int x = 0; x < newColumns; ++x )
-        {
-            double nx = (double)x / (double)(newColumns-1);
-            double ny = (double)y / (double)(newRows-1);
-            float h = getHeightAtNormalizedLocation( input, nx, ny );
-            output->setHeight( x, y, h );
-        }
-    }
+        py[y] = ((double)y / (double)(newRows-1)) * (double)(input->getNumRows() - 1);
+
+    RowPointers rows;
+    getRowPointers( input, rows );
+    resample( rows, AxisSamples(px, input->getNumColumns()), AxisSamples(py, input->getNumRows()), INTERP_BILINEAR, output );
 
     return output;
 }
@@ -328,50 +541,65 @@ HeightFieldUtils::createClusterCullingCallback( osg::HeightField* grid, osg::Ell
 
     osg::Vec3 transformed_center_normal = center_normal;
 
-    unsigned int r,c;
+    // Same math as EllipsoidModel::convertLatLongHeightToXYZ, but the longitude terms
+    // only vary by column and the latitude terms only by row, so we compute each once.
+    double radiusEquator = et->getRadiusEquator();
+    double flattening = (radiusEquator - et->getRadiusPolar()) / radiusEquator;
+    double eccentricitySquared = 2.0*flattening - flattening*flattening;
 
-    // populate the vertex/normal/texcoord arrays from the grid.
     double orig_X = grid->getOrigin().x();
     double delta_X = grid->getXInterval();
     double orig_Y = grid->getOrigin().y();
     double delta_Y = grid->getYInterval();
     double orig_Z = grid->getOrigin().z();
 
+    std::vector<double> cosLon( numColumns ), sinLon( numColumns );
+    for( unsigned int c = 0; c < numColumns; ++c )
+    {
+        double lon = osg::DegreesToRadians( orig_X + delta_X*(double)c );
+        cosLon[c] = cos( lon );
+        sinLon[c] = sin( lon );
+    }
+
+    double cutoff = osg::PI_2 - 0.1;
 
-    float min_dot_product = 1.0f;
-    float max_cluster_culling_height = 0.0f;
-    float max_cluster_culling_radius = 0.0f;
+    // The cone's dot product, height and radius (-sin, 1/cos-1 and tan of beta) all
+    // grow with beta = theta + phi below the cutoff, so we only need the largest beta
+    // rather than evaluating all three for every post.
+    double max_beta = 0.0;
 
-    for(r=0;r<numRows;++r)
+    // one row at a time: first the posts' heights and distances from the center, in
+    // plain arrays, then the angles.
+    std::vector<double> heights( numColumns ), distances( numColumns );
+    for( unsigned int r = 0; r < numRows; ++r )
     {
-        for(c=0;c<numColumns;++c)
+        double lat = osg::DegreesToRadians( orig_Y + delta_Y*(double)r );
+        double sinLat = sin( lat );
+        double cosLat = cos( lat );
+        double N = radiusEquator / sqrt( 1.0 - eccentricitySquared*sinLat*sinLat );
+        double NZ = N * (1.0 - eccentricitySquared);
+
+        for( unsigned int c = 0; c < numColumns; ++c )
+        {
+            double height = orig_Z + grid->getHeight(c, r) * verticalScale;
+            double xy = (N + height) * cosLat;
+
+            // the distance is taken in single precision, as it always has been.
+            osg::Vec3 dv = osg::Vec3d( xy * cosLon[c], xy * sinLon[c], (NZ + height) * sinLat ) - center_position;
+            heights[c] = height;
+            distances[c] = sqrt(dv.x()*dv.x() + dv.y()*dv.y() + dv.z()*dv.z());
+        }
+
+        for( unsigned int c = 0; c < numColumns; ++c )
         {
-            double X = orig_X + delta_X*(double)c;
-            double Y = orig_Y + delta_Y*(double)r;
-            double Z = orig_Z + grid->getHeight(c,r) * verticalScale;
-            double height = Z;
-
-            et->convertLatLongHeightToXYZ(
-                osg::DegreesToRadians(Y), osg::DegreesToRadians(X), Z,
-                X, Y, Z);
-
-            osg::Vec3d v(X,Y,Z);
-            osg::Vec3 dv = v - center_position;
-            double d = sqrt(dv.x()*dv.x() + dv.y()*dv.y() + dv.z()*dv.z());
-            double theta = acos( globe_radius/ (globe_radius + fabs(height)) );
-            double phi = 2.0 * asin (d*0.5/globe_radius); // d/globe_radius;
+            double theta = acos( globe_radius/ (globe_radius + fabs(heights[c])) );
+            double phi = 2.0 * asin (distances[c]*0.5/globe_radius); // d/globe_radius;
             double beta = theta+phi;
-            double cutoff = osg::PI_2 - 0.1;
 
             //log(osg::INFO,"theta="<<theta<<"\tphi="<<phi<<" beta "<<beta);
             if (phi<cutoff && beta<cutoff)
             {
-                float local_dot_product = -sin(theta + phi);
-                float local_m = globe_radius*( 1.0/ cos(theta+phi) - 1.0);
-                float local_radius = static_cast<float>(globe_radius * tan(beta)); // beta*globe_radius;
-                min_dot_product = osg::minimum(min_dot_product, local_dot_product);
-                max_cluster_culling_height = osg::maximum(max_cluster_culling_height,local_m);      
-                max_cluster_culling_radius = osg::maximum(max_cluster_culling_radius,local_radius);
+                max_beta = osg::maximum( max_beta, beta );
             }
             else
             {
@@ -379,7 +607,11 @@ HeightFieldUtils::createClusterCullingCallback( osg::HeightField* grid, osg::Ell
                 return 0;
             }
         }
-    }    
+    }
+
+    float min_dot_product = osg::minimum( 1.0f, (float)-sin(max_beta) );
+    float max_cluster_culling_height = globe_radius*( 1.0/ cos(max_beta) - 1.0);
+    float max_cluster_culling_radius = static_cast<float>(globe_radius * tan(max_beta)); // beta*globe_radius;
 
     osg::ClusterCullingCallback* ccc = new osg::ClusterCullingCallback;
 
@@ -458,3 +690,200 @@ FillNoDataOperator::operator ()(osg::HeightField *heightField)
         }
     }
 }
+
+/******************************************************************************************/
+namespace
+{
+    /** The nearest valid post found so far for a post, and its squared distance. */
+    struct Nearest
+    {
+        Nearest() : _col(-1), _row(-1), _dist2(INT_MAX) { }
+        int _col, _row, _dist2;
+    };
+
+    /** A void post: its index in the height list and its column and row. */
+    struct Void
+    {
+        Void( int index, int col, int row ) : _index(index), _col(col), _row(row) { }
+        int _index, _col, _row;
+    };
+
+    /**
+     * One step of the nearest-valid-post propagation: if the neighbor's nearest
+     * valid post is closer to (col,row) than our current one, adopt it.
+     */
+    inline void propagate( Nearest& n, const Nearest& from, int col, int row )
+    {
+        if ( from._col < 0 )
+            return;
+        int dx = from._col - col;
+        int dy = from._row - row;
+        int d2 = dx*dx + dy*dy;
+        if ( d2 < n._dist2 )
+        {
+            n._col = from._col;
+            n._row = from._row;
+            n._dist2 = d2;
+        }
+    }
+
+    // validity tests for building the void mask; the common operators are inlined
+    // instead of making a virtual call per post.
+    struct IsNotNoData
+    {
+        bool operator()( float h ) const { return h != NO_DATA_VALUE; }
+    };
+
+    struct IsNotValue
+    {
+        IsNotValue( float value ) : _value(value) { }
+        bool operator()( float h ) const { return h != _value; }
+        float _value;
+    };
+
+    struct IsInRange
+    {
+        IsInRange( float minValue, float maxValue ) : _min(minValue), _max(maxValue) { }
+        bool operator()( float h ) const { return h >= _min && h <= _max; }
+        float _min, _max;
+    };
+
+    struct IsValidByOperator
+    {
+        IsValidByOperator( const osgTerrain::ValidDataOperator* op ) : _op(op) { }
+        bool operator()( float h ) const { return (*_op)( h ); }
+        const osgTerrain::ValidDataOperator* _op;
+    };
+
+    /** Marks each valid post as its own nearest, and lists the void posts. */
+    template<typename IS_VALID>
+    void buildVoidMask(const std::vector<float>& heights, int numCols, int numRows, const IS_VALID& isValid,
+                       std::vector<Nearest>& nearest, std::vector<Void>& voids )
+    {
+        for( int row = 0, i = 0; row < numRows; ++row )
+        {
+            for( int col = 0; col < numCols; ++col, ++i )
+            {
+                if ( isValid(heights[i]) )
+                {
+                    nearest[i]._col = col;
+                    nearest[i]._row = row;
+                    nearest[i]._dist2 = 0;
+                }
+                else
+                {
+                    voids.push_back( Void(i, col, row) );
+                }
+            }
+        }
+    }
+}
+
+VoidFillOperator::VoidFillOperator():
+_defaultValue(0.0f),
+_smoothingPasses(4)
+{
+}
+
+void
+VoidFillOperator::operator ()(osg::HeightField *heightField)
+{
+    if ( !heightField )
+        return;
+
+    int numCols = heightField->getNumColumns();
+    int numRows = heightField->getNumRows();
+    osg::HeightField::HeightList& heights = heightField->getHeightList();
+    if ( heights.empty() )
+        return;
+
+    // build the void mask, recording for each valid post that it is its own nearest.
+    std::vector<Nearest> nearest( heights.size() );
+    std::vector<Void> voids;
+
+    const osgTerrain::ValidDataOperator* validOp = _validDataOperator.get();
+    if ( !validOp )
+        buildVoidMask( heights, numCols, numRows, IsNotNoData(), nearest, voids );
+    else if ( typeid(*validOp) == typeid(osgTerrain::NoDataValue) )
+        buildVoidMask( heights, numCols, numRows, IsNotValue(static_cast<const osgTerrain::NoDataValue*>(validOp)->getValue()), nearest, voids );
+    else if ( typeid(*validOp) == typeid(osgTerrain::ValidRange) )
+    {
+        const osgTerrain::ValidRange* range = static_cast<const osgTerrain::ValidRange*>( validOp );
+        buildVoidMask( heights, numCols, numRows, IsInRange(range->getMinValue(), range->getMaxValue()), nearest, voids );
+    }
+    else
+        buildVoidMask( heights, numCols, numRows, IsValidByOperator(validOp), nearest, voids );
+
+    if ( voids.empty() )
+        return;
+
+    if ( voids.size() == heights.size() )
+    {
+        std::fill( heights.begin(), heights.end(), _defaultValue );
+        return;
+    }
+
+    // two-pass (8SSEDT-style) propagation of the nearest valid post:
+    for( int row = 0; row < numRows; ++row )
+    {
+        Nearest* n = &nearest[row*numCols];
+        for( int col = 0; col < numCols; ++col )
+        {
+            if ( n[col]._dist2 == 0 ) continue;
+            if ( col > 0 )                          propagate( n[col], n[col-1], col, row );
+            if ( row > 0 )                          propagate( n[col], n[col-numCols], col, row );
+            if ( row > 0 && col > 0 )               propagate( n[col], n[col-numCols-1], col, row );
+            if ( row > 0 && col < numCols-1 )       propagate( n[col], n[col-numCols+1], col, row );
+        }
+        for( int col = numCols-2; col >= 0; --col )
+        {
+            if ( n[col]._dist2 == 0 ) continue;
+            propagate( n[col], n[col+1], col, row );
+        }
+    }
+
+    for( int row = numRows-1; row >= 0; --row )
+    {
+        Nearest* n = &nearest[row*numCols];
+        for( int col = numCols-1; col >= 0; --col )
+        {
+            if ( n[col]._dist2 == 0 ) continue;
+            if ( col < numCols-1 )                  propagate( n[col], n[col+1], col, row );
+            if ( row < numRows-1 )                  propagate( n[col], n[col+numCols], col, row );
+            if ( row < numRows-1 && col < numCols-1 ) propagate( n[col], n[col+numCols+1], col, row );
+            if ( row < numRows-1 && col > 0 )       propagate( n[col], n[col+numCols-1], col, row );
+        }
+        for( int col = 1; col < numCols; ++col )
+        {
+            if ( n[col]._dist2 == 0 ) continue;
+            propagate( n[col], n[col-1], col, row );
+        }
+    }
+
+    for( std::vector<Void>::const_iterator v = voids.begin(); v != voids.end(); ++v )
+    {
+        const Nearest& n = nearest[v->_index];
+        heights[v->_index] = heights[ n._row*numCols + n._col ];
+    }
+
+    // smoothing: Jacobi relaxation of the filled posts toward their 4-neighbor average.
+    std::vector<float> smoothed( voids.size() );
+    for( unsigned int pass = 0; pass < _smoothingPasses; ++pass )
+    {
+        for( unsigned int v = 0; v < voids.size(); ++v )
+        {
+            int i = voids[v]._index, col = voids[v]._col, row = voids[v]._row;
+            float sum = 0.0f;
+            int count = 0;
+            if ( col > 0 )         { sum += heights[i-1];       ++count; }
+            if ( col < numCols-1 ) { sum += heights[i+1];       ++count; }
+            if ( row > 0 )         { sum += heights[i-numCols]; ++count; }
+            if ( row < numRows-1 ) { sum += heights[i+numCols]; ++count; }
+            smoothed[v] = count > 0 ? sum / (float)count : heights[i];
+        }
+        for( unsigned int v = 0; v < voids.size(); ++v )
+        {
+            heights[voids[v]._index] = smoothed[v];
+        }
+    }
+}
@@ -22,6 +22,7 @@
 #include <osgEarth/ImageUtils>
 #include <osgEarth/Registry>
 #include <osgEarth/StringUtils>
+#include <osgEarth/CacheCodec>
 #include <osg/Version>
 //#include <memory.h>
 #include <limits.h>
@@ -55,6 +56,7 @@ ImageLayerOptions::setDefaults()
     _minRange.init( -FLT_MAX );
     _maxRange.init( FLT_MAX );
     _lodBlending.init( false );
+    _textureCompression.init( false );
 }
 
 void
@@ -72,6 +74,7 @@ ImageLayerOptions::fromConfig( const Config& conf )
     conf.getIfSet( "min_range", _minRange );
     conf.getIfSet( "max_range", _maxRange );
     conf.getIfSet( "lod_blending", _lodBlending );
+    conf.getIfSet( "texture_compression", _textureCompression );
 
     if ( conf.hasValue( "transparent_color" ) )
         _transparentColor = stringToColor( conf.value( "transparent_color" ), osg::Vec4ub(0,0,0,0));
@@ -100,6 +103,7 @@ ImageLayerOptions::getConfig() const
     conf.updateIfSet( "min_range", _minRange );
     conf.updateIfSet( "max_range", _maxRange );
     conf.updateIfSet( "lod_blending", _lodBlending );
+    conf.updateIfSet( "texture_compression", _textureCompression );
 
 	if (_transparentColor.isSet())
         conf.update("transparent_color", colorToString( _transparentColor.value()));
@@ -334,6 +338,41 @@ ImageLayer::initPreCacheOp()
 
 }
 
+std::string
+ImageLayer::suggestCacheFormat() const
+{
+    // compressed tiles need a cache format that can store them as-is.
+    if ( _runtimeOptions.textureCompression() == true )
+        return CacheCodec::EXTENSION;
+
+    return TerrainLayer::suggestCacheFormat();
+}
+
+void
+ImageLayer::normalizeIfNecessary( GeoImage& image ) const
+{
+    if ( image.valid() && !ImageUtils::isNormalized(image.getImage()) )
+    {
+        // the image may be shared (see Cache), so normalize a private copy.
+        osg::ref_ptr<osg::Image> writable = ImageUtils::makeWritable( image.getImage() );
+        ImageUtils::normalizeImage( writable.get() );
+        image = GeoImage( writable.get(), image.getExtent() );
+    }
+}
+
+void
+ImageLayer::compressIfNecessary( GeoImage& image ) const
+{
+    if ( image.valid() && _runtimeOptions.textureCompression() == true && !ImageUtils::isCompressed(image.getImage()) )
+    {
+        osg::Image* compressed = ImageUtils::compressImageDXT( image.getImage() );
+        if ( compressed )
+        {
+            image = GeoImage( compressed, image.getExtent() );
+        }
+    }
+}
+
 GeoImage
 ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
 {
@@ -390,8 +429,14 @@ ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
 		{
 			OE_DEBUG << LC << "Layer \"" << getName()<< "\" got tile " << key.str() << " from map cache " << std::endl;
 
-            result = GeoImage( ImageUtils::cloneImage(cachedImage.get()), key.getExtent() );
-            ImageUtils::normalizeImage( result.getImage() );
+            // the cached image is shared and read-only (see Cache), and the caller
+            // may modify the result, so copy it if the cache still holds it.
+            osg::ref_ptr<osg::Image> image = ImageUtils::makeWritable( cachedImage.get() );
+            cachedImage = 0L;
+            result = GeoImage( image.get(), key.getExtent() );
+            normalizeIfNecessary( result );
+            compressIfNecessary( result );
+            recordAvailability( key, true, progress );
             return result;
 		}
 	}
@@ -400,11 +445,13 @@ ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
     if ( mapProfile->isEquivalentTo( layerProfile ) )
     {
 		OE_DEBUG << LC << "Key and source profiles are equivalent, requesting single tile" << std::endl;
+        // the image is shared and read-only (see Cache), so copy it if the cache holds it too.
         osg::ref_ptr<const osg::Image> image;
-        osg::Image* im = createImageWrapper( key, cacheInLayerProfile, progress );
-        if ( im )
+        if ( createImageWrapper( key, cacheInLayerProfile, image, progress ) )
         {
-            result = GeoImage( im, key.getExtent() );
+            osg::ref_ptr<osg::Image> writable = ImageUtils::makeWritable( image.get() );
+            image = 0L;
+            result = GeoImage( writable.get(), key.getExtent() );
         }
     }
 
@@ -443,14 +490,14 @@ ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
 
 				OE_DEBUG << LC << "\t Intersecting Tile " << j << ": " << minX << ", " << minY << ", " << maxX << ", " << maxY << std::endl;
 
-				osg::ref_ptr<osg::Image> img;
-                img = createImageWrapper( intersectingTiles[j], cacheInLayerProfile, progress );
+				osg::ref_ptr<const osg::Image> img;
+                createImageWrapper( intersectingTiles[j], cacheInLayerProfile, img, progress );
 
                 if ( img.valid() )
                 {
                     if (img->getPixelFormat() != GL_RGBA || img->getDataType() != GL_UNSIGNED_BYTE || img->getInternalTextureFormat() != GL_RGBA8 )
 					{
-                        osg::ref_ptr<osg::Image> convertedImg = ImageUtils::convertToRGBA8(img.get());
+                        osg::ref_ptr<const osg::Image> convertedImg = ImageUtils::convertToRGBA8(img.get());
                         if (convertedImg.valid())
                         {
                             img = convertedImg;
@@ -484,8 +531,8 @@ ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
                 for (unsigned int j = 0; j < missingTiles.size(); ++j)
                 {
                     // Create transparent image which size equals to the size of a valid image
-                    osg::ref_ptr<osg::Image> newImage = new osg::Image;
-                    newImage->allocateImage(tileWidth, tileHeight, tileDepth, validImage->getPixelFormat(), validImage->getDataType());
+                    osg::ref_ptr<osg::Image> newImage = Registry::instance()->getBufferPool()->createImage(
+                        tileWidth, tileHeight, tileDepth, validImage->getPixelFormat(), validImage->getDataType());
                     unsigned char *data = newImage->data(0,0);
                     memset(data, 0, newImage->getTotalSizeInBytes());
 
@@ -592,10 +639,10 @@ ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
     }
 
     // Normalize the image if necessary
-    if ( result.valid() )
-    {
-        ImageUtils::normalizeImage( result.getImage() );
-    }
+    normalizeIfNecessary( result );
+
+    // Compress before writing to the map cache, so that cached tiles are stored compressed.
+    compressIfNecessary( result );
 
 	//If we got a result, the cache is valid and we are caching in the map profile, write to the map cache.
     if (result.valid() && _cache.valid() && _runtimeOptions.cacheEnabled() == true && cacheInMapProfile)
@@ -603,12 +650,16 @@ ImageLayer::createImage( const TileKey& key, ProgressCallback* progress)
 		OE_DEBUG << LC << "Layer \"" << getName() << "\" writing tile " << key.str() << " to cache " << std::endl;
 		_cache->setImage( key, _cacheSpec, result.getImage());
 	}
+
+    recordAvailability( key, result.valid(), progress );
+
     return result;
 }
 
-osg::Image*
+bool
 ImageLayer::createImageWrapper(const TileKey& key,
                                bool cacheInLayerProfile,
+                               osg::ref_ptr<const osg::Image>& out_image,
                                ProgressCallback* progress )
 {
     // Results:
@@ -619,9 +670,10 @@ ImageLayer::createImageWrapper(const TileKey& key,
     // * return an "empty image" if the LOD is valid BUT the key does not intersect the
     //   source's data extents.
 
-    osg::Image* result = 0L;
+    osg::ref_ptr<const osg::Image> result;
 
     // first check the cache.
+    // (images come back shared with the caches, so they are never copied here.)
     // TODO: find a way to avoid caching/checking when the LOD falls
     if (_cache.valid() && cacheInLayerProfile && _runtimeOptions.cacheEnabled() == true )
     {
@@ -629,7 +681,8 @@ ImageLayer::createImageWrapper(const TileKey& key,
 		if ( _cache->getImage( key, _cacheSpec, cachedImage ) )
 	    {
             OE_INFO << LC << " Layer \"" << getName() << "\" got " << key.str() << " from cache " << std::endl;
-            return ImageUtils::cloneImage(cachedImage.get());
+            out_image = cachedImage.get();
+            return true;
     	}
     }
 
@@ -637,7 +690,7 @@ ImageLayer::createImageWrapper(const TileKey& key,
 	{
         TileSource* source = getTileSource();
         if ( !source )
-            return 0L;
+            return false;
 
         // Only try to get the image if it's not in the blacklist
         if ( !source->getBlacklist()->contains(key.getTileId()) )
@@ -653,10 +706,10 @@ ImageLayer::createImageWrapper(const TileKey& key,
                     //overwritten and deleted if this ImageLayer is added to another Map
                     //while createImage is going on.
                     osg::ref_ptr< TileSource::ImageOperation > op = _preCacheOp;
-                    result = source->createImage( key, op.get(), progress );
+                    source->getImage( key, result, op.get(), progress );
 
                     // if no result was created, add this key to the blacklist.
-                    if ( result == 0L && (!progress || !progress->isCanceled()) )
+                    if ( !result.valid() && (!progress || !progress->isCanceled()) )
                     {
                         //Add the tile to the blacklist
                         source->getBlacklist()->add(key.getTileId());
@@ -673,16 +726,17 @@ ImageLayer::createImageWrapper(const TileKey& key,
             else
             {
                 // in this case, the source cannot service the LOD
-                result = NULL;
+                result = 0L;
             }            
         }
 
         // Cache is necessary:
-        if ( result && _cache.valid() && cacheInLayerProfile && _runtimeOptions.cacheEnabled() == true )
+        if ( result.valid() && _cache.valid() && cacheInLayerProfile && _runtimeOptions.cacheEnabled() == true )
 		{
-			_cache->setImage( key, _cacheSpec, result );
+			_cache->setImage( key, _cacheSpec, result.get() );
 		}
 	}
 
-    return result;
+    out_image = result.get();
+    return out_image.valid();
 }
@@ -20,6 +20,7 @@
 #include <osgEarth/ImageMosaic>
 #include <osgEarth/ImageUtils>
 #include <osgEarth/HeightFieldUtils>
+#include <osgEarth/Registry>
 #include <osg/Notify>
 #include <osg/Timer>
 #include <osg/io_utils>
@@ -29,7 +30,7 @@ using namespace osgEarth;
 
 /***************************************************************************/
 
-TileImage::TileImage(osg::Image* image, const TileKey& key)
+TileImage::TileImage(const osg::Image* image, const TileKey& key)
 {
     _image = image;
     key.getExtent().getBounds(_minX, _minY, _maxX, _maxY);
@@ -98,8 +99,8 @@ ImageMosaic::createImage()
     unsigned int pixelsWide = tilesWide * tileWidth;
     unsigned int pixelsHigh = tilesHigh * tileHeight;
 
-    osg::ref_ptr<osg::Image> image = new osg::Image;
-    image->allocateImage(pixelsWide, pixelsHigh, 1, _images[0]._image->getPixelFormat(), _images[0]._image->getDataType());
+    osg::ref_ptr<osg::Image> image = Registry::instance()->getBufferPool()->createImage(
+        pixelsWide, pixelsHigh, 1, _images[0]._image->getPixelFormat(), _images[0]._image->getDataType());
     image->setInternalTextureFormat(_images[0]._image->getInternalTextureFormat()); 
 
     //Composite the incoming images into the master image
@@ -18,6 +18,7 @@
 */
 
 #include <osgEarth/ImageToHeightFieldConverter>
+#include <osgEarth/Registry>
 #include <osg/Notify>
 #include <limits.h>
 #include <string.h>
@@ -51,6 +52,45 @@ ImageToHeightFieldConverter::setRemoveNoDataValues( bool which, float f )
   _replace_nodata = which;
 }
 
+namespace
+{
+  /**
+   * Replaces the NODATA values in one row of a heightfield, in the same order (and with
+   * the same neighbor rules) as a full scan would: the left and upper neighbors are
+   * already final, the right and lower neighbors are the raw values of the row being
+   * converted and of the next source row.
+   */
+  void replaceNoData( float* row, const float* above, const float* below, unsigned int numCols, float fallback )
+  {
+    for( unsigned int col=0; col < numCols; ++col )
+    {
+      float val = row[col];
+      if ( !isNoData( val ) ) {
+        continue;
+      }
+      if ( col > 0 )
+        val = row[col-1];
+      else if ( col+1 < numCols )
+        val = row[col+1];
+
+      if ( isNoData( val ) )
+      {
+        if ( above )
+          val = above[col];
+        else if ( below )
+          val = below[col];
+      }
+
+      if ( isNoData( val ) )
+      {
+        val = fallback;
+      }
+
+      row[col] = val;
+    }
+  }
+}
+
 osg::HeightField* ImageToHeightFieldConverter::convert(const osg::Image* image ) {
   if ( !image ) {
     return NULL;
@@ -63,40 +103,6 @@ osg::HeightField* ImageToHeightFieldConverter::convert(const osg::Image* image )
     hf = convert16( image );
   }
 
-  // scan for and replace NODATA values. This algorithm is terrible but good enough for now
-  if ( _replace_nodata )
-  {
-    for( unsigned int row=0; row < hf->getNumRows(); ++row )
-    {
-      for( unsigned int col=0; col < hf->getNumColumns(); ++col )
-      {
-        float val = hf->getHeight(col, row);
-        if ( !isNoData( val ) ) {
-          continue;
-        }
-        if ( col > 0 )
-          val = hf->getHeight(col-1,row);
-        else if ( col <= hf->getNumColumns()-1 )
-          val = hf->getHeight(col+1,row);
-
-        if ( isNoData( val ) )
-        {
-          if ( row > 0 )
-            val = hf->getHeight(col, row-1);
-          else if ( row < hf->getNumRows()-1 )
-            val = hf->getHeight(col, row+1);
-        }
-
-        if ( isNoData( val ) )
-        {
-          val = _nodata_value;
-        }
-
-        hf->setHeight( col, row, val );
-      }
-    }
-  }
-
   return hf;
 }
 
@@ -105,13 +111,16 @@ osg::HeightField* ImageToHeightFieldConverter::convert16(const osg::Image* image
     return NULL;
   }
 
-  osg::HeightField *hf = new osg::HeightField();
-  hf->allocate( image->s(), image->t() );
-
-  osg::FloatArray* floats = hf->getFloatArray();
+  osg::HeightField *hf = Registry::instance()->getBufferPool()->createHeightField( image->s(), image->t() );
 
-  for( unsigned int i = 0; i < floats->size(); ++i ) {
-    floats->at( i ) = *(short*)image->data(i);
+  // one pass per row; 16-bit values are never NODATA once converted to float.
+  unsigned int numCols = image->s();
+  float* out = &hf->getFloatArray()->front();
+  for( int t = 0; t < image->t(); ++t, out += numCols )
+  {
+    const short* in = reinterpret_cast<const short*>( image->data(0, t) );
+    for( unsigned int i = 0; i < numCols; ++i )
+      out[i] = (float)in[i];
   }
 
   return hf;
@@ -122,15 +131,36 @@ osg::HeightField* ImageToHeightFieldConverter::convert32(const osg::Image* image
     return NULL;
   }
 
-  osg::HeightField *hf = new osg::HeightField();
-  hf->allocate( image->s(), image->t() );
+  osg::HeightField *hf = Registry::instance()->getBufferPool()->createHeightField( image->s(), image->t() );
+
+  unsigned int numCols = image->s();
+  unsigned int numRows = image->t();
+  float* out = &hf->getFloatArray()->front();
+
+  // when the rows are tightly packed the whole tile is a single copy.
+  if ( !_replace_nodata && image->getRowSizeInBytes() == numCols * sizeof(float) )
+  {
+    memcpy( out, image->data(), sizeof(float) * hf->getFloatArray()->size() );
+    return hf;
+  }
+
+  // otherwise copy row by row, replacing NODATA values as we go.
+  for( unsigned int t = 0; t < numRows; ++t )
+  {
+    float* row = out + t*numCols;
+    memcpy( row, image->data(0, t), sizeof(float) * numCols );
 
-  memcpy( &hf->getFloatArray()->front(), image->data(), sizeof(float) * hf->getFloatArray()->size() );
+    if ( _replace_nodata )
+    {
+      const float* above = t > 0 ? row - numCols : 0L;
+      const float* below = t == 0 && numRows > 1 ? reinterpret_cast<const float*>( image->data(0, 1) ) : 0L;
+      replaceNoData( row, above, below, numCols, _nodata_value );
+    }
+  }
 
   return hf;
 }
 
-
 osg::HeightField*
 ImageToHeightFieldConverter::convert(const osg::Image* image, float scaleFactor)
 {
@@ -167,10 +197,13 @@ osg::Image* ImageToHeightFieldConverter::convert16(const osg::HeightField* hf )
   osg::Image* image = new osg::Image();
   image->allocateImage(hf->getNumColumns(), hf->getNumRows(), 1, GL_LUMINANCE, GL_SHORT);
 
-  const osg::FloatArray* floats = hf->getFloatArray();
-
-  for( unsigned int i = 0; i < floats->size(); ++i  ) {
-    *(short*)image->data(i) = (short)floats->at( i );
+  unsigned int numCols = hf->getNumColumns();
+  const float* in = &hf->getFloatArray()->front();
+  for( unsigned int t = 0; t < hf->getNumRows(); ++t, in += numCols )
+  {
+    short* out = reinterpret_cast<short*>( image->data(0, t) );
+    for( unsigned int i = 0; i < numCols; ++i )
+      out[i] = (short)in[i];
   }
 
   return image;
@@ -184,7 +217,16 @@ osg::Image* ImageToHeightFieldConverter::convert32(const osg::HeightField* hf) c
   osg::Image* image = new osg::Image();
   image->allocateImage(hf->getNumColumns(), hf->getNumRows(), 1, GL_LUMINANCE, GL_FLOAT);
 
-  memcpy( image->data(), &hf->getFloatArray()->front(), sizeof(float) * hf->getFloatArray()->size() );
+  if ( image->getRowSizeInBytes() == hf->getNumColumns() * sizeof(float) )
+  {
+    memcpy( image->data(), &hf->getFloatArray()->front(), sizeof(float) * hf->getFloatArray()->size() );
+  }
+  else
+  {
+    const float* in = &hf->getFloatArray()->front();
+    for( unsigned int t = 0; t < hf->getNumRows(); ++t, in += hf->getNumColumns() )
+      memcpy( image->data(0, t), in, sizeof(float) * hf->getNumColumns() );
+  }
 
   return image;
 }
@@ -18,12 +18,14 @@
  */
 
 #include <osgEarth/ImageUtils>
+#include <osgEarth/Registry>
 #include <osg/Notify>
 #include <osg/Texture>
 #include <osg/ImageSequence>
 #include <osg/Timer>
 #include <osgDB/Registry>
 #include <string.h>
+#include <algorithm>
 //#include <memory.h>
 
 #define LC "[ImageUtils] "
@@ -39,12 +41,50 @@ ImageUtils::cloneImage( const osg::Image* input )
     // Calling clone->dirty() might work, but we are not sure.
 
     if ( !input ) return 0L;
+
+    // plain images get a pooled buffer; anything fancier goes through osg::clone.
+    if ( input->data() && !input->isMipmap() && !input->getUserData() && !dynamic_cast<const osg::ImageStream*>(input) )
+    {
+        osg::Image* clone = Registry::instance()->getBufferPool()->createImage(
+            input->s(), input->t(), input->r(), input->getPixelFormat(), input->getDataType(), input->getPacking() );
+        clone->setName( input->getName() );
+        clone->setFileName( input->getFileName() );
+        clone->setInternalTextureFormat( input->getInternalTextureFormat() );
+        clone->setOrigin( input->getOrigin() );
+        memcpy( clone->data(), input->data(), input->getTotalSizeInBytes() );
+        return clone;
+    }
     
     osg::Image* clone = osg::clone( input, osg::CopyOp::DEEP_COPY_ALL );
     clone->dirty();
     return clone;
 }
 
+osg::Image*
+ImageUtils::makeWritable( const osg::Image* image )
+{
+    if ( !image ) return 0L;
+
+    // nobody else can get at an image that only the caller references.
+    if ( image->referenceCount() <= 1 )
+        return const_cast<osg::Image*>( image );
+
+    return cloneImage( image );
+}
+
+bool
+ImageUtils::isNormalized( const osg::Image* image )
+{
+    if ( image->getDataType() == GL_UNSIGNED_BYTE )
+    {
+        if ( image->getPixelFormat() == GL_RGB )
+            return image->getInternalTextureFormat() == GL_RGB8;
+        else if ( image->getPixelFormat() == GL_RGBA )
+            return image->getInternalTextureFormat() == GL_RGBA8;
+    }
+    return true;
+}
+
 void
 ImageUtils::normalizeImage( osg::Image* image )
 {
@@ -128,17 +168,15 @@ ImageUtils::resizeImage(const osg::Image* input,
 
     if ( !output.valid() )
     {
-        output = new osg::Image();
-
         if ( PixelWriter::supports(input) )
         {
-            output->allocateImage( out_s, out_t, 1, input->getPixelFormat(), input->getDataType(), input->getPacking() );
+            output = Registry::instance()->getBufferPool()->createImage( out_s, out_t, 1, input->getPixelFormat(), input->getDataType(), input->getPacking() );
             output->setInternalTextureFormat( input->getInternalTextureFormat() );
         }
         else
         {
             // for unsupported write formats, convert to RGBA8 automatically.
-            output->allocateImage( out_s, out_t, 1, GL_RGBA, GL_UNSIGNED_BYTE );
+            output = Registry::instance()->getBufferPool()->createImage( out_s, out_t, 1, GL_RGBA, GL_UNSIGNED_BYTE );
             output->setInternalTextureFormat( GL_RGBA8 );
         }
     }
@@ -316,8 +354,7 @@ ImageUtils::cropImage(const osg::Image* image,
     //OE_NOTICE << "Copying from " << windowX << ", " << windowY << ", " << windowWidth << ", " << windowHeight << std::endl;
 
     //Allocate the croppped image
-    osg::Image* cropped = new osg::Image;
-    cropped->allocateImage(windowWidth, windowHeight, 1, image->getPixelFormat(), image->getDataType());
+    osg::Image* cropped = Registry::instance()->getBufferPool()->createImage(windowWidth, windowHeight, 1, image->getPixelFormat(), image->getDataType());
     cropped->setInternalTextureFormat( image->getInternalTextureFormat() );
     
     
@@ -410,8 +447,7 @@ ImageUtils::convert(const osg::Image* image, GLenum pixelFormat, GLenum dataType
     if ( !canConvert(image, pixelFormat, dataType) )
         return 0L;
 
-    osg::Image* result = new osg::Image();
-    result->allocateImage(image->s(), image->t(), image->r(), pixelFormat, dataType);
+    osg::Image* result = Registry::instance()->getBufferPool()->createImage(image->s(), image->t(), image->r(), pixelFormat, dataType);
 
     if ( pixelFormat == GL_RGB && dataType == GL_UNSIGNED_BYTE )
         result->setInternalTextureFormat( GL_RGB8 );
@@ -507,6 +543,204 @@ ImageUtils::isCompressed(const osg::Image *image)
 
 //------------------------------------------------------------------------
 
+namespace
+{
+    // Fast "real-time" DXT encoding (after J.M.P. van Waveren, 2006). All of the per-block
+    // work is straight-line integer math over a 4x4 RGBA8 block, with no searching.
+
+    inline unsigned short toRGB565( int r, int g, int b )
+    {
+        return (unsigned short)( ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3) );
+    }
+
+    inline void fromRGB565( unsigned short c, int* rgb )
+    {
+        int r = (c >> 11) & 0x1F, g = (c >> 5) & 0x3F, b = c & 0x1F;
+        rgb[0] = (r << 3) | (r >> 2);
+        rgb[1] = (g << 2) | (g >> 4);
+        rgb[2] = (b << 3) | (b >> 2);
+    }
+
+    // Writes the 8-byte BC1 color block for 16 RGBA8 pixels.
+    void encodeColorBlock( const unsigned char* block, unsigned char* out )
+    {
+        int minC[3] = { 255, 255, 255 };
+        int maxC[3] = { 0, 0, 0 };
+        for( int i=0; i<16; ++i )
+        {
+            const unsigned char* p = block + i*4;
+            for( int c=0; c<3; ++c )
+            {
+                if ( p[c] < minC[c] ) minC[c] = p[c];
+                if ( p[c] > maxC[c] ) maxC[c] = p[c];
+            }
+        }
+
+        // pick the bounding-box diagonal that follows the color distribution, using the
+        // channel with the largest range as the reference.
+        int ref = 0;
+        for( int c=1; c<3; ++c )
+            if ( maxC[c]-minC[c] > maxC[ref]-minC[ref] ) ref = c;
+
+        int center[3];
+        for( int c=0; c<3; ++c )
+            center[c] = (minC[c] + maxC[c]) >> 1;
+
+        for( int c=0; c<3; ++c )
+        {
+            if ( c == ref ) continue;
+            int cov = 0;
+            for( int i=0; i<16; ++i )
+                cov += (block[i*4+c] - center[c]) * (block[i*4+ref] - center[ref]);
+            if ( cov < 0 )
+                std::swap( minC[c], maxC[c] );
+        }
+
+        // inset the box by 1/16 of its extent to lower the error of the interior colors.
+        for( int c=0; c<3; ++c )
+        {
+            int inset = (maxC[c] - minC[c]) / 16;
+            maxC[c] -= inset;
+            minC[c] += inset;
+        }
+
+        unsigned short c0 = toRGB565( maxC[0], maxC[1], maxC[2] );
+        unsigned short c1 = toRGB565( minC[0], minC[1], minC[2] );
+
+        unsigned int indices = 0;
+        if ( c0 != c1 )
+        {
+            // four-color mode requires c0 > c1.
+            if ( c0 < c1 )
+                std::swap( c0, c1 );
+
+            int e0[3], e1[3];
+            fromRGB565( c0, e0 );
+            fromRGB565( c1, e1 );
+
+            int dir[3] = { e1[0]-e0[0], e1[1]-e0[1], e1[2]-e0[2] };
+            int len2 = dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2];
+
+            // palette order along the e0->e1 axis is 0, 2, 3, 1.
+            static const unsigned int remap[4] = { 0, 2, 3, 1 };
+
+            for( int i=0; i<16; ++i )
+            {
+                const unsigned char* p = block + i*4;
+                int d = (p[0]-e0[0])*dir[0] + (p[1]-e0[1])*dir[1] + (p[2]-e0[2])*dir[2];
+                d = d < 0 ? 0 : d > len2 ? len2 : d;
+                int step = (6*d + len2) / (2*len2);
+                indices |= remap[step] << (2*i);
+            }
+        }
+
+        out[0] = (unsigned char)(c0 & 0xFF);
+        out[1] = (unsigned char)(c0 >> 8);
+        out[2] = (unsigned char)(c1 & 0xFF);
+        out[3] = (unsigned char)(c1 >> 8);
+        out[4] = (unsigned char)(indices & 0xFF);
+        out[5] = (unsigned char)((indices >> 8) & 0xFF);
+        out[6] = (unsigned char)((indices >> 16) & 0xFF);
+        out[7] = (unsigned char)(indices >> 24);
+    }
+
+    // Writes the 8-byte BC3 alpha block for 16 RGBA8 pixels. The endpoints are the exact
+    // alpha extremes so that fully transparent and fully opaque pixels stay that way.
+    void encodeAlphaBlock( const unsigned char* block, unsigned char* out )
+    {
+        int a0 = 0, a1 = 255;
+        for( int i=0; i<16; ++i )
+        {
+            int a = block[i*4+3];
+            if ( a > a0 ) a0 = a;
+            if ( a < a1 ) a1 = a;
+        }
+
+        out[0] = (unsigned char)a0;
+        out[1] = (unsigned char)a1;
+
+        // eight-value mode (a0 > a1); index 0 is a0, 1 is a1, 2..7 run from a0 toward a1.
+        unsigned int bits[2] = { 0, 0 };
+        if ( a0 > a1 )
+        {
+            int range = a0 - a1;
+            for( int i=0; i<16; ++i )
+            {
+                int step = ((block[i*4+3] - a1) * 14 + range) / (2*range);
+                unsigned int index = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+                bits[i/8] |= index << (3*(i%8));
+            }
+        }
+
+        for( int h=0; h<2; ++h )
+        {
+            out[2+h*3] = (unsigned char)(bits[h] & 0xFF);
+            out[3+h*3] = (unsigned char)((bits[h] >> 8) & 0xFF);
+            out[4+h*3] = (unsigned char)((bits[h] >> 16) & 0xFF);
+        }
+    }
+}
+
+osg::Image*
+ImageUtils::compressImageDXT( const osg::Image* input )
+{
+    if ( !input || input->r() != 1 || input->s() % 4 != 0 || input->t() % 4 != 0 || isCompressed(input) )
+        return 0L;
+
+    osg::ref_ptr<const osg::Image> rgba = input;
+    if ( input->getPixelFormat() != GL_RGBA || input->getDataType() != GL_UNSIGNED_BYTE )
+    {
+        if ( !canConvert(input, GL_RGBA, GL_UNSIGNED_BYTE) )
+            return 0L;
+        rgba = convertToRGBA8( input );
+    }
+
+    // any non-opaque pixel requires the explicit alpha block of DXT5.
+    bool opaque = true;
+    for( int t=0; t<rgba->t() && opaque; ++t )
+    {
+        const unsigned char* p = rgba->data(0, t);
+        for( int s=0; s<rgba->s(); ++s, p += 4 )
+        {
+            if ( p[3] != 255 )
+            {
+                opaque = false;
+                break;
+            }
+        }
+    }
+
+    GLenum format = opaque ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+
+    osg::Image* output = new osg::Image();
+    output->allocateImage( rgba->s(), rgba->t(), 1, format, GL_UNSIGNED_BYTE );
+    output->setInternalTextureFormat( format );
+
+    unsigned char  block[64];
+    unsigned char* out = output->data();
+
+    for( int bt=0; bt < rgba->t(); bt += 4 )
+    {
+        for( int bs=0; bs < rgba->s(); bs += 4 )
+        {
+            for( int row=0; row<4; ++row )
+                ::memcpy( block + row*16, rgba->data(bs, bt+row), 16 );
+
+            if ( !opaque )
+            {
+                encodeAlphaBlock( block, out );
+                out += 8;
+            }
+            encodeColorBlock( block, out );
+            out += 8;
+        }
+    }
+
+    return output;
+}
+
+//------------------------------------------------------------------------
+
 namespace
 {
     //static const float r10= 1.0f/1023.0f;
@@ -870,6 +1104,70 @@ namespace
         }
     };
 
+    template<>
+    struct ColorReader<GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GLubyte>
+    {
+        static osg::Vec4 read(const ImageUtils::PixelReader* pr, int s, int t, int r, int m)
+        {
+            static const int BLOCK_BYTES = 16;
+
+            unsigned int blocksPerRow = pr->_image->s()/4;
+            unsigned int bs = s/4, bt = t/4;
+            unsigned int blockStart = (bt*blocksPerRow+bs) * BLOCK_BYTES;
+
+            const GLubyte* p = pr->data() + blockStart;
+            int ls = s-4*bs, lt = t-4*bt;
+            int x = ls + (4 * lt);
+
+            // alpha block: two 8-bit endpoints followed by 16 3-bit indices.
+            int a0 = p[0], a1 = p[1];
+            const GLubyte* bits = p + 2 + 3*(x/8);
+            unsigned int word = bits[0] | (bits[1] << 8) | (bits[2] << 16);
+            unsigned int aIndex = (word >> (3*(x%8))) & 0x07;
+
+            float alpha;
+            if ( aIndex == 0 )
+                alpha = a0;
+            else if ( aIndex == 1 )
+                alpha = a1;
+            else if ( a0 > a1 )
+                alpha = ((8-aIndex)*a0 + (aIndex-1)*a1) / 7.0f;
+            else if ( aIndex == 6 )
+                alpha = 0.0f;
+            else if ( aIndex == 7 )
+                alpha = 255.0f;
+            else
+                alpha = ((6-aIndex)*a0 + (aIndex-1)*a1) / 5.0f;
+
+            // color block: always decoded in four-color mode.
+            const GLubyte* c = p + 8;
+            GLushort c0p = c[0] | (c[1] << 8);
+            GLushort c1p = c[2] | (c[3] << 8);
+            osg::Vec4f c0(
+                (float)(c0p >> 11)/31.0f,
+                (float)((c0p & 0x07E0) >> 5)/63.0f,
+                (float)((c0p & 0x001F))/31.0f,
+                1.0f );
+            osg::Vec4f c1(
+                (float)(c1p >> 11)/31.0f,
+                (float)((c1p & 0x07E0) >> 5)/63.0f,
+                (float)((c1p & 0x001F))/31.0f,
+                1.0f );
+
+            unsigned int table = c[4] | (c[5] << 8) | (c[6] << 16) | ((unsigned int)c[7] << 24);
+            unsigned int index = (table >> (2*x)) & 0x00000003;
+
+            osg::Vec4f color =
+                index == 0 ? c0 :
+                index == 1 ? c1 :
+                index == 2 ? c0*(2.0f/3.0f) + c1*(1.0f/3.0f) :
+                             c0*(1.0f/3.0f) + c1*(2.0f/3.0f);
+
+            color.a() = alpha / 255.0f;
+            return color;
+        }
+    };
+
     template<int GLFormat>
     inline ImageUtils::PixelReader::ReaderFunc
     chooseReader(GLenum dataType)
@@ -931,6 +1229,9 @@ namespace
         case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
             return &ColorReader<GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GLubyte>::read;
             break;
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            return &ColorReader<GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, GLubyte>::read;
+            break;
         default:
             return 0L;
             break;
@@ -20,6 +20,7 @@
 #include <osgEarth/Registry>
 #include <osgEarth/TileSource>
 #include <OpenThreads/ScopedLock>
+#include <algorithm>
 #include <iterator>
 
 using namespace osgEarth;
@@ -64,6 +65,7 @@ MapCallback::onMapModelChanged( const MapModelChange& change )
 Map::Map( const MapOptions& options ) :
 osg::Referenced( true ),
 _mapOptions( options ),
+_mapDataMutex( "Map data" ),
 _dataModelRevision(0)
 {
     //NOP
@@ -92,7 +94,7 @@ Map::getImageLayers( ImageLayerVector& out_list, bool validLayersOnly ) const
 {
     out_list.reserve( _imageLayers.size() );
 
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     for( ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
         if ( !validLayersOnly || i->get()->getProfile() )
             out_list.push_back( i->get() );
@@ -103,14 +105,14 @@ Map::getImageLayers( ImageLayerVector& out_list, bool validLayersOnly ) const
 int
 Map::getNumImageLayers() const
 {
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     return _imageLayers.size();
 }
 
 ImageLayer*
 Map::getImageLayerByName( const std::string& name ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     for( ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
         if ( i->get()->getName() == name )
             return i->get();
@@ -120,7 +122,7 @@ Map::getImageLayerByName( const std::string& name ) const
 ImageLayer*
 Map::getImageLayerByUID( UID layerUID ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     for( ImageLayerVector::const_iterator i = _imageLayers.begin(); i != _imageLayers.end(); ++i )
         if ( i->get()->getUID() == layerUID )
             return i->get();
@@ -130,7 +132,7 @@ Map::getImageLayerByUID( UID layerUID ) const
 ImageLayer*
 Map::getImageLayerAt( int index ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     if ( index >= 0 && index < (int)_imageLayers.size() )
         return _imageLayers[index].get();
     else
@@ -142,7 +144,7 @@ Map::getElevationLayers( ElevationLayerVector& out_list, bool validLayersOnly )
 {
     out_list.reserve( _elevationLayers.size() );
 
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     for( ElevationLayerVector::const_iterator i = _elevationLayers.begin(); i != _elevationLayers.end(); ++i )
         if ( !validLayersOnly || i->get()->getProfile() )
             out_list.push_back( i->get() );
@@ -153,14 +155,14 @@ Map::getElevationLayers( ElevationLayerVector& out_list, bool validLayersOnly )
 int
 Map::getNumElevationLayers() const
 {
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     return _elevationLayers.size();
 }
 
 ElevationLayer*
 Map::getElevationLayerByName( const std::string& name ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     for( ElevationLayerVector::const_iterator i = _elevationLayers.begin(); i != _elevationLayers.end(); ++i )
         if ( i->get()->getName() == name )
             return i->get();
@@ -170,7 +172,7 @@ Map::getElevationLayerByName( const std::string& name ) const
 ElevationLayer*
 Map::getElevationLayerByUID( UID layerUID ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     for( ElevationLayerVector::const_iterator i = _elevationLayers.begin(); i != _elevationLayers.end(); ++i )
         if ( i->get()->getUID() == layerUID )
             return i->get();
@@ -180,7 +182,7 @@ Map::getElevationLayerByUID( UID layerUID ) const
 ElevationLayer*
 Map::getElevationLayerAt( int index ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     if ( index >= 0 && index < (int)_elevationLayers.size() )
         return _elevationLayers[index].get();
     else
@@ -192,7 +194,7 @@ Map::getModelLayers( ModelLayerVector& out_list, bool validLayersOnly ) const
 {
     out_list.reserve( _modelLayers.size() );
 
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     for( ModelLayerVector::const_iterator i = _modelLayers.begin(); i != _modelLayers.end(); ++i )
         //if ( !validLayersOnly || i->get()->i->get()->getProfile() )
             out_list.push_back( i->get() );
@@ -203,7 +205,7 @@ Map::getModelLayers( ModelLayerVector& out_list, bool validLayersOnly ) const
 ModelLayer*
 Map::getModelLayerByName( const std::string& name ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     for( ModelLayerVector::const_iterator i = _modelLayers.begin(); i != _modelLayers.end(); ++i )
         if ( i->get()->getName() == name )
             return i->get();
@@ -213,7 +215,7 @@ Map::getModelLayerByName( const std::string& name ) const
 ModelLayer*
 Map::getModelLayerByUID( UID layerUID ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     for( ModelLayerVector::const_iterator i = _modelLayers.begin(); i != _modelLayers.end(); ++i )
         if ( i->get()->getUID() == layerUID )
             return i->get();
@@ -224,7 +226,7 @@ Map::getModelLayerByUID( UID layerUID ) const
 ModelLayer*
 Map::getModelLayerAt( int index ) const
 {
-    Threading::ScopedReadLock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     if ( index >= 0 && index < (int)_modelLayers.size() )
         return _modelLayers[index].get();
     else
@@ -234,7 +236,7 @@ Map::getModelLayerAt( int index ) const
 int
 Map::getNumModelLayers() const
 {
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     return _modelLayers.size();
 }
 
@@ -243,7 +245,7 @@ Map::getTerrainMaskLayers( MaskLayerVector& out_list ) const
 {
     out_list.reserve( _terrainMaskLayers.size() );
 
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     for( MaskLayerVector::const_iterator i = _terrainMaskLayers.begin(); i != _terrainMaskLayers.end(); ++i )
         out_list.push_back( i->get() );
 
@@ -258,7 +260,7 @@ Map::setName( const std::string& name ) {
 Revision
 Map::getDataModelRevision() const
 {
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
     return _dataModelRevision;
 }
 
@@ -361,7 +363,7 @@ Map::addImageLayer( ImageLayer* layer )
 
         // Add the layer to our stack.
         {
-            Threading::ScopedWriteLock lock( _mapDataMutex );
+            Threading::ScopedWriteLock lock( _mapDataMutex, OE_LOCK_SITE );
 
             _imageLayers.push_back( layer );
             index = _imageLayers.size() - 1;
@@ -405,7 +407,7 @@ Map::insertImageLayer( ImageLayer* layer, unsigned int index )
 
         // Add the layer to our stack.
         {
-            Threading::ScopedWriteLock lock( _mapDataMutex );
+            Threading::ScopedWriteLock lock( _mapDataMutex, OE_LOCK_SITE );
 
             if (index >= _imageLayers.size())
                 _imageLayers.push_back(layer);
@@ -451,7 +453,7 @@ Map::addElevationLayer( ElevationLayer* layer )
 
         // Add the layer to our stack.
         {
-            Threading::ScopedWriteLock lock( _mapDataMutex );
+            Threading::ScopedWriteLock lock( _mapDataMutex, OE_LOCK_SITE );
 
             _elevationLayers.push_back( layer );
             index = _elevationLayers.size() - 1;
@@ -478,7 +480,7 @@ Map::removeImageLayer( ImageLayer* layer )
 
     if ( layerToRemove.get() )
     {
-        Threading::ScopedWriteLock lock( _mapDataMutex );
+        Threading::ScopedWriteLock lock( _mapDataMutex, OE_LOCK_SITE );
         index = 0;
         for( ImageLayerVector::iterator i = _imageLayers.begin(); i != _imageLayers.end(); i++, index++ )
         {
@@ -514,7 +516,7 @@ Map::removeElevationLayer( ElevationLayer* layer )
 
     if ( layerToRemove.get() )
     {
-        Threading::ScopedWriteLock lock( _mapDataMutex );
+        Threading::ScopedWriteLock lock( _mapDataMutex, OE_LOCK_SITE );
         index = 0;
         for( ElevationLayerVector::iterator i = _elevationLayers.begin(); i != _elevationLayers.end(); i++, index++ )
         {
@@ -547,7 +549,7 @@ Map::moveImageLayer( ImageLayer* layer, unsigned int newIndex )
 
     if ( layer )
     {
-        Threading::ScopedWriteLock lock( _mapDataMutex );
+        Threading::ScopedWriteLock lock( _mapDataMutex, OE_LOCK_SITE );
 
         // preserve the layer with a ref:
         osg::ref_ptr<ImageLayer> layerToMove = layer;
@@ -594,7 +596,7 @@ Map::moveElevationLayer( ElevationLayer* layer, unsigned int newIndex )
 
     if ( layer )
     {
-        Threading::ScopedWriteLock lock( _mapDataMutex );
+        Threading::ScopedWriteLock lock( _mapDataMutex, OE_LOCK_SITE );
 
         // preserve the layer with a ref:
         osg::ref_ptr<ElevationLayer> layerToMove = layer;
@@ -641,7 +643,7 @@ Map::addModelLayer( ModelLayer* layer )
 
         Revision newRevision;
         {
-            Threading::ScopedWriteLock lock( _mapDataMutex );
+            Threading::ScopedWriteLock lock( _mapDataMutex, OE_LOCK_SITE );
             _modelLayers.push_back( layer );
 						index = _modelLayers.size() - 1;
             newRevision = ++_dataModelRevision;
@@ -665,7 +667,7 @@ Map::insertModelLayer( ModelLayer* layer, unsigned int index )
     {
         Revision newRevision;
         {
-            Threading::ScopedWriteLock lock( _mapDataMutex );
+            Threading::ScopedWriteLock lock( _mapDataMutex, OE_LOCK_SITE );
             _modelLayers.insert( _modelLayers.begin() + index, layer );
             newRevision = ++_dataModelRevision;
         }
@@ -691,7 +693,7 @@ Map::removeModelLayer( ModelLayer* layer )
 
         Revision newRevision;
         {
-            Threading::ScopedWriteLock lock( _mapDataMutex );
+            Threading::ScopedWriteLock lock( _mapDataMutex, OE_LOCK_SITE );
             for( ModelLayerVector::iterator i = _modelLayers.begin(); i != _modelLayers.end(); ++i )
             {
                 if ( i->get() == layer )
@@ -720,7 +722,7 @@ Map::moveModelLayer( ModelLayer* layer, unsigned int newIndex )
 
     if ( layer )
     {
-        Threading::ScopedWriteLock lock( _mapDataMutex );
+        Threading::ScopedWriteLock lock( _mapDataMutex, OE_LOCK_SITE );
 
         // preserve the layer with a ref:
         osg::ref_ptr<ModelLayer> layerToMove = layer;
@@ -765,7 +767,7 @@ Map::addTerrainMaskLayer( MaskLayer* layer )
     {
         Revision newRevision;
         {
-            Threading::ScopedWriteLock lock( _mapDataMutex );
+            Threading::ScopedWriteLock lock( _mapDataMutex, OE_LOCK_SITE );
             _terrainMaskLayers.push_back(layer);
             newRevision = ++_dataModelRevision;
         }
@@ -790,7 +792,7 @@ Map::removeTerrainMaskLayer( MaskLayer* layer )
         osg::ref_ptr< MaskLayer > layerRef = layer;
         Revision newRevision;
         {
-            Threading::ScopedWriteLock lock( _mapDataMutex );
+            Threading::ScopedWriteLock lock( _mapDataMutex, OE_LOCK_SITE );
             for( MaskLayerVector::iterator i = _terrainMaskLayers.begin(); i != _terrainMaskLayers.end(); ++i )
             {
                 if ( i->get() == layer )
@@ -863,7 +865,7 @@ Map::calculateProfile()
         // At this point, if we don't have a profile we need to search tile sources until we find one.
         if ( !_profile.valid() )
         {
-            Threading::ScopedReadLock lock( _mapDataMutex );
+            Threading::ScopedReadLock lock( _mapDataMutex, OE_LOCK_SITE );
 
             for( ImageLayerVector::iterator i = _imageLayers.begin(); i != _imageLayers.end() && !_profile.valid(); i++ )
             {
@@ -905,7 +907,7 @@ Map::calculateProfile()
     {
         // tell all the loaded layers what the profile is, as a hint
         {
-            Threading::ScopedWriteLock lock( _mapDataMutex );
+            Threading::ScopedWriteLock lock( _mapDataMutex, OE_LOCK_SITE );
 
             for( ImageLayerVector::iterator i = _imageLayers.begin(); i != _imageLayers.end(); i++ )
             {
@@ -957,11 +959,13 @@ namespace
             ElevationLayer* layer = i->get();
             if (layer->getProfile() && layer->getEnabled() )
             {
-                osg::HeightField* hf = layer->createHeightField( key, progress );
-                layerValidMap[ layer ] = (hf != 0L);
-                if ( hf )                {
+                // shared with the layer's caches; we only read it, or copy it to modify it.
+                osg::ref_ptr<const osg::HeightField> hf;
+                layer->getHeightField( key, hf, progress );
+                layerValidMap[ layer ] = hf.valid();
+                if ( hf.valid() )                {
                     numValidHeightFields++;
-                    GeoHeightField ghf( hf, key.getExtent(), layer->getProfile()->getVerticalSRS() );
+                    GeoHeightField ghf( hf.get(), key.getExtent(), layer->getProfile()->getVerticalSRS() );
                     heightFields.push_back( ghf );
                 }
             }
@@ -983,12 +987,20 @@ namespace
             {
                 if (!layerValidMap[ layer ])
                 {
+                    // Ask the layer's availability index for the deepest level that should
+                    // have data, and go straight there instead of trying every level.
                     TileKey hf_key = key;
-                    osg::ref_ptr< osg::HeightField > hf;
-                    while (hf_key.valid())
+                    osg::ref_ptr< const osg::HeightField > hf;
+                    unsigned bestLOD;
+                    while (hf_key.valid() && layer->getBestAvailableLOD( hf_key, bestLOD ))
                     {
-                        hf = layer->createHeightField( hf_key, progress );
-                        if ( hf.valid() )
+                        if ( bestLOD < hf_key.getLevelOfDetail() )
+                            hf_key = hf_key.createAncestorKey( bestLOD );
+
+                        if ( layer->getHeightField( hf_key, hf, progress ) )
+                            break;
+
+                        if ( progress && progress->isCanceled() )
                             break;
 
                         hf_key = hf_key.createParentKey();
@@ -996,6 +1008,10 @@ namespace
 
                     if (hf.valid())
                     {
+                        // remember where this search ended so that neighboring keys skip it.
+                        if ( !layer->isDynamic() )
+                            layer->getDataAvailabilityIndex()->setFallback( key, hf_key.getLevelOfDetail() );
+
                         if ( hf_key.getLevelOfDetail() < lowestLOD )
                             lowestLOD = hf_key.getLevelOfDetail();
 
@@ -1020,8 +1036,11 @@ namespace
 	    {
             if ( lowestLOD == key.getLevelOfDetail() )
             {
-		        //If we only have on heightfield, just return it.
-		        out_result = heightFields[0].takeHeightField();
+		        //If we only have on heightfield, just return it. The result gets modified below,
+		        //so it is copied if a cache holds it too.
+		        osg::ref_ptr<const osg::HeightField> hf = heightFields[0].getHeightField();
+		        heightFields.clear();
+		        out_result = HeightFieldUtils::makeWritable( hf.get() );
             }
             else
             {
@@ -1044,8 +1063,7 @@ namespace
 			    if (i->getHeightField()->getNumRows() > height) 
                     height = i->getHeightField()->getNumRows();
 		    }
-		    out_result = new osg::HeightField();
-		    out_result->allocate( width, height );
+		    out_result = Registry::instance()->getBufferPool()->createHeightField( width, height );
 
 		    //Go ahead and set up the heightfield so we don't have to worry about it later
             double minx, miny, maxx, maxy;
@@ -1155,7 +1173,7 @@ Map::getHeightField(const TileKey& key,
                     ElevationSamplePolicy samplePolicy,
                     ProgressCallback* progress) const
 {
-    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
+    Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
 
     return s_getHeightField(
         key, _elevationLayers, getProfile(), fallback, 
@@ -1172,7 +1190,7 @@ Map::sync( MapFrame& frame ) const
     if ( frame._mapDataModelRevision != _dataModelRevision || !frame._initialized )
     {
         // hold the read lock while copying the layer lists.
-        Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex );
+        Threading::ScopedReadLock lock( const_cast<Map*>(this)->_mapDataMutex, OE_LOCK_SITE );
 
         if ( frame._parts & IMAGE_LAYERS )
         {
@@ -1401,72 +1419,59 @@ MapFrame::getImageLayerByName( const std::string& name ) const
     return 0L;
 }
 
-bool
-MapFrame::isCached( const osgEarth::TileKey& key ) const
+namespace
 {
-    const Profile* mapProfile = getProfile();
-
-    //Check the imagery layers
-    for( ImageLayerVector::const_iterator i = imageLayers().begin(); i != imageLayers().end(); i++ )
+    // checks the layer's cache for all the layer tiles that cover the map key, in one query.
+    bool isLayerCached( TerrainLayer* layer, const Profile* mapProfile, const TileKey& key )
     {
-        ImageLayer* layer = i->get();
         osg::ref_ptr< Cache > cache = layer->getCache();
 
         if ( !cache.valid() || !layer->getProfile() ) 
             return false;
 
-        std::vector< TileKey > keys;
+        std::vector< TileKey > intersectingKeys;
 
         if ( mapProfile->isEquivalentTo( layer->getProfile() ) )
         {
-            keys.push_back( key );
+            intersectingKeys.push_back( key );
         }
         else
         {
-            layer->getProfile()->getIntersectingTiles( key, keys );
+            layer->getProfile()->getIntersectingTiles( key, intersectingKeys );
         }
 
-        for (unsigned int j = 0; j < keys.size(); ++j)
+        std::vector< TileKey > keys;
+        for (unsigned int j = 0; j < intersectingKeys.size(); ++j)
         {
-            if ( layer->isKeyValid( keys[j] ) )
-            {
-                if ( !cache->isCached( keys[j], layer->getCacheSpec() ) )
-                {
-                    return false;
-                }
-            }
+            if ( layer->isKeyValid( intersectingKeys[j] ) )
+                keys.push_back( intersectingKeys[j] );
         }
-    }
 
-    for( ElevationLayerVector::const_iterator i = elevationLayers().begin(); i != elevationLayers().end(); ++i )
-    {
-        ElevationLayer* layer = i->get();
-        osg::ref_ptr< Cache > cache = layer->getCache();
+        if ( keys.empty() )
+            return true;
 
-        if ( !cache.valid() || !layer->getProfile() )
-            return false;
+        std::vector< bool > cached;
+        cache->isCached( keys, layer->getCacheSpec(), cached );
+        return std::find( cached.begin(), cached.end(), false ) == cached.end();
+    }
+}
 
-        std::vector<TileKey> keys;
+bool
+MapFrame::isCached( const osgEarth::TileKey& key ) const
+{
+    const Profile* mapProfile = getProfile();
 
-        if ( mapProfile->isEquivalentTo( layer->getProfile() ) )
-        {
-            keys.push_back( key );
-        }
-        else
-        {
-            layer->getProfile()->getIntersectingTiles( key, keys );
-        }
+    //Check the imagery layers
+    for( ImageLayerVector::const_iterator i = imageLayers().begin(); i != imageLayers().end(); i++ )
+    {
+        if ( !isLayerCached( i->get(), mapProfile, key ) )
+            return false;
+    }
 
-        for (unsigned int j = 0; j < keys.size(); ++j)
-        {
-            if ( layer->isKeyValid( keys[j] ) )
-            {
-                if ( !cache->isCached( keys[j], layer->getCacheSpec() ) )
-                {
-                    return false;
-                }
-            }
-        }
+    for( ElevationLayerVector::const_iterator i = elevationLayers().begin(); i != elevationLayers().end(); ++i )
+    {
+        if ( !isLayerCached( i->get(), mapProfile, key ) )
+            return false;
     }
     return true;
 }
@@ -559,6 +559,9 @@ MapNode::traverse( osg::NodeVisitor& nv )
             //accept( v );
             _terrainEngine->accept( v );
         }
+
+        // give the task service manager a chance to rebalance its threads
+        Registry::instance()->getTaskServiceManager()->update();
     }
 
     osg::Group::traverse( nv );
@@ -223,7 +223,10 @@ _useWarping   ( false ),
 _warp         ( 1.0f ),
 _visualizeWarp( false ),
 _mipmapping   ( true ),
-_rttBlending  ( true )
+_rttBlending  ( true ),
+_projectionTolerance( 0.0 ),
+_rttCaching   ( false ),
+_rttCurrent   ( false )
 {
     // nop
 }
@@ -233,6 +236,10 @@ OverlayDecorator::reinit()
 {
     if ( !_engine.valid() ) return;
 
+    // anything we rebuild here invalidates the cached projection and texture.
+    _projectionInputs._valid = false;
+    _rttCurrent = false;
+
     if ( _overlayGraph.valid() )
     {
         // apply the user-request texture unit, if applicable:
@@ -572,6 +579,23 @@ OverlayDecorator::setOverlayBlending( bool value )
     }
 }
 
+void
+OverlayDecorator::setProjectionTolerance( double value )
+{
+    _projectionTolerance = osg::maximum( value, 0.0 );
+    _projectionInputs._valid = false;
+}
+
+void
+OverlayDecorator::setOverlayTextureCaching( bool value )
+{
+    if ( value != _rttCaching )
+    {
+        _rttCaching = value;
+        _rttCurrent = false;
+    }
+}
+
 void
 OverlayDecorator::onInstall( TerrainEngineNode* engine )
 {
@@ -694,8 +718,6 @@ OverlayDecorator::cull( osgUtil::CullVisitor* cv )
         // there is no maximum horizon distance in a projected map
         horizonDistance = DBL_MAX;
         horizonDistanceInRTTPlane = DBL_MAX;
-
-        _rttViewMatrix = osg::Matrixd::lookAt( eye, eye-worldUp*hasl, osg::Vec3(0,1,0) );
     }
 
     // create a "weighting" that weights HASL against the camera's pitch.
@@ -758,6 +780,52 @@ OverlayDecorator::cull( osgUtil::CullVisitor* cv )
     // projection matrix.
     cv->setCalculatedNearPlane( osg::minimum(zSavedNear, zNear) );
     cv->setCalculatedFarPlane( osg::maximum(zSavedFar, zFar) );
+
+    // if the view hasn't changed (much) since we last computed the projection, and the
+    // overlay graph hasn't moved, reuse the projection (and maybe the texture) as-is.
+    const osg::BoundingSphere& overlayBound = _overlayGraph->getBound();
+    bool overlayMoved =
+        overlayBound.center() != _projectionInputs._overlayBound.center() ||
+        overlayBound.radius() != _projectionInputs._overlayBound.radius();
+
+    if ( _projectionInputs._valid && !overlayMoved )
+    {
+        const ProjectionInputs& last = _projectionInputs;
+        double tol = _projectionTolerance;
+
+        osg::Vec3d look( camLookVec );
+        osg::Vec3d upVec( up );
+        upVec.normalize();
+
+        // (1-cos) of the rotation tolerance; near enough to angle^2/2 for small angles.
+        double maxCosDelta = 1.0 - cos( osg::minimum(tol, osg::PI) );
+
+        bool reuse =
+            (eye - last._eye).length() <= tol * hasl &&
+            1.0 - (look * last._look) <= maxCosDelta &&
+            1.0 - (upVec * last._up) <= maxCosDelta &&
+            *cv->getProjectionMatrix() == last._proj &&
+            osg::absolute(zNear - last._zNear) <= tol * osg::absolute(last._zNear) &&
+            osg::absolute(zFar - last._zFar) <= tol * osg::absolute(last._zFar);
+
+        if ( reuse )
+        {
+            // the first reuse is the frame after the texture was rendered with this projection.
+            _rttCurrent = _rttCaching;
+            return;
+        }
+    }
+
+    _rttCurrent = false;
+    _projectionInputs._valid        = true;
+    _projectionInputs._eye          = eye;
+    _projectionInputs._look         = camLookVec;
+    _projectionInputs._up           = up;
+    _projectionInputs._up.normalize();
+    _projectionInputs._proj         = *cv->getProjectionMatrix();
+    _projectionInputs._zNear        = zNear;
+    _projectionInputs._zFar         = zFar;
+    _projectionInputs._overlayBound = overlayBound;
        
     // contruct the polyhedron representing the viewing frustum.
     //osgShadow::ConvexPolyhedron frustumPH;
@@ -826,6 +894,7 @@ OverlayDecorator::cull( osgUtil::CullVisitor* cv )
         double new_eMax;
         getMinMaxExtentInSilhouette( from, osg::Vec3d(0,0,-1), verts, eMin, new_eMax );   
         eMax = std::min( eMax, new_eMax ); 
+        _rttViewMatrix = osg::Matrixd::lookAt( eye, eye-worldUp*hasl, osg::Vec3(0,1,0) );
         _rttProjMatrix = osg::Matrix::ortho( -eMax, eMax, -eMax, eMax, -eyeLen, eyeLen );
     }
 
@@ -893,7 +962,10 @@ OverlayDecorator::traverse( osg::NodeVisitor& nv )
             {
                 cull( cv );
             }
-            _rttCamera->accept( nv );
+
+            // the overlay texture still holds the last render if nothing changed.
+            if ( !_rttCurrent )
+                _rttCamera->accept( nv );
             
             // note: texgennode doesn't need a cull, and the subgraph
             // is traversed in cull().
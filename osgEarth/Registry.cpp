@@ -60,6 +60,8 @@ _caps( 0L )
 
     _shaderLib = new ShaderFactory();
     _taskServiceManager = new TaskServiceManager();
+    _residencyManager = new ResidencyManager();
+    _bufferPool = new BufferPool();
 
     // activate KMZ support
     osgDB::Registry::instance()->addFileExtensionAlias( "kmz", "kml" );
@@ -83,6 +85,15 @@ _caps( 0L )
         setCacheOverride( new TMSCache(tmso) );
         OE_INFO << LC << "Setting cache (from env.var.) to " << tmso.path() << std::endl;
     }
+
+    // see if there's a memory budget (in MB) in the envvar
+    const char* budget = ::getenv("OSGEARTH_MEMORY_BUDGET");
+    if ( budget )
+    {
+        size_t mb = (size_t)::atol( budget );
+        _residencyManager->setBudget( mb * 1024 * 1024 );
+        OE_INFO << LC << "Setting memory budget (from env.var.) to " << mb << " MB" << std::endl;
+    }
 }
 
 Registry::~Registry()
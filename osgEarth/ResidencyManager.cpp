@@ -0,0 +1,345 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/ResidencyManager>
+#include <osgEarth/Registry>
+#include <osg/Image>
+#include <osg/Shape>
+#include <osg/Timer>
+#include <osgTerrain/TerrainTile>
+#include <osgTerrain/Layer>
+#include <iomanip>
+#include <ostream>
+
+using namespace osgEarth;
+
+#define LC "[ResidencyManager] "
+
+// size assumed for objects we cannot measure
+#define DEFAULT_OBJECT_SIZE 1024
+
+// once over budget, evict down to this fraction of it, so the next walk is a
+// while away rather than on the very next insert
+#define LOW_WATER_MARK 0.9
+
+//------------------------------------------------------------------------
+
+ResidencyConsumer::~ResidencyConsumer()
+{
+    //nop
+}
+
+void
+ResidencyConsumer::attach( const std::string& name, float cost )
+{
+    Registry* registry = Registry::instance();
+    if ( registry && registry->getResidencyManager() )
+    {
+        _residencyManager = registry->getResidencyManager();
+        _residencyManager->add( this, name, cost );
+    }
+}
+
+void
+ResidencyConsumer::detach()
+{
+    // use the manager we attached to rather than the Registry's: at exit the
+    // Registry may have released it (or be gone) while caches are still torn down.
+    if ( _residencyManager.valid() )
+    {
+        _residencyManager->remove( this );
+        _residencyManager = 0L;
+    }
+}
+
+std::string
+ResidencyConsumer::getResidencyName() const
+{
+    ResidencyUsage usage;
+    if ( _residencyManager.valid() && _residencyManager->getUsage(this, usage) )
+        return usage._name;
+    return std::string();
+}
+
+float
+ResidencyConsumer::getResidencyCost() const
+{
+    ResidencyUsage usage;
+    if ( _residencyManager.valid() && _residencyManager->getUsage(this, usage) )
+        return usage._cost;
+    return 1.0f;
+}
+
+//------------------------------------------------------------------------
+
+ResidencyManager::ResidencyManager() :
+osg::Referenced( true ),
+_budget  ( 0 ),
+_resident( 0 )
+{
+    //nop
+}
+
+void
+ResidencyManager::setBudget( size_t bytes )
+{
+    _budget = bytes;
+    enforce();
+}
+
+void
+ResidencyManager::add( ResidencyConsumer* consumer, const std::string& name, float cost )
+{
+    if ( !consumer )
+        return;
+
+    Threading::ScopedMutexLock lock( _mutex );
+    for( EntryVector::iterator i = _entries.begin(); i != _entries.end(); ++i )
+    {
+        if ( i->_consumer == consumer )
+            return;
+    }
+
+    Entry entry;
+    entry._consumer     = consumer;
+    entry._usage._name  = name;
+    entry._usage._cost  = cost > 0.0f ? cost : 1.0f;
+    _entries.push_back( entry );
+}
+
+void
+ResidencyManager::remove( ResidencyConsumer* consumer )
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    for( EntryVector::iterator i = _entries.begin(); i != _entries.end(); ++i )
+    {
+        if ( i->_consumer == consumer )
+        {
+            _entries.erase( i );
+            return;
+        }
+    }
+}
+
+void
+ResidencyManager::setCost( ResidencyConsumer* consumer, float cost )
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    for( EntryVector::iterator i = _entries.begin(); i != _entries.end(); ++i )
+    {
+        if ( i->_consumer == consumer )
+            i->_usage._cost = cost > 0.0f ? cost : 1.0f;
+    }
+}
+
+size_t
+ResidencyManager::getResidentBytes() const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    size_t total = 0;
+    for( EntryVector::const_iterator i = _entries.begin(); i != _entries.end(); ++i )
+        total += i->_consumer->getResidentBytes();
+    return total;
+}
+
+void
+ResidencyManager::getUsage( ResidencyUsageVector& out_usage ) const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    out_usage.clear();
+    out_usage.reserve( _entries.size() );
+    for( EntryVector::const_iterator i = _entries.begin(); i != _entries.end(); ++i )
+    {
+        ResidencyUsage usage = i->_usage;
+        usage._bytes   = i->_consumer->getResidentBytes();
+        usage._entries = i->_consumer->getResidentEntries();
+        out_usage.push_back( usage );
+    }
+}
+
+bool
+ResidencyManager::getUsage( const ResidencyConsumer* consumer, ResidencyUsage& out_usage ) const
+{
+    Threading::ScopedMutexLock lock( _mutex );
+    for( EntryVector::const_iterator i = _entries.begin(); i != _entries.end(); ++i )
+    {
+        if ( i->_consumer == consumer )
+        {
+            out_usage = i->_usage;
+            out_usage._bytes   = consumer->getResidentBytes();
+            out_usage._entries = consumer->getResidentEntries();
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+ResidencyManager::report( std::ostream& out ) const
+{
+    ResidencyUsageVector usage;
+    getUsage( usage );
+
+    size_t total = 0;
+    for( ResidencyUsageVector::const_iterator i = usage.begin(); i != usage.end(); ++i )
+    {
+        out << std::setw(24) << std::left << i->_name << std::right
+            << " bytes=" << i->_bytes
+            << " entries=" << i->_entries
+            << " cost=" << i->_cost
+            << " evictions=" << i->_evictions
+            << " evictedBytes=" << i->_evictedBytes
+            << std::endl;
+        total += i->_bytes;
+    }
+    out << "Total: " << total << " bytes, budget: ";
+    if ( _budget > 0 )
+        out << _budget << " bytes" << std::endl;
+    else
+        out << "none" << std::endl;
+}
+
+void
+ResidencyManager::added( size_t bytes )
+{
+    if ( _budget == 0 )
+        return;
+
+    // the common case: still under budget, so no need to touch the consumers.
+    {
+        Threading::ScopedMutexLock lock( _residentMutex );
+        _resident += bytes;
+        if ( _resident <= _budget )
+            return;
+    }
+
+    Threading::ScopedMutexLock lock( _mutex );
+
+    // another thread may have enforced the budget while we waited for the lock:
+    {
+        Threading::ScopedMutexLock residentLock( _residentMutex );
+        if ( _resident <= _budget )
+            return;
+    }
+
+    enforceLocked();
+}
+
+void
+ResidencyManager::enforce()
+{
+    if ( _budget == 0 )
+        return;
+
+    // holding the lock for the whole pass serializes enforcement, and keeps
+    // consumers from unregistering (and going away) while we evict from them.
+    Threading::ScopedMutexLock lock( _mutex );
+    enforceLocked();
+}
+
+void
+ResidencyManager::enforceLocked()
+{
+    size_t total = 0;
+    for( EntryVector::const_iterator i = _entries.begin(); i != _entries.end(); ++i )
+        total += i->_consumer->getResidentBytes();
+
+    if ( total > _budget )
+    {
+        size_t target = (size_t)( (double)_budget * LOW_WATER_MARK );
+        double now = osg::Timer::instance()->time_s();
+
+        while( total > target )
+        {
+            Entry* victim = 0L;
+            double bestScore = 0.0;
+
+            for( EntryVector::iterator i = _entries.begin(); i != _entries.end(); ++i )
+            {
+                double lastUsed;
+                size_t bytes;
+                if ( i->_consumer->getOldestResident(lastUsed, bytes) )
+                {
+                    // the small bias ranks entries used "just now" by size rather than
+                    // treating them all as equal.
+                    double age = osg::maximum( now - lastUsed, 0.0 ) + 0.001;
+                    double score = age * (double)bytes / (double)i->_usage._cost;
+                    if ( !victim || score > bestScore )
+                    {
+                        victim = &(*i);
+                        bestScore = score;
+                    }
+                }
+            }
+
+            size_t freed;
+            if ( !victim || !victim->_consumer->evictOldestResident(freed) )
+                break;
+
+            victim->_usage._evictions++;
+            victim->_usage._evictedBytes += freed;
+            total = freed < total ? total - freed : 0;
+        }
+    }
+
+    OE_DEBUG << LC << "Resident: " << total << " bytes (budget " << _budget << ")" << std::endl;
+
+    Threading::ScopedMutexLock lock( _residentMutex );
+    _resident = total;
+}
+
+size_t
+ResidencyManager::getSizeInBytes( const osg::Object* object )
+{
+    if ( !object )
+        return 0;
+
+    const osg::Image* image = dynamic_cast<const osg::Image*>( object );
+    if ( image )
+    {
+        return sizeof(osg::Image) + image->getTotalSizeInBytesIncludingMipmaps();
+    }
+
+    const osg::HeightField* hf = dynamic_cast<const osg::HeightField*>( object );
+    if ( hf )
+    {
+        return sizeof(osg::HeightField) + hf->getNumColumns() * hf->getNumRows() * sizeof(float);
+    }
+
+    const osgTerrain::TerrainTile* tile = dynamic_cast<const osgTerrain::TerrainTile*>( object );
+    if ( tile )
+    {
+        size_t size = sizeof(osgTerrain::TerrainTile);
+
+        const osgTerrain::HeightFieldLayer* hfLayer =
+            dynamic_cast<const osgTerrain::HeightFieldLayer*>( tile->getElevationLayer() );
+        if ( hfLayer )
+            size += getSizeInBytes( hfLayer->getHeightField() );
+
+        for( unsigned i = 0; i < tile->getNumColorLayers(); ++i )
+        {
+            const osgTerrain::ImageLayer* imageLayer =
+                dynamic_cast<const osgTerrain::ImageLayer*>( tile->getColorLayer(i) );
+            if ( imageLayer )
+                size += getSizeInBytes( imageLayer->getImage() );
+        }
+        return size;
+    }
+
+    return DEFAULT_OBJECT_SIZE;
+}
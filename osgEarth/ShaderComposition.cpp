@@ -23,7 +23,9 @@
 #include <osg/Program>
 #include <osg/State>
 #include <osg/Notify>
+#include <OpenThreads/Atomic>
 #include <sstream>
+#include <string.h>
 
 #define LC "[VirtualProgram] "
 
@@ -53,6 +55,50 @@ namespace
             return sh->getAttributeVec( attribute );
         }
     };
+
+    /**
+     * Source of VirtualProgram shader revisions. Every new VirtualProgram and every
+     * change to one's shaders draws a fresh number from it, so a revision identifies
+     * one state of one program: a new program at the address of a deleted one never
+     * matches what was recorded for the old one.
+     */
+    OpenThreads::Atomic s_revisionSource;
+
+    /** Hashes the attribute stack plus the applying attribute (FNV-1a over the pointers). */
+    unsigned long long hashStack( const StateHack::AttributeVec* av, const osg::StateAttribute* top )
+    {
+        unsigned long long hash = 14695981039346656037ULL;
+        if ( av )
+        {
+            for( StateHack::AttributeVec::const_iterator i = av->begin(); i != av->end(); ++i )
+                hash = (hash ^ (unsigned long long)(size_t)i->first) * 1099511628211ULL;
+        }
+        return (hash ^ (unsigned long long)(size_t)top) * 1099511628211ULL;
+    }
+
+    /**
+     * VirtualProgram's class name, recorded by its constructor (where className() is
+     * always VirtualProgram's own), so it is set before any VirtualProgram is applied.
+     */
+    const char* s_className = "VirtualProgram";
+
+    /**
+     * Whether a PROGRAM attribute is a VirtualProgram, by its class name tag instead of
+     * RTTI: this runs for every attribute in the stack on every apply(). The name is
+     * normally the very same literal; the string compare only runs for other classes,
+     * and fails on the first character for an osg::Program.
+     */
+    bool isVirtualProgram( const osg::StateAttribute* sa )
+    {
+        const char* name = sa->className();
+        return name == s_className || ( strcmp(name, s_className) == 0 && strcmp(sa->libraryName(), "osgEarth") == 0 );
+    }
+
+    /** Shader revision of an attribute in the stack; 0 for anything but a VirtualProgram. */
+    unsigned revisionOf( const osg::StateAttribute* sa )
+    {
+        return isVirtualProgram( sa ) ? static_cast<const VirtualProgram*>( sa )->getRevision() : 0;
+    }
 }
 
 //------------------------------------------------------------------------
@@ -63,8 +109,11 @@ namespace
 #define NOTIFICATION_MESSAGES 0
 
 VirtualProgram::VirtualProgram( unsigned int mask ) : 
-_mask( mask ) 
+_mask( mask ),
+_revision( ++s_revisionSource )
 {
+    s_className = className();
+
     // because we sometimes update/change the attribute's members from within the apply() method
     this->setDataVariance( osg::Object::DYNAMIC );
 }
@@ -73,9 +122,15 @@ VirtualProgram::VirtualProgram(const VirtualProgram& rhs, const osg::CopyOp& cop
 osg::Program( rhs, copyop ),
 _shaderMap( rhs._shaderMap ),
 _mask( rhs._mask ),
+_revision( ++s_revisionSource ),
 _functions( rhs._functions )
 {
-    //nop
+    //NOP
+}
+
+VirtualProgram::~VirtualProgram()
+{
+    //NOP
 }
 
 osg::Shader*
@@ -87,6 +142,12 @@ VirtualProgram::getShader( const std::string& shaderSemantic, osg::Shader::Type
 
 osg::Shader*
 VirtualProgram::setShader( const std::string& shaderSemantic, osg::Shader * shader )
+{
+    return installShader( shaderSemantic, shader, true );
+}
+
+osg::Shader*
+VirtualProgram::installShader( const std::string& shaderSemantic, osg::Shader* shader, bool newRevision )
 {
     if( shader->getType() == osg::Shader::UNDEFINED ) 
         return NULL;
@@ -101,6 +162,8 @@ VirtualProgram::setShader( const std::string& shaderSemantic, osg::Shader * shad
     if( shaderCurrent != shaderNew )
     {
        shaderCurrent = shaderNew;
+       if ( newRevision )
+           _revision = ++s_revisionSource;
     }
 
     //OE_NOTICE << shader->getShaderSource() << std::endl;
@@ -126,7 +189,40 @@ VirtualProgram::setFunction(const std::string& functionName,
 void
 VirtualProgram::removeShader( const std::string& shaderSemantic, osg::Shader::Type type )
 {
-    _shaderMap.erase( ShaderMap::key_type( shaderSemantic, type ) );
+    if ( _shaderMap.erase( ShaderMap::key_type( shaderSemantic, type ) ) > 0 )
+        _revision = ++s_revisionSource;
+}
+
+void
+VirtualProgram::captureStack( StackEntry& entry, const AttributeStack* av ) const
+{
+    entry._stack.clear();
+    entry._revisions.clear();
+    if ( av )
+    {
+        for( AttributeStack::const_iterator i = av->begin(); i != av->end(); ++i )
+        {
+            entry._stack.push_back( i->first );
+            entry._revisions.push_back( revisionOf(i->first) );
+        }
+    }
+    entry._stack.push_back( this );
+    entry._revisions.push_back( getRevision() );
+}
+
+bool
+VirtualProgram::stackMatches( const StackEntry& entry, const AttributeStack* av ) const
+{
+    unsigned size = av ? av->size() : 0;
+    if ( entry._stack.size() != size + 1 || entry._stack.back() != this || entry._revisions.back() != _revision )
+        return false;
+
+    // the pointers in the live stack are valid, so their revisions can be read safely.
+    for( unsigned i = 0; i < size; ++i )
+        if ( entry._stack[i] != (*av)[i].first || entry._revisions[i] != revisionOf((*av)[i].first) )
+            return false;
+
+    return true;
 }
 
 static unsigned s_applies = 0;
@@ -138,15 +234,50 @@ VirtualProgram::apply( osg::State & state ) const
     if( _shaderMap.empty() ) // Virtual Program works as normal Program
         return Program::apply( state );
 
+    const StateHack::AttributeVec* av = StateHack::GetAttributeVec( state, this );
+
+    // fastest path: this context applied the same stack, unchanged, last time. Only
+    // one thread applies a given context, so its slot needs no lock.
+    osg::ref_ptr<StackEntry>& last = _lastApplied[ state.getContextID() ];
+    if ( last.valid() && stackMatches(*last.get(), av) )
+    {
+        last->_program->apply( state );
+        return;
+    }
+
+    // fast path: if nothing changed since we last saw this attribute stack, reuse
+    // the program we resolved for it then. No shader map merging. Entries never
+    // change once recorded, so sharing one with the context's slot is safe.
+    unsigned long long stackHash = hashStack( av, this );
+    bool found = false;
+    {
+        Threading::ScopedMutexLock lock( _stackProgramMapMutex );
+        StackProgramMap::const_iterator e = _stackProgramMap.find( stackHash );
+        if ( e != _stackProgramMap.end() && stackMatches(*e->second.get(), av) )
+        {
+            last = e->second;
+            found = true;
+        }
+    }
+    if ( found )
+    {
+        last->_program->apply( state );
+        return;
+    }
+
+    // record the stack and its revisions before resolving it, so that a change made
+    // while we resolve it sends the next apply() back here.
+    osg::ref_ptr<StackEntry> resolved = new StackEntry();
+    captureStack( *resolved.get(), av );
+
     // first, find and collect all the VirtualProgram attributes:
     ShaderMap shaderMap;
-    const StateHack::AttributeVec* av = StateHack::GetAttributeVec( state, this );
     if ( av )
     {
         for( StateHack::AttributeVec::const_iterator i = av->begin(); i != av->end(); ++i )
         {
             const osg::StateAttribute* sa = i->first;
-            const VirtualProgram* vp = dynamic_cast< const VirtualProgram* >( sa );
+            const VirtualProgram* vp = isVirtualProgram( sa ) ? static_cast< const VirtualProgram* >( sa ) : 0L;
             if( vp && ( vp->_mask & _mask ) )
             {
                 for( ShaderMap::const_iterator i = vp->_shaderMap.begin(); i != vp->_shaderMap.end(); ++i )
@@ -183,11 +314,12 @@ VirtualProgram::apply( osg::State & state ) const
             const_cast<VirtualProgram*>(this)->refreshAccumulatedFunctions( state );
                 
             osg::Shader* vert_main = sf->createVertexShaderMain( _accumulatedFunctions );
-            const_cast<VirtualProgram*>(this)->setShader( "osgearth_vert_main", vert_main );
+            // installing the generated mains doesn't change what any stack resolves to.
+            const_cast<VirtualProgram*>(this)->installShader( "osgearth_vert_main", vert_main, false );
             shaderMap[ ShaderSemantic("osgearth_vert_main", osg::Shader::VERTEX) ] = vert_main;
 
             osg::Shader* frag_main = sf->createFragmentShaderMain( _accumulatedFunctions );
-            const_cast<VirtualProgram*>(this)->setShader( "osgearth_frag_main", frag_main );
+            const_cast<VirtualProgram*>(this)->installShader( "osgearth_frag_main", frag_main, false );
             shaderMap[ ShaderSemantic("osgearth_frag_main", osg::Shader::FRAGMENT) ] = frag_main;
             
             // rebuild the shader list now that we've changed the shader map.
@@ -237,6 +369,24 @@ VirtualProgram::apply( osg::State & state ) const
             _programMap[ sl ] = program;
         }
 
+        // remember the program for this attribute stack.
+        resolved->_program = program;
+        {
+            Threading::ScopedMutexLock lock( _stackProgramMapMutex );
+            if ( _stackProgramMap.size() >= 64 && _stackProgramMap.find(stackHash) == _stackProgramMap.end() )
+            {
+                // make room by dropping one stack. The keys are hashes, so the one
+                // following the new key is as good as a random pick.
+                StackProgramMap::iterator victim = _stackProgramMap.lower_bound( stackHash );
+                if ( victim == _stackProgramMap.end() )
+                    victim = _stackProgramMap.begin();
+                _stackProgramMap.erase( victim );
+            }
+
+            _stackProgramMap[ stackHash ] = resolved;
+        }
+        last = resolved;
+
         // finally, apply the program attribute.
         program->apply( state );
     }
@@ -264,10 +414,10 @@ VirtualProgram::refreshAccumulatedFunctions( const osg::State& state )
     _accumulatedFunctions.clear();
 
     const StateHack::AttributeVec* av = StateHack::GetAttributeVec( state, this );
-    for( StateHack::AttributeVec::const_iterator i = av->begin(); i != av->end(); ++i )
+    for( unsigned n = 0; av && n < av->size(); ++n )
     {
-        const osg::StateAttribute* sa = i->first;
-        const VirtualProgram* vp = dynamic_cast< const VirtualProgram* >( sa );
+        const osg::StateAttribute* sa = (*av)[n].first;
+        const VirtualProgram* vp = isVirtualProgram( sa ) ? static_cast< const VirtualProgram* >( sa ) : 0L;
         if( vp && vp != this && ( vp->_mask & _mask ) )
         {
             FunctionLocationMap rhs;
@@ -18,6 +18,7 @@
  */
 
 #include <osgEarth/SpatialReference>
+#include <osgEarth/ECEF>
 #include <osgEarth/Registry>
 #include <osgEarth/Cube>
 #include <osgEarth/LocalTangentPlane>
@@ -926,19 +927,38 @@ SpatialReference::transformToECEF(std::vector<osg::Vec3d>& points,
     if ( points.size() == 0 )
         return false;
 
-    const SpatialReference*    geoSRS    = getGeographicSRS();
-    const osg::EllipsoidModel* ellipsoid = geoSRS->getEllipsoid();
+    const SpatialReference* geoSRS = getGeographicSRS();
 
-    for( unsigned i=0; i<points.size(); ++i )
+    if ( isGeographic() )
     {
-        osg::Vec3d& p = points[i];
+        ECEF::geodeticToECEF( geoSRS->getEllipsoid(), &points[0], &points[0], points.size() );
+        return true;
+    }
 
-        if ( !isGeographic() )
-            transform( p.x(), p.y(), p.z(), geoSRS, p.x(), p.y(), p.z() );
+    // first convert all the points to lat/long. Try one batch; it fails as a whole if
+    // any one point fails, so then go point by point and deal with the bad ones.
+    std::vector<osg::Vec3d> geodetic( points );
+    std::vector<bool>       failed;
+    if ( !transformPoints( geoSRS, geodetic, 0L, false ) )
+    {
+        failed.resize( points.size(), false );
+        for( unsigned i=0; i<points.size(); ++i )
+        {
+            if ( !transform( points[i], geoSRS, geodetic[i] ) )
+            {
+                if ( !ignoreErrors )
+                    return false;
+                failed[i] = true;
+            }
+        }
+    }
 
-        ellipsoid->convertLatLongHeightToXYZ(
-            osg::DegreesToRadians( p.y() ), osg::DegreesToRadians( p.x() ), p.z(),
-            p.x(), p.y(), p.z() );
+    // then convert them to ECEF, keeping the points that failed as they were.
+    ECEF::geodeticToECEF( geoSRS->getEllipsoid(), &geodetic[0], &geodetic[0], geodetic.size() );
+    for( unsigned i=0; i<points.size(); ++i )
+    {
+        if ( failed.empty() || !failed[i] )
+            points[i] = geodetic[i];
     }
 
     return true;
@@ -950,20 +970,17 @@ SpatialReference::transformFromECEF(const osg::Vec3d& input,
 {
     // transform to lat/long:
     osg::Vec3d geo;
-
-    getGeographicSRS()->getEllipsoid()->convertXYZToLatLongHeight(
-        input.x(), input.y(), input.z(),
-        geo.y(), geo.x(), geo.z() );
+    ECEF::ecefToGeodetic( getGeographicSRS()->getEllipsoid(), &input, &geo, 1 );
 
     // then convert to the local SRS.
     if ( isGeographic() )
     {
-        output.set( osg::RadiansToDegrees(geo.x()), osg::RadiansToDegrees(geo.y()), geo.z() );
+        output = geo;
     }
     else
     {
         getGeographicSRS()->transform( 
-            osg::RadiansToDegrees(geo.x()), osg::RadiansToDegrees(geo.y()), geo.z(),
+            geo.x(), geo.y(), geo.z(),
             this,
             output.x(), output.y(), output.z() );
         //output.z() = geo.z();
@@ -978,18 +995,11 @@ SpatialReference::transformFromECEF(std::vector<osg::Vec3d>& points,
 {
     bool ok = true;
 
+    if ( points.size() == 0 )
+        return ok;
+
     // first convert all the points to lat/long (in place):
-    for( unsigned i=0; i<points.size(); ++i )
-    {
-        osg::Vec3d& p = points[i];
-        osg::Vec3d geo;
-        getGeographicSRS()->getEllipsoid()->convertXYZToLatLongHeight(
-            p.x(), p.y(), p.z(),
-            geo.y(), geo.x(), geo.z() );
-        geo.x() = osg::RadiansToDegrees( geo.x() );
-        geo.y() = osg::RadiansToDegrees( geo.y() );
-        p = geo;
-    }
+    ECEF::ecefToGeodetic( getGeographicSRS()->getEllipsoid(), &points[0], &points[0], points.size() );
 
     // then convert them all to the local SRS if necessary.
     if ( !isGeographic() )
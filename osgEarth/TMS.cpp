@@ -426,78 +426,81 @@ TileMapReaderWriter::read(std::istream &in)
 {
     osg::ref_ptr<TileMap> tileMap = new TileMap;
 
-    osg::ref_ptr<XmlDocument> doc = XmlDocument::load( in );
-    if (!doc.valid())
+    // read the document straight into a Config; names are already lower case
+    Config doc;
+    if ( !XmlReader::readConfig( in, doc ) )
     {
         OE_DEBUG << LC << "Failed to load TileMap " << std::endl;
         return 0;
     }
    
     //Get the root TileMap element
-    osg::ref_ptr<XmlElement> e_tile_map = doc->getSubElement( ELEM_TILEMAP );
-    if (!e_tile_map.valid())
+    const Config& e_tile_map = doc.child( ELEM_TILEMAP );
+    if (e_tile_map.empty())
     {
         OE_WARN << LC << "Could not find root TileMap element " << std::endl;
         return 0;
     }
 
-    tileMap->setVersion( e_tile_map->getAttr( ATTR_VERSION ) );
-    tileMap->setTileMapService( e_tile_map->getAttr( ATTR_TILEMAPSERVICE ) );
+    tileMap->setVersion( e_tile_map.attrs().get( ATTR_VERSION ) );
+    tileMap->setTileMapService( e_tile_map.attrs().get( ATTR_TILEMAPSERVICE ) );
 
-    tileMap->setTitle( e_tile_map->getSubElementText(ELEM_TITLE) );
-    tileMap->setAbstract( e_tile_map->getSubElementText(ELEM_ABSTRACT) );
-    tileMap->setSRS( e_tile_map->getSubElementText(ELEM_SRS) );
-    tileMap->setVerticalSRS( e_tile_map->getSubElementText(ELEM_VERTICAL_SRS) );
+    tileMap->setTitle( e_tile_map.child(ELEM_TITLE).value() );
+    tileMap->setAbstract( e_tile_map.child(ELEM_ABSTRACT).value() );
+    tileMap->setSRS( e_tile_map.child(ELEM_SRS).value() );
+    tileMap->setVerticalSRS( e_tile_map.child(ELEM_VERTICAL_SRS).value() );
 
     //Read the bounding box
-    osg::ref_ptr<XmlElement> e_bounding_box = e_tile_map->getSubElement(ELEM_BOUNDINGBOX);
-    if (e_bounding_box.valid())
+    const Config& e_bounding_box = e_tile_map.child(ELEM_BOUNDINGBOX);
+    if (!e_bounding_box.empty())
     {
-        double minX = as<double>(e_bounding_box->getAttr( ATTR_MINX ), 0.0);
-        double minY = as<double>(e_bounding_box->getAttr( ATTR_MINY ), 0.0);
-        double maxX = as<double>(e_bounding_box->getAttr( ATTR_MAXX ), 0.0);
-        double maxY = as<double>(e_bounding_box->getAttr( ATTR_MAXY ), 0.0);
+        double minX = as<double>(e_bounding_box.attrs().get( ATTR_MINX ), 0.0);
+        double minY = as<double>(e_bounding_box.attrs().get( ATTR_MINY ), 0.0);
+        double maxX = as<double>(e_bounding_box.attrs().get( ATTR_MAXX ), 0.0);
+        double maxY = as<double>(e_bounding_box.attrs().get( ATTR_MAXY ), 0.0);
         tileMap->setExtents( minX, minY, maxX, maxY);
     }
 
     //Read the origin
-    osg::ref_ptr<XmlElement> e_origin = e_tile_map->getSubElement(ELEM_ORIGIN);
-    if (e_origin.valid())
+    const Config& e_origin = e_tile_map.child(ELEM_ORIGIN);
+    if (!e_origin.empty())
     {
-        tileMap->setOriginX( as<double>(e_origin->getAttr( ATTR_X ), 0.0) );
-        tileMap->setOriginY( as<double>(e_origin->getAttr( ATTR_Y ), 0.0) );
+        tileMap->setOriginX( as<double>(e_origin.attrs().get( ATTR_X ), 0.0) );
+        tileMap->setOriginY( as<double>(e_origin.attrs().get( ATTR_Y ), 0.0) );
     }
 
     //Read the tile format
-    osg::ref_ptr<XmlElement> e_tile_format = e_tile_map->getSubElement(ELEM_TILE_FORMAT);
-    if (e_tile_format.valid())
+    const Config& e_tile_format = e_tile_map.child(ELEM_TILE_FORMAT);
+    if (!e_tile_format.empty())
     {
-        tileMap->getFormat().setExtension( e_tile_format->getAttr( ATTR_EXTENSION ) );
-        tileMap->getFormat().setMimeType( e_tile_format->getAttr( ATTR_MIME_TYPE) );
-        tileMap->getFormat().setWidth( as<unsigned int>(e_tile_format->getAttr( ATTR_WIDTH ), 0) );
-        tileMap->getFormat().setHeight( as<unsigned int>(e_tile_format->getAttr( ATTR_HEIGHT ), 0) );
+        tileMap->getFormat().setExtension( e_tile_format.attrs().get( ATTR_EXTENSION ) );
+        tileMap->getFormat().setMimeType( e_tile_format.attrs().get( ATTR_MIME_TYPE) );
+        tileMap->getFormat().setWidth( as<unsigned int>(e_tile_format.attrs().get( ATTR_WIDTH ), 0) );
+        tileMap->getFormat().setHeight( as<unsigned int>(e_tile_format.attrs().get( ATTR_HEIGHT ), 0) );
     }
 
     //Read the tilesets
-    osg::ref_ptr<XmlElement> e_tile_sets = e_tile_map->getSubElement(ELEM_TILESETS);
-    if (e_tile_sets.valid())
+    const Config& e_tile_sets = e_tile_map.child(ELEM_TILESETS);
+    if (!e_tile_sets.empty())
     {
         //Read the profile
-        std::string profile = e_tile_sets->getAttr( ATTR_PROFILE );
+        std::string profile = e_tile_sets.attrs().get( ATTR_PROFILE );
         if (profile == "global-geodetic") tileMap->setProfileType( Profile::TYPE_GEODETIC );
         else if (profile == "global-mercator") tileMap->setProfileType( Profile::TYPE_MERCATOR );
         else if (profile == "local") tileMap->setProfileType( Profile::TYPE_LOCAL );
         else tileMap->setProfileType( Profile::TYPE_UNKNOWN );
 
         //Read each TileSet
-        XmlNodeList tile_sets = e_tile_sets->getSubElements( ELEM_TILESET );
-        for( XmlNodeList::const_iterator i = tile_sets.begin(); i != tile_sets.end(); i++ )
+        const ConfigSet& tile_sets = e_tile_sets.children();
+        for( ConfigSet::const_iterator i = tile_sets.begin(); i != tile_sets.end(); i++ )
         {
-            osg::ref_ptr<XmlElement> e_tile_set = static_cast<XmlElement*>( i->get() );
+            const Config& e_tile_set = *i;
+            if ( e_tile_set.key() != ELEM_TILESET )
+                continue;
             TileSet tileset;
-            tileset.setHref( e_tile_set->getAttr( ATTR_HREF ) );
-            tileset.setOrder( as<unsigned int>(e_tile_set->getAttr( ATTR_ORDER ), -1) );
-            tileset.setUnitsPerPixel( as<double>(e_tile_set->getAttr( ATTR_UNITSPERPIXEL ), 0.0 ) );
+            tileset.setHref( e_tile_set.attrs().get( ATTR_HREF ) );
+            tileset.setOrder( as<unsigned int>(e_tile_set.attrs().get( ATTR_ORDER ), -1) );
+            tileset.setUnitsPerPixel( as<double>(e_tile_set.attrs().get( ATTR_UNITSPERPIXEL ), 0.0 ) );
             tileMap->getTileSets().push_back(tileset);
         }
     }
@@ -512,21 +515,23 @@ TileMapReaderWriter::read(std::istream &in)
     tileMap->computeNumTiles();
 
     //Read the data areas
-    osg::ref_ptr<XmlElement> e_data_extents = e_tile_map->getSubElement(ELEM_DATA_EXTENTS);
-    if (e_data_extents.valid())
+    const Config& e_data_extents = e_tile_map.child(ELEM_DATA_EXTENTS);
+    if (!e_data_extents.empty())
     {
         osg::ref_ptr< const osgEarth::Profile > profile = tileMap->createProfile();
         OE_DEBUG << LC << "Found DataExtents " << std::endl;
-        XmlNodeList data_extents = e_data_extents->getSubElements( ELEM_DATA_EXTENT );
-        for( XmlNodeList::const_iterator i = data_extents.begin(); i != data_extents.end(); i++ )
+        const ConfigSet& data_extents = e_data_extents.children();
+        for( ConfigSet::const_iterator i = data_extents.begin(); i != data_extents.end(); i++ )
         {
-            osg::ref_ptr<XmlElement> e_data_extent = static_cast<XmlElement*>( i->get() );
-            double minX = as<double>(e_data_extent->getAttr( ATTR_MINX ), 0.0);
-            double minY = as<double>(e_data_extent->getAttr( ATTR_MINY ), 0.0);
-            double maxX = as<double>(e_data_extent->getAttr( ATTR_MAXX ), 0.0);
-            double maxY = as<double>(e_data_extent->getAttr( ATTR_MAXY ), 0.0);
-            //unsigned int minLevel = as<unsigned int>(e_data_extent->getAttr( ATTR_MIN_LEVEL ), 0);
-            unsigned int maxLevel = as<unsigned int>(e_data_extent->getAttr( ATTR_MAX_LEVEL ), 0);            
+            const Config& e_data_extent = *i;
+            if ( e_data_extent.key() != ELEM_DATA_EXTENT )
+                continue;
+            double minX = as<double>(e_data_extent.attrs().get( ATTR_MINX ), 0.0);
+            double minY = as<double>(e_data_extent.attrs().get( ATTR_MINY ), 0.0);
+            double maxX = as<double>(e_data_extent.attrs().get( ATTR_MAXX ), 0.0);
+            double maxY = as<double>(e_data_extent.attrs().get( ATTR_MAXY ), 0.0);
+            //unsigned int minLevel = as<unsigned int>(e_data_extent.attrs().get( ATTR_MIN_LEVEL ), 0);
+            unsigned int maxLevel = as<unsigned int>(e_data_extent.attrs().get( ATTR_MAX_LEVEL ), 0);            
 
             //OE_DEBUG << LC << "Read area " << minX << ", " << minY << ", " << maxX << ", " << maxY << ", minlevel=" << minLevel << " maxlevel=" << maxLevel << std::endl;
             tileMap->getDataExtents().push_back( DataExtent(GeoExtent(profile->getSRS(), minX, minY, maxX, maxY), 0, maxLevel));
@@ -29,7 +29,8 @@ using namespace OpenThreads;
 TaskRequest::TaskRequest( float priority ) :
 osg::Referenced( true ),
 _priority( priority ),
-_state( STATE_IDLE )
+_state( STATE_IDLE ),
+_queuedTime( 0 )
 {
     _progress = new ProgressCallback();
 }
@@ -66,7 +67,10 @@ TaskRequest::wasCanceled() const
 
 TaskRequestQueue::TaskRequestQueue() :
 osg::Referenced( true ),
-_done( false )
+_done( false ),
+_numCompleted( 0 ),
+_totalRunTime( 0.0 ),
+_totalWaitTime( 0.0 )
 {
 }
 
@@ -84,6 +88,25 @@ TaskRequestQueue::getNumRequests() const
     return _requests.size();
 }
 
+void
+TaskRequestQueue::recordCompleted( TaskRequest* request )
+{
+    ScopedLock<Mutex> lock(_mutex);
+    _numCompleted++;
+    _totalRunTime  += request->runTime();
+    _totalWaitTime += request->waitTime();
+}
+
+void
+TaskRequestQueue::getStats( TaskServiceStats& out_stats ) const
+{
+    ScopedLock<Mutex> lock(const_cast<TaskRequestQueue*>(this)->_mutex);
+    out_stats._queueDepth    = _requests.size();
+    out_stats._numCompleted  = _numCompleted;
+    out_stats._totalRunTime  = _totalRunTime;
+    out_stats._totalWaitTime = _totalWaitTime;
+}
+
 void 
 TaskRequestQueue::add( TaskRequest* request )
 {
@@ -93,6 +116,8 @@ TaskRequestQueue::add( TaskRequest* request )
     if ( !request->getProgressCallback() )
         request->setProgressCallback( new ProgressCallback() );
 
+    request->setQueuedTime( osg::Timer::instance()->tick() );
+
     ScopedLock<Mutex> lock(_mutex);
 
     // insert by priority.
@@ -197,6 +222,7 @@ TaskThread::run()
 
                 _request->setState( TaskRequest::STATE_IN_PROGRESS );
                 _request->run();
+                _queue->recordCompleted( _request.get() );
 
                 //OE_INFO << LC << "Task \"" << _request->getName() << "\" runtime = " << _request->runTime() << " s." << std::endl;
             }
@@ -241,6 +267,7 @@ TaskThread::cancel()
 
 TaskService::TaskService( const std::string& name, int numThreads ):
 osg::Referenced( true ),
+_numThreads(0),
 _lastRemoveFinishedThreadsStamp(0),
 _name(name)
 {
@@ -254,6 +281,14 @@ TaskService::getNumRequests() const
     return _queue->getNumRequests();
 }
 
+TaskServiceStats
+TaskService::getStats() const
+{
+    TaskServiceStats stats;
+    _queue->getStats( stats );
+    return stats;
+}
+
 void
 TaskService::add( TaskRequest* request )
 {   
@@ -351,7 +386,7 @@ TaskService::adjustThreadCount()
         }
     }  
 
-    OE_INFO << LC << "TaskService [" << _name << "] using " << _numThreads << " threads" << std::endl;
+    OE_DEBUG << LC << "TaskService [" << _name << "] using " << _numThreads << " threads" << std::endl;
 }
 
 void
@@ -380,9 +415,21 @@ TaskService::removeFinishedThreads()
 
 //------------------------------------------------------------------------
 
+namespace
+{
+    // demand credited to every service, so that idle services keep a small share of the threads
+    const double IDLE_DEMAND = 0.1;
+
+    // weight of the newest measurement in the smoothed demand
+    const double DEMAND_SMOOTHING = 0.5;
+}
+
 TaskServiceManager::TaskServiceManager( int numThreads ) :
 _numThreads( 0 ),
-_targetNumThreads( numThreads )
+_targetNumThreads( numThreads ),
+_rebalanceInterval( 1.0 ),
+_hysteresis( 2 ),
+_lastRebalance( osg::Timer::instance()->tick() )
 {
     //nop
 }
@@ -390,7 +437,9 @@ _targetNumThreads( numThreads )
 void
 TaskServiceManager::setNumThreads( int numThreads )
 {
-    reallocate( numThreads );
+    ScopedLock<Mutex> lock( _taskServiceMgrMutex );
+    _targetNumThreads = osg::maximum( 1, numThreads );
+    reallocate( _targetNumThreads );
 }
 
 TaskService*
@@ -404,14 +453,18 @@ TaskServiceManager::add( UID uid, float weight )
     TaskServiceMap::iterator i = _services.find( uid );
     if ( i != _services.end() )
     {
-        i->second.second = weight;
+        i->second._weight = weight;
         reallocate( _targetNumThreads );
-        return i->second.first.get();
+        return i->second._service.get();
     }
     else
     {
         TaskService* newService = new TaskService( "", 1 );
-        _services[uid] = WeightedTaskService( newService, weight );
+        ManagedService& entry = _services[uid];
+        entry._service = newService;
+        entry._weight = weight;
+        entry._lastStats = newService->getStats();
+        entry._allocation._uid = uid;
         reallocate( _targetNumThreads );
         return newService;
     }
@@ -420,9 +473,9 @@ TaskServiceManager::add( UID uid, float weight )
 TaskService*
 TaskServiceManager::get( UID uid ) const
 {
-    ScopedLock<Mutex> lock( const_cast<TaskServiceManager*>(this)->_taskServiceMgrMutex );
+    ScopedLock<Mutex> lock( _taskServiceMgrMutex );
     TaskServiceMap::const_iterator i = _services.find(uid);
-    return i != _services.end() ? i->second.first.get() : 0L;
+    return i != _services.end() ? i->second._service.get() : 0L;
 }
 
 TaskService*
@@ -438,7 +491,7 @@ TaskServiceManager::remove( TaskService* service )
     ScopedLock<Mutex> lock( _taskServiceMgrMutex );
     for( TaskServiceMap::iterator i = _services.begin(); i != _services.end(); ++i )
     {
-        if ( i->second.first.get() == service ) 
+        if ( i->second._service.get() == service ) 
         {
             _services.erase( i );
             reallocate( _targetNumThreads );
@@ -463,34 +516,252 @@ TaskServiceManager::setWeight( TaskService* service, float weight )
     if ( weight <= 0.0f )
         weight = 0.001;
 
-    if ( !service )
-        return;
+    ManagedService* entry = find( service );
+    if ( entry )
+    {
+        entry->_weight = weight;
+        reallocate( _targetNumThreads );
+    }
+}
 
-    for( TaskServiceMap::iterator i = _services.begin(); i != _services.end(); ++i )
+void
+TaskServiceManager::setThreadLimits( TaskService* service, int minThreads, int maxThreads )
+{
+    ScopedLock<Mutex> lock( _taskServiceMgrMutex );
+
+    ManagedService* entry = find( service );
+    if ( entry )
+    {
+        entry->_minThreads = osg::maximum( 1, minThreads );
+        entry->_maxThreads = maxThreads > 0 ? osg::maximum( maxThreads, entry->_minThreads ) : 0;
+        reallocate( _targetNumThreads );
+    }
+}
+
+void
+TaskServiceManager::setRebalanceInterval( double seconds )
+{
+    ScopedLock<Mutex> lock( _taskServiceMgrMutex );
+    _rebalanceInterval = osg::maximum( 0.0, seconds );
+}
+
+void
+TaskServiceManager::setHysteresis( unsigned count )
+{
+    ScopedLock<Mutex> lock( _taskServiceMgrMutex );
+    _hysteresis = osg::maximum( 1u, count );
+}
+
+void
+TaskServiceManager::getAllocations( TaskServiceAllocationVector& out_allocations ) const
+{
+    ScopedLock<Mutex> lock( _taskServiceMgrMutex );
+    out_allocations.clear();
+    for( TaskServiceMap::const_iterator i = _services.begin(); i != _services.end(); ++i )
+        out_allocations.push_back( i->second._allocation );
+}
+
+void
+TaskServiceManager::update()
+{
+    ScopedLock<Mutex> lock( _taskServiceMgrMutex );
+    if ( _rebalanceInterval > 0.0 &&
+         osg::Timer::instance()->delta_s( _lastRebalance, osg::Timer::instance()->tick() ) >= _rebalanceInterval )
+    {
+        balance();
+    }
+}
+
+void
+TaskServiceManager::rebalance()
+{
+    ScopedLock<Mutex> lock( _taskServiceMgrMutex );
+    balance();
+}
+
+TaskServiceManager::ManagedService*
+TaskServiceManager::find( TaskService* service )
+{
+    if ( service )
+    {
+        for( TaskServiceMap::iterator i = _services.begin(); i != _services.end(); ++i )
+            if ( i->second._service.get() == service )
+                return &i->second;
+    }
+    return 0L;
+}
+
+void
+TaskServiceManager::allocate(const std::vector<ManagedService*>& services,
+                             const std::vector<double>&          scores,
+                             int                                 numThreads,
+                             std::vector<int>&                   out_threads ) const
+{
+    // every service gets its minimum; the rest of the threads go out one at a time to the
+    // service with the highest score per thread (i.e. in proportion to the scores),
+    // skipping services that reached their maximum.
+    out_threads.resize( services.size() );
+    int remaining = numThreads;
+    for( unsigned i=0; i<services.size(); ++i )
+    {
+        out_threads[i] = services[i]->_minThreads;
+        remaining -= out_threads[i];
+    }
+
+    for( ; remaining > 0; --remaining )
     {
-        if ( i->second.first.get() == service )
+        int    best      = -1;
+        double bestScore = 0.0;
+        for( unsigned i=0; i<services.size(); ++i )
         {
-            i->second.second = weight;
-            reallocate( _targetNumThreads );
-            break;
+            if ( services[i]->_maxThreads > 0 && out_threads[i] >= services[i]->_maxThreads )
+                continue;
+            double score = scores[i] / (double)(out_threads[i] + 1);
+            if ( best < 0 || score > bestScore )
+            {
+                best      = i;
+                bestScore = score;
+            }
         }
-    }    
+        if ( best < 0 )
+            break;
+        out_threads[best]++;
+    }
 }
 
 void
 TaskServiceManager::reallocate( int numThreads )
 {
-    // first, total up all the weights.
-    float totalWeight = 0.0f;
-    for( TaskServiceMap::const_iterator i = _services.begin(); i != _services.end(); ++i )
-        totalWeight += i->second.second;
+    // divide the thread pool by the relative weight of each service (scaled by its
+    // measured demand, if it has been rebalanced before).
+    std::vector<ManagedService*> services;
+    std::vector<double>          scores;
+    for( TaskServiceMap::iterator i = _services.begin(); i != _services.end(); ++i )
+    {
+        services.push_back( &i->second );
+        scores.push_back( (double)i->second._weight * (i->second._allocation._demand + IDLE_DEMAND) );
+    }
+
+    std::vector<int> threads;
+    allocate( services, scores, numThreads, threads );
 
-    // next divide the total thread pool size by the relative weight of each service.
     _numThreads = 0;
-    for( TaskServiceMap::const_iterator i = _services.begin(); i != _services.end(); ++i )
+    for( unsigned i=0; i<services.size(); ++i )
     {
-        int threads = osg::maximum( 1, (int)( (float)_targetNumThreads * (i->second.second / totalWeight) ) );
-        i->second.first->setNumThreads( threads );
-        _numThreads += threads;
+        ManagedService& entry = *services[i];
+        entry._service->setNumThreads( threads[i] );
+        entry._pendingChanges = 0;
+
+        TaskServiceAllocation& a = entry._allocation;
+        a._weight        = entry._weight;
+        a._minThreads    = entry._minThreads;
+        a._maxThreads    = entry._maxThreads;
+        a._targetThreads = threads[i];
+        a._numThreads    = threads[i];
+
+        _numThreads += threads[i];
+    }
+}
+
+void
+TaskServiceManager::balance()
+{
+    osg::Timer_t now = osg::Timer::instance()->tick();
+    double dt = osg::Timer::instance()->delta_s( _lastRebalance, now );
+    _lastRebalance = now;
+    if ( dt <= 0.0 || _services.empty() )
+        return;
+
+    // measure the load of each service since the last rebalance.
+    std::vector<ManagedService*> services;
+    std::vector<double>          scores;
+    for( TaskServiceMap::iterator i = _services.begin(); i != _services.end(); ++i )
+    {
+        ManagedService& entry = i->second;
+        TaskServiceAllocation& a = entry._allocation;
+
+        TaskServiceStats stats = entry._service->getStats();
+        unsigned completed = stats._numCompleted  - entry._lastStats._numCompleted;
+        double   runTime   = stats._totalRunTime  - entry._lastStats._totalRunTime;
+        double   waitTime  = stats._totalWaitTime - entry._lastStats._totalWaitTime;
+        entry._lastStats = stats;
+
+        a._weight     = entry._weight;
+        a._minThreads = entry._minThreads;
+        a._maxThreads = entry._maxThreads;
+        a._queueDepth = stats._queueDepth;
+        a._throughput = (double)completed / dt;
+        if ( completed > 0 )
+        {
+            a._avgRunTime  = runTime / (double)completed;
+            a._avgWaitTime = waitTime / (double)completed;
+        }
+
+        // threads kept busy, plus the threads it would take to drain the queue within one interval
+        // (until a request completes, assume each one would keep a thread busy for the whole interval):
+        double busy    = runTime / dt;
+        double backlog = (double)stats._queueDepth * (a._avgRunTime > 0.0 ? osg::minimum(a._avgRunTime, dt) : dt) / dt;
+        a._demand = DEMAND_SMOOTHING*(busy + backlog) + (1.0-DEMAND_SMOOTHING)*a._demand;
+
+        services.push_back( &entry );
+        scores.push_back( (double)entry._weight * (a._demand + IDLE_DEMAND) );
+    }
+
+    std::vector<int> targets;
+    allocate( services, scores, _targetNumThreads, targets );
+
+    // hysteresis: a service's thread count only changes after the same change has been
+    // called for by enough consecutive rebalances.
+    std::vector<int> wanted( services.size() );
+    for( unsigned i=0; i<services.size(); ++i )
+    {
+        ManagedService& entry = *services[i];
+        int current = entry._allocation._numThreads;
+        int delta   = targets[i] - current;
+        int dir     = delta > 0 ? 1 : delta < 0 ? -1 : 0;
+
+        if ( dir == 0 )
+            entry._pendingChanges = 0;
+        else if ( entry._pendingChanges * dir > 0 )
+            entry._pendingChanges += dir;
+        else
+            entry._pendingChanges = dir;
+
+        entry._allocation._targetThreads = targets[i];
+        wanted[i] = (unsigned)osg::absolute(entry._pendingChanges) >= _hysteresis ? targets[i] : current;
+    }
+
+    // apply the reductions first, then hand the freed threads to the services that want more
+    // (so the total never exceeds the budget, even when only some changes are due).
+    int total = 0;
+    for( unsigned i=0; i<services.size(); ++i )
+        total += osg::minimum( wanted[i], services[i]->_allocation._numThreads );
+
+    int available = osg::maximum( _targetNumThreads, total ) - total;
+
+    _numThreads = 0;
+    for( unsigned i=0; i<services.size(); ++i )
+    {
+        ManagedService& entry = *services[i];
+        TaskServiceAllocation& a = entry._allocation;
+        int threads = wanted[i];
+        if ( threads > a._numThreads )
+        {
+            int grant = osg::minimum( threads - a._numThreads, available );
+            available -= grant;
+            threads = a._numThreads + grant;
+        }
+
+        if ( threads != a._numThreads )
+        {
+            OE_DEBUG << LC << "Service " << a._uid << ": " << a._numThreads << " -> " << threads << " threads"
+                << " (queue=" << a._queueDepth << ", demand=" << a._demand << ", throughput=" << a._throughput << "/s)"
+                << std::endl;
+            entry._service->setNumThreads( threads );
+            entry._pendingChanges = 0;
+            a._numThreads = threads;
+        }
+
+        _numThreads += a._numThreads;
     }
 }
@@ -130,6 +130,267 @@ TerrainLayerOptions::mergeConfig( const Config& conf )
 
 //------------------------------------------------------------------------
 
+DataAvailabilityIndex::DataAvailabilityIndex( unsigned maxEntries ) :
+_count     ( 0 ),
+_maxEntries( maxEntries ),
+_mutex( "DataAvailabilityIndex" )
+{
+    rehash( 64 );
+}
+
+namespace
+{
+    inline unsigned hashTileID( const osgTerrain::TileID& id )
+    {
+        return
+            ((unsigned)id.x * 73856093u) ^
+            ((unsigned)id.y * 19349663u) ^
+            ((unsigned)id.level * 83492791u);
+    }
+}
+
+void
+DataAvailabilityIndex::rehash( unsigned numBuckets )
+{
+    Buckets buckets( numBuckets );
+    for( Order::iterator i = _order.begin(); i != _order.end(); ++i )
+        buckets[ hashTileID(i->_id) & (numBuckets-1) ].push_back( i );
+    _buckets.swap( buckets );
+}
+
+DataAvailabilityIndex::Bucket&
+DataAvailabilityIndex::bucketFor( const osgTerrain::TileID& id )
+{
+    return _buckets[ hashTileID(id) & (_buckets.size()-1) ];
+}
+
+const DataAvailabilityIndex::Entry*
+DataAvailabilityIndex::find( const osgTerrain::TileID& id ) const
+{
+    const Bucket& bucket = _buckets[ hashTileID(id) & (_buckets.size()-1) ];
+    for( Bucket::const_iterator i = bucket.begin(); i != bucket.end(); ++i )
+    {
+        if ( (*i)->_id == id )
+            return &(**i);
+    }
+    return 0L;
+}
+
+void
+DataAvailabilityIndex::setDataExtents( const DataExtentList& extents )
+{
+    Threading::ScopedWriteLock lock( _mutex );
+    _dataExtents = extents;
+    _keyExtents = 0L;
+    _keySRS = 0L;
+}
+
+void
+DataAvailabilityIndex::insert( const osgTerrain::TileID& id, bool hasData, int fallbackLOD )
+{
+    Order::iterator entry = _order.end();
+
+    Bucket& bucket = bucketFor( id );
+    for( Bucket::iterator b = bucket.begin(); b != bucket.end(); ++b )
+    {
+        if ( (*b)->_id == id )
+        {
+            entry = *b;
+            break;
+        }
+    }
+
+    if ( entry != _order.end() )
+    {
+        // move it to the back of the eviction order; list iterators stay valid.
+        _order.splice( _order.end(), _order, entry );
+    }
+    else
+    {
+        // keep the index bounded by forgetting the least recently recorded tile;
+        // it will simply be re-learned.
+        if ( _maxEntries > 0 && _count >= _maxEntries )
+        {
+            Order::iterator oldest = _order.begin();
+            Bucket& oldBucket = bucketFor( oldest->_id );
+            for( Bucket::iterator b = oldBucket.begin(); b != oldBucket.end(); ++b )
+            {
+                if ( *b == oldest )
+                {
+                    *b = oldBucket.back();
+                    oldBucket.pop_back();
+                    break;
+                }
+            }
+            _order.pop_front();
+            --_count;
+        }
+
+        Entry e;
+        e._id = id;
+        entry = _order.insert( _order.end(), e );
+
+        // grow to keep the chains short:
+        if ( ++_count > _buckets.size() )
+            rehash( _buckets.size() * 2 );
+        else
+            bucketFor( id ).push_back( entry );
+    }
+
+    entry->_hasData = hasData;
+    entry->_fallbackLOD = fallbackLOD;
+}
+
+void
+DataAvailabilityIndex::setAvailable( const TileKey& key )
+{
+    Threading::ScopedWriteLock lock( _mutex );
+    insert( key.getTileId(), true, -1 );
+}
+
+void
+DataAvailabilityIndex::setUnavailable( const TileKey& key )
+{
+    // above the first level with data, "no data" doesn't carry down to the descendants.
+    unsigned minLOD = 0, maxLOD = key.getLevelOfDetail();
+    if ( getExtentBounds( key, minLOD, maxLOD ) && key.getLevelOfDetail() < minLOD )
+        return;
+
+    Threading::ScopedWriteLock lock( _mutex );
+    insert( key.getTileId(), false, -1 );
+}
+
+void
+DataAvailabilityIndex::setFallback( const TileKey& key, unsigned ancestorLOD )
+{
+    unsigned lod = key.getLevelOfDetail();
+    if ( ancestorLOD > lod )
+        return;
+
+    unsigned x, y;
+    key.getTileXY( x, y );
+
+    Threading::ScopedWriteLock lock( _mutex );
+    for( unsigned level = ancestorLOD+1; level <= lod; ++level )
+    {
+        insert( osgTerrain::TileID(level, x >> (lod-level), y >> (lod-level)), false, (int)ancestorLOD );
+    }
+    insert( osgTerrain::TileID(ancestorLOD, x >> (lod-ancestorLOD), y >> (lod-ancestorLOD)), true, -1 );
+}
+
+bool
+DataAvailabilityIndex::getExtentBounds( const TileKey& key, unsigned& out_minLOD, unsigned& out_maxLOD ) const
+{
+    const SpatialReference* keySRS = key.getProfile()->getSRS();
+    osg::ref_ptr<const DataExtentIndex> index;
+    bool ready = false;
+    {
+        Threading::ScopedReadLock lock( const_cast<DataAvailabilityIndex*>(this)->_mutex );
+        if ( _dataExtents.size() == 0 )
+            return true;
+
+        if ( _keySRS.get() == keySRS )
+        {
+            index = _keyExtents.get();
+            ready = true;
+        }
+    }
+
+    if ( !ready )
+    {
+        Threading::ScopedWriteLock lock( const_cast<DataAvailabilityIndex*>(this)->_mutex );
+
+        // the data extents are in the source's SRS; bring them into the keys' SRS once.
+        if ( _keySRS.get() != keySRS )
+        {
+            _keyExtents = 0L;
+            _keySRS = keySRS;
+
+            DataExtentList keyExtents;
+            for( DataExtentList::const_iterator i = _dataExtents.begin(); i != _dataExtents.end(); ++i )
+            {
+                GeoExtent ex = i->getSRS()->isEquivalentTo( keySRS ) ? GeoExtent(*i) : i->transform( keySRS );
+                if ( !ex.isValid() )
+                {
+                    // can't use the extents to bound anything.
+                    keyExtents.clear();
+                    break;
+                }
+                keyExtents.push_back( DataExtent(ex, i->getMinLevel(), i->getMaxLevel()) );
+            }
+
+            if ( keyExtents.size() > 0 )
+                _keyExtents = new DataExtentIndex( keyExtents );
+        }
+        index = _keyExtents.get();
+    }
+
+    if ( !index.valid() )
+        return true;
+
+    return index->getLevelRange( key.getExtent(), out_minLOD, out_maxLOD );
+}
+
+bool
+DataAvailabilityIndex::getBestAvailableLOD( const TileKey& key, unsigned& out_lod ) const
+{
+    unsigned keyLOD = key.getLevelOfDetail();
+    unsigned minLOD = 0, maxLOD = keyLOD;
+    if ( !getExtentBounds( key, minLOD, maxLOD ) )
+        return false;
+
+    int lod = (int)osg::minimum( keyLOD, maxLOD );
+
+    unsigned x, y;
+    key.getTileXY( x, y );
+
+    Threading::ScopedReadLock lock( const_cast<DataAvailabilityIndex*>(this)->_mutex );
+
+    // walk up from the key. A tile with data means all of its ancestors have data too;
+    // a tile without data means none of its descendants do (down to the first data level).
+    for( int level = (int)keyLOD; level >= (int)minLOD && _count > 0; --level )
+    {
+        const Entry* e = find( osgTerrain::TileID(level, x >> (keyLOD-level), y >> (keyLOD-level)) );
+        if ( e )
+        {
+            if ( e->_hasData )
+                break;
+
+            if ( e->_fallbackLOD >= 0 )
+            {
+                lod = osg::minimum( lod, e->_fallbackLOD );
+                break;
+            }
+
+            lod = osg::minimum( lod, level-1 );
+        }
+    }
+
+    if ( lod < (int)minLOD )
+        return false;
+
+    out_lod = (unsigned)lod;
+    return true;
+}
+
+void
+DataAvailabilityIndex::clear()
+{
+    Threading::ScopedWriteLock lock( _mutex );
+    _order.clear();
+    _count = 0;
+    rehash( 64 );
+}
+
+unsigned
+DataAvailabilityIndex::size() const
+{
+    Threading::ScopedReadLock lock( const_cast<DataAvailabilityIndex*>(this)->_mutex );
+    return _count;
+}
+
+//------------------------------------------------------------------------
+
 TerrainLayer::TerrainLayer( TerrainLayerOptions* options ) :
 _runtimeOptions( options )
 {
@@ -148,6 +409,7 @@ TerrainLayer::init()
 {
     _tileSourceInitialized = false;
     _tileSize              = 256;
+    _availability          = new DataAvailabilityIndex();
 }
 
 void
@@ -323,6 +585,8 @@ TerrainLayer::initTileSource()
 		if ( _tileSource->isOK() )
 		{
 			_tileSize = _tileSource->getPixelsPerTile();
+            const TileSource* source = _tileSource.get();
+            _availability->setDataExtents( source->getDataExtents() );
 		}
 		else
 		{
@@ -393,6 +657,44 @@ TerrainLayer::isKeyValid(const TileKey& key) const
 	return true;
 }
 
+bool
+TerrainLayer::getBestAvailableLOD( const TileKey& key, unsigned& out_lod ) const
+{
+    unsigned lod;
+    if ( !_availability->getBestAvailableLOD( key, lod ) )
+        return false;
+
+    // respect the explicit level limits.
+    if ( _runtimeOptions->maxLevel().isSet() && (int)lod > _runtimeOptions->maxLevel().value() )
+        lod = _runtimeOptions->maxLevel().value();
+
+    if ( _runtimeOptions->minLevel().isSet() && (int)lod < _runtimeOptions->minLevel().value() )
+        return false;
+
+    out_lod = lod;
+    return true;
+}
+
+void
+TerrainLayer::recordAvailability( const TileKey& key, bool hasData, ProgressCallback* progress )
+{
+    // a canceled request says nothing about the data, and dynamic data can change.
+    if ( !hasData && progress && (progress->isCanceled() || progress->needsRetry()) )
+        return;
+
+    if ( isDynamic() )
+        return;
+
+    // keys outside the layer's level limits return nothing without asking the source.
+    if ( !isKeyValid(key) )
+        return;
+
+    if ( hasData )
+        _availability->setAvailable( key );
+    else
+        _availability->setUnavailable( key );
+}
+
 void
 TerrainLayer::setEnabled( bool value )
 {
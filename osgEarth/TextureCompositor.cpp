@@ -261,7 +261,8 @@ TextureCompositor::TextureCompositor(const TerrainOptions& options) :
 osg::Referenced( true ),
 _tech( options.compositingTechnique().value() ),
 _options( options ),
-_forceTech( false )
+_forceTech( false ),
+_layoutMutex( "TextureCompositor layout" )
 {
     // for debugging:
     if ( _tech == TerrainOptions::COMPOSITING_AUTO && ::getenv( "OSGEARTH_COMPOSITOR_TECH" ) )
@@ -0,0 +1,267 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/ThreadingUtils>
+
+#ifdef OSGEARTH_PROFILE_LOCKS
+#  include <osg/Timer>
+#  include <algorithm>
+#  include <iomanip>
+#endif
+
+#define LC "[ReadWriteMutex] "
+
+using namespace osgEarth;
+using namespace osgEarth::Threading;
+
+//------------------------------------------------------------------------
+
+#ifdef OSGEARTH_PROFILE_LOCKS
+
+struct LockProfiler::Entry
+{
+    LockStats          _stats;
+    OpenThreads::Mutex _mutex;
+};
+
+namespace
+{
+    const char* siteName( const char* site )
+    {
+        return site ? site : "(unknown)";
+    }
+
+    double totalWait( const LockStats& stats )
+    {
+        return stats._readWaitTime + stats._writeWaitTime;
+    }
+
+    bool worseLock( const LockStats& lhs, const LockStats& rhs )
+    {
+        return totalWait(lhs) > totalWait(rhs);
+    }
+
+    typedef std::pair<std::string, LockSiteStats> SiteEntry;
+
+    bool worseSite( const SiteEntry& lhs, const SiteEntry& rhs )
+    {
+        return lhs.second._waitTime + lhs.second._holdTime > rhs.second._waitTime + rhs.second._holdTime;
+    }
+}
+
+LockProfiler*
+LockProfiler::instance()
+{
+    // never destroyed, since static locks may still be in use during shutdown
+    static LockProfiler* s_instance = new LockProfiler();
+    return s_instance;
+}
+
+LockProfiler::Entry*
+LockProfiler::getEntry( const std::string& name )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    Entry*& entry = _entries[name];
+    if ( !entry )
+    {
+        entry = new Entry();
+        entry->_stats._name = name;
+    }
+    return entry;
+}
+
+void
+LockProfiler::record( Entry* entry, const char* site, bool write, bool contended, double waitTime )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( entry->_mutex );
+    LockStats& stats = entry->_stats;
+    if ( write )
+    {
+        stats._writes++;
+        if ( contended ) stats._contendedWrites++;
+        stats._writeWaitTime += waitTime;
+    }
+    else
+    {
+        stats._reads++;
+        if ( contended ) stats._contendedReads++;
+        stats._readWaitTime += waitTime;
+    }
+    if ( waitTime > stats._maxWaitTime )
+        stats._maxWaitTime = waitTime;
+
+    LockSiteStats& siteStats = stats._sites[siteName(site)];
+    siteStats._acquisitions++;
+    if ( contended ) siteStats._contended++;
+    siteStats._waitTime += waitTime;
+}
+
+void
+LockProfiler::recordHold( Entry* entry, const char* site, double holdTime )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( entry->_mutex );
+    entry->_stats._sites[siteName(site)]._holdTime += holdTime;
+}
+
+void
+LockProfiler::getStats( std::vector<LockStats>& out_stats ) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    out_stats.clear();
+    out_stats.reserve( _entries.size() );
+    for( EntryMap::const_iterator i = _entries.begin(); i != _entries.end(); ++i )
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> entryLock( i->second->_mutex );
+        out_stats.push_back( i->second->_stats );
+    }
+}
+
+void
+LockProfiler::reset()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    for( EntryMap::iterator i = _entries.begin(); i != _entries.end(); ++i )
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> entryLock( i->second->_mutex );
+        LockStats& stats = i->second->_stats;
+        std::string name = stats._name;
+        stats = LockStats();
+        stats._name = name;
+    }
+}
+
+void
+LockProfiler::report( std::ostream& out ) const
+{
+    std::vector<LockStats> stats;
+    getStats( stats );
+    std::sort( stats.begin(), stats.end(), worseLock );
+
+    out << std::fixed << std::setprecision(3);
+    for( std::vector<LockStats>::const_iterator i = stats.begin(); i != stats.end(); ++i )
+    {
+        out << "Lock \"" << i->_name << "\": "
+            << i->_reads << " reads (" << i->_contendedReads << " contended, " << 1000.0*i->_readWaitTime << " ms waiting), "
+            << i->_writes << " writes (" << i->_contendedWrites << " contended, " << 1000.0*i->_writeWaitTime << " ms waiting), "
+            << "longest wait " << 1000.0*i->_maxWaitTime << " ms" << std::endl;
+
+        std::vector<SiteEntry> sites( i->_sites.begin(), i->_sites.end() );
+        std::sort( sites.begin(), sites.end(), worseSite );
+        for( std::vector<SiteEntry>::const_iterator s = sites.begin(); s != sites.end(); ++s )
+        {
+            out << "    " << s->first << ": "
+                << s->second._acquisitions << " acquisitions (" << s->second._contended << " contended), "
+                << 1000.0*s->second._waitTime << " ms waiting, "
+                << 1000.0*s->second._holdTime << " ms held exclusively" << std::endl;
+        }
+    }
+}
+
+#endif // OSGEARTH_PROFILE_LOCKS
+
+//------------------------------------------------------------------------
+
+ReadWriteMutex::ReadWriteMutex( const char* name ) :
+_state( 0 )
+{
+#ifdef OSGEARTH_PROFILE_LOCKS
+    _profile    = LockProfiler::instance()->getEntry( name ? name : "(unnamed)" );
+    _holderSite = 0L;
+    _holdStart  = 0.0;
+#endif
+}
+
+void
+ReadWriteMutex::readLockContended( const char* site )
+{
+#ifdef OSGEARTH_PROFILE_LOCKS
+    osg::Timer_t start = osg::Timer::instance()->tick();
+#endif
+
+    // a writer holds or is waiting for the lock: back out, wait for it to finish, and retry.
+    do
+    {
+        if ( --_state == WRITER )
+            wake();
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _waitMutex );
+        while( (_state & WRITER) != 0 )
+            _cond.wait( &_waitMutex );
+    }
+    while( (++_state & WRITER) != 0 );
+
+#ifdef OSGEARTH_PROFILE_LOCKS
+    LockProfiler::instance()->record( _profile, site, false, true,
+        osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()) );
+#endif
+}
+
+void
+ReadWriteMutex::writeLock( const char* site )
+{
+#ifdef OSGEARTH_PROFILE_LOCKS
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    bool contended = _writerMutex.trylock() != 0;
+    if ( contended )
+#endif
+    _writerMutex.lock();
+
+    // announce the writer (which turns new readers away), then wait for the current readers to leave.
+    // (the return value of Atomic::OR differs between OpenThreads builds, so re-read the state)
+    _state.OR( WRITER );
+    if ( _state != WRITER )
+    {
+#ifdef OSGEARTH_PROFILE_LOCKS
+        contended = true;
+#endif
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _waitMutex );
+        while( _state != WRITER )
+            _cond.wait( &_waitMutex );
+    }
+
+#ifdef OSGEARTH_PROFILE_LOCKS
+    _holdStart  = osg::Timer::instance()->time_s();
+    _holderSite = site;
+    LockProfiler::instance()->record( _profile, site, true, contended,
+        contended ? osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick()) : 0.0 );
+#endif
+}
+
+void
+ReadWriteMutex::writeUnlock()
+{
+#ifdef OSGEARTH_PROFILE_LOCKS
+    const char* site = _holderSite;
+    double      held = osg::Timer::instance()->time_s() - _holdStart;
+#endif
+
+    _state.AND( ~WRITER );
+    wake();
+    _writerMutex.unlock();
+
+#ifdef OSGEARTH_PROFILE_LOCKS
+    LockProfiler::instance()->recordHold( _profile, site, held );
+#endif
+}
+
+void
+ReadWriteMutex::wake()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _waitMutex );
+    _cond.broadcast();
+}
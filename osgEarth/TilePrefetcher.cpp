@@ -0,0 +1,576 @@
+/* -*-c++-*- */
+/* osgEarth - Dynamic map generation toolkit for OpenSceneGraph
+ * Copyright 2008-2010 Pelican Mapping
+ * http://osgearth.org
+ *
+ * osgEarth is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#include <osgEarth/TilePrefetcher>
+#include <osgEarth/Registry>
+#include <osgUtil/CullVisitor>
+#include <osg/Timer>
+#include <OpenThreads/Thread>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <cmath>
+
+#define LC "[TilePrefetcher] "
+
+using namespace osgEarth;
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    // meters per degree of latitude (and of longitude at the equator)
+    const double METERS_PER_DEGREE = 111319.49;
+
+    // bounds the number of tiles per footprint, in case of a bogus camera height
+    const int MAX_TILES_ACROSS = 16;
+
+    // the prefetcher remembers this many of the tiles it fetched, forgetting the ones
+    // least recently predicted first (they may have left the caches by then anyway)
+    const unsigned MAX_FETCHED = 4096;
+
+    bool sooner( const std::pair<double, TileKey>& lhs, const std::pair<double, TileKey>& rhs )
+    {
+        return lhs.first < rhs.first;
+    }
+}
+
+//------------------------------------------------------------------------
+
+bool
+CameraPathIO::read( std::istream& in, CameraPath& out_path )
+{
+    std::string line;
+    while( std::getline(in, line) )
+    {
+        if ( line.empty() || line[0] == '#' )
+            continue;
+
+        std::istringstream buf( line );
+        CameraSample sample;
+        if ( !(buf >> sample._time >> sample._position.x() >> sample._position.y() >> sample._position.z()) )
+            return false;
+        out_path.push_back( sample );
+    }
+    return !in.bad();
+}
+
+bool
+CameraPathIO::write( const CameraPath& path, std::ostream& out )
+{
+    out << std::setprecision(15);
+    for( CameraPath::const_iterator i = path.begin(); i != path.end(); ++i )
+    {
+        out << i->_time << " " << i->_position.x() << " " << i->_position.y() << " " << i->_position.z() << std::endl;
+    }
+    return !out.fail();
+}
+
+//------------------------------------------------------------------------
+
+TilePrefetchPredictor::TilePrefetchPredictor( const Profile* profile ) :
+_profile ( profile ),
+_horizon ( 2.0 ),
+_step    ( 0.5 ),
+_history ( 1.0 ),
+_fov     ( 30.0 ),
+_pixels  ( 1024.0 ),
+_tileSize( 256 ),
+_minLevel( 0 ),
+_maxLevel( 23 )
+{
+    //nop
+}
+
+void
+TilePrefetchPredictor::addSample( const CameraSample& sample )
+{
+    // time went backwards (e.g. a new replay): start over.
+    if ( !_samples.empty() && sample._time < _samples.back()._time )
+        _samples.clear();
+
+    _samples.push_back( sample );
+    while( _samples.size() > 2 && _samples.front()._time < sample._time - _history )
+        _samples.pop_front();
+}
+
+void
+TilePrefetchPredictor::reset()
+{
+    _samples.clear();
+}
+
+bool
+TilePrefetchPredictor::getPosition( osg::Vec3d& out_position ) const
+{
+    if ( _samples.empty() )
+        return false;
+    out_position = _samples.back()._position;
+    return true;
+}
+
+osg::Vec3d
+TilePrefetchPredictor::getVelocity() const
+{
+    // least-squares fit of position over time, which smooths out jittery samples.
+    if ( _samples.size() < 2 )
+        return osg::Vec3d(0,0,0);
+
+    double     meanTime = 0.0;
+    osg::Vec3d meanPos;
+    for( std::deque<CameraSample>::const_iterator i = _samples.begin(); i != _samples.end(); ++i )
+    {
+        meanTime += i->_time;
+        meanPos  += i->_position;
+    }
+    meanTime /= (double)_samples.size();
+    meanPos  /= (double)_samples.size();
+
+    double     den = 0.0;
+    osg::Vec3d num;
+    for( std::deque<CameraSample>::const_iterator i = _samples.begin(); i != _samples.end(); ++i )
+    {
+        double dt = i->_time - meanTime;
+        num += (i->_position - meanPos) * dt;
+        den += dt*dt;
+    }
+
+    return den > 0.0 ? num / den : osg::Vec3d(0,0,0);
+}
+
+void
+TilePrefetchPredictor::getVisibleKeys( const osg::Vec3d& position, std::set<TileKey>& out_keys ) const
+{
+    if ( !_profile.valid() )
+        return;
+
+    // half-width of the footprint, in meters, then in profile units:
+    double height    = osg::maximum( position.z(), 1.0 );
+    double halfWidth = height * tan( osg::DegreesToRadians(0.5*_fov) );
+    double unitsX = 1.0, unitsY = 1.0;
+    if ( _profile->getSRS()->isGeographic() )
+    {
+        unitsY = 1.0 / METERS_PER_DEGREE;
+        unitsX = unitsY / osg::maximum( cos(osg::DegreesToRadians(position.y())), 0.01 );
+    }
+    double halfX = halfWidth * unitsX;
+    double halfY = halfWidth * unitsY;
+
+    // the level of detail that puts about one tile pixel on each screen pixel:
+    double resolution = 2.0*halfY / _pixels;
+    unsigned lod = osg::clampBetween(
+        _profile->getLevelOfDetailForHorizResolution( resolution, _tileSize ), _minLevel, _maxLevel );
+
+    double tileWidth, tileHeight;
+    _profile->getTileDimensions( lod, tileWidth, tileHeight );
+    unsigned numWide, numHigh;
+    _profile->getNumTiles( lod, numWide, numHigh );
+
+    // tile rows count down from the top of the profile:
+    const GeoExtent& ex = _profile->getExtent();
+    int xmin = (int)floor( (position.x() - halfX - ex.xMin()) / tileWidth );
+    int xmax = (int)floor( (position.x() + halfX - ex.xMin()) / tileWidth );
+    int ymin = (int)floor( (ex.yMax() - (position.y() + halfY)) / tileHeight );
+    int ymax = (int)floor( (ex.yMax() - (position.y() - halfY)) / tileHeight );
+
+    if ( xmax < 0 || ymax < 0 || xmin >= (int)numWide || ymin >= (int)numHigh )
+        return;
+
+    xmin = osg::maximum( xmin, osg::maximum(0, (xmin+xmax)/2 - MAX_TILES_ACROSS/2) );
+    xmax = osg::minimum( xmax, osg::minimum((int)numWide-1, xmin + MAX_TILES_ACROSS-1) );
+    ymin = osg::maximum( ymin, osg::maximum(0, (ymin+ymax)/2 - MAX_TILES_ACROSS/2) );
+    ymax = osg::minimum( ymax, osg::minimum((int)numHigh-1, ymin + MAX_TILES_ACROSS-1) );
+
+    for( int y = ymin; y <= ymax; ++y )
+        for( int x = xmin; x <= xmax; ++x )
+            out_keys.insert( TileKey(lod, x, y, _profile.get()) );
+}
+
+void
+TilePrefetchPredictor::getPredictedKeys( std::map<TileKey, double>& out_keys ) const
+{
+    osg::Vec3d position;
+    if ( !getPosition(position) )
+        return;
+
+    // a camera at rest needs nothing beyond what it already sees.
+    osg::Vec3d velocity = getVelocity();
+    if ( velocity.length2() == 0.0 )
+        return;
+
+    std::set<TileKey> visibleNow;
+    getVisibleKeys( position, visibleNow );
+
+    double step = _step > 0.0 ? _step : _horizon;
+    for( double t = step; t <= _horizon + 1e-6; t += step )
+    {
+        osg::Vec3d future = position + velocity*t;
+
+        std::set<TileKey> keys;
+        getVisibleKeys( future, keys );
+        for( std::set<TileKey>::const_iterator k = keys.begin(); k != keys.end(); ++k )
+        {
+            if ( visibleNow.find(*k) == visibleNow.end() && out_keys.find(*k) == out_keys.end() )
+                out_keys[*k] = t;
+        }
+    }
+}
+
+//------------------------------------------------------------------------
+
+namespace
+{
+    /** Creates one tile in every terrain layer, which leaves it in the layers' caches. */
+    struct PrefetchTask : public TaskRequest
+    {
+        PrefetchTask( const MapFrame& mapf, const TileKey& key, float priority ) :
+            TaskRequest( priority ),
+            _mapf      ( mapf, "TilePrefetcher task" ),
+            _key       ( key ) { }
+
+        void operator()( ProgressCallback* progress )
+        {
+            if ( _mapf.isCached(_key) )
+                return;
+
+            for( ImageLayerVector::const_iterator i = _mapf.imageLayers().begin(); i != _mapf.imageLayers().end(); ++i )
+            {
+                if ( progress && progress->isCanceled() )
+                    return;
+                if ( i->get()->isKeyValid(_key) )
+                    i->get()->createImage( _key, progress );
+            }
+
+            if ( _mapf.elevationLayers().size() > 0 && !(progress && progress->isCanceled()) )
+            {
+                osg::ref_ptr<osg::HeightField> hf;
+                _mapf.getHeightField( _key, false, hf, 0L, INTERP_AVERAGE, SAMPLE_FIRST_VALID, progress );
+            }
+        }
+
+        MapFrame _mapf;
+        TileKey  _key;
+    };
+}
+
+TilePrefetcher::TilePrefetcher( const Map* map ) :
+osg::Referenced( true ),
+_mapf        ( map, Map::TERRAIN_LAYERS, "TilePrefetcher" ),
+_predictor   ( map->getProfile() ),
+_maxPending  ( 64 ),
+_numIssued   ( 0 ),
+_numCancelled( 0 ),
+_numCompleted( 0 ),
+_replayCompleted( 0L )
+{
+    // prefetching runs in its own low-weight task service, so it never delays the
+    // requests for tiles that are actually on screen.
+    TaskServiceManager* manager = Registry::instance()->getTaskServiceManager();
+    _serviceUID = Registry::instance()->createUID();
+    _service = manager->add( _serviceUID, 0.25f );
+    _service->setName( "TilePrefetcher" );
+    manager->setThreadLimits( _service.get(), 1, 2 );
+}
+
+TilePrefetcher::~TilePrefetcher()
+{
+    cancelPending();
+    Registry::instance()->getTaskServiceManager()->remove( _serviceUID );
+}
+
+unsigned
+TilePrefetcher::getNumIssued() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    return _numIssued;
+}
+
+unsigned
+TilePrefetcher::getNumCancelled() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    return _numCancelled;
+}
+
+unsigned
+TilePrefetcher::getNumCompleted() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    return _numCompleted;
+}
+
+void
+TilePrefetcher::cancel()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    cancelPending();
+}
+
+void
+TilePrefetcher::cancelPending()
+{
+    for( PendingMap::iterator i = _pending.begin(); i != _pending.end(); ++i )
+    {
+        if ( !i->second->isCompleted() )
+        {
+            i->second->cancel();
+            _numCancelled++;
+        }
+    }
+    _pending.clear();
+}
+
+void
+TilePrefetcher::retireCompleted()
+{
+    for( PendingMap::iterator i = _pending.begin(); i != _pending.end(); )
+    {
+        if ( i->second->isCompleted() )
+        {
+            if ( !i->second->wasCanceled() )
+            {
+                touchFetched( i->first );
+                _numCompleted++;
+                if ( _replayCompleted )
+                    _replayCompleted->insert( i->first );
+            }
+            _pending.erase( i++ );
+        }
+        else ++i;
+    }
+}
+
+void
+TilePrefetcher::touchFetched( const TileKey& key )
+{
+    FetchedMap::iterator i = _fetched.find( key );
+    if ( i != _fetched.end() )
+    {
+        _fetchedOrder.splice( _fetchedOrder.end(), _fetchedOrder, i->second );
+    }
+    else
+    {
+        _fetched[key] = _fetchedOrder.insert( _fetchedOrder.end(), key );
+        while( _fetchedOrder.size() > MAX_FETCHED )
+        {
+            _fetched.erase( _fetchedOrder.front() );
+            _fetchedOrder.pop_front();
+        }
+    }
+}
+
+void
+TilePrefetcher::update( double time, const osg::Vec3d& position )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+
+    _predictor.addSample( time, position );
+    _mapf.sync();
+
+    retireCompleted();
+
+    std::map<TileKey, double> predicted;
+    _predictor.getPredictedKeys( predicted );
+
+    // cancel the tasks for tiles that are no longer predicted.
+    for( PendingMap::iterator i = _pending.begin(); i != _pending.end(); )
+    {
+        if ( predicted.find(i->first) == predicted.end() )
+        {
+            i->second->cancel();
+            _numCancelled++;
+            _pending.erase( i++ );
+        }
+        else ++i;
+    }
+
+    // queue the new ones, soonest needed first (the task queue runs the lowest priority value first).
+    // tiles already fetched are kept from being forgotten while they are still predicted.
+    std::vector< std::pair<double, TileKey> > order;
+    order.reserve( predicted.size() );
+    for( std::map<TileKey, double>::const_iterator i = predicted.begin(); i != predicted.end(); ++i )
+    {
+        if ( _fetched.find(i->first) != _fetched.end() )
+            touchFetched( i->first );
+        else if ( _pending.find(i->first) == _pending.end() )
+            order.push_back( std::make_pair(i->second, i->first) );
+    }
+    std::sort( order.begin(), order.end(), sooner );
+
+    for( unsigned i = 0; i < order.size() && _pending.size() < _maxPending; ++i )
+    {
+        TaskRequest* task = new PrefetchTask( _mapf, order[i].second, (float)order[i].first );
+        task->setName( order[i].second.str() );
+        _pending[order[i].second] = task;
+        _service->add( task );
+        _numIssued++;
+    }
+}
+
+TilePrefetchReport
+TilePrefetcher::replay( const CameraPath& path, double speed )
+{
+    TilePrefetchReport report;
+    if ( path.empty() )
+        return report;
+    if ( speed <= 0.0 )
+        speed = 1.0;
+
+    std::set<TileKey> completed; // tiles prefetched during the replay
+    std::set<TileKey> demanded;
+    unsigned issued, cancelled;
+
+    // start from a clean slate, so tiles fetched before the replay do not count as hits:
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        cancelPending();
+        _fetched.clear();
+        _fetchedOrder.clear();
+        _predictor.reset();
+        _replayCompleted = &completed;
+        issued    = _numIssued;
+        cancelled = _numCancelled;
+    }
+
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    double t0 = path.front()._time;
+
+    for( CameraPath::const_iterator s = path.begin(); s != path.end(); ++s )
+    {
+        // wait until the sample is due:
+        double due = (s->_time - t0) / speed;
+        double now = osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+        if ( due > now )
+            OpenThreads::Thread::microSleep( (unsigned int)((due - now) * 1.0e6) );
+
+        report._samples++;
+
+        // what the camera needs now, against what has been prefetched so far:
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            retireCompleted();
+
+            std::set<TileKey> visible;
+            _predictor.getVisibleKeys( s->_position, visible );
+            for( std::set<TileKey>::const_iterator k = visible.begin(); k != visible.end(); ++k )
+            {
+                if ( demanded.insert(*k).second )
+                {
+                    report._demanded++;
+                    if ( completed.find(*k) != completed.end() )
+                        report._hits++;
+                    else if ( _pending.find(*k) != _pending.end() )
+                        report._late++;
+                    else
+                        report._misses++;
+                }
+            }
+        }
+
+        update( s->_time, s->_position );
+    }
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        retireCompleted();
+        cancelPending();
+        _replayCompleted = 0L;
+        report._issued    = _numIssued - issued;
+        report._cancelled = _numCancelled - cancelled;
+    }
+
+    for( std::set<TileKey>::const_iterator k = completed.begin(); k != completed.end(); ++k )
+    {
+        if ( demanded.find(*k) == demanded.end() )
+            report._wasted++;
+    }
+
+    return report;
+}
+
+//------------------------------------------------------------------------
+
+TilePrefetchCallback::TilePrefetchCallback( TilePrefetcher* prefetcher, const Map* map ) :
+_prefetcher( prefetcher ),
+_profile   ( map->getProfile() ),
+_geocentric( map->isGeocentric() ),
+_record    ( false ),
+_lastFrame ( ~0u )
+{
+    //nop
+}
+
+void
+TilePrefetchCallback::getRecordedPath( CameraPath& out_path ) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+    out_path = _path;
+}
+
+void
+TilePrefetchCallback::operator()( osg::Node* node, osg::NodeVisitor* nv )
+{
+    osgUtil::CullVisitor* cv = dynamic_cast<osgUtil::CullVisitor*>( nv );
+
+    // one sample per frame, even with several cameras culling in parallel:
+    bool sample = false;
+    if ( cv && _profile.valid() && nv->getFrameStamp() )
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+        if ( nv->getFrameStamp()->getFrameNumber() != _lastFrame )
+        {
+            _lastFrame = nv->getFrameStamp()->getFrameNumber();
+            sample = true;
+        }
+    }
+
+    if ( sample )
+    {
+        osg::Vec3d eye = cv->getEyePoint();
+        osg::Vec3d position = eye;
+
+        if ( _geocentric )
+        {
+            // from ECEF to the profile SRS, keeping the height in meters:
+            const SpatialReference* geoSRS = _profile->getSRS()->getGeographicSRS();
+            double lat, lon, height;
+            geoSRS->getEllipsoid()->convertXYZToLatLongHeight( eye.x(), eye.y(), eye.z(), lat, lon, height );
+            position.set( osg::RadiansToDegrees(lon), osg::RadiansToDegrees(lat), height );
+
+            if ( !_profile->getSRS()->isGeographic() )
+            {
+                osg::Vec3d local;
+                if ( geoSRS->transform(position, _profile->getSRS(), local) )
+                    position.set( local.x(), local.y(), height );
+            }
+        }
+
+        double time = nv->getFrameStamp()->getReferenceTime();
+
+        if ( _record )
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _mutex );
+            _path.push_back( CameraSample(time, position) );
+        }
+
+        if ( _prefetcher.valid() )
+            _prefetcher->update( time, position );
+    }
+
+    traverse( node, nv );
+}
@@ -21,6 +21,7 @@
 #include <osgEarth/TileSource>
 #include <osgEarth/ImageToHeightFieldConverter>
 #include <osgEarth/ImageUtils>
+#include <osgEarth/HeightFieldUtils>
 #include <osgEarth/FileUtils>
 #include <osgEarth/Registry>
 #include <osgEarth/ThreadingUtils>
@@ -28,6 +29,9 @@
 #include <osgDB/FileNameUtils>
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 
 #define LC "[TileSource] "
 
@@ -35,7 +39,8 @@ using namespace osgEarth;
 
 //------------------------------------------------------------------------
 
-TileBlacklist::TileBlacklist()
+TileBlacklist::TileBlacklist() :
+_mutex( "TileBlacklist" )
 {
     //NOP
 }
@@ -43,7 +48,7 @@ TileBlacklist::TileBlacklist()
 void
 TileBlacklist::add(const osgTerrain::TileID &tile)
 {
-    Threading::ScopedWriteLock lock(_mutex);
+    Threading::ScopedWriteLock lock(_mutex, OE_LOCK_SITE);
     _tiles.insert(tile);
     OE_DEBUG << "Added " << tile.level << " (" << tile.x << ", " << tile.y << ") to blacklist" << std::endl;
 }
@@ -51,7 +56,7 @@ TileBlacklist::add(const osgTerrain::TileID &tile)
 void
 TileBlacklist::remove(const osgTerrain::TileID &tile)
 {
-    Threading::ScopedWriteLock lock(_mutex);
+    Threading::ScopedWriteLock lock(_mutex, OE_LOCK_SITE);
     _tiles.erase(tile);
     OE_DEBUG << "Removed " << tile.level << " (" << tile.x << ", " << tile.y << ") from blacklist" << std::endl;
 }
@@ -59,7 +64,7 @@ TileBlacklist::remove(const osgTerrain::TileID &tile)
 void
 TileBlacklist::clear()
 {
-    Threading::ScopedWriteLock lock(_mutex);
+    Threading::ScopedWriteLock lock(_mutex, OE_LOCK_SITE);
     _tiles.clear();
     OE_DEBUG << "Cleared blacklist" << std::endl;
 }
@@ -67,14 +72,14 @@ TileBlacklist::clear()
 bool
 TileBlacklist::contains(const osgTerrain::TileID &tile) const
 {
-    Threading::ScopedReadLock lock(const_cast<TileBlacklist*>(this)->_mutex);
+    Threading::ScopedReadLock lock(const_cast<TileBlacklist*>(this)->_mutex, OE_LOCK_SITE);
     return _tiles.find(tile) != _tiles.end();
 }
 
 unsigned int
 TileBlacklist::size() const
 {
-    Threading::ScopedReadLock lock(const_cast<TileBlacklist*>(this)->_mutex);
+    Threading::ScopedReadLock lock(const_cast<TileBlacklist*>(this)->_mutex, OE_LOCK_SITE);
     return _tiles.size();
 }
 
@@ -129,7 +134,7 @@ TileBlacklist::write(const std::string &filename) const
 void
 TileBlacklist::write(std::ostream &output) const
 {
-    Threading::ScopedReadLock lock(const_cast<TileBlacklist*>(this)->_mutex);
+    Threading::ScopedReadLock lock(const_cast<TileBlacklist*>(this)->_mutex, OE_LOCK_SITE);
     for (BlacklistedTiles::const_iterator itr = _tiles.begin(); itr != _tiles.end(); ++itr)
     {
         output << itr->level << " " << itr->x << " " << itr->y << std::endl;
@@ -138,14 +143,287 @@ TileBlacklist::write(std::ostream &output) const
 
 //------------------------------------------------------------------------
 
+namespace
+{
+    // number of children per node in the packed R-tree.
+    const unsigned RTREE_NODE_SIZE = 16;
+
+    template<typename T>
+    struct LessCenterX {
+        bool operator()( const T& lhs, const T& rhs ) const {
+            return lhs._xmin + lhs._xmax < rhs._xmin + rhs._xmax; }
+    };
+
+    template<typename T>
+    struct LessCenterY {
+        bool operator()( const T& lhs, const T& rhs ) const {
+            return lhs._ymin + lhs._ymax < rhs._ymin + rhs._ymax; }
+    };
+
+    template<typename T>
+    struct LessBoxCenterX {
+        bool operator()( const T& lhs, const T& rhs ) const {
+            return lhs._box._xmin + lhs._box._xmax < rhs._box._xmin + rhs._box._xmax; }
+    };
+
+    template<typename T>
+    struct LessBoxCenterY {
+        bool operator()( const T& lhs, const T& rhs ) const {
+            return lhs._box._ymin + lhs._box._ymax < rhs._box._ymin + rhs._box._ymax; }
+    };
+
+    template<typename BOX>
+    inline bool boxesIntersect( const BOX& a, const BOX& b ) {
+        return !( a._xmin > b._xmax || a._xmax < b._xmin || a._ymin > b._ymax || a._ymax < b._ymin );
+    }
+
+    template<typename BOX>
+    inline void expandBox( BOX& box, const BOX& rhs ) {
+        box._xmin = osg::minimum( box._xmin, rhs._xmin );
+        box._ymin = osg::minimum( box._ymin, rhs._ymin );
+        box._xmax = osg::maximum( box._xmax, rhs._xmax );
+        box._ymax = osg::maximum( box._ymax, rhs._ymax );
+        box._minLevel = osg::minimum( box._minLevel, rhs._minLevel );
+        box._maxLevel = osg::maximum( box._maxLevel, rhs._maxLevel );
+    }
+
+    // Sort-Tile-Recursive ordering: sorts by x, then sorts each vertical slice by y, so
+    // that consecutive runs of RTREE_NODE_SIZE entries are spatially compact.
+    template<typename T, typename LESS_X, typename LESS_Y>
+    void sortTileRecursive( std::vector<T>& entries )
+    {
+        unsigned numNodes = (entries.size() + RTREE_NODE_SIZE - 1) / RTREE_NODE_SIZE;
+        unsigned numSlices = (unsigned)ceil( sqrt( (double)numNodes ) );
+        unsigned sliceSize = numSlices * RTREE_NODE_SIZE;
+
+        std::sort( entries.begin(), entries.end(), LESS_X() );
+        for( unsigned i = 0; i < entries.size(); i += sliceSize )
+        {
+            unsigned end = osg::minimum( i + sliceSize, (unsigned)entries.size() );
+            std::sort( entries.begin() + i, entries.begin() + end, LESS_Y() );
+        }
+    }
+}
+
+DataExtentIndex::DataExtentIndex( const DataExtentList& extents ) :
+_minLevel( 0 ),
+_maxLevel( 0 )
+{
+    for( DataExtentList::const_iterator i = extents.begin(); i != extents.end(); ++i )
+    {
+        addBoxes( *i, i->getMinLevel(), i->getMaxLevel(), _items );
+    }
+
+    if ( _items.empty() )
+        return;
+
+    // level ranges, merged so hasLevel() is a binary search:
+    std::vector< std::pair<unsigned, unsigned> > ranges;
+    for( DataExtentList::const_iterator i = extents.begin(); i != extents.end(); ++i )
+        ranges.push_back( std::make_pair(i->getMinLevel(), i->getMaxLevel()) );
+    std::sort( ranges.begin(), ranges.end() );
+    for( unsigned i = 0; i < ranges.size(); ++i )
+    {
+        if ( !_levels.empty() && ranges[i].first <= _levels.back().second + 1 )
+            _levels.back().second = osg::maximum( _levels.back().second, ranges[i].second );
+        else
+            _levels.push_back( ranges[i] );
+    }
+    _minLevel = _levels.front().first;
+    _maxLevel = _levels.back().second;
+
+    // pack the leaves:
+    sortTileRecursive< Box, LessCenterX<Box>, LessCenterY<Box> >( _items );
+
+    std::vector<Node> level;
+    for( unsigned i = 0; i < _items.size(); i += RTREE_NODE_SIZE )
+    {
+        Node node;
+        node._first = i;
+        node._count = osg::minimum( RTREE_NODE_SIZE, (unsigned)_items.size() - i );
+        node._leaf  = true;
+        node._box   = _items[i];
+        for( unsigned j = 1; j < node._count; ++j )
+            expandBox( node._box, _items[i+j] );
+        level.push_back( node );
+    }
+
+    // then pack each level of nodes into the one above it, until one root remains.
+    // Each level is appended to _nodes, so the root ends up last.
+    while( true )
+    {
+        if ( level.size() > 1 )
+            sortTileRecursive< Node, LessBoxCenterX<Node>, LessBoxCenterY<Node> >( level );
+
+        unsigned first = _nodes.size();
+        _nodes.insert( _nodes.end(), level.begin(), level.end() );
+        if ( level.size() == 1 )
+            break;
+
+        std::vector<Node> parents;
+        for( unsigned i = 0; i < level.size(); i += RTREE_NODE_SIZE )
+        {
+            Node node;
+            node._first = first + i;
+            node._count = osg::minimum( RTREE_NODE_SIZE, (unsigned)level.size() - i );
+            node._leaf  = false;
+            node._box   = level[i]._box;
+            for( unsigned j = 1; j < node._count; ++j )
+                expandBox( node._box, level[i+j]._box );
+            parents.push_back( node );
+        }
+        level.swap( parents );
+    }
+}
+
+void
+DataExtentIndex::addBoxes( const GeoExtent& extent, unsigned minLevel, unsigned maxLevel, BoxVector& out )
+{
+    if ( extent.crossesDateLine() )
+    {
+        GeoExtent first, second;
+        if ( extent.splitAcrossDateLine( first, second ) )
+        {
+            addBoxes( first, minLevel, maxLevel, out );
+            addBoxes( second, minLevel, maxLevel, out );
+        }
+        else
+        {
+            // can't split it, so cover the full width rather than risk missing it.
+            Box box = { -DBL_MAX, extent.yMin(), DBL_MAX, extent.yMax(), minLevel, maxLevel };
+            out.push_back( box );
+        }
+        return;
+    }
+
+    Box box = { extent.xMin(), extent.yMin(), extent.xMax(), extent.yMax(), minLevel, maxLevel };
+    out.push_back( box );
+
+    // geographic extents that run past +/-180 also cover the wrapped-around side.
+    if ( extent.getSRS() && extent.getSRS()->isGeographic() )
+    {
+        if ( box._xmax > 180.0 )
+        {
+            Box wrapped = { box._xmin - 360.0, box._ymin, box._xmax - 360.0, box._ymax, minLevel, maxLevel };
+            out.push_back( wrapped );
+        }
+        if ( box._xmin < -180.0 )
+        {
+            Box wrapped = { box._xmin + 360.0, box._ymin, box._xmax + 360.0, box._ymax, minLevel, maxLevel };
+            out.push_back( wrapped );
+        }
+    }
+}
+
+bool
+DataExtentIndex::query( const BoxVector& boxes, int lod, bool all, unsigned& out_minLevel, unsigned& out_maxLevel ) const
+{
+    if ( _nodes.empty() )
+        return false;
+
+    bool found = false;
+    std::vector<unsigned> stack;
+
+    for( BoxVector::const_iterator q = boxes.begin(); q != boxes.end(); ++q )
+    {
+        stack.clear();
+        stack.push_back( _nodes.size() - 1 );
+
+        while( !stack.empty() )
+        {
+            const Node& node = _nodes[stack.back()];
+            stack.pop_back();
+
+            if ( !boxesIntersect(node._box, *q) )
+                continue;
+            if ( lod >= 0 && ((unsigned)lod < node._box._minLevel || (unsigned)lod > node._box._maxLevel) )
+                continue;
+
+            for( unsigned i = node._first; i < node._first + node._count; ++i )
+            {
+                if ( !node._leaf )
+                {
+                    stack.push_back( i );
+                    continue;
+                }
+
+                const Box& item = _items[i];
+                if ( !boxesIntersect(item, *q) )
+                    continue;
+                if ( lod >= 0 && ((unsigned)lod < item._minLevel || (unsigned)lod > item._maxLevel) )
+                    continue;
+
+                if ( !found )
+                {
+                    out_minLevel = item._minLevel;
+                    out_maxLevel = item._maxLevel;
+                    found = true;
+                }
+                else
+                {
+                    out_minLevel = osg::minimum( out_minLevel, item._minLevel );
+                    out_maxLevel = osg::maximum( out_maxLevel, item._maxLevel );
+                }
+
+                if ( !all )
+                    return true;
+            }
+        }
+    }
+
+    return found;
+}
+
+bool
+DataExtentIndex::intersects( const GeoExtent& extent, int lod ) const
+{
+    if ( !extent.isValid() )
+        return false;
+
+    BoxVector boxes;
+    addBoxes( extent, 0, 0, boxes );
+
+    unsigned minLevel, maxLevel;
+    return query( boxes, lod, false, minLevel, maxLevel );
+}
+
+bool
+DataExtentIndex::getLevelRange( const GeoExtent& extent, unsigned& out_minLevel, unsigned& out_maxLevel ) const
+{
+    if ( !extent.isValid() )
+        return false;
+
+    BoxVector boxes;
+    addBoxes( extent, 0, 0, boxes );
+
+    return query( boxes, -1, true, out_minLevel, out_maxLevel );
+}
+
+bool
+DataExtentIndex::hasLevel( unsigned lod ) const
+{
+    // find the last range that starts at or before lod.
+    std::vector< std::pair<unsigned, unsigned> >::const_iterator i = std::upper_bound(
+        _levels.begin(), _levels.end(), std::make_pair(lod, UINT_MAX) );
+
+    if ( i == _levels.begin() )
+        return false;
+    --i;
+    return lod <= i->second;
+}
+
+//------------------------------------------------------------------------
+
 TileSource::TileSource( const TileSourceOptions& options ) :
-_options( options )
+_options( options ),
+_dataExtentsIndexCount( 0 ),
+_dataExtentsIndexDirty( true )
 {
     this->setThreadSafeRefUnref( true );
 
     if ( *options.L2CacheSize() > 0 )
     {
-        _memCache = new MemCache( *options.L2CacheSize() );
+        _memCache = new MemCache( *options.L2CacheSize(), "TileSource L2", 2.0f );
     }
     else
     {
@@ -190,14 +468,39 @@ TileSource::getPixelsPerTile() const
 
 osg::Image*
 TileSource::createImage(const TileKey& key, ImageOperation* prepOp, ProgressCallback* progress)
+{
+    osg::ref_ptr<const osg::Image> image;
+    if ( !getImage(key, image, prepOp, progress) )
+        return 0L;
+
+    // the caller may modify the result, so copy it if the L2 cache holds it too.
+    osg::ref_ptr<osg::Image> result = ImageUtils::makeWritable( image.get() );
+    image = 0L;
+    return result.release();
+}
+
+osg::HeightField*
+TileSource::createHeightField(const TileKey& key, HeightFieldOperation* prepOp, ProgressCallback* progress )
+{
+    osg::ref_ptr<const osg::HeightField> hf;
+    if ( !getHeightField(key, hf, prepOp, progress) )
+        return 0L;
+
+    // the caller may modify the result, so copy it if the L2 cache holds it too.
+    osg::ref_ptr<osg::HeightField> result = HeightFieldUtils::makeWritable( hf.get() );
+    hf = 0L;
+    return result.release();
+}
+
+bool
+TileSource::getImage(const TileKey& key, osg::ref_ptr<const osg::Image>& out_image, ImageOperation* prepOp, ProgressCallback* progress)
 {
     // Try to get it from the memcache fist
     if (_memCache.valid())
     {
-        osg::ref_ptr<const osg::Image> cachedImage;
-        if ( _memCache->getImage( key, CacheSpec(), cachedImage ) )
+        if ( _memCache->getImage( key, CacheSpec(), out_image ) )
         {
-            return ImageUtils::cloneImage(cachedImage.get());
+            return true;
         }
     }
 
@@ -208,23 +511,23 @@ TileSource::createImage(const TileKey& key, ImageOperation* prepOp, ProgressCall
 
     if ( newImage.valid() && _memCache.valid() )
     {
-        // cache it to the memory cache.
+        // cache it to the memory cache; from here on the image is shared.
         _memCache->setImage( key, CacheSpec(), newImage.get() );
     }
 
-    return newImage.release();
+    out_image = newImage.get();
+    return out_image.valid();
 }
 
-osg::HeightField*
-TileSource::createHeightField(const TileKey& key, HeightFieldOperation* prepOp, ProgressCallback* progress )
+bool
+TileSource::getHeightField(const TileKey& key, osg::ref_ptr<const osg::HeightField>& out_hf, HeightFieldOperation* prepOp, ProgressCallback* progress)
 {
     // Try to get it from the memcache first:
 	if (_memCache.valid())
 	{
-        osg::ref_ptr<const osg::HeightField> cachedHF;
-		if ( _memCache->getHeightField( key, CacheSpec(), cachedHF ) )
+		if ( _memCache->getHeightField( key, CacheSpec(), out_hf ) )
         {
-            return new osg::HeightField( *cachedHF.get() );
+            return true;
         }
 	}
 
@@ -233,13 +536,24 @@ TileSource::createHeightField(const TileKey& key, HeightFieldOperation* prepOp,
     if ( prepOp )
         (*prepOp)( newHF );
 
-    if ( newHF.valid() && _memCache.valid() )
+    if ( newHF.valid() )
     {
-        _memCache->setHeightField( key, CacheSpec(), newHF.get() );
+        // set up the geometry now, since nobody may modify the heightfield once it is shared.
+        double minx, miny, maxx, maxy;
+        key.getExtent().getBounds(minx, miny, maxx, maxy);
+        newHF->setOrigin( osg::Vec3d( minx, miny, 0.0 ) );
+        newHF->setXInterval( (maxx - minx)/(double)(newHF->getNumColumns()-1) );
+        newHF->setYInterval( (maxy - miny)/(double)(newHF->getNumRows()-1) );
+        newHF->setBorderWidth( 0 );
+
+        if ( _memCache.valid() )
+        {
+            _memCache->setHeightField( key, CacheSpec(), newHF.get() );
+        }
     }
 
-    //TODO: why not just newHF.release()? -gw
-    return newHF.valid() ? new osg::HeightField( *newHF.get() ) : 0L;
+    out_hf = newHF.get();
+    return out_hf.valid();
 }
 
 osg::HeightField*
@@ -274,18 +588,42 @@ TileSource::getProfile() const
     return _profile.get();
 }
 
+osg::ref_ptr<const DataExtentIndex>
+TileSource::getDataExtentsIndex() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _dataExtentsIndexMutex );
+
+    // the count catches extents appended through a reference taken before the last build.
+    if ( _dataExtentsIndexDirty || !_dataExtentsIndex.valid() || _dataExtentsIndexCount != _dataExtents.size() )
+    {
+        _dataExtentsIndex = new DataExtentIndex( _dataExtents );
+        _dataExtentsIndexCount = _dataExtents.size();
+        _dataExtentsIndexDirty = false;
+    }
+    return _dataExtentsIndex;
+}
+
+DataExtentList&
+TileSource::getDataExtents()
+{
+    dirtyDataExtents();
+    return _dataExtents;
+}
+
+void
+TileSource::dirtyDataExtents()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock( _dataExtentsIndexMutex );
+    _dataExtentsIndexDirty = true;
+}
+
 unsigned int
 TileSource::getMaxDataLevel() const
 {
     //If we have no data extents, just use a reasonably high number
     if (_dataExtents.size() == 0) return 35;
 
-    unsigned int maxDataLevel = 0;
-    for (DataExtentList::const_iterator itr = _dataExtents.begin(); itr != _dataExtents.end(); ++itr)
-    {
-        if (itr->getMaxLevel() > maxDataLevel) maxDataLevel = itr->getMaxLevel();
-    }
-    return maxDataLevel;
+    return getDataExtentsIndex()->getMaxLevel();
 }
 
 unsigned int
@@ -294,12 +632,7 @@ TileSource::getMinDataLevel() const
     //If we have no data extents, just use 0
     if (_dataExtents.size() == 0) return 0;
 
-    unsigned int minDataLevel = INT_MAX;
-    for (DataExtentList::const_iterator itr = _dataExtents.begin(); itr != _dataExtents.end(); ++itr)
-    {
-        if (itr->getMinLevel() < minDataLevel) minDataLevel = itr->getMinLevel();
-    }
-    return minDataLevel;
+    return getDataExtentsIndex()->getMinLevel();
 }
 
 bool
@@ -309,17 +642,7 @@ TileSource::hasDataAtLOD( unsigned lod ) const
     if ( _dataExtents.size() == 0 )
         return true;
 
-    bool intersects = false;
-
-    for (DataExtentList::const_iterator itr = _dataExtents.begin(); itr != _dataExtents.end(); ++itr)
-    {
-        if ( itr->getMinLevel() <= lod && lod <= itr->getMaxLevel() )
-        {
-            intersects = true;
-            break;
-        }
-    }
-    return intersects;
+    return getDataExtentsIndex()->hasLevel( lod );
 }
 
 bool
@@ -329,17 +652,7 @@ TileSource::hasDataInExtent( const GeoExtent& extent ) const
     if ( _dataExtents.size() == 0 )
         return true;
 
-    bool intersects = false;
-
-    for (DataExtentList::const_iterator itr = _dataExtents.begin(); itr != _dataExtents.end(); ++itr)
-    {
-        if ( extent.intersects( *itr ) )
-        {
-            intersects = true;
-            break;
-        }
-    }
-    return intersects;
+    return getDataExtentsIndex()->intersects( extent );
 }
 
 
@@ -349,19 +662,7 @@ TileSource::hasData(const osgEarth::TileKey& key) const
     //If no data extents are provided, just return true
     if (_dataExtents.size() == 0) return true;
 
-    const osgEarth::GeoExtent& keyExtent = key.getExtent();
-    bool intersectsData = false;
-
-    for (DataExtentList::const_iterator itr = _dataExtents.begin(); itr != _dataExtents.end(); ++itr)
-    {
-        if (keyExtent.intersects( *itr ) && key.getLevelOfDetail() >= itr->getMinLevel() && key.getLevelOfDetail() <= itr->getMaxLevel())
-        {
-            intersectsData = true;
-            break;
-        }
-    }
-
-    return intersectsData;
+    return getDataExtentsIndex()->intersects( key.getExtent(), (int)key.getLevelOfDetail() );
 }
 
 bool
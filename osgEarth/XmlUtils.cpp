@@ -21,9 +21,9 @@
 #include <osgEarth/StringUtils>
 #include <osgEarth/HTTPClient>
 #include <osg/Notify>
-#include "tinyxml.h"
 #include <algorithm>
 #include <sstream>
+#include <cstring>
 #include <iomanip>
 
 
@@ -276,102 +276,453 @@ XmlDocument::~XmlDocument()
 
 namespace
 {
-    XmlAttributes
-    getAttributes( const char** attrs )
+    inline bool isSpace( char c )
     {
-        XmlAttributes map;
-        const char** ptr = attrs;
-        while( *ptr != NULL )
-        {
-            std::string name = *ptr++;
-            std::string value = *ptr++;
-            std::transform( name.begin(), name.end(), name.begin(), tolower );
-            map[name] = value;
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+    }
+
+    inline char toLowerASCII( char c )
+    {
+        return c >= 'A' && c <= 'Z' ? c + ('a'-'A') : c;
+    }
+
+    void appendUTF8( unsigned long ucs, std::string& out )
+    {
+        if ( ucs < 0x80 ) {
+            out += (char)ucs;
+        }
+        else if ( ucs < 0x800 ) {
+            out += (char)(0xC0 | (ucs >> 6));
+            out += (char)(0x80 | (ucs & 0x3F));
+        }
+        else if ( ucs < 0x10000 ) {
+            out += (char)(0xE0 | (ucs >> 12));
+            out += (char)(0x80 | ((ucs >> 6) & 0x3F));
+            out += (char)(0x80 | (ucs & 0x3F));
+        }
+        else {
+            out += (char)(0xF0 | (ucs >> 18));
+            out += (char)(0x80 | ((ucs >> 12) & 0x3F));
+            out += (char)(0x80 | ((ucs >> 6) & 0x3F));
+            out += (char)(0x80 | (ucs & 0x3F));
         }
-        return map;
     }
 
-    void processNode(XmlElement* parent, TiXmlNode* node)
+    /**
+     * Pull parser behind XmlReader. It walks the document buffer once, condensing
+     * whitespace and resolving entities the same way tinyxml did, and reports
+     * elements and text to the handler as it goes. Element and attribute names are
+     * lower-cased, so end tags match their start tags regardless of case.
+     */
+    class XmlParser
     {
-        XmlElement* new_element = 0;
-        switch (node->Type())
+    public:
+        XmlParser( const std::string& buffer, XmlReader::Handler& handler ) :
+          _begin  ( buffer.c_str() ),
+          _p      ( buffer.c_str() ),
+          _end    ( buffer.c_str() + buffer.size() ),
+          _handler( handler ),
+          _error  ( 0L ) { }
+
+        bool parse()
         {
-        case TiXmlNode::TINYXML_ELEMENT:
+            // UTF-8 byte order mark
+            if ( _end - _p >= 3 && (unsigned char)_p[0] == 0xEF && (unsigned char)_p[1] == 0xBB && (unsigned char)_p[2] == 0xBF )
+                _p += 3;
+
+            // skip the prolog up to the root element:
+            for( ;; )
+            {
+                skipSpace();
+                if ( _p >= _end )
+                    return fail( "Document empty" );
+                else if ( *_p != '<' )
+                    return fail( "Unexpected text before the root element" );
+                else if ( !skipMarkup() )
+                    break;
+            }
+
+            // read the root element and everything under it:
+            std::vector<std::string> open;
+            std::string name;
+            XmlAttributes attrs;
+
+            if ( !readStartTag( name, attrs, open ) )
+                return false;
+
+            while( !open.empty() )
             {
-                TiXmlElement* element = node->ToElement();
-                std::string tag = element->Value();
-                std::transform( tag.begin(), tag.end(), tag.begin(), tolower);
-
-                //Get all the attributes
-                XmlAttributes attrs;
-                TiXmlAttribute* attr = element->FirstAttribute();
-                while (attr)
+                if ( _p >= _end )
+                    return fail( "Unexpected end of document" );
+
+                if ( *_p != '<' )
+                {
+                    readText();
+                }
+                else if ( startsWith("</") )
+                {
+                    _p += 2;
+                    const char* start = _p;
+                    while( _p < _end && *_p != '>' ) ++_p;
+                    const char* stop = _p;
+                    while( stop > start && isSpace(stop[-1]) ) --stop;
+                    if ( _p >= _end || !matchesName(open.back(), start, stop) )
+                        return fail( "Error reading end tag" );
+                    ++_p;
+                    open.pop_back();
+                    _handler.endElement();
+                }
+                else if ( startsWith("<![CDATA[") )
                 {
-                    std::string name  = attr->Name();
-                    std::string value = attr->Value();
-                    std::transform( name.begin(), name.end(), name.begin(), tolower);
-                    attrs[name] = value;
-                    attr = attr->Next();
+                    _p += 9;
+                    const char* start = _p;
+                    if ( !skipPast("]]>") )
+                        return fail( "Error parsing CDATA" );
+                    _handler.text( std::string(start, _p-3) );
+                }
+                else if ( !skipMarkup() )
+                {
+                    if ( !readStartTag( name, attrs, open ) )
+                        return false;
+                }
+            }
+            return true;
+        }
+
+        const char* error() const { return _error; }
+
+        void errorLocation( int& row, int& col ) const
+        {
+            row = 1, col = 1;
+            for( const char* c = _begin; c < _p && c < _end; ++c ) {
+                if ( *c == '\n' ) { ++row; col = 1; }
+                else ++col;
+            }
+        }
+
+    private:
+        bool fail( const char* msg )
+        {
+            _error = msg;
+            return false;
+        }
+
+        bool startsWith( const char* s ) const
+        {
+            const char* p = _p;
+            for( ; *s; ++s, ++p )
+                if ( p >= _end || *p != *s )
+                    return false;
+            return true;
+        }
+
+        // Whether the raw name in [start, stop) lower-cases to the given name.
+        static bool matchesName( const std::string& name, const char* start, const char* stop )
+        {
+            if ( name.size() != (std::string::size_type)(stop - start) )
+                return false;
+            for( std::string::const_iterator c = name.begin(); c != name.end(); ++c, ++start )
+                if ( *c != toLowerASCII(*start) )
+                    return false;
+            return true;
+        }
+
+        void skipSpace()
+        {
+            while( _p < _end && isSpace(*_p) ) ++_p;
+        }
+
+        bool skipPast( const char* s )
+        {
+            for( ; _p < _end; ++_p ) {
+                if ( startsWith(s) ) {
+                    _p += strlen(s);
+                    return true;
                 }
+            }
+            return false;
+        }
 
-                //All the element to the stack
-                new_element = new XmlElement( tag, attrs );
-                parent->getChildren().push_back( new_element );
+        // Skips a declaration, processing instruction, comment or DOCTYPE block at the
+        // current '<'. Returns false if the markup is something else (an element).
+        bool skipMarkup()
+        {
+            if ( startsWith("<?") )
+            {
+                skipPast( "?>" );
             }
-            break;
-        case TiXmlNode::TINYXML_TEXT:
+            else if ( startsWith("<!--") )
             {
-                TiXmlText* text = node->ToText();
-                std::string data( text->Value());
-                parent->getChildren().push_back( new XmlText( data ) );
+                skipPast( "-->" );
             }
-            break;
-        }    
-
-        XmlElement* new_parent = new_element ? new_element : parent;
-        TiXmlNode* child;
-        for (child = node->FirstChild(); child != 0; child = child->NextSibling())
-        {    
-            processNode( new_parent, child );
+            else if ( startsWith("<!") && !startsWith("<![CDATA[") )
+            {
+                // DOCTYPE blocks may contain nested markup
+                int depth = 0;
+                for( ++_p; _p < _end; ++_p ) {
+                    if ( *_p == '<' ) ++depth;
+                    else if ( *_p == '>' && depth-- == 0 ) break;
+                }
+                if ( _p < _end ) ++_p;
+            }
+            else
+            {
+                return false;
+            }
+            return true;
         }
-    }
 
-    void
-    removeDocType(std::string &xmlStr)
-    {
-        //TinyXML has an issue with parsing DTDs.  See http://www.grinninglizard.com/tinyxmldocs/index.html
-        //We need to remove any !DOCTYPE block that appears in the XML before parsing to avoid errors.
-        std::string::size_type startIndex = xmlStr.find("<!DOCTYPE");
-        if (startIndex == xmlStr.npos) return;
-
-        std::string::size_type endIndex = startIndex;
-        int numChildElements = 0;
-        //We've found the first index of the <!DOCTYPE, now find the index of the closing >
-        while (endIndex < xmlStr.size())
+        // Appends one character or entity starting at _p to the output.
+        void readChar( std::string& out )
         {
-            endIndex+=1;
-            if (xmlStr[endIndex] == '<')
+            if ( *_p != '&' )
             {
-                numChildElements++;
+                out += *_p++;
+                return;
             }
-            else if (xmlStr[endIndex] == '>')
+
+            static const char* entities[] = { "&amp;", "&lt;", "&gt;", "&quot;", "&apos;" };
+            static const char  values[]   = { '&', '<', '>', '"', '\'' };
+            for( unsigned i=0; i<5; ++i ) {
+                if ( startsWith(entities[i]) ) {
+                    out += values[i];
+                    _p += strlen(entities[i]);
+                    return;
+                }
+            }
+
+            if ( _p+2 < _end && _p[1] == '#' )
             {
-                if (numChildElements == 0)
+                const char* q = _p + 2;
+                bool hex = *q == 'x';
+                if ( hex ) ++q;
+                unsigned long ucs = 0;
+                const char* digits = q;
+                for( ; q < _end && *q != ';'; ++q ) {
+                    int d =
+                        *q >= '0' && *q <= '9' ? *q - '0' :
+                        hex && *q >= 'a' && *q <= 'f' ? *q - 'a' + 10 :
+                        hex && *q >= 'A' && *q <= 'F' ? *q - 'A' + 10 : -1;
+                    if ( d < 0 ) break;
+                    ucs = ucs * (hex ? 16 : 10) + d;
+                }
+                if ( q < _end && *q == ';' && q > digits )
                 {
-                    break;
+                    appendUTF8( ucs, out );
+                    _p = q + 1;
+                    return;
+                }
+            }
+
+            // not an entity we know; keep it literally
+            out += *_p++;
+        }
+
+        // Reads a run of text up to the next markup, condensing whitespace.
+        void readText()
+        {
+            _text.clear();
+            bool space = false;
+            skipSpace();
+            while( _p < _end && *_p != '<' )
+            {
+                if ( isSpace(*_p) ) {
+                    space = true;
+                    ++_p;
+                }
+                else {
+                    if ( space ) {
+                        _text += ' ';
+                        space = false;
+                    }
+                    readChar( _text );
+                }
+            }
+            if ( !_text.empty() )
+                _handler.text( _text );
+        }
+
+        bool readStartTag( std::string& name, XmlAttributes& attrs, std::vector<std::string>& open )
+        {
+            ++_p; // '<'
+            const char* start = _p;
+            while( _p < _end && !isSpace(*_p) && *_p != '/' && *_p != '>' ) ++_p;
+            if ( _p == start || _p >= _end )
+                return fail( "Failed to read element name" );
+
+            name.assign( start, _p );
+            for( std::string::iterator c = name.begin(); c != name.end(); ++c )
+                *c = toLowerASCII( *c );
+
+            attrs.clear();
+            for( ;; )
+            {
+                skipSpace();
+                if ( _p >= _end )
+                    return fail( "Error parsing element" );
+
+                if ( startsWith("/>") )
+                {
+                    _p += 2;
+                    _handler.startElement( name, attrs );
+                    _handler.endElement();
+                    return true;
+                }
+                else if ( *_p == '>' )
+                {
+                    ++_p;
+                    _handler.startElement( name, attrs );
+                    open.push_back( name );
+                    return true;
+                }
+
+                const char* a = _p;
+                while( _p < _end && !isSpace(*_p) && *_p != '=' && *_p != '/' && *_p != '>' ) ++_p;
+                std::string attrName( a, _p );
+                for( std::string::iterator c = attrName.begin(); c != attrName.end(); ++c )
+                    *c = toLowerASCII( *c );
+
+                skipSpace();
+                if ( attrName.empty() || _p >= _end || *_p != '=' )
+                    return fail( "Error parsing attribute" );
+                ++_p;
+                skipSpace();
+                if ( _p >= _end )
+                    return fail( "Error parsing attribute" );
+
+                std::string& value = attrs[attrName];
+                value.clear();
+                if ( *_p == '"' || *_p == '\'' )
+                {
+                    char quote = *_p++;
+                    while( _p < _end && *_p != quote )
+                        readChar( value );
+                    if ( _p >= _end )
+                        return fail( "Error parsing attribute" );
+                    ++_p;
                 }
                 else
                 {
-                    numChildElements--;
+                    while( _p < _end && !isSpace(*_p) && *_p != '/' && *_p != '>' )
+                        readChar( value );
                 }
             }
         }
 
-        //Now, replace the <!DOCTYPE> element with whitespace
-        xmlStr.erase(startIndex, endIndex - startIndex + 1);
+        const char*         _begin;
+        const char*         _p;
+        const char*         _end;
+        XmlReader::Handler& _handler;
+        const char*         _error;
+        std::string         _text;
+    };
+
+    /** Builds an XmlElement tree under an XmlDocument */
+    struct ElementBuilder : public XmlReader::Handler
+    {
+        ElementBuilder( XmlDocument* doc ) { _stack.push_back( doc ); }
+
+        void startElement( const std::string& name, const XmlAttributes& attrs ) {
+            XmlElement* e = new XmlElement( name, attrs );
+            _stack.back()->getChildren().push_back( e );
+            _stack.push_back( e );
+        }
+
+        void text( const std::string& value ) {
+            _stack.back()->getChildren().push_back( new XmlText(value) );
+        }
+
+        void endElement() {
+            _stack.pop_back();
+        }
+
+        std::vector<XmlElement*> _stack;
+    };
+
+    /** Builds a Config tree directly, the way XmlElement::getConfig() would */
+    struct ConfigBuilder : public XmlReader::Handler
+    {
+        ConfigBuilder() {
+            _stack.push_back( Config("Document") );
+            _text.push_back( std::string() );
+        }
+
+        void startElement( const std::string& name, const XmlAttributes& attrs ) {
+            _stack.push_back( Config(name) );
+            _text.push_back( std::string() );
+            if ( !attrs.empty() )
+                _stack.back().attrs().insert( attrs.begin(), attrs.end() );
+        }
+
+        void text( const std::string& value ) {
+            _text.back() += value;
+        }
+
+        void endElement() {
+            // set the value before copying, so that the element isn't un-shared.
+            _stack.back().value() = trim( _text.back() );
+            Config conf = _stack.back();
+            _stack.pop_back();
+            _text.pop_back();
+            _stack.back().add( conf );
+        }
+
+        std::vector<Config>      _stack;
+        std::vector<std::string> _text;
+    };
+
+    bool
+    readBuffer( std::istream& in, std::string& out_buffer )
+    {
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        out_buffer = buffer.str();
+        return true;
     }
 }
 
+//------------------------------------------------------------------------
+
+bool
+XmlReader::parse( const std::string& buffer, Handler& handler, const URIContext& uriContext )
+{
+    XmlParser parser( buffer, handler );
+    if ( !parser.parse() )
+    {
+        int row, col;
+        parser.errorLocation( row, col );
+        std::stringstream buf;
+        buf << parser.error() << " (row " << row << ", col " << col << ")";
+        std::string str = buf.str();
+        OE_WARN << "Error in XML document: " << str << std::endl;
+        if ( !uriContext.referrer().empty() )
+            OE_WARN << uriContext.referrer() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool
+XmlReader::parse( std::istream& in, Handler& handler, const URIContext& uriContext )
+{
+    std::string buffer;
+    readBuffer( in, buffer );
+    return parse( buffer, handler, uriContext );
+}
+
+bool
+XmlReader::readConfig( std::istream& in, Config& out, const URIContext& uriContext )
+{
+    ConfigBuilder builder;
+    if ( !parse( in, builder, uriContext ) )
+        return false;
+
+    out = builder._stack.front();
+    out.setURIContext( URI("", uriContext).full() );
+    return true;
+}
+
+//------------------------------------------------------------------------
 
 XmlDocument*
 XmlDocument::load( const std::string& location )
@@ -401,36 +752,13 @@ XmlDocument::load( const URI& uri )
 XmlDocument*
 XmlDocument::load( std::istream& in, const URIContext& uriContext )
 {
-    TiXmlDocument xmlDoc;
-
-    //Read the entire document into a string
-    std::stringstream buffer;
-    buffer << in.rdbuf();
-    std::string xmlStr(buffer.str()); 
-
-    removeDocType( xmlStr );
-    //OE_NOTICE << xmlStr;
-
-    XmlDocument* doc = NULL;
-    xmlDoc.Parse(xmlStr.c_str());    
-
-    if ( xmlDoc.Error() )
-    {
-        std::stringstream buf;
-        buf << xmlDoc.ErrorDesc() << " (row " << xmlDoc.ErrorRow() << ", col " << xmlDoc.ErrorCol() << ")";
-        std::string str = buf.str();
-        OE_WARN << "Error in XML document: " << str << std::endl;
-        if ( !uriContext.referrer().empty() )
-            OE_WARN << uriContext.referrer() << std::endl;
-    }
+    osg::ref_ptr<XmlDocument> doc = new XmlDocument();
+    ElementBuilder builder( doc.get() );
+    if ( !XmlReader::parse( in, builder, uriContext ) )
+        return 0L;
 
-    if ( !xmlDoc.Error() && xmlDoc.RootElement() )
-    {
-        doc = new XmlDocument();
-        processNode( doc,  xmlDoc.RootElement() );
-        doc->_sourceURI = URI("", uriContext);
-    }
-    return doc;    
+    doc->_sourceURI = URI("", uriContext);
+    return doc.release();
 }
 
 Config